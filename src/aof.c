@@ -30,6 +30,7 @@
 #include "server.h"
 #include "bio.h"
 #include "rio.h"
+#include "atomicvar.h"
 
 #include <signal.h>
 #include <fcntl.h>
@@ -39,11 +40,12 @@
 #include <sys/resource.h>
 #include <sys/wait.h>
 #include <sys/param.h>
-#include <db.h>
 
 
 void aofUpdateCurrentSize(void);
 void aofClosePipes(void);
+static void aofWriterFlush(void);
+static void aofWriterWait(void);
 
 /* ----------------------------------------------------------------------------
  * AOF rewrite buffer implementation.
@@ -243,6 +245,8 @@ void stopAppendOnly(void) {
     server.aof_fd = -1;
     server.aof_selected_db = -1;
     server.aof_state = AOF_OFF;
+    /* The writes are no longer logged, so no longer indexed. */
+    setIndexedLogIncomplete();
     killAppendOnlyChild();
 }
 
@@ -331,6 +335,85 @@ ssize_t aofWrite(int fd, const char *buf, size_t len) {
     return totwritten;
 }
 
+#define AOF_WRITE_LOG_ERROR_RATE 30 /* Seconds between errors logging. */
+
+/* Check the result of writing 'len' bytes of AOF buffer, '*nwritten' being
+ * what aofWrite() returned and 'write_errno' the errno it left. On success
+ * the AOF size is updated and C_OK is returned. Otherwise the error is
+ * logged and C_ERR is returned, with '*nwritten' set to the number of bytes
+ * that remain in the file (-1 if none), so that the caller can remove them
+ * from the buffer before retrying. */
+static int aofHandleWriteResult(ssize_t *nwritten, size_t len, int write_errno) {
+    if (*nwritten != (ssize_t)len) {
+        static time_t last_write_error_log = 0;
+        int can_log = 0;
+
+        /* Limit logging rate to 1 line per AOF_WRITE_LOG_ERROR_RATE seconds. */
+        if ((server.unixtime - last_write_error_log) > AOF_WRITE_LOG_ERROR_RATE) {
+            can_log = 1;
+            last_write_error_log = server.unixtime;
+        }
+
+        /* Log the AOF write error and record the error code. */
+        if (*nwritten == -1) {
+            if (can_log) {
+                serverLog(LL_WARNING,"Error writing to the AOF file: %s",
+                    strerror(write_errno));
+                server.aof_last_write_errno = write_errno;
+            }
+        } else {
+            if (can_log) {
+                serverLog(LL_WARNING,"Short write while writing to "
+                                       "the AOF file: (nwritten=%lld, "
+                                       "expected=%lld)",
+                                       (long long)*nwritten,
+                                       (long long)len);
+            }
+
+            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
+                if (can_log) {
+                    serverLog(LL_WARNING, "Could not remove short write "
+                             "from the append-only file.  Redis may refuse "
+                             "to load the AOF the next time it starts.  "
+                             "ftruncate: %s", strerror(errno));
+                }
+            } else {
+                /* If the ftruncate() succeeded we can set nwritten to
+                 * -1 since there is no longer partial data into the AOF. */
+                *nwritten = -1;
+            }
+            server.aof_last_write_errno = ENOSPC;
+        }
+
+        /* Handle the AOF write error. */
+        if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
+            /* We can't recover when the fsync policy is ALWAYS since the
+             * reply for the client is already in the output buffers, and we
+             * have the contract with the user that on acknowledged write data
+             * is synced on disk. */
+            serverLog(LL_WARNING,"Can't recover from AOF write error when the AOF fsync policy is 'always'. Exiting...");
+            exit(1);
+        }
+
+        /* Recover from failed write leaving data into the buffer. However
+         * set an error to stop accepting writes as long as the error
+         * condition is not cleared. */
+        server.aof_last_write_status = C_ERR;
+        if (*nwritten > 0) server.aof_current_size += *nwritten;
+        return C_ERR;
+    }
+
+    /* Successful write(2). If AOF was in error state, restore the
+     * OK state and log the event. */
+    if (server.aof_last_write_status == C_ERR) {
+        serverLog(LL_WARNING,
+            "AOF write error looks solved, Redis can write again.");
+        server.aof_last_write_status = C_OK;
+    }
+    server.aof_current_size += *nwritten;
+    return C_OK;
+}
+
 /* Write the append only file buffer on disk.
  *
  * Since we are required to write the AOF before replying to the client,
@@ -348,13 +431,24 @@ ssize_t aofWrite(int fd, const char *buf, size_t len) {
  * flushed ASAP, and will try to do that in the serverCron() function.
  *
  * However if force is set to 1 we'll write regardless of the background
- * fsync. */
-#define AOF_WRITE_LOG_ERROR_RATE 30 /* Seconds between errors logging. */
+ * fsync.
+ *
+ * With the AOF writer thread enabled the buffer is just handed to the
+ * thread, unless force is set to 1: in that case we wait for the batch in
+ * progress, if any, and write the buffer synchronously. */
 void flushAppendOnlyFile(int force) {
     ssize_t nwritten;
     int sync_in_progress = 0;
     mstime_t latency;
 
+    if (server.aof_writer_thread) {
+        if (!force) {
+            aofWriterFlush();
+            return;
+        }
+        aofWriterWait();
+    }
+
     if (sdslen(server.aof_buf) == 0) {
         /* Check if we need to do fsync even the aof buffer is empty,
          * because previously in AOF_FSYNC_EVERYSEC mode, fsync is
@@ -421,79 +515,13 @@ void flushAppendOnlyFile(int force) {
     /* We performed the write so reset the postponed flush sentinel to zero. */
     server.aof_flush_postponed_start = 0;
 
-    if (nwritten != (ssize_t)sdslen(server.aof_buf)) {
-        static time_t last_write_error_log = 0;
-        int can_log = 0;
-
-        /* Limit logging rate to 1 line per AOF_WRITE_LOG_ERROR_RATE seconds. */
-        if ((server.unixtime - last_write_error_log) > AOF_WRITE_LOG_ERROR_RATE) {
-            can_log = 1;
-            last_write_error_log = server.unixtime;
-        }
-
-        /* Log the AOF write error and record the error code. */
-        if (nwritten == -1) {
-            if (can_log) {
-                serverLog(LL_WARNING,"Error writing to the AOF file: %s",
-                    strerror(errno));
-                server.aof_last_write_errno = errno;
-            }
-        } else {
-            if (can_log) {
-                serverLog(LL_WARNING,"Short write while writing to "
-                                       "the AOF file: (nwritten=%lld, "
-                                       "expected=%lld)",
-                                       (long long)nwritten,
-                                       (long long)sdslen(server.aof_buf));
-            }
-
-            if (ftruncate(server.aof_fd, server.aof_current_size) == -1) {
-                if (can_log) {
-                    serverLog(LL_WARNING, "Could not remove short write "
-                             "from the append-only file.  Redis may refuse "
-                             "to load the AOF the next time it starts.  "
-                             "ftruncate: %s", strerror(errno));
-                }
-            } else {
-                /* If the ftruncate() succeeded we can set nwritten to
-                 * -1 since there is no longer partial data into the AOF. */
-                nwritten = -1;
-            }
-            server.aof_last_write_errno = ENOSPC;
-        }
-
-        /* Handle the AOF write error. */
-        if (server.aof_fsync == AOF_FSYNC_ALWAYS) {
-            /* We can't recover when the fsync policy is ALWAYS since the
-             * reply for the client is already in the output buffers, and we
-             * have the contract with the user that on acknowledged write data
-             * is synced on disk. */
-            serverLog(LL_WARNING,"Can't recover from AOF write error when the AOF fsync policy is 'always'. Exiting...");
-            exit(1);
-        } else {
-            /* Recover from failed write leaving data into the buffer. However
-             * set an error to stop accepting writes as long as the error
-             * condition is not cleared. */
-            server.aof_last_write_status = C_ERR;
-
-            /* Trim the sds buffer if there was a partial write, and there
-             * was no way to undo it with ftruncate(2). */
-            if (nwritten > 0) {
-                server.aof_current_size += nwritten;
-                sdsrange(server.aof_buf,nwritten,-1);
-            }
-            return; /* We'll try again on the next call... */
-        }
-    } else {
-        /* Successful write(2). If AOF was in error state, restore the
-         * OK state and log the event. */
-        if (server.aof_last_write_status == C_ERR) {
-            serverLog(LL_WARNING,
-                "AOF write error looks solved, Redis can write again.");
-            server.aof_last_write_status = C_OK;
-        }
+    if (aofHandleWriteResult(&nwritten,sdslen(server.aof_buf),errno) == C_ERR) {
+        /* Trim the sds buffer if there was a partial write, and there
+         * was no way to undo it with ftruncate(2). */
+        if (nwritten > 0) sdsrange(server.aof_buf,nwritten,-1);
+        return; /* We'll try again on the next call... */
     }
-    server.aof_current_size += nwritten;
+    server.aof_durable_lsn = server.aof_appended_lsn;
 
     /* Re-use AOF buffer when it is small enough. The maximum comes from the
      * arena size of 4k minus some overhead (but is otherwise arbitrary). */
@@ -531,6 +559,320 @@ try_fsync:
     }
 }
 
+/* ----------------------------------------------------------------------------
+ * AOF writer thread
+ * ------------------------------------------------------------------------- */
+
+/* When "aof-writer-thread" is enabled the AOF buffer is double buffered:
+ * before sleeping the main thread hands the commands accumulated in
+ * server.aof_buf to the writer thread, and keeps serving clients filling a
+ * new buffer while the thread writes the batch and, if the fsync policy
+ * requires it, fsyncs the file.
+ *
+ * Every byte appended to the AOF buffer gets a log sequence number (LSN),
+ * and a client remembers the LSN of the AOF when its last command ran (its
+ * own writes included, see call()). Its replies are held
+ * until the batch containing that LSN is written (or synced with
+ * "appendfsync always"), so that all the clients that wrote during a batch
+ * are acknowledged together by a single write and fsync: group commit.
+ *
+ * Only one batch is in flight at a time: the commands received while the
+ * thread is busy are grouped into the next batch. */
+static struct aofWriterJob {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int pending;            /* A batch was handed to the thread and was not
+                               completed yet. Only used by the main thread. */
+    int done;               /* The thread finished the batch. */
+
+    /* Set by the main thread. */
+    sds buf;                /* The batch: the back AOF buffer. */
+    int fd;                 /* AOF file descriptor. */
+    int fsync;              /* Fsync the file after writing the batch. */
+    long long lsn;          /* LSN of the end of the batch. */
+    long long stall;        /* Milliseconds to sleep before each batch, set
+                               with DEBUG AOF-WRITER-STALL. Under the lock. */
+
+    /* Set by the writer thread. */
+    ssize_t nwritten;       /* Return value of aofWrite(). */
+    int write_errno;        /* Errno set by aofWrite(). */
+    int fsynced;            /* The file was fsynced after the write. */
+    mstime_t write_latency;
+    mstime_t fsync_latency;
+} aofWriter;
+
+static void *aofWriterMain(void *arg) {
+    sigset_t sigset;
+    UNUSED(arg);
+
+    /* Block SIGALRM so we are sure that only the main thread will
+     * receive the watchdog signal. */
+    sigemptyset(&sigset);
+    sigaddset(&sigset, SIGALRM);
+    if (pthread_sigmask(SIG_BLOCK, &sigset, NULL))
+        serverLog(LL_WARNING,
+            "Warning: can't mask SIGALRM in the AOF writer thread: %s",
+            strerror(errno));
+
+    pthread_mutex_lock(&aofWriter.lock);
+    while(1) {
+        /* The loop always starts with the lock hold. */
+        while (!aofWriter.pending || aofWriter.done)
+            pthread_cond_wait(&aofWriter.cond,&aofWriter.lock);
+        long long stall = aofWriter.stall;
+        pthread_mutex_unlock(&aofWriter.lock);
+        if (stall) usleep(stall*1000);
+
+        size_t len = sdslen(aofWriter.buf);
+        mstime_t latency = 0;
+
+        aofWriter.nwritten = 0;
+        aofWriter.write_errno = 0;
+        if (len) {
+            latencyStartMonitor(latency);
+            aofWriter.nwritten = aofWrite(aofWriter.fd,aofWriter.buf,len);
+            aofWriter.write_errno = errno;
+            latencyEndMonitor(latency);
+        }
+        aofWriter.write_latency = latency;
+
+        latency = 0;
+        aofWriter.fsynced = 0;
+        if (aofWriter.fsync && aofWriter.nwritten == (ssize_t)len) {
+            latencyStartMonitor(latency);
+            redis_fsync(aofWriter.fd);
+            latencyEndMonitor(latency);
+            aofWriter.fsynced = 1;
+        }
+        aofWriter.fsync_latency = latency;
+
+        pthread_mutex_lock(&aofWriter.lock);
+        aofWriter.done = 1;
+        pthread_cond_broadcast(&aofWriter.cond);
+        /* Wake up the event loop: the main thread completes the batch. */
+        if (write(server.aof_writer_pipe[1],"A",1) != 1) {
+            /* Ignore the error: the pipe is only full if the main thread
+             * was already woken up. */
+        }
+    }
+    return NULL;
+}
+
+/* Called in the main thread once the writer thread finished the batch in
+ * flight: account the write as flushAppendOnlyFile() does, and advance the
+ * durable LSN so that the replies waiting for the batch can be sent. */
+static void aofWriterComplete(void) {
+    ssize_t nwritten = aofWriter.nwritten;
+    size_t len = sdslen(aofWriter.buf);
+
+    pthread_mutex_lock(&aofWriter.lock);
+    aofWriter.pending = 0;
+    aofWriter.done = 0;
+    pthread_mutex_unlock(&aofWriter.lock);
+
+    if (len) {
+        latencyAddSampleIfNeeded("aof-write",aofWriter.write_latency);
+        server.stat_aof_group_commits++;
+    }
+    if (aofWriter.fsynced && server.aof_fsync == AOF_FSYNC_ALWAYS)
+        latencyAddSampleIfNeeded("aof-fsync-always",aofWriter.fsync_latency);
+
+    if (aofHandleWriteResult(&nwritten,len,aofWriter.write_errno) == C_ERR) {
+        /* Put what was not written back in front of the commands received
+         * in the meantime: it will be retried with the next batch. */
+        sds buf = aofWriter.buf;
+        if (nwritten > 0) sdsrange(buf,nwritten,-1);
+        buf = sdscatsds(buf,server.aof_buf);
+        aofWriter.buf = server.aof_buf;
+        server.aof_buf = buf;
+        sdsclear(aofWriter.buf);
+    } else {
+        /* Re-use the buffer when it is small enough, see
+         * flushAppendOnlyFile(). */
+        if ((sdslen(aofWriter.buf)+sdsavail(aofWriter.buf)) < 4000) {
+            sdsclear(aofWriter.buf);
+        } else {
+            sdsfree(aofWriter.buf);
+            aofWriter.buf = sdsempty();
+        }
+        if (aofWriter.fsynced) {
+            server.aof_fsync_offset = server.aof_current_size;
+            server.aof_last_fsync = server.unixtime;
+        }
+    }
+
+    /* Like for the synchronous write, the replies are sent even if the
+     * write failed with a policy other than 'always': the error is
+     * reported refusing the next writes. */
+    server.aof_durable_lsn = aofWriter.lsn;
+}
+
+/* Hand the AOF buffer to the writer thread, unless a batch is already in
+ * flight, in which case the buffer keeps growing and will be handed once
+ * the current batch completes. */
+static void aofWriterFlush(void) {
+    int fsync;
+
+    if (aofWriter.pending) return;
+
+    /* Don't fsync if no-appendfsync-on-rewrite is set to yes and there are
+     * children doing I/O in the background. */
+    if (server.aof_no_fsync_on_rewrite &&
+        (server.aof_child_pid != -1 || server.rdb_child_pid != -1))
+        fsync = 0;
+    else if (server.aof_fsync == AOF_FSYNC_ALWAYS)
+        fsync = 1;
+    else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
+        fsync = server.unixtime > server.aof_last_fsync;
+    else
+        fsync = 0;
+
+    /* With nothing to write, we may still have to fsync the data written
+     * in the last second when the policy is 'everysec'. */
+    if (sdslen(server.aof_buf) == 0 &&
+        !(fsync && server.aof_fsync == AOF_FSYNC_EVERYSEC &&
+          server.aof_fsync_offset != server.aof_current_size)) return;
+
+    sds buf = aofWriter.buf;
+    aofWriter.buf = server.aof_buf;
+    server.aof_buf = buf;
+    aofWriter.fd = server.aof_fd;
+    aofWriter.fsync = fsync;
+    aofWriter.lsn = server.aof_appended_lsn;
+
+    pthread_mutex_lock(&aofWriter.lock);
+    aofWriter.pending = 1;
+    pthread_cond_broadcast(&aofWriter.cond);
+    pthread_mutex_unlock(&aofWriter.lock);
+}
+
+/* Wait for the batch in flight, if any, to be written. This must be called
+ * before writing the AOF from the main thread, or changing its file. */
+static void aofWriterWait(void) {
+    if (!aofWriter.pending) return;
+
+    pthread_mutex_lock(&aofWriter.lock);
+    while (!aofWriter.done)
+        pthread_cond_wait(&aofWriter.cond,&aofWriter.lock);
+    pthread_mutex_unlock(&aofWriter.lock);
+    aofWriterComplete();
+}
+
+/* Read handler of the pipe the writer thread uses to wake up the event loop
+ * when a batch is done. */
+static void aofWriterDoneHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
+    char buf[64];
+    int done;
+    UNUSED(el);
+    UNUSED(privdata);
+    UNUSED(mask);
+
+    while (read(fd,buf,sizeof(buf)) > 0);
+
+    pthread_mutex_lock(&aofWriter.lock);
+    done = aofWriter.pending && aofWriter.done;
+    pthread_mutex_unlock(&aofWriter.lock);
+    if (done) aofWriterComplete();
+}
+
+/* Start the AOF writer thread if "aof-writer-thread" is enabled. */
+void initAofWriter(void) {
+    pthread_t tid;
+
+    if (!server.aof_writer_thread) return;
+
+    pthread_mutex_init(&aofWriter.lock,NULL);
+    pthread_cond_init(&aofWriter.cond,NULL);
+    aofWriter.pending = 0;
+    aofWriter.done = 0;
+    aofWriter.buf = sdsempty();
+
+    if (pipe(server.aof_writer_pipe) == -1) {
+        serverLog(LL_WARNING,
+            "Can't create the pipe for the AOF writer thread: %s",
+            strerror(errno));
+        exit(1);
+    }
+    anetNonBlock(NULL,server.aof_writer_pipe[0]);
+    anetNonBlock(NULL,server.aof_writer_pipe[1]);
+    if (aeCreateFileEvent(server.el,server.aof_writer_pipe[0],AE_READABLE,
+        aofWriterDoneHandler,NULL) == AE_ERR)
+    {
+        serverPanic("Unrecoverable error creating the AOF writer pipe "
+                    "file event.");
+    }
+
+    if (pthread_create(&tid,NULL,aofWriterMain,NULL) != 0) {
+        serverLog(LL_WARNING,"Fatal: Can't initialize the AOF writer thread.");
+        exit(1);
+    }
+}
+
+/* Memory used by the batch the writer thread holds. */
+size_t aofWriterBufferSize(void) {
+    return server.aof_writer_thread ? sdsalloc(aofWriter.buf) : 0;
+}
+
+/* Length of the batch in flight: it is appended to the AOF after
+ * server.aof_current_size and before server.aof_buf. */
+size_t aofWriterPendingLength(void) {
+    return (server.aof_writer_thread && aofWriter.pending) ?
+           sdslen(aofWriter.buf) : 0;
+}
+
+/* Make the writer thread sleep 'ms' milliseconds before writing each batch,
+ * or stop doing it if 'ms' is 0. Used by the tests to hold the replies. */
+void aofWriterSetStall(long long ms) {
+    pthread_mutex_lock(&aofWriter.lock);
+    aofWriter.stall = ms;
+    pthread_mutex_unlock(&aofWriter.lock);
+}
+
+/* Return 1 and park the client in server.clients_waiting_aof if its
+ * replies must wait for its last write to be durable, otherwise return 0.
+ * Parked clients get back to the pending writes list in
+ * handleClientsWaitingAof(). */
+int aofHoldClientReply(client *c) {
+    if (!server.aof_writer_thread) return 0;
+    if (c->aof_wait_node) return 1;
+    if (c->aof_lsn <= server.aof_durable_lsn) return 0;
+
+    if (c->fd != -1) aeDeleteFileEvent(server.el,c->fd,AE_WRITABLE);
+    listAddNodeTail(server.clients_waiting_aof,c);
+    c->aof_wait_node = listLast(server.clients_waiting_aof);
+    return 1;
+}
+
+/* Called before sleeping: move the clients whose writes are now durable
+ * back to the pending writes list, and park the clients having pending
+ * writes whose replies can't be sent yet. */
+void handleClientsWaitingAof(void) {
+    listIter li;
+    listNode *ln;
+
+    if (!server.aof_writer_thread) return;
+
+    listRewind(server.clients_waiting_aof,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (c->aof_lsn > server.aof_durable_lsn) continue;
+        listDelNode(server.clients_waiting_aof,ln);
+        c->aof_wait_node = NULL;
+        clientInstallWriteHandler(c);
+    }
+
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        if (c->aof_lsn <= server.aof_durable_lsn) continue;
+        listDelNode(server.clients_pending_write,ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+        aofHoldClientReply(c);
+    }
+}
+
 sds catAppendOnlyGenericCommand(sds dst, int argc, robj **argv) {
     char buf[32];
     int len, j;
@@ -596,6 +938,7 @@ sds catAppendOnlyExpireAtCommand(sds buf, struct redisCommand *cmd, robj *key, r
 void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int argc) {
     sds buf = sdsempty();
     robj *tmpargv[3];
+    int records = 1; /* Log records appended, used by the instant recovery. */
 
     /* The DB this command was targeting is not the same as the last command
      * we appended. To issue a SELECT command is needed. */
@@ -606,6 +949,7 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
         buf = sdscatprintf(buf,"*2\r\n$6\r\nSELECT\r\n$%lu\r\n%s\r\n",
             (unsigned long)strlen(seldb),seldb);
         server.aof_selected_db = dictid;
+        records++;
     }
 
     if (cmd->proc == expireCommand || cmd->proc == pexpireCommand ||
@@ -620,6 +964,7 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
         buf = catAppendOnlyGenericCommand(buf,3,tmpargv);
         decrRefCount(tmpargv[0]);
         buf = catAppendOnlyExpireAtCommand(buf,cmd,argv[1],argv[2]);
+        records++;
     } else if (cmd->proc == setCommand && argc > 3) {
         int i;
         robj *exarg = NULL, *pxarg = NULL;
@@ -630,6 +975,7 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
             if (!strcasecmp(argv[i]->ptr, "px")) pxarg = argv[i+1];
         }
         serverAssert(!(exarg && pxarg));
+        if (exarg || pxarg) records++;
         if (exarg)
             buf = catAppendOnlyExpireAtCommand(buf,server.expireCommand,argv[1],
                                                exarg);
@@ -643,11 +989,23 @@ void feedAppendOnlyFile(struct redisCommand *cmd, int dictid, robj **argv, int a
         buf = catAppendOnlyGenericCommand(buf,argc,argv);
     }
 
+    /* Instant recovery: the dataset can't be rebuilt from the indexed log
+     * anymore if the Indexer skips this command. */
+    if (!isIndexedLogCommand(cmd,argc)) setIndexedLogIncomplete();
+
     /* Append to the AOF buffer. This will be flushed on disk just before
      * of re-entering the event loop, so before the client will get a
      * positive reply about the operation performed. */
-    if (server.aof_state == AOF_ON)
+    if (server.aof_state == AOF_ON) {
         server.aof_buf = sdscatlen(server.aof_buf,buf,sdslen(buf));
+        server.aof_appended_lsn += sdslen(buf);
+        if (server.current_client)
+            server.current_client->aof_lsn = server.aof_appended_lsn;
+        atomicIncr(server.count_log_records_written,records);
+        /* Instant recovery: keys not in the indexed log yet can't be
+         * evicted by the allkeys-indexedlog policy. */
+        trackIndexedLogWrite(cmd,dictid,argv,argc);
+    }
 
     /* If a background append only file rewriting is in progress we want to
      * accumulate the differences between the child DB and the current one
@@ -675,6 +1033,10 @@ struct client *createFakeClient(void) {
     c->querybuf_peak = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
+    c->argv_pool_len = 0;
+    c->aof_lsn = 0;
+    c->aof_wait_node = NULL;
     c->bufpos = 0;
     c->flags = 0;
     c->btype = BLOCKED_NONE;
@@ -747,6 +1109,10 @@ int loadAppendOnlyFile(char *filename) {
     fakeClient = createFakeClient();
     startLoading(fp);
 
+    /* The dataset is rebuilt from the AOF: it can be rebuilt from the indexed
+     * log again, unless the AOF has commands the Indexer skips. */
+    server.indexedlog_incomplete = 0;
+
     /* Check if this AOF file has an RDB preamble. In that case we need to
      * load the RDB file and later continue loading the AOF tail. */
     char sig[5]; /* "REDIS" */
@@ -799,6 +1165,7 @@ int loadAppendOnlyFile(char *filename) {
         argv = zmalloc(sizeof(robj*)*argc);
         fakeClient->argc = argc;
         fakeClient->argv = argv;
+        fakeClient->argv_len = argc;
 
         for (j = 0; j < argc; j++) {
             if (fgets(buf,sizeof(buf),fp) == NULL) {
@@ -836,6 +1203,7 @@ int loadAppendOnlyFile(char *filename) {
         }
 
         if (cmd == server.multiCommand) valid_before_multi = valid_up_to;
+        if (!isIndexedLogCommand(cmd,argc)) setIndexedLogIncomplete();
 
         /* Run the command in the context of a fake client */
         fakeClient->cmd = cmd;
@@ -1595,6 +1963,13 @@ int rewriteAppendOnlyFileBackground(void) {
     long long start;
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    /* With instant recovery the new AOF can be written from the indexed
+     * log by a thread, without forking. */
+    if (isIndexedLogAofRewriteInProgress()) return C_ERR;
+    if (isIndexedLogAofRewriteEnabled()) return startIndexedLogAofRewrite();
+    /* Not while the RDB is loaded on demand, see rdbSave(). */
+    if (server.rdb_key_directory) return C_ERR;
+    if (restoreAllEvictedKeys() == C_ERR) return C_ERR;
     if (aofCreatePipes() != C_OK) return C_ERR;
     openChildInfoPipe();
     start = ustime();
@@ -1651,7 +2026,7 @@ int rewriteAppendOnlyFileBackground(void) {
 }
 
 void bgrewriteaofCommand(client *c) {
-    if (server.aof_child_pid != -1) {
+    if (server.aof_child_pid != -1 || isIndexedLogAofRewriteInProgress()) {
         addReplyError(c,"Background append only file rewriting already in progress");
     } else if (server.rdb_child_pid != -1) {
         server.aof_rewrite_scheduled = 1;
@@ -1689,6 +2064,33 @@ void aofUpdateCurrentSize(void) {
     latencyAddSampleIfNeeded("aof-fstat",latency);
 }
 
+/* Replace the AOF file descriptor with 'newfd', the rewritten AOF that
+ * was just renamed to the configured file, once the writer thread is done
+ * with the old one. Returns the old file descriptor, that the caller should
+ * close in background. */
+int aofSwitchToRewrittenFile(int newfd) {
+    int oldfd;
+
+    aofWriterWait();
+    oldfd = server.aof_fd;
+    server.aof_fd = newfd;
+    if (server.aof_fsync == AOF_FSYNC_ALWAYS)
+        redis_fsync(newfd);
+    else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
+        aof_background_fsync(newfd);
+    server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
+    aofUpdateCurrentSize();
+    server.aof_rewrite_base_size = server.aof_current_size;
+    server.aof_fsync_offset = server.aof_current_size;
+
+    /* Clear regular AOF buffer since its contents was just written to
+     * the new AOF from the background rewrite buffer. */
+    sdsfree(server.aof_buf);
+    server.aof_buf = sdsempty();
+    server.aof_durable_lsn = server.aof_appended_lsn;
+    return oldfd;
+}
+
 /* A background append only file rewriting (BGREWRITEAOF) terminated its work.
  * Handle this. */
 void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
@@ -1786,21 +2188,7 @@ void backgroundRewriteDoneHandler(int exitcode, int bysignal) {
             close(newfd);
         } else {
             /* AOF enabled, replace the old fd with the new one. */
-            oldfd = server.aof_fd;
-            server.aof_fd = newfd;
-            if (server.aof_fsync == AOF_FSYNC_ALWAYS)
-                redis_fsync(newfd);
-            else if (server.aof_fsync == AOF_FSYNC_EVERYSEC)
-                aof_background_fsync(newfd);
-            server.aof_selected_db = -1; /* Make sure SELECT is re-issued */
-            aofUpdateCurrentSize();
-            server.aof_rewrite_base_size = server.aof_current_size;
-            server.aof_fsync_offset = server.aof_current_size;
-
-            /* Clear regular AOF buffer since its contents was just written to
-             * the new AOF from the background rewrite buffer. */
-            sdsfree(server.aof_buf);
-            server.aof_buf = sdsempty();
+            oldfd = aofSwitchToRewrittenFile(newfd);
         }
 
         server.aof_lastbgrewrite_status = C_OK;
@@ -8,6 +8,12 @@
  * atomicDecr(var,count) -- Decrement the atomic counter
  * atomicGet(var,dstvar) -- Fetch the atomic counter value
  * atomicSet(var,value)  -- Set the atomic counter value
+ * atomicGetWithSync(var,dstvar) -- Fetch the value with a full memory barrier
+ * atomicSetWithSync(var,value)  -- Set the value with a full memory barrier
+ *
+ * The "WithSync" variants don't need the mutex, and are meant for values
+ * used to hand work over between threads, where the other memory accesses
+ * of the thread must be visible along with the new value.
  *
  * The variable 'var' should also have a declared mutex with the same
  * name and the "_mutex" postfix, for instance:
@@ -80,6 +86,11 @@
     dstvar = __atomic_load_n(&var,__ATOMIC_RELAXED); \
 } while(0)
 #define atomicSet(var,value) __atomic_store_n(&var,value,__ATOMIC_RELAXED)
+#define atomicGetWithSync(var,dstvar) do { \
+    dstvar = __atomic_load_n(&var,__ATOMIC_SEQ_CST); \
+} while(0)
+#define atomicSetWithSync(var,value) \
+    __atomic_store_n(&var,value,__ATOMIC_SEQ_CST)
 #define REDIS_ATOMIC_API "atomic-builtin"
 
 #elif defined(HAVE_ATOMIC)
@@ -96,6 +107,9 @@
 #define atomicSet(var,value) do { \
     while(!__sync_bool_compare_and_swap(&var,var,value)); \
 } while(0)
+/* The __sync builtins are already full barriers. */
+#define atomicGetWithSync(var,dstvar) atomicGet(var,dstvar)
+#define atomicSetWithSync(var,value) atomicSet(var,value)
 #define REDIS_ATOMIC_API "sync-builtin"
 
 #else
@@ -127,6 +141,18 @@
     var = value; \
     pthread_mutex_unlock(&var ## _mutex); \
 } while(0)
+/* Used for variables without an associated mutex (like array elements), so
+ * just use a full memory barrier around the access. */
+#define atomicGetWithSync(var,dstvar) do { \
+    __sync_synchronize(); \
+    dstvar = var; \
+    __sync_synchronize(); \
+} while(0)
+#define atomicSetWithSync(var,value) do { \
+    __sync_synchronize(); \
+    var = value; \
+    __sync_synchronize(); \
+} while(0)
 #define REDIS_ATOMIC_API "pthread-mutex"
 
 #endif
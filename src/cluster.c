@@ -4348,6 +4348,9 @@ NULL
                     (char*)c->argv[4]->ptr);
                 return;
             }
+            /* Instant recovery: the keys of the slot must be in memory to be
+             * listed and migrated. */
+            restoreSlotFromIndexedLog(slot);
             server.cluster->migrating_slots_to[slot] = n;
         } else if (!strcasecmp(c->argv[3]->ptr,"importing") && c->argc == 5) {
             if (server.cluster->slots[slot] == myself) {
@@ -4526,6 +4529,7 @@ NULL
             addReplyError(c,"Invalid slot");
             return;
         }
+        restoreSlotFromIndexedLog(slot); /* Instant recovery. */
         addReplyLongLong(c,countKeysInSlot(slot));
     } else if (!strcasecmp(c->argv[1]->ptr,"getkeysinslot") && c->argc == 4) {
         /* CLUSTER GETKEYSINSLOT <slot> <count> */
@@ -4543,6 +4547,10 @@ NULL
             return;
         }
 
+        /* Instant recovery: restore the keys of the slot still in the
+         * indexed log. */
+        restoreSlotFromIndexedLog(slot);
+
         /* Avoid allocating more than needed in case of large COUNT argument
          * and smaller actual number of keys. */
         unsigned int keys_in_slot = countKeysInSlot(slot);
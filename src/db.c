@@ -1133,8 +1133,9 @@ int keyIsExpired(redisDb *db, robj *key) {
 
     if (when < 0) return 0; /* No expire for this key */
 
-    /* Don't expire anything while loading. It will be done later. */
-    if (server.loading) return 0;
+    /* Don't expire anything while loading. It will be done later. The keys
+     * loaded on demand from the RDB are served, so they expire as usual. */
+    if (server.loading && server.rdb_key_directory == NULL) return 0;
 
     /* If we are in the context of a Lua script, we pretend that time is
      * blocked to when the Lua script started. This way a key can expire
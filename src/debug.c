@@ -300,9 +300,11 @@ void computeDatasetDigest(unsigned char *final) {
 void debugCommand(client *c) {
     if (c->argc == 2 && !strcasecmp(c->argv[1]->ptr,"help")) {
         const char *help[] = {
+"AOF-WRITER-STALL <milliseconds> -- Make the AOF writer thread sleep <milliseconds> before writing each batch. 0 disables it.",
 "ASSERT -- Crash by assertion failed.",
 "CHANGE-REPL-ID -- Change the replication IDs of the instance. Dangerous, should be used only for testing the replication subsystem.",
 "CRASH-AND-RECOVER <milliseconds> -- Hard crash and restart after <milliseconds> delay.",
+"CRASHAT <INDEXER-BATCH|CHECKPOINT|NONE> [<count>] -- Kill the server at the <count>th (default 1) indexer batch or checkpoint of the instant recovery from now, before it ends.",
 "DIGEST -- Output a hex signature representing the current DB content.",
 "DIGEST-VALUE <key-1> ... <key-N>-- Output a hex signature of the values of all the specified keys.",
 "ERROR <string> -- Return a Redis protocol error with <string> as message. Useful for clients unit tests to simulate Redis errors.",
@@ -344,6 +346,27 @@ NULL
              RESTART_SERVER_NONE;
         restartServer(flags,delay);
         addReplyError(c,"failed to restart the server. Check server logs.");
+    } else if (!strcasecmp(c->argv[1]->ptr,"crashat") &&
+               (c->argc == 3 || c->argc == 4))
+    {
+        long long count = 1;
+
+        if (server.instant_recovery_state != IR_ON) {
+            addReplyError(c,"Instant recovery is disabled");
+            return;
+        }
+        if (c->argc == 4 &&
+            getLongLongFromObjectOrReply(c,c->argv[3],&count,NULL) != C_OK)
+            return;
+        if (count < 1) {
+            addReplyError(c,"The count must be a positive number");
+            return;
+        }
+        if (armCrashPoint(c->argv[2]->ptr,count) == C_ERR) {
+            addReplyError(c,"Unknown crash point. Use INDEXER-BATCH, CHECKPOINT or NONE");
+            return;
+        }
+        addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"oom")) {
         void *ptr = zmalloc(ULONG_MAX); /* Should trigger an out of memory. */
         zfree(ptr);
@@ -538,6 +561,19 @@ NULL
         tv.tv_nsec = (utime % 1000000) * 1000;
         nanosleep(&tv, NULL);
         addReply(c,shared.ok);
+    } else if (!strcasecmp(c->argv[1]->ptr,"aof-writer-stall") &&
+               c->argc == 3)
+    {
+        long long ms;
+
+        if (getLongLongFromObjectOrReply(c,c->argv[2],&ms,NULL) != C_OK)
+            return;
+        if (ms < 0) {
+            addReplyError(c,"Invalid number of milliseconds");
+            return;
+        }
+        aofWriterSetStall(ms);
+        addReply(c,shared.ok);
     } else if (!strcasecmp(c->argv[1]->ptr,"set-active-expire") &&
                c->argc == 3)
     {
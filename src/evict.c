@@ -181,6 +181,11 @@ void evictionPoolPopulate(int dbid, dict *sampledict, dict *keydict, struct evic
             o = dictGetVal(de);
         }
 
+        /* With the allkeys-indexedlog policy only the keys already stored
+         * in the indexed log of the instant recovery can be evicted. */
+        if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_INDEXEDLOG &&
+            !isIndexedLogEvictable(dbid,key,o)) continue;
+
         /* Calculate the idle time according to the policy. This is called
          * idle just because the code initially handled LRU, but is in fact
          * just a score where an higher score means better candidate. */
@@ -364,7 +369,8 @@ size_t freeMemoryGetNotCountedMemory(void) {
         }
     }
     if (server.aof_state != AOF_OFF) {
-        overhead += sdsalloc(server.aof_buf)+aofRewriteBufferSize();
+        overhead += sdsalloc(server.aof_buf)+aofWriterBufferSize()+
+                    aofRewriteBufferSize();
     }
     return overhead;
 }
@@ -452,6 +458,7 @@ int freeMemoryIfNeeded(void) {
     mstime_t latency, eviction_latency;
     long long delta;
     int slaves = listLength(server.slaves);
+    int tiering_failed_checks = 0;
 
     /* When clients are paused the dataset should be static not just from the
      * POV of clients not being able to write, but also from the POV of
@@ -465,9 +472,12 @@ int freeMemoryIfNeeded(void) {
     if (server.maxmemory_policy == MAXMEMORY_NO_EVICTION)
         goto cant_free; /* We need to free memory, but policy forbids. */
 
+    if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_INDEXEDLOG)
+        forgetIndexedLogWrites();
+
     latencyStartMonitor(latency);
     while (mem_freed < mem_tofree) {
-        int j, k, i, keys_freed = 0;
+        int j, k, i, keys_freed = 0, samplings = 0;
         static unsigned int next_db = 0;
         sds bestkey = NULL;
         int bestdbid;
@@ -497,6 +507,11 @@ int freeMemoryIfNeeded(void) {
                 }
                 if (!total_keys) break; /* No keys to evict. */
 
+                /* Sampled keys may not be evictable by the allkeys-indexedlog
+                 * policy, so the pool can stay empty: don't sample forever. */
+                if (server.maxmemory_policy == MAXMEMORY_ALLKEYS_INDEXEDLOG &&
+                    ++samplings > EVPOOL_SIZE) break;
+
                 /* Go backward from best to worst element to evict. */
                 for (k = EVPOOL_SIZE-1; k >= 0; k--) {
                     if (pool[k].key == NULL) continue;
@@ -549,11 +564,23 @@ int freeMemoryIfNeeded(void) {
             }
         }
 
+        /* A key not found in the indexed log is pinned in memory: try
+         * another one, but only a few times since each check reads the disk. */
+        if (bestkey && server.maxmemory_policy == MAXMEMORY_ALLKEYS_INDEXEDLOG &&
+            !evictKeyToIndexedLog(server.db+bestdbid,bestkey))
+        {
+            if (++tiering_failed_checks <= IR_TIERING_MAX_FAILED_CHECKS) continue;
+            bestkey = NULL;
+        }
+
         /* Finally remove the selected key. */
         if (bestkey) {
             db = server.db+bestdbid;
             robj *keyobj = createStringObject(bestkey,sdslen(bestkey));
-            propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
+            /* With the allkeys-indexedlog policy the key stays in the
+             * sequential and indexed logs, so the deletion is not propagated. */
+            if (server.maxmemory_policy != MAXMEMORY_ALLKEYS_INDEXEDLOG)
+                propagateExpire(db,keyobj,server.lazyfree_lazy_eviction);
             /* We compute the amount of memory freed by db*Delete() alone.
              * It is possible that actually the memory needed to propagate
              * the DEL in AOF and replication link is greater than the one
@@ -0,0 +1,732 @@
+/*
+                                    INSTANT RECOVERY TECHINIQUE
+
+  HASHLOG: built-in storage engine of the indexed log (see indexedlog.h). It requires
+  no external library. An indexed log file is stored in two files:
+
+    <file>      Append-only log of records. A record is a header, the key and the log
+                record (PUT), or a header and the key (DEL, removes the log records of
+                the key). The header has the offset of the previous record of the same
+                key, so the records of a key form a chain, and a crc64 to detect records
+                torn by a crash.
+    <file>.idx  Open addressing (linear probing) hash index, mmap'ed in memory. Each
+                slot has the hash of a key and the offsets of its first and last records.
+                The index only speeds up the accesses: if it is missing or it does not
+                match the log after a crash, it is rebuilt from the log.
+
+  The indexer, the restorer and the on-demand restore open the same files from different
+  threads, so the handles of a file are shared by the whole process and every operation
+  holds the mutex of the file.
+*/
+
+#include "fmacros.h"
+#include "indexedlog.h"
+#include "zmalloc.h"
+#include "crc64.h"
+#include "sds.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define HASHLOG_LOG_MAGIC "IRHLOG01"
+#define HASHLOG_IDX_MAGIC "IRHIDX01"
+#define HASHLOG_LOG_HEADER 16           /* Records start here, so the offset 0 means "none". */
+#define HASHLOG_MIN_SLOTS 1024          /* Initial number of slots of the index. */
+#define HASHLOG_READ_BUFFER (64*1024)   /* Read ahead of the cursors. */
+#define HASHLOG_MAX_RECORD (512*1024*1024)
+
+#define HASHLOG_PUT 1
+#define HASHLOG_DEL 2
+
+/* Slot of a deleted key. It keeps the probing sequences of the other keys. */
+#define HASHLOG_DELETED UINT64_MAX
+
+typedef struct hashLogRecordHeader {
+    uint64_t crc;       /* crc64 of the fields below, the key and the log record. */
+    uint64_t prev;      /* Offset of the previous record of the key, 0 if none. */
+    uint32_t type;      /* HASHLOG_PUT or HASHLOG_DEL. */
+    uint32_t keylen;
+    uint32_t datalen;
+    uint32_t unused;
+} hashLogRecordHeader;
+
+typedef struct hashLogIndexHeader {
+    char magic[8];
+    uint64_t slots;     /* Number of slots, a power of two. */
+    uint64_t used;      /* Slots not empty, i.e. keys and deleted keys. */
+    uint64_t keys;      /* Slots with keys. */
+    uint64_t log_size;  /* Size of the log when the index was synced, 0 if it is dirty. */
+    uint64_t unused[3];
+} hashLogIndexHeader;
+
+typedef struct hashLogSlot {
+    uint64_t hash;
+    uint64_t first;     /* Offset of the first record of the key, 0 if the slot is empty. */
+    uint64_t last;      /* Offset of the last record of the key. */
+    uint64_t count;     /* Number of records of the key. */
+} hashLogSlot;
+
+typedef struct hashLog {
+    sds file_name;
+    int refcount;
+    pthread_mutex_t lock;
+    int log_fd;
+    uint64_t log_size;          /* End of the log, where the next record is appended. */
+    int idx_fd;
+    hashLogIndexHeader *idx;    /* The index mmap'ed: the header followed by the slots. */
+    size_t idx_size;
+    int dirty;                  /* Records were added after the last sync. */
+    struct hashLog *next;
+} hashLog;
+
+typedef struct hashLogCursor {
+    hashLog *hl;
+    uint64_t scan;              /* Offset of the next record checked by a scan. */
+    uint64_t *chain;            /* Offsets of the records of the current key. */
+    uint64_t chain_len, chain_pos, chain_cap;
+    char *buf;                  /* Read ahead buffer. */
+    uint64_t buf_offset;
+    size_t buf_len, buf_cap;
+} hashLogCursor;
+
+/* Files opened by the process. */
+static hashLog *hashLogs = NULL;
+static pthread_mutex_t hashLogsLock = PTHREAD_MUTEX_INITIALIZER;
+
+#define hashLogSlots(idx) ((hashLogSlot*)((char*)(idx)+sizeof(hashLogIndexHeader)))
+#define hashLogIndexFileSize(slots) (sizeof(hashLogIndexHeader)+(size_t)(slots)*sizeof(hashLogSlot))
+
+static uint64_t hashLogHash(void *key, size_t len){
+    return crc64(0, key, len);
+}
+
+static uint64_t hashLogRecordCrc(hashLogRecordHeader *h, void *key, void *data){
+    uint64_t crc = crc64(0, (unsigned char*)&h->prev, sizeof(*h)-sizeof(h->crc));
+    crc = crc64(crc, key, h->keylen);
+    if(h->datalen)
+        crc = crc64(crc, data, h->datalen);
+    return crc;
+}
+
+/* Reads 'len' bytes at 'offset' of the log. Returns 0 on success. */
+static int hashLogRead(hashLog *hl, uint64_t offset, void *buf, size_t len){
+    size_t done = 0;
+    while(done < len){
+        ssize_t n = pread(hl->log_fd, (char*)buf+done, len-done, offset+done);
+        if(n <= 0){
+            if(n < 0 && errno == EINTR) continue;
+            return n == 0 ? INDEXEDLOG_ERR : errno;
+        }
+        done += n;
+    }
+    return 0;
+}
+
+/*
+    Returns a pointer to 'len' bytes of the log at 'offset', read through the buffer of
+    the cursor. The pointer is valid until the next read.
+*/
+static char *hashLogCursorRead(hashLogCursor *c, uint64_t offset, size_t len){
+    if(offset >= c->buf_offset && offset+len <= c->buf_offset+c->buf_len)
+        return c->buf+(offset-c->buf_offset);
+
+    size_t want = len > HASHLOG_READ_BUFFER ? len : HASHLOG_READ_BUFFER;
+    if(offset+want > c->hl->log_size)
+        want = c->hl->log_size > offset ? c->hl->log_size-offset : 0;
+    if(want < len)
+        return NULL;
+    if(want > c->buf_cap){
+        c->buf = zrealloc(c->buf, want);
+        c->buf_cap = want;
+    }
+    c->buf_len = 0;
+    if(hashLogRead(c->hl, offset, c->buf, want) != 0)
+        return NULL;
+    c->buf_offset = offset;
+    c->buf_len = want;
+    return c->buf;
+}
+
+/*
+    Reads and checks the record at 'offset' through the cursor buffer.
+    Returns a pointer to the header (followed by the key and the data) or NULL if the
+    record is beyond the end of the log or it is corrupted.
+*/
+static hashLogRecordHeader *hashLogCursorReadRecord(hashLogCursor *c, uint64_t offset){
+    hashLogRecordHeader *h = (hashLogRecordHeader*)hashLogCursorRead(c, offset, sizeof(*h));
+    if(h == NULL || h->keylen == 0 || h->keylen > HASHLOG_MAX_RECORD || h->datalen > HASHLOG_MAX_RECORD ||
+       (h->type != HASHLOG_PUT && h->type != HASHLOG_DEL))
+        return NULL;
+
+    size_t len = sizeof(*h)+h->keylen+h->datalen;
+    h = (hashLogRecordHeader*)hashLogCursorRead(c, offset, len);
+    if(h == NULL)
+        return NULL;
+    char *key = (char*)h+sizeof(*h);
+    if(hashLogRecordCrc(h, key, key+h->keylen) != h->crc)
+        return NULL;
+    return h;
+}
+
+/* Returns 1 if the key of the record at 'offset' is equal to 'key'. */
+static int hashLogKeyEquals(hashLog *hl, uint64_t offset, indexedLogRecord *key){
+    hashLogRecordHeader h;
+    char stackbuf[256], *buf = stackbuf;
+    int equals = 0;
+
+    if(hashLogRead(hl, offset, &h, sizeof(h)) != 0 || h.keylen != key->size)
+        return 0;
+    if(key->size > sizeof(stackbuf))
+        buf = zmalloc(key->size);
+    if(hashLogRead(hl, offset+sizeof(h), buf, key->size) == 0)
+        equals = memcmp(buf, key->data, key->size) == 0;
+    if(buf != stackbuf)
+        zfree(buf);
+    return equals;
+}
+
+/*
+    Returns the slot of the key, or the empty slot where the key should be added if the
+    key is not in the index.
+*/
+static hashLogSlot *hashLogLookup(hashLog *hl, indexedLogRecord *key, uint64_t hash){
+    hashLogSlot *slots = hashLogSlots(hl->idx);
+    uint64_t mask = hl->idx->slots-1, j = hash & mask;
+    hashLogSlot *free_slot = NULL;
+
+    while(slots[j].first != 0){
+        if(slots[j].first == HASHLOG_DELETED){
+            if(free_slot == NULL)
+                free_slot = &slots[j];
+        }else if(slots[j].hash == hash && hashLogKeyEquals(hl, slots[j].first, key)){
+            return &slots[j];
+        }
+        j = (j+1) & mask;
+    }
+    return free_slot ? free_slot : &slots[j];
+}
+
+/* Inserts a key in an index that does not have it. Used when the index is resized. */
+static void hashLogIndexInsert(hashLogIndexHeader *idx, hashLogSlot *slot){
+    hashLogSlot *slots = hashLogSlots(idx);
+    uint64_t mask = idx->slots-1, j = slot->hash & mask;
+
+    while(slots[j].first != 0)
+        j = (j+1) & mask;
+    slots[j] = *slot;
+    idx->used++;
+    idx->keys++;
+}
+
+/* Maps an index file of 'slots' slots. The file is truncated if 'create' is 1. */
+static hashLogIndexHeader *hashLogIndexMap(int fd, uint64_t slots, int create){
+    size_t size = hashLogIndexFileSize(slots);
+    if(create){
+        if(ftruncate(fd, 0) == -1 || ftruncate(fd, size) == -1)
+            return NULL;
+    }
+    void *p = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(p == MAP_FAILED)
+        return NULL;
+    if(create){
+        hashLogIndexHeader *idx = p;
+        memcpy(idx->magic, HASHLOG_IDX_MAGIC, 8);
+        idx->slots = slots;
+    }
+    return p;
+}
+
+/*
+    Replaces the index by a new index with 'slots' slots without the deleted keys.
+    The new index is written in a temporary file that is renamed when it is complete.
+*/
+static int hashLogIndexResize(hashLog *hl, uint64_t slots){
+    sds tmp_name = sdscatprintf(sdsempty(), "%s.idx.tmp", hl->file_name);
+    sds idx_name = sdscatprintf(sdsempty(), "%s.idx", hl->file_name);
+    int fd = open(tmp_name, O_RDWR|O_CREAT|O_TRUNC, 0644), error = 0;
+    hashLogIndexHeader *idx = NULL;
+
+    if(fd == -1 || (idx = hashLogIndexMap(fd, slots, 1)) == NULL){
+        error = errno;
+        if(fd != -1) close(fd);
+        unlink(tmp_name);
+        goto end;
+    }
+
+    if(hl->idx){
+        hashLogSlot *old = hashLogSlots(hl->idx);
+        uint64_t j;
+        for(j = 0; j < hl->idx->slots; j++)
+            if(old[j].first != 0 && old[j].first != HASHLOG_DELETED)
+                hashLogIndexInsert(idx, &old[j]);
+    }
+    //The old index is kept if the new one can't replace it
+    if(rename(tmp_name, idx_name) == -1){
+        error = errno;
+        munmap(idx, hashLogIndexFileSize(slots));
+        close(fd);
+        unlink(tmp_name);
+        goto end;
+    }
+    if(hl->idx){
+        munmap(hl->idx, hl->idx_size);
+        close(hl->idx_fd);
+    }
+    hl->idx = idx;
+    hl->idx_fd = fd;
+    hl->idx_size = hashLogIndexFileSize(slots);
+
+end:
+    sdsfree(tmp_name);
+    sdsfree(idx_name);
+    return error;
+}
+
+/* Resizes the index if a new key makes it more than 70% full. */
+static int hashLogIndexReserve(hashLog *hl){
+    uint64_t slots = hl->idx->slots;
+    if((hl->idx->used+1)*10 <= slots*7)
+        return 0;
+    //The deleted keys are not copied, so the index only grows if the keys need it
+    while((hl->idx->keys+1)*2 > slots)
+        slots *= 2;
+    return hashLogIndexResize(hl, slots);
+}
+
+/*
+    Marks the index as not synced with the log before its first change after a sync.
+    The header is flushed now, so a crash before the next sync always rebuilds the index.
+*/
+static void hashLogMarkDirty(hashLog *hl){
+    if(hl->dirty)
+        return;
+    hl->idx->log_size = 0;
+    msync(hl->idx, sizeof(hashLogIndexHeader), MS_SYNC);
+    hl->dirty = 1;
+}
+
+/* Applies a record of the log at 'offset' to the index. */
+static int hashLogIndexApply(hashLog *hl, hashLogRecordHeader *h, void *key, uint64_t offset){
+    indexedLogRecord k = {key, h->keylen};
+    uint64_t hash = hashLogHash(key, h->keylen);
+    hashLogSlot *slot;
+    int error;
+
+    if(h->type == HASHLOG_PUT && (error = hashLogIndexReserve(hl)) != 0)
+        return error;
+    slot = hashLogLookup(hl, &k, hash);
+    int found = slot->first != 0 && slot->first != HASHLOG_DELETED;
+
+    if(h->type == HASHLOG_DEL){
+        if(found){
+            slot->first = HASHLOG_DELETED;
+            slot->last = slot->count = 0;
+            hl->idx->keys--;
+        }
+        return 0;
+    }
+
+    if(found){
+        slot->last = offset;
+        slot->count++;
+    }else{
+        if(slot->first == 0)
+            hl->idx->used++;
+        hl->idx->keys++;
+        slot->hash = hash;
+        slot->first = slot->last = offset;
+        slot->count = 1;
+    }
+    return 0;
+}
+
+/*
+    Rebuilds the index scanning the log. A torn record at the end of the log (crash
+    during a write) and the records after it are removed from the log.
+*/
+static int hashLogIndexRebuild(hashLog *hl){
+    hashLogCursor c;
+    hashLogRecordHeader *h;
+    uint64_t offset = HASHLOG_LOG_HEADER;
+    int error;
+
+    if((error = hashLogIndexResize(hl, HASHLOG_MIN_SLOTS)) != 0)
+        return error;
+    hl->idx->used = hl->idx->keys = 0;
+
+    memset(&c, 0, sizeof(c));
+    c.hl = hl;
+    while(offset < hl->log_size && (h = hashLogCursorReadRecord(&c, offset)) != NULL){
+        if((error = hashLogIndexApply(hl, h, (char*)h+sizeof(*h), offset)) != 0)
+            break;
+        offset += sizeof(*h)+h->keylen+h->datalen;
+    }
+    zfree(c.buf);
+    if(error != 0)
+        return error;
+
+    if(offset < hl->log_size){
+        if(ftruncate(hl->log_fd, offset) == -1)
+            return errno;
+        hl->log_size = offset;
+    }
+    fsync(hl->log_fd);
+    hl->idx->log_size = hl->log_size;
+    msync(hl->idx, hl->idx_size, MS_SYNC);
+    return 0;
+}
+
+/* Opens the log and the index files of a new handle. */
+static int hashLogOpenFiles(hashLog *hl, char mode){
+    struct stat sb;
+    char magic[HASHLOG_LOG_HEADER];
+    int flags = mode == 'R' ? O_RDWR : O_RDWR|O_CREAT;
+
+    hl->log_fd = open(hl->file_name, flags, 0644);
+    if(hl->log_fd == -1 || fstat(hl->log_fd, &sb) == -1)
+        return errno;
+    hl->log_size = sb.st_size;
+
+    if(hl->log_size == 0){
+        memset(magic, 0, sizeof(magic));
+        memcpy(magic, HASHLOG_LOG_MAGIC, 8);
+        if(pwrite(hl->log_fd, magic, sizeof(magic), 0) != sizeof(magic))
+            return errno;
+        hl->log_size = sizeof(magic);
+    }else if(hl->log_size < HASHLOG_LOG_HEADER || hashLogRead(hl, 0, magic, sizeof(magic)) != 0 ||
+             memcmp(magic, HASHLOG_LOG_MAGIC, 8) != 0){
+        return INDEXEDLOG_ERR;
+    }
+
+    sds idx_name = sdscatprintf(sdsempty(), "%s.idx", hl->file_name);
+    hl->idx_fd = open(idx_name, O_RDWR|O_CREAT, 0644);
+    sdsfree(idx_name);
+    if(hl->idx_fd == -1 || fstat(hl->idx_fd, &sb) == -1)
+        return errno;
+
+    //Uses the index only if it was synced with the log as it is now
+    if((size_t)sb.st_size >= sizeof(hashLogIndexHeader)){
+        hashLogIndexHeader h;
+        if(pread(hl->idx_fd, &h, sizeof(h), 0) == sizeof(h) && memcmp(h.magic, HASHLOG_IDX_MAGIC, 8) == 0 &&
+           h.slots >= HASHLOG_MIN_SLOTS && (h.slots & (h.slots-1)) == 0 &&
+           (size_t)sb.st_size == hashLogIndexFileSize(h.slots) && h.log_size == hl->log_size){
+            hl->idx = hashLogIndexMap(hl->idx_fd, h.slots, 0);
+            if(hl->idx != NULL){
+                hl->idx_size = hashLogIndexFileSize(h.slots);
+                return 0;
+            }
+        }
+    }
+    close(hl->idx_fd);
+    hl->idx_fd = -1;
+    return hashLogIndexRebuild(hl);
+}
+
+static void hashLogFree(hashLog *hl){
+    if(hl->idx)
+        munmap(hl->idx, hl->idx_size);
+    if(hl->idx_fd != -1)
+        close(hl->idx_fd);
+    if(hl->log_fd != -1)
+        close(hl->log_fd);
+    pthread_mutex_destroy(&hl->lock);
+    sdsfree(hl->file_name);
+    zfree(hl);
+}
+
+static void *hashLogOpen(char *file_name, char mode, int *result){
+    hashLog *hl;
+
+    pthread_mutex_lock(&hashLogsLock);
+    for(hl = hashLogs; hl != NULL; hl = hl->next){
+        if(strcmp(hl->file_name, file_name) == 0){
+            hl->refcount++;
+            pthread_mutex_unlock(&hashLogsLock);
+            *result = 0;
+            return hl;
+        }
+    }
+
+    hl = zcalloc(sizeof(*hl));
+    hl->file_name = sdsnew(file_name);
+    hl->refcount = 1;
+    hl->log_fd = hl->idx_fd = -1;
+    pthread_mutex_init(&hl->lock, NULL);
+    *result = hashLogOpenFiles(hl, mode);
+    if(*result != 0){
+        hashLogFree(hl);
+        pthread_mutex_unlock(&hashLogsLock);
+        return NULL;
+    }
+    hl->next = hashLogs;
+    hashLogs = hl;
+    pthread_mutex_unlock(&hashLogsLock);
+    return hl;
+}
+
+/* Flushes the log and then the index. Called with the lock held. */
+static int hashLogSyncLocked(hashLog *hl){
+    if(!hl->dirty)
+        return 0;
+    if(fsync(hl->log_fd) == -1)
+        return errno;
+    hl->idx->log_size = hl->log_size;
+    if(msync(hl->idx, hl->idx_size, MS_SYNC) == -1)
+        return errno;
+    hl->dirty = 0;
+    return 0;
+}
+
+static void hashLogClose(void *handle, int sync){
+    hashLog *hl = handle, **p;
+
+    pthread_mutex_lock(&hashLogsLock);
+    pthread_mutex_lock(&hl->lock);
+    if(sync)
+        hashLogSyncLocked(hl);
+    pthread_mutex_unlock(&hl->lock);
+    if(--hl->refcount > 0){
+        pthread_mutex_unlock(&hashLogsLock);
+        return;
+    }
+    for(p = &hashLogs; *p != hl; p = &(*p)->next);
+    *p = hl->next;
+    pthread_mutex_unlock(&hashLogsLock);
+    hashLogFree(hl);
+}
+
+/* Appends a record to the log and applies it to the index. Called with the lock held. */
+static int hashLogAppend(hashLog *hl, int type, uint64_t prev, indexedLogRecord *key, indexedLogRecord *data){
+    hashLogRecordHeader h;
+    size_t len;
+    char *buf;
+    int error = 0;
+
+    if(key->size == 0 || key->size > HASHLOG_MAX_RECORD || (data && data->size > HASHLOG_MAX_RECORD))
+        return EINVAL;
+    memset(&h, 0, sizeof(h));
+    h.prev = prev;
+    h.type = type;
+    h.keylen = key->size;
+    h.datalen = data ? data->size : 0;
+    h.crc = hashLogRecordCrc(&h, key->data, data ? data->data : NULL);
+
+    len = sizeof(h)+h.keylen+h.datalen;
+    buf = zmalloc(len);
+    memcpy(buf, &h, sizeof(h));
+    memcpy(buf+sizeof(h), key->data, h.keylen);
+    if(h.datalen)
+        memcpy(buf+sizeof(h)+h.keylen, data->data, h.datalen);
+
+    hashLogMarkDirty(hl);
+    if(pwrite(hl->log_fd, buf, len, hl->log_size) != (ssize_t)len){
+        error = errno ? errno : EIO;
+    }else{
+        error = hashLogIndexApply(hl, &h, buf+sizeof(h), hl->log_size);
+        hl->log_size += len;
+    }
+    zfree(buf);
+    return error;
+}
+
+static int hashLogPut(void *handle, indexedLogRecord *key, indexedLogRecord *data){
+    hashLog *hl = handle;
+    hashLogSlot *slot;
+    int error;
+
+    pthread_mutex_lock(&hl->lock);
+    slot = hashLogLookup(hl, key, hashLogHash(key->data, key->size));
+    error = hashLogAppend(hl, HASHLOG_PUT, (slot->first != 0 && slot->first != HASHLOG_DELETED) ? slot->last : 0, key, data);
+    pthread_mutex_unlock(&hl->lock);
+    return error;
+}
+
+static int hashLogDel(void *handle, indexedLogRecord *key){
+    hashLog *hl = handle;
+    hashLogSlot *slot;
+    int error;
+
+    pthread_mutex_lock(&hl->lock);
+    slot = hashLogLookup(hl, key, hashLogHash(key->data, key->size));
+    if(slot->first == 0 || slot->first == HASHLOG_DELETED)
+        error = INDEXEDLOG_NOTFOUND;
+    else
+        error = hashLogAppend(hl, HASHLOG_DEL, slot->last, key, NULL);
+    pthread_mutex_unlock(&hl->lock);
+    return error;
+}
+
+static int hashLogGetLatest(void *handle, indexedLogRecord *key, indexedLogRecord *data){
+    hashLog *hl = handle;
+    hashLogSlot *slot;
+    hashLogRecordHeader h;
+    int error;
+
+    pthread_mutex_lock(&hl->lock);
+    slot = hashLogLookup(hl, key, hashLogHash(key->data, key->size));
+    if(slot->first == 0 || slot->first == HASHLOG_DELETED){
+        error = INDEXEDLOG_NOTFOUND;
+    }else if((error = hashLogRead(hl, slot->last, &h, sizeof(h))) == 0){
+        data->size = h.datalen;
+        data->data = zmalloc(h.datalen);
+        error = hashLogRead(hl, slot->last+sizeof(h)+h.keylen, data->data, h.datalen);
+        if(error != 0){
+            zfree(data->data);
+            data->data = NULL;
+        }
+    }
+    pthread_mutex_unlock(&hl->lock);
+    return error;
+}
+
+static int hashLogSync(void *handle){
+    hashLog *hl = handle;
+    int error;
+
+    pthread_mutex_lock(&hl->lock);
+    error = hashLogSyncLocked(hl);
+    pthread_mutex_unlock(&hl->lock);
+    return error;
+}
+
+static void *hashLogCursorOpen(void *handle){
+    hashLogCursor *c = zcalloc(sizeof(*c));
+    c->hl = handle;
+    c->scan = HASHLOG_LOG_HEADER;
+    return c;
+}
+
+/*
+    Loads in the cursor the offsets of the records of the key in 'slot', in the order
+    they were added, following the chain from the last record.
+*/
+static int hashLogCursorLoadChain(hashLogCursor *c, hashLogSlot *slot){
+    uint64_t offset = slot->last, n = slot->count;
+    hashLogRecordHeader h;
+
+    if(n > c->chain_cap){
+        c->chain = zrealloc(c->chain, sizeof(uint64_t)*n);
+        c->chain_cap = n;
+    }
+    c->chain_len = n;
+    c->chain_pos = 0;
+    while(n > 0 && offset != 0){
+        c->chain[--n] = offset;
+        if(hashLogRead(c->hl, offset, &h, sizeof(h)) != 0)
+            return INDEXEDLOG_ERR;
+        offset = h.prev;
+    }
+    return n == 0 ? 0 : INDEXEDLOG_ERR;
+}
+
+/*
+    Moves the scan to the first record of the next key. The records of the log are
+    checked in order, and a record starts a key if it is the first record of its key
+    in the index, so keys deleted and records of previous versions are skipped.
+*/
+static int hashLogCursorNextKey(hashLogCursor *c){
+    hashLog *hl = c->hl;
+    hashLogRecordHeader *h;
+
+    while(c->scan < hl->log_size){
+        uint64_t offset = c->scan;
+        if((h = hashLogCursorReadRecord(c, offset)) == NULL)
+            return INDEXEDLOG_ERR;
+        c->scan += sizeof(*h)+h->keylen+h->datalen;
+        if(h->type != HASHLOG_PUT || h->prev != 0)
+            continue;
+
+        //Offsets are unique, so the key is not read to find its slot
+        uint64_t hash = hashLogHash((char*)h+sizeof(*h), h->keylen);
+        hashLogSlot *slots = hashLogSlots(hl->idx);
+        uint64_t mask = hl->idx->slots-1, j = hash & mask;
+        while(slots[j].first != 0){
+            if(slots[j].first == offset)
+                return hashLogCursorLoadChain(c, &slots[j]);
+            j = (j+1) & mask;
+        }
+    }
+    return INDEXEDLOG_NOTFOUND;
+}
+
+/* Returns the current record of the chain of the cursor. */
+static int hashLogCursorCurrent(hashLogCursor *c, indexedLogRecord *key, indexedLogRecord *data){
+    hashLogRecordHeader *h = hashLogCursorReadRecord(c, c->chain[c->chain_pos]);
+    if(h == NULL)
+        return INDEXEDLOG_ERR;
+    key->data = (char*)h+sizeof(*h);
+    key->size = h->keylen;
+    data->data = (char*)key->data+h->keylen;
+    data->size = h->datalen;
+    return 0;
+}
+
+static int hashLogCursorGet(void *cursor, indexedLogRecord *key, indexedLogRecord *data, int op){
+    hashLogCursor *c = cursor;
+    hashLog *hl = c->hl;
+    int error = 0;
+
+    pthread_mutex_lock(&hl->lock);
+    switch(op){
+    case INDEXEDLOG_SET: {
+        hashLogSlot *slot = hashLogLookup(hl, key, hashLogHash(key->data, key->size));
+        if(slot->first == 0 || slot->first == HASHLOG_DELETED)
+            error = INDEXEDLOG_NOTFOUND;
+        else
+            error = hashLogCursorLoadChain(c, slot);
+        //A next scan goes on after the key
+        c->scan = hl->log_size;
+        break;
+    }
+    case INDEXEDLOG_NEXT_DUP:
+        if(c->chain_pos+1 >= c->chain_len)
+            error = INDEXEDLOG_NOTFOUND;
+        else
+            c->chain_pos++;
+        break;
+    case INDEXEDLOG_NEXT:
+        if(c->chain_pos+1 < c->chain_len){
+            c->chain_pos++;
+            break;
+        }
+        /* fall through */
+    case INDEXEDLOG_NEXT_NODUP:
+        c->chain_len = c->chain_pos = 0;
+        error = hashLogCursorNextKey(c);
+        break;
+    default:
+        error = EINVAL;
+    }
+    if(error == 0)
+        error = hashLogCursorCurrent(c, key, data);
+    pthread_mutex_unlock(&hl->lock);
+    return error;
+}
+
+static void hashLogCursorClose(void *cursor){
+    hashLogCursor *c = cursor;
+    zfree(c->chain);
+    zfree(c->buf);
+    zfree(c);
+}
+
+indexedLogType indexedLogTypeHashLog = {
+    "HASHLOG",
+    NULL,
+    hashLogOpen,
+    hashLogClose,
+    hashLogPut,
+    hashLogDel,
+    hashLogGetLatest,
+    hashLogSync,
+    hashLogCursorOpen,
+    hashLogCursorGet,
+    hashLogCursorClose
+};
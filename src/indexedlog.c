@@ -0,0 +1,393 @@
+/*
+                                    INSTANT RECOVERY TECHINIQUE
+
+  Storage engines of the indexed log: the functions that dispatch the indexed log
+  operations to the engine chosen in redis_ir.conf, and the Berkeley DB engine.
+  The built-in engine (HASHLOG) is implemented in hashlog.c.
+  See indexedlog.h.
+*/
+
+#include "server.h"
+
+#ifdef USE_BERKELEYDB
+#include <db.h>
+#endif
+
+// ==================================================================================
+// Engine independent functions
+
+/*
+    Returns the storage engine with the name given (case insensitive), or NULL if
+    there is no engine with this name in this build.
+*/
+indexedLogType *indexedLogLookupType(const char *name){
+#ifdef USE_BERKELEYDB
+    if(strcasecmp(name, indexedLogTypeBerkeleyDB.name) == 0)
+        return &indexedLogTypeBerkeleyDB;
+#endif
+    if(strcasecmp(name, indexedLogTypeHashLog.name) == 0)
+        return &indexedLogTypeHashLog;
+    return NULL;
+}
+
+/*
+    Initializes the storage engine. Returns 1 if the engine is ready to open indexed logs.
+*/
+int indexedLogInit(indexedLogType *type){
+    if(type->init == NULL)
+        return 1;
+    return type->init();
+}
+
+/*
+    Opens an indexed log file with the storage engine given.
+    mode: 'W' creates the file if it does not exist, 'R' requires an existing file,
+          'T' returns a handle that can be used by multiple threads (BDB only).
+    result: returns 0 (zero) if the indexed log is openned. If fail, returns a code error
+            and NULL is returned.
+*/
+indexedLog *indexedLogOpen(indexedLogType *type, char *file_name, char mode, int *result){
+    void *handle = type->open(file_name, mode, result);
+    if(handle == NULL)
+        return NULL;
+
+    indexedLog *il = zmalloc(sizeof(indexedLog));
+    il->type = type;
+    il->handle = handle;
+    return il;
+}
+
+/*
+    Closes the indexed log. If sync is 0, the records are not flushed to disk.
+*/
+void indexedLogClose(indexedLog *il, int sync){
+    if(il == NULL)
+        return;
+    il->type->close(il->handle, sync);
+    zfree(il);
+}
+
+int indexedLogPut(indexedLog *il, indexedLogRecord *key, indexedLogRecord *data){
+    return il->type->put(il->handle, key, data);
+}
+
+int indexedLogDel(indexedLog *il, indexedLogRecord *key){
+    return il->type->del(il->handle, key);
+}
+
+int indexedLogGetLatest(indexedLog *il, indexedLogRecord *key, indexedLogRecord *data){
+    return il->type->getLatest(il->handle, key, data);
+}
+
+int indexedLogSync(indexedLog *il){
+    return il->type->sync(il->handle);
+}
+
+/*
+    Opens a cursor to scan the indexed log. Returns NULL on error.
+*/
+indexedLogCursor *indexedLogCursorOpen(indexedLog *il){
+    void *cursor = il->type->cursorOpen(il->handle);
+    if(cursor == NULL)
+        return NULL;
+
+    indexedLogCursor *c = zmalloc(sizeof(indexedLogCursor));
+    c->type = il->type;
+    c->cursor = cursor;
+    return c;
+}
+
+int indexedLogCursorGet(indexedLogCursor *c, indexedLogRecord *key, indexedLogRecord *data, int op){
+    return c->type->cursorGet(c->cursor, key, data, op);
+}
+
+void indexedLogCursorClose(indexedLogCursor *c){
+    if(c == NULL)
+        return;
+    c->type->cursorClose(c->cursor);
+    zfree(c);
+}
+
+/*
+    Returns a message describing an error returned by a storage engine.
+*/
+char *indexedLogStrerror(int error){
+    if(error == INDEXEDLOG_NOTFOUND)
+        return "record not found";
+    if(error == INDEXEDLOG_ERR)
+        return "invalid or corrupted indexed log";
+#ifdef USE_BERKELEYDB
+    return db_strerror(error);
+#else
+    return strerror(error);
+#endif
+}
+
+#ifdef USE_BERKELEYDB
+// ==================================================================================
+// Berkeley DB engine
+
+static DB_ENV *BDB_env = NULL;
+
+//Creates a Berkeley DB environment
+static int bdbInit(void){
+  u_int32_t env_flags; /* env open flags */
+  int ret; /* function return value */
+
+  /*
+   Create an environment object and initialize it for error
+   reporting.
+  */
+  ret = db_env_create(&BDB_env, 0);
+  if (ret != 0) {
+   serverLog(LL_NOTICE,  "Error creating Environment handle: %s\n", db_strerror(ret));
+   return 0;
+  }
+
+  /* Open the environment. */
+  env_flags = DB_CREATE | /* If the environment does not exist, create it. */
+              DB_INIT_MPOOL|
+              DB_THREAD; /* Initialize the in-memory cache. */
+
+  ret = BDB_env->open(BDB_env,       /* DB_ENV ptr */
+                    "", /* env home directory */
+                    env_flags,          /* Open flags */
+                    0);                 /* File mode (default) */
+  if (ret != 0) {
+   serverLog(LL_NOTICE,  "Environment open failed: %s", db_strerror(ret));
+   return 0;
+  }
+  return 1;
+}
+
+/*
+Opens Berkeley DB.
+Returns a pointer to hadle the Berkeley database or NULL if fail.
+file_name: Berkeley database file name;
+flags:
+    DB_CREATE: Create the underlying database and any necessary physical files.
+    DB_NOMMAP: Do not map this database into process memory.
+    DB_RDONLY: Treat the data base as read-only.
+    DB_THREAD: The returned handle is free-threaded, that is, it can be used simultaneously by multiple threads within the process.
+    DB_TRUNCATE: Physically truncate the underlying database file, discarding all databases it contained.
+    DB_UPGRADE: Upgrade the database format as necessary.
+duplicates:
+    DB_DUP: The database supports non-sorted duplicate records.
+    DB_DUPSORT: The database supports sorted duplicate records. Note that this flag also sets the DB_DUP flag for you.
+data_structure: database access method (DB_BTREE, DB_HASH, DB_HEAP, DB_QUEUE, DB_RECNO, or DB_UNKNOWN)
+retult: return 0 (zero) if the indexel log is openned. If fail, return a code error.
+*/
+static DB* openBerkeleyDB(char* file_name, u_int32_t flags, u_int32_t duplicates, u_int32_t data_structure, int *result){
+
+    DB *BDB_database;//A pointer to the database
+
+    int ret = db_create(&BDB_database, BDB_env, 0);
+    *result = ret;
+    if (ret != 0) {
+        serverLog(LL_NOTICE,"Error while creating the BerkeleyDB database! \n");
+        return NULL;
+    }
+    *result = ret;
+
+  /* We want to support duplicates keys*/
+    if(duplicates == DB_DUP || duplicates == DB_DUPSORT){
+        ret = BDB_database->set_flags(BDB_database, DB_DUP);
+        if (ret != 0) {
+            serverLog(LL_NOTICE,"Error while setting the DB_DUMP flag on BerkeleyDB! %s\n", db_strerror(ret));
+            *result = ret;
+            BDB_database->close(BDB_database, 0);
+            return NULL;
+        }
+    }
+
+    /* open the database */
+    ret = BDB_database->open(BDB_database,      /* DB structure pointer */
+                            NULL,               /* Transaction pointer */
+                            file_name,          /* On-disk file that holds the database. */
+                            NULL,               /* Optional logical database name */
+                            data_structure,     /* Database access method */
+                            flags,              /* If the database does not exist, create it. */
+                            0);                 /* File mode (using defaults) */
+    *result = ret;
+
+    if (ret != 0) {
+        serverLog(LL_NOTICE,"Error while openning the BerkeleyDB database! %s", db_strerror(ret));
+        BDB_database->close(BDB_database, 0);
+        return NULL;
+    }
+
+    return BDB_database;
+}
+
+static void *bdbOpen(char *file_name, char mode, int *result){
+    u_int32_t flags;
+    switch (mode){
+        case 'W': flags = DB_CREATE; break;
+        case 'R': flags = DB_RDONLY; break;
+        case 'T': flags = DB_THREAD; break;
+        default:
+        serverLog(LL_NOTICE,"Invalide database openning mode! \n");
+        exit(0);
+    }
+
+    u_int32_t data_structure;
+    if(strcmp(server.indexedlog_structure,"BTREE") == 0)
+        data_structure = DB_BTREE;
+    else
+        if(strcmp(server.indexedlog_structure,"HASH") == 0)
+           data_structure = DB_HASH;
+        else
+            data_structure = DB_BTREE;
+
+    return openBerkeleyDB(file_name, flags, DB_DUP, data_structure, result);
+}
+
+static void bdbClose(void *handle, int sync){
+    DB *dbp = handle;
+    dbp->close(dbp, sync ? 0 : DB_NOSYNC);
+}
+
+/* Fills a DBT with a key or a log record. */
+static void bdbSetDBT(DBT *dbt, indexedLogRecord *r){
+    memset(dbt, 0, sizeof(DBT));
+    dbt->data = r->data;
+    dbt->size = r->size;
+}
+
+/*
+Insert a pair key/data to BerkeleyDB
+Return a non-zero DB->put() error if fail
+*/
+static int bdbPut(void *handle, indexedLogRecord *key, indexedLogRecord *data){
+    DB *BDB_database = handle;
+    DBT key2, data2;
+    int error;
+
+    bdbSetDBT(&key2, key);
+    bdbSetDBT(&data2, data);
+    error = BDB_database->put(BDB_database, NULL, &key2, &data2, 0);
+    if (error != 0)
+        BDB_database->err(BDB_database, error, "DB->put error: ");
+
+    return error;
+}
+
+/*
+    Delete a data on BerkeleyDB
+    Return a non-zero DB->del() error if fail
+*/
+static int bdbDel(void *handle, indexedLogRecord *key){
+    DB *dbp = handle;
+    DBT key2;
+    int error;
+
+    bdbSetDBT(&key2, key);
+    error = dbp->del(dbp, NULL, &key2, 0);
+    if (error == DB_NOTFOUND)
+        return INDEXEDLOG_NOTFOUND;
+
+    return error;
+}
+
+/*
+    Gets the last duplicate of a key. Berkeley DB has no operation to position a cursor
+    on the last duplicate, so the duplicates of the key are scanned.
+*/
+static int bdbGetLatest(void *handle, indexedLogRecord *key, indexedLogRecord *data){
+    DB *dbp = handle;
+    DBC *cursorp;
+    DBT key2, data2;
+    int error;
+
+    bdbSetDBT(&key2, key);
+    memset(&data2, 0, sizeof(DBT));
+    error = dbp->cursor(dbp, NULL, &cursorp, 0);
+    if (error != 0)
+        return error;
+
+    data->data = NULL;
+    data->size = 0;
+    error = cursorp->get(cursorp, &key2, &data2, DB_SET);
+    while (error == 0) {
+        zfree(data->data);
+        data->data = zmalloc(data2.size);
+        memcpy(data->data, data2.data, data2.size);
+        data->size = data2.size;
+        error = cursorp->get(cursorp, &key2, &data2, DB_NEXT_DUP);
+    }
+    cursorp->close(cursorp);
+
+    if (error != DB_NOTFOUND) {
+        zfree(data->data);
+        data->data = NULL;
+        return error;
+    }
+    return data->data == NULL ? INDEXEDLOG_NOTFOUND : INDEXEDLOG_OK;
+}
+
+static int bdbSync(void *handle){
+    DB *dbp = handle;
+    return dbp->sync(dbp, 0);
+}
+
+static void *bdbCursorOpen(void *handle){
+    DB *dbp = handle;
+    DBC *cursorp;
+
+    if (dbp->cursor(dbp, NULL, &cursorp, 0) != 0)
+        return NULL;
+    return cursorp;
+}
+
+static int bdbCursorGet(void *cursor, indexedLogRecord *key, indexedLogRecord *data, int op){
+    DBC *cursorp = cursor;
+    DBT key2, data2;
+    u_int32_t flags;
+    int error;
+
+    switch(op){
+        case INDEXEDLOG_NEXT: flags = DB_NEXT; break;
+        case INDEXEDLOG_NEXT_NODUP: flags = DB_NEXT_NODUP; break;
+        case INDEXEDLOG_SET: flags = DB_SET; break;
+        case INDEXEDLOG_NEXT_DUP: flags = DB_NEXT_DUP; break;
+        default: return EINVAL;
+    }
+
+    if (op == INDEXEDLOG_SET)
+        bdbSetDBT(&key2, key);
+    else
+        memset(&key2, 0, sizeof(DBT));
+    memset(&data2, 0, sizeof(DBT));
+
+    error = cursorp->get(cursorp, &key2, &data2, flags);
+    if (error == DB_NOTFOUND)
+        return INDEXEDLOG_NOTFOUND;
+    if (error != 0)
+        return error;
+
+    key->data = key2.data;
+    key->size = key2.size;
+    data->data = data2.data;
+    data->size = data2.size;
+    return INDEXEDLOG_OK;
+}
+
+static void bdbCursorClose(void *cursor){
+    DBC *cursorp = cursor;
+    cursorp->close(cursorp);
+}
+
+indexedLogType indexedLogTypeBerkeleyDB = {
+    "BDB",
+    bdbInit,
+    bdbOpen,
+    bdbClose,
+    bdbPut,
+    bdbDel,
+    bdbGetLatest,
+    bdbSync,
+    bdbCursorOpen,
+    bdbCursorGet,
+    bdbCursorClose
+};
+#endif
@@ -0,0 +1,93 @@
+/*
+  Storage engines of the indexed log.
+
+  The indexed log stores, for each key, the log records needed to redo the key in the
+  order they were added (a key can have several log records). The instant recovery does
+  not access a storage engine directly, but through the indexedLogType interface below,
+  so the engine is chosen in the 'indexedlog_engine' setting of redis_ir.conf:
+
+    BDB      Berkeley DB (B+-tree or hash with duplicate keys). Requires libdb and is
+             only available if Redis is built with USE_BERKELEYDB=yes (the default).
+    HASHLOG  Built-in engine: an append-only log of records plus an mmap'ed open
+             addressing hash index. It requires no external library.
+
+  Keys and records are NULL terminated strings, and the sizes stored include the NULL
+  terminator, as Berkeley DB always did in Redis-IR.
+*/
+
+#ifndef __INDEXEDLOG_H
+#define __INDEXEDLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Return codes of the engine functions. Any other non-zero value is an error. */
+#define INDEXEDLOG_OK 0
+#define INDEXEDLOG_NOTFOUND -1      /* Key not found or end of the scan. */
+#define INDEXEDLOG_ERR -2           /* Generic error, errno is set. */
+
+/* Cursor operations. */
+#define INDEXEDLOG_NEXT 0           /* Next record. The first one on a new cursor. */
+#define INDEXEDLOG_NEXT_NODUP 1     /* First record of the next key. */
+#define INDEXEDLOG_SET 2            /* First record of the key given. */
+#define INDEXEDLOG_NEXT_DUP 3       /* Next record of the current key. */
+
+/* A key or a log record. When returned by an engine, 'data' is owned by the
+ * engine and is valid until the next operation on the same cursor. */
+typedef struct indexedLogRecord {
+    void *data;
+    size_t size;
+} indexedLogRecord;
+
+typedef struct indexedLogType {
+    char *name;
+    /* Initializes the engine once, before any indexed log is opened. */
+    int (*init)(void);
+    /* Mode 'W' creates the files if they don't exist, 'R' requires them. */
+    void *(*open)(char *file_name, char mode, int *result);
+    void (*close)(void *handle, int sync);
+    /* Adds a log record to the key, after the log records it already has. */
+    int (*put)(void *handle, indexedLogRecord *key, indexedLogRecord *data);
+    /* Removes all the log records of the key. */
+    int (*del)(void *handle, indexedLogRecord *key);
+    /* Returns the last log record of the key in 'data', allocated with zmalloc(). */
+    int (*getLatest)(void *handle, indexedLogRecord *key, indexedLogRecord *data);
+    /* Flushes the log records to disk. */
+    int (*sync)(void *handle);
+    /* Cursors scan the records key by key, in the order the records of each key
+     * were added (INDEXEDLOG_NEXT...), or the range of records of one key
+     * (INDEXEDLOG_SET + INDEXEDLOG_NEXT_DUP). */
+    void *(*cursorOpen)(void *handle);
+    int (*cursorGet)(void *cursor, indexedLogRecord *key, indexedLogRecord *data, int op);
+    void (*cursorClose)(void *cursor);
+} indexedLogType;
+
+typedef struct indexedLog {
+    indexedLogType *type;
+    void *handle;
+} indexedLog;
+
+typedef struct indexedLogCursor {
+    indexedLogType *type;
+    void *cursor;
+} indexedLogCursor;
+
+#ifdef USE_BERKELEYDB
+extern indexedLogType indexedLogTypeBerkeleyDB;
+#endif
+extern indexedLogType indexedLogTypeHashLog;
+
+indexedLogType *indexedLogLookupType(const char *name);
+int indexedLogInit(indexedLogType *type);
+indexedLog *indexedLogOpen(indexedLogType *type, char *file_name, char mode, int *result);
+void indexedLogClose(indexedLog *il, int sync);
+int indexedLogPut(indexedLog *il, indexedLogRecord *key, indexedLogRecord *data);
+int indexedLogDel(indexedLog *il, indexedLogRecord *key);
+int indexedLogGetLatest(indexedLog *il, indexedLogRecord *key, indexedLogRecord *data);
+int indexedLogSync(indexedLog *il);
+indexedLogCursor *indexedLogCursorOpen(indexedLog *il);
+int indexedLogCursorGet(indexedLogCursor *c, indexedLogRecord *key, indexedLogRecord *data, int op);
+void indexedLogCursorClose(indexedLogCursor *c);
+char *indexedLogStrerror(int error);
+
+#endif
@@ -19,7 +19,7 @@
     Files created: redis_ir.conf, an instant_recovery.c.
     Direcories created: datasets, logs, recovery_report, system_monitoring, indexing_report, 
                         graphics, and ir-dev-tools (and its files).
-    Libraries included: uthash.h, hiredis.h, and db.h (BerkeleyDB).
+    Libraries included: uthash.h, hiredis.h, and db.h (BerkeleyDB, optional, see indexedlog.h).
     Program included: Memtier benchmark (memtier_benchmark).
 */
 
@@ -28,12 +28,15 @@
 #include "server.h"
 
 #include <sys/stat.h> 
+#include <fcntl.h>
 #include <assert.h>
 #include <libconfig.h>
-#include <db.h>
 
 #include "hiredis.h"
 #include "uthash.h"
+#include "atomicvar.h"
+#include "cluster.h"
+#include "bio.h"
 
 
 
@@ -48,7 +51,14 @@ void selfTuneCheckpointTimeInterval(int time_interval);
 //void *indexesSequentialLogToIndexedLogV1();
 void *indexesSequentialLogToIndexedLogV2();
 void stopThredas();
-int creat_env();
+void closeIndexedLogPartitions(indexedLog **dbps);
+long long int readFinalLogSeek(char *filename);
+int readFinalLogSeekDb(char *filename);
+
+/* Size of the key and value buffers of the records to index (see recordToIndex). */
+#define IR_RECORD_FIELD_LEN 50
+/* Delimits the database id of the keys of the indexed log (see getIndexedLogKey). */
+#define IR_DB_KEY_PREFIX '\x01'
 
 
 // ==================================================================================
@@ -272,6 +282,34 @@ void initializeIRParameters(){
     exit(0);
   }
 
+  //server.sequential_log_state
+  if(config_lookup_string(&cfg, "sequential_log_state", &str)){
+    if(strcmp(str, "ON") == 0)
+      server.sequential_log_state = IR_ON;
+    else
+      if(strcmp(str, "OFF") == 0 && server.instant_recovery_state == IR_OFF)
+        server.sequential_log_state = IR_OFF;
+      else{
+        serverLog(LL_NOTICE, "Invalid setting for 'sequential_log_state' in 'redis_ir.conf' configuration file in "
+                                "Redis-IR root path. Use \"ON\" or \"OFF\" (only if 'instant_recovery_state' is OFF) values.\n");
+        exit(0);
+      }
+  }
+  else{
+    server.sequential_log_state = IR_ON; //default value
+  }
+
+  //server.indexedlog_engine
+  if(config_lookup_string(&cfg, "indexedlog_engine", &str)){
+    server.indexedlog_engine = indexedLogLookupType(str);
+    if(server.indexedlog_engine == NULL){
+        serverLog(LL_NOTICE, "Invalid setting for 'indexedlog_engine' in 'redis_ir.conf' configuration file in "
+                                "Redis-IR root path. Use \"HASHLOG\" or \"BDB\" (only if Redis was built with "
+                                "USE_BERKELEYDB=yes) values.\n");
+        exit(0);
+      }
+  }
+
   //server.indexedlog_structure
   if(config_lookup_string(&cfg, "indexedlog_structure", &str)){
     if(strcmp(str, "BTREE") == 0 || strcmp(str, "HASH") == 0){
@@ -331,6 +369,19 @@ void initializeIRParameters(){
   }
 
   int int_aux;
+  //server.indexedlog_partitions
+  if(config_lookup_int(&cfg, "indexedlog_partitions", &int_aux)){
+    if(int_aux < 1 || int_aux > CLUSTER_SLOTS){
+      serverLog(LL_NOTICE, "Invalid setting for 'indexedlog_partitions' in 'redis_ir.conf' configuration "
+                              "file. Use a value between 1 and %d.\n", CLUSTER_SLOTS);
+      exit(0);
+    }
+    server.indexedlog_partitions = int_aux;
+  }
+  else{
+    server.indexedlog_partitions = 1; //default value
+  }
+
   //server.indexer_time_interval
   if(config_lookup_int(&cfg, "indexer_time_interval", &int_aux)){
     server.indexer_time_interval = int_aux;
@@ -438,6 +489,23 @@ void initializeIRParameters(){
     server.log_corruption = 0; //default value
   }
 
+  //server.estimate_recovery_eta
+  if(config_lookup_string(&cfg, "estimate_recovery_eta", &str)){
+    if(strcmp(str, "ON") == 0)
+      server.estimate_recovery_eta = IR_ON;
+    else
+      if(strcmp(str, "OFF") == 0)
+        server.estimate_recovery_eta = IR_OFF;
+      else{
+        serverLog(LL_NOTICE, "Invalid setting for 'estimate_recovery_eta' in 'redis_ir.conf' configuration file in Redis-IR "
+                                "root path. Use \"ON\" or \"OFF\" values.\n");
+        exit(0);
+      }
+  }
+  else{
+    server.estimate_recovery_eta = IR_ON;
+  }
+
   //server.rebuild_indexedlog
   if(config_lookup_string(&cfg, "rebuild_indexedlog", &str)){
     if(strcmp(str, "ON") == 0)
@@ -455,6 +523,57 @@ void initializeIRParameters(){
     server.rebuild_indexedlog = IR_OFF;
   }
 
+  //server.replica_sync_from_indexedlog
+  if(config_lookup_string(&cfg, "replica_sync_from_indexedlog", &str)){
+    if(strcmp(str, "ON") == 0)
+      server.replica_sync_from_indexedlog = IR_ON;
+    else
+      if(strcmp(str, "OFF") == 0)
+        server.replica_sync_from_indexedlog = IR_OFF;
+      else{
+        serverLog(LL_NOTICE, "Invalid setting for 'replica_sync_from_indexedlog' in 'redis_ir.conf' configuration "
+                                "file in Redis-IR root path. Use \"ON\" or \"OFF\" values.\n");
+        exit(0);
+      }
+  }
+  else{
+    server.replica_sync_from_indexedlog = IR_OFF;
+  }
+
+  //server.aof_rewrite_from_indexedlog
+  if(config_lookup_string(&cfg, "aof_rewrite_from_indexedlog", &str)){
+    if(strcmp(str, "ON") == 0)
+      server.aof_rewrite_from_indexedlog = IR_ON;
+    else
+      if(strcmp(str, "OFF") == 0)
+        server.aof_rewrite_from_indexedlog = IR_OFF;
+      else{
+        serverLog(LL_NOTICE, "Invalid setting for 'aof_rewrite_from_indexedlog' in 'redis_ir.conf' configuration "
+                                "file in Redis-IR root path. Use \"ON\" or \"OFF\" values.\n");
+        exit(0);
+      }
+  }
+  else{
+    server.aof_rewrite_from_indexedlog = IR_OFF;
+  }
+
+  //server.indexed_rdb
+  if(config_lookup_string(&cfg, "indexed_rdb", &str)){
+    if(strcmp(str, "ON") == 0)
+      server.indexed_rdb = IR_ON;
+    else
+      if(strcmp(str, "OFF") == 0)
+        server.indexed_rdb = IR_OFF;
+      else{
+        serverLog(LL_NOTICE, "Invalid setting for 'indexed_rdb' in 'redis_ir.conf' configuration "
+                                "file in Redis-IR root path. Use \"ON\" or \"OFF\" values.\n");
+        exit(0);
+      }
+  }
+  else{
+    server.indexed_rdb = IR_OFF;
+  }
+
   //server.checkpoint_state
   if(config_lookup_string(&cfg, "checkpoint_state", &str)){
     if(strcmp(str, "ON") == 0)
@@ -855,6 +974,19 @@ void initializeIRParameters(){
     server.system_monitoring_time_interval = 1; //default value
   }
 
+  //system_monitoring_time_interval_ms
+  if(config_lookup_int(&cfg, "system_monitoring_time_interval_ms", &int_aux)){
+    if(int_aux < 10){
+      serverLog(LL_NOTICE, "Invalid setting for 'system_monitoring_time_interval_ms' in 'redis_ir.conf' configuration "
+                              "file. Use a value greater than or equal to 10 milliseconds.\n");
+      exit(0);
+    }
+    server.system_monitoring_time_interval_ms = int_aux;
+  }
+  else{
+    server.system_monitoring_time_interval_ms = server.system_monitoring_time_interval*1000; //default value
+  }
+
   //server.overwrite_system_monitoring
   if(config_lookup_string(&cfg, "overwrite_system_monitoring", &str)){
     if(strcmp(str, "ON") == 0){
@@ -874,7 +1006,7 @@ void initializeIRParameters(){
 
   config_destroy(&cfg);
 
-  if(creat_env()){
+  if(indexedLogInit(server.indexedlog_engine)){
     serverLog(LL_NOTICE, "Indexed log Environment started!");
   }else{
     serverLog(LL_NOTICE, "The system was not started! Indexeed log Environment could not be started!");
@@ -892,202 +1024,158 @@ void initializeIRParameters(){
 }
 
 // ==================================================================================
-// Functions to handle Berkeley DB
-
-//Creates a Berkeley DB environment
-int creat_env(){
-  u_int32_t env_flags; /* env open flags */
-  int ret; /* function return value */
-
-  /* 
-   Create an environment object and initialize it for error
-   reporting. 
-  */
-  ret = db_env_create(&server.IR_env, 0);
-  if (ret != 0) {
-   serverLog(LL_NOTICE,  "Error creating Environment handle: %s\n", db_strerror(ret));
-   return 0;
-  }
-
-  /* Open the environment. */
-  env_flags = DB_CREATE | /* If the environment does not exist, create it. */
-              DB_INIT_MPOOL|
-              DB_THREAD; /* Initialize the in-memory cache. */
+// Functions to store and access records in the indexed log (see indexedlog.h)
 
-  ret = server.IR_env->open(server.IR_env,       /* DB_ENV ptr */
-                    "", /* env home directory */
-                    env_flags,          /* Open flags */
-                    0);                 /* File mode (default) */
-  if (ret != 0) {
-   serverLog(LL_NOTICE,  "Environment open failed: %s", db_strerror(ret));
-   return 0;
-  }
-  return 1;
-}
 
 /*
-Opens Berkeley DB.
-Returns a pointer to hadle the Berkeley database.
-file_name: Berkeley database file name;
-flags: 
-    DB_CREATE: Create the underlying database and any necessary physical files.
-    DB_NOMMAP: Do not map this database into process memory.
-    DB_RDONLY: Treat the data base as read-only.
-    DB_THREAD: The returned handle is free-threaded, that is, it can be used simultaneously by multiple threads within the process. 
-    DB_TRUNCATE: Physically truncate the underlying database file, discarding all databases it contained.
-    DB_UPGRADE: Upgrade the database format as necessary. 
-duplicates: 
-    DB_DUP: The database supports non-sorted duplicate records.
-    DB_DUPSORT: The database supports sorted duplicate records. Note that this flag also sets the DB_DUP flag for you.
-data_structure: database access method (DB_BTREE, DB_HASH, DB_HEAP, DB_QUEUE, DB_RECNO, or DB_UNKNOWN)
-retult: return 0 (zero) if the indexel log is openned. If fail, return a code error.
-*/
-DB* openBerkeleyDB(char* file_name, u_int32_t flags, u_int32_t duplicates, u_int32_t data_structure, int *result){
-
-    DB *BDB_database;//A pointer to the database
-
-    int ret = db_create(&BDB_database, server.IR_env, 0);
-    *result = ret;
-    if (ret != 0) {
-        serverLog(LL_NOTICE,"Error while creating the BerkeleyDB database! \n");
-        return BDB_database;
-    }
-    *result = ret;
-  
-  /* We want to support duplicates keys*/
-    if(duplicates == DB_DUP || duplicates == DB_DUPSORT){
-        ret = BDB_database->set_flags(BDB_database, DB_DUP);
-        if (ret != 0) {
-            serverLog(LL_NOTICE,"Error while setting the DB_DUMP flag on BerkeleyDB! %s\n", db_strerror(ret));
-            return BDB_database;
-        }
-    }  
-
-    /* open the database */
-    ret = BDB_database->open(BDB_database,      /* DB structure pointer */
-                            NULL,               /* Transaction pointer */
-                            file_name,          /* On-disk file that holds the database. */
-                            NULL,               /* Optional logical database name */
-                            data_structure,     /* Database access method */
-                            flags,              /* If the database does not exist, create it. */
-                            0);                 /* File mode (using defaults) */
-    *result = ret;  
-
-    if (ret != 0) {
-        serverLog(LL_NOTICE,"Error while openning the BerkeleyDB database! %s", db_strerror(ret));
-        return BDB_database;
+Opens the indexed log with the storage engine set in redis_ir.conf (see indexedlog.h).
+Returns a pointer to hadle the indexed log or NULL if fail.
+file_name: indexed log file name;
+mode: 
+    W: Create the underlying database and any necessary physical files.
+    R: Treat the data base as read-only.
+    T: The returned handle is free-threaded, that is, it can be used simultaneously by multiple threads within the process. 
+retult: returns 0 (zero) if the indexed log is openned. If fail, returns a code error.
+*/
+indexedLog* openIndexedLog(char* file_name, char mode, int *result){
+    if(mode != 'W' && mode != 'R' && mode != 'T'){
+        serverLog(LL_NOTICE,"Invalide database openning mode! \n");
+        exit(0);
     }
-
-    return BDB_database;
+    return indexedLogOpen(server.indexedlog_engine, file_name, mode, result);
 }
 
-/* 
-Insert a pair key/data to BerkeleyDB
-Return a non-zero DB->put() error if fail
+/*
+Close the indexed log
 */
-int addDataBerkeleyDB(DB *BDB_database, DBT key, DBT data){
-  int error;
-
-  error = BDB_database->put(BDB_database, NULL, &key, &data, 0);
-  if ( error == 0){
-    ;//printf("db: %s : key stored.\n", (char *)key.data);
-  }else{
-    BDB_database->err(BDB_database, error, "DB->put error: ");  
-  } 
-
-  return error;
+void closeIndexedLog(indexedLog* dbp){
+  indexedLogClose(dbp, 1);
 }
 
 /*
-Get a pair key/data on BerkeleyDB
-Return a record in DBT format or null (if it does not exist)
+Closes the indexed log and does not flush the data to sencondary memory
 */
-DBT getDataBerkeleyDB(DB *dbp, DBT key){
-    DBT data;
-    int error;
-    
-    error = dbp->get(dbp, NULL, &key, &data, 0);    
-    if (error != 0)
-        dbp->err(dbp, error, "DB->get error key = %s", (char *)key.data);
-    
-    return data;
+void closeIndexedLogNoSync(indexedLog* dbp){
+  indexedLogClose(dbp, 0);
 }
 
-/* 
-    Delete a data on BerkeleyDB
-    Return a non-zero DB->del() error if fail
+/*
+    Returns the key of a database record in the indexed log. The keys of the database 0
+    are stored as they are, so the indexed logs written before SELECT was supported are
+    still valid. The keys of the other databases are stored as
+    IR_DB_KEY_PREFIX<dbid>IR_DB_KEY_PREFIX<key>.
+    The sds string returned must be freed by the caller.
 */
-int delDataBerkeleyDB(DB *dbp, DBT key){
-    int error;
-
-    error = dbp->del(dbp, NULL, &key, 0);
-
-    return error;
+sds getIndexedLogKey(int dbid, char *key){
+  if(dbid == 0)
+    return sdsnew(key);
+  return sdscatprintf(sdsempty(), "%c%d%c%s", IR_DB_KEY_PREFIX, dbid, IR_DB_KEY_PREFIX, key);
 }
 
+/*
+    Returns the database of a key of the indexed log (see getIndexedLogKey()). The key 
+    of the database record is returned in 'key', pointing into the indexed_key string.
+*/
+int parseIndexedLogKey(char *indexed_key, char **key){
+  char *end;
+  int dbid;
 
-// ==================================================================================
-// Functions to store and access records in the indexed log using Berkeley DB funcitons
+  *key = indexed_key;
+  if(indexed_key[0] != IR_DB_KEY_PREFIX)
+    return 0;
+  dbid = strtol(indexed_key+1, &end, 10);
+  if(end == indexed_key+1 || *end != IR_DB_KEY_PREFIX)
+    return 0;
+  *key = end+1;
+  return dbid;
+}
 
+/*
+    Returns the partition of the indexed log that stores the log records of a key.
+    Keys are mapped to the partitions by their cluster hash slot, so all the keys of 
+    a hash slot are always stored in the same partition, whatever their database.
+*/
+int getIndexedLogPartition(char *key){
+  if(server.indexedlog_partitions <= 1)
+    return 0;
+  parseIndexedLogKey(key, &key);
+  return getIndexedLogSlotPartition(keyHashSlot(key, strlen(key)));
+}
 
 /*
-Opens the indexed log.
-Returns a pointer to hadle the Berkeley database.
-file_name: Berkeley database file name;
-mode: 
-    W: Create the underlying database and any necessary physical files.
-    R: Treat the data base as read-only.
-    T: The returned handle is free-threaded, that is, it can be used simultaneously by multiple threads within the process. 
-retult: returns 0 (zero) if the indexed log is openned. If fail, returns a code error.
+    Returns the partition of the indexed log that stores the keys of a hash slot.
 */
-DB* openIndexedLog(char* file_name, char mode, int *result){
-    u_int32_t flags;
-    switch (mode){
-        case 'W': flags = DB_CREATE; break;
-        case 'R': flags = DB_RDONLY; break;
-        case 'T': flags = DB_THREAD; break;
-        default:
-        serverLog(LL_NOTICE,"Invalide database openning mode! \n");
-        exit(0);
-    }
+int getIndexedLogSlotPartition(int slot){
+  if(server.indexedlog_partitions <= 1)
+    return 0;
+  return slot % server.indexedlog_partitions;
+}
 
-    u_int32_t data_structure;
-    if(strcmp(server.indexedlog_structure,"BTREE") == 0)
-        data_structure = DB_BTREE;
-    else
-        if(strcmp(server.indexedlog_structure,"HASH") == 0)
-           data_structure = DB_HASH;
-        else
-            data_structure = DB_BTREE;
+/*
+    Returns the file name of a partition of an indexed log file (indexed log or its replica).
+    If the indexed log has only one partition, the file name is not changed. Otherwise, the 
+    partition number is added as a suffix, e.g. "logs/indexedLog.db.3".
+    The sds string returned must be freed by the caller.
+*/
+sds getIndexedLogPartitionFilename(char *file_name, int partition){
+  if(server.indexedlog_partitions <= 1)
+    return sdsnew(file_name);
+  return sdscatprintf(sdsempty(), "%s.%d", file_name, partition);
+}
 
-    return openBerkeleyDB(file_name, flags, DB_DUP, data_structure, result);
+/*
+    Opens a partition of an indexed log file (indexed log or its replica). See openIndexedLog().
+*/
+indexedLog* openIndexedLogPartition(char *file_name, int partition, char mode, int *result){
+  sds partition_filename = getIndexedLogPartitionFilename(file_name, partition);
+  indexedLog *dbp = openIndexedLog(partition_filename, mode, result);
+  sdsfree(partition_filename);
+  return dbp;
 }
 
 /*
-Close the BerkeleyDB
+    Opens all the partitions of an indexed log file (indexed log or its replica).
+    Returns an array of server.indexedlog_partitions handles that must be closed by 
+    closeIndexedLogPartitions(). If a partition cannot be opened, the partitions already
+    openned are closed, result is setted with the error and NULL is returned.
 */
-void closeIndexedLog(DB* dbp){
-  if (dbp != NULL)
-    dbp->close(dbp, 0);
+indexedLog** openIndexedLogPartitions(char *file_name, char mode, int *result){
+  indexedLog **dbps = zcalloc(sizeof(indexedLog*)*server.indexedlog_partitions);
+  int partition;
+
+  for(partition = 0; partition < server.indexedlog_partitions; partition++){
+    dbps[partition] = openIndexedLogPartition(file_name, partition, mode, result);
+    if(*result != 0){
+      serverLog(LL_NOTICE, "Cannot open the partition %d of the indexed log!", partition);
+      closeIndexedLog(dbps[partition]);
+      dbps[partition] = NULL;
+      closeIndexedLogPartitions(dbps);
+      return NULL;
+    }
+  }
+  return dbps;
 }
 
 /*
-Closes the BerkeleyDB and does not flush the data to sencondary memory
+    Closes the partitions of the indexed log openned by openIndexedLogPartitions().
+    Partitions not openned (NULL) are skipped.
 */
-void closeIndexedLogNoSync(DB* dbp){
-  if (dbp != NULL)
-    dbp->close(dbp, DB_NOSYNC);
+void closeIndexedLogPartitions(indexedLog **dbps){
+  int partition;
+
+  if(dbps == NULL)
+    return;
+  for(partition = 0; partition < server.indexedlog_partitions; partition++)
+    closeIndexedLog(dbps[partition]);
+  zfree(dbps);
 }
 
 /* 
-Insert a log record (sting) by its tuple key (string) to indexed log (BerkeleyDB)
-Return a non-zero DB->put() error if fail
+Insert a log record (sting) by its tuple key (string) to indexed log
+Return a non-zero error if fail
 */
-int addRecordIndexedLog(DB* dbp, char* key, char* data){
-  DBT key2, data2;
-
-  memset(&key2, 0, sizeof(DBT));
-  memset(&data2, 0, sizeof(DBT));
+int addRecordIndexedLog(indexedLog* dbp, char* key, char* data){
+  indexedLogRecord key2, data2;
 
   key2.data = key;
   key2.size = strlen(key) + 1;
@@ -1095,25 +1183,24 @@ int addRecordIndexedLog(DB* dbp, char* key, char* data){
   data2.data = data;
   data2.size = strlen(data) + 1; 
 
-  return addDataBerkeleyDB(dbp, key2, data2);
+  int error = indexedLogPut(dbp, &key2, &data2);
+  if (error != 0)
+    serverLog(LL_NOTICE, "Error while adding a record to the indexed log! %s", indexedLogStrerror(error));
+
+  return error;
 }
 
 /*
-Get a log record (sting) by its tuple key (string) on indexed log (BerkeleyDB)
-Return a record record or null (if it does not exist)
+Get the last log record (sting) by its tuple key (string) on indexed log
+Return a record record or null (if it does not exist). The record must be freed with zfree().
 */
-char* getRecordIndexedLog(DB* dbp,  char* key){
-    DBT key2, data;
-    int error;
-
-    memset(&key2, 0, sizeof(DBT));
-    memset(&data, 0, sizeof(DBT));
+char* getRecordIndexedLog(indexedLog* dbp,  char* key){
+    indexedLogRecord key2, data;
 
     key2.data = key;
     key2.size = strlen(key) + 1;
 
-    error = dbp->get(dbp, NULL, &key2, &data, 0);    
-    if (error != 0)
+    if (indexedLogGetLatest(dbp, &key2, &data) != 0)
         return NULL;
 
     return (char *)data.data;
@@ -1121,49 +1208,41 @@ char* getRecordIndexedLog(DB* dbp,  char* key){
 
 /* 
     Delete a log record on indexed log by a key (string)
-    Return a non-zero DB->del() error if fail
+    Return a non-zero error if fail
 */
-int delRecordIndexdLog(DB* dbp, char *key){
-    DBT key2;
-    int error;
-
-    memset(&key2, 0, sizeof(DBT));
+int delRecordIndexdLog(indexedLog* dbp, char *key){
+    indexedLogRecord key2;
 
     key2.data = key;
     key2.size = strlen(key) + 1;
 
-    error = delDataBerkeleyDB(dbp, key2);
-
-    return error;
+    return indexedLogDel(dbp, &key2);
 }
 
 /*
     Returns the number of log records in the indexed log.
 */
-unsigned long long countRecordsIndexedLog(DB* dbp){
-  DBC *cursorp;
-  DBT key, data;
+unsigned long long countRecordsIndexedLog(indexedLog* dbp){
+  indexedLogCursor *cursorp;
+  indexedLogRecord key, data;
   int error;
   unsigned long long count = 0;
 
-  /* Zero out the DBTs before using them. */
-  memset(&key, 0, sizeof(DBT));
-  memset(&data, 0, sizeof(DBT));
-
   /* Get a cursor */
-  dbp->cursor(dbp, NULL, &cursorp, 0); 
+  cursorp = indexedLogCursorOpen(dbp);
+  if (cursorp == NULL)
+    return 0;
 
     /* Iterate over the database, retrieving each record in turn. */
-  while ((error = cursorp->get(cursorp, &key, &data, DB_NEXT)) == 0) {
+  while ((error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT)) == 0) {
     count++;
   }
-  if (error != DB_NOTFOUND) {
+  if (error != INDEXEDLOG_NOTFOUND) {
   /* Error handling goes here */
   }
 
   // Cursors must be closed
-  if (cursorp != NULL)
-    cursorp->close(cursorp); 
+  indexedLogCursorClose(cursorp); 
 
   return count;
 }
@@ -1171,30 +1250,27 @@ unsigned long long countRecordsIndexedLog(DB* dbp){
 /*
     Returns the number of tuples in the indexed log.
 */
-unsigned long long countTuplesIndexedLog(DB* dbp){
-  DBC *cursorp;
-  DBT key, data;
+unsigned long long countTuplesIndexedLog(indexedLog* dbp){
+  indexedLogCursor *cursorp;
+  indexedLogRecord key, data;
   int error;
   unsigned long long count = 0;
 
-  /* Zero out the DBTs before using them. */
-  memset(&key, 0, sizeof(DBT));
-  memset(&data, 0, sizeof(DBT));
-
   /* Get a cursor */
-  dbp->cursor(dbp, NULL, &cursorp, 0); 
+  cursorp = indexedLogCursorOpen(dbp);
+  if (cursorp == NULL)
+    return 0;
 
     /* Iterate over the database, retrieving each record in turn. */
-  while ((error = cursorp->get(cursorp, &key, &data, DB_NEXT_NODUP)) == 0) {
+  while ((error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT_NODUP)) == 0) {
     count++;
   }
-  if (error != DB_NOTFOUND) {
+  if (error != INDEXEDLOG_NOTFOUND) {
   /* Error handling goes here */
   }
 
   // Cursors must be closed
-  if (cursorp != NULL)
-    cursorp->close(cursorp); 
+  indexedLogCursorClose(cursorp); 
 
   return count;
 }
@@ -1202,33 +1278,30 @@ unsigned long long countTuplesIndexedLog(DB* dbp){
 /*
     Prints the pair key/log record from the indexed log. 
 */
-int printIndexedLog(DB* dbp){
-  DBC *cursorp;
-  DBT key, data;
+int printIndexedLog(indexedLog* dbp){
+  indexedLogCursor *cursorp;
+  indexedLogRecord key, data;
   int error;
 
-  /* Zero out the DBTs before using them. */
-  memset(&key, 0, sizeof(DBT));
-  memset(&data, 0, sizeof(DBT));
-
   /* Get a cursor */
-  dbp->cursor(dbp, NULL, &cursorp, 0); 
+  cursorp = indexedLogCursorOpen(dbp);
+  if (cursorp == NULL)
+    return INDEXEDLOG_ERR;
 
   unsigned long long i = 1;
   printf("Indexed log:\n");
     /* Iterate over the database, retrieving each record in turn. */
-  while ((error = cursorp->get(cursorp, &key, &data, DB_NEXT)) == 0) {
+  while ((error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT)) == 0) {
     printf("%llu: Key[%s] => log[%s]\n", i, (char *)key.data,(char *)data.data);
     i++;
   }
   
-  if (error != DB_NOTFOUND) {
+  if (error != INDEXEDLOG_NOTFOUND) {
   /* Error handling goes here */
   }
 
   // Cursors must be closed
-    if (cursorp != NULL)
-    cursorp->close(cursorp); 
+  indexedLogCursorClose(cursorp); 
 
   return error;
 }
@@ -1238,15 +1311,16 @@ int printIndexedLog(DB* dbp){
   The function prints the result of the function printIndexedLog();
 */
 void printIndex(client *c) {
-    int ret;
-    DB *dbp = openIndexedLog(server.indexedlog_filename, 'R', &ret);
+    int ret, partition;
+    indexedLog **dbps = openIndexedLogPartitions(server.indexedlog_filename, 'R', &ret);
     if(ret != 0){
         shared.ir_error = createObject(OBJ_STRING,sdsnew(
         "- the indexer could not openned!\r\n"));
         addReply(c,shared.ir_error);
     }else{
-        printIndexedLog(dbp);
-        closeIndexedLog(dbp);
+        for(partition = 0; partition < server.indexedlog_partitions; partition++)
+            printIndexedLog(dbps[partition]);
+        closeIndexedLogPartitions(dbps);
         addReply(c,shared.ok);
     }
 }
@@ -1442,9 +1516,170 @@ void waitCommandsExecutedFinish(){
   }
 }
 
+/*
+    Per-thread CPU clocks of the Indexer, Restorer and Checkpointer threads. Each thread
+    registers its own clock when it starts and unregisters it when it finishes, so the
+    system monitoring can read the CPU time of the thread with a clock_gettime() call.
+*/
+typedef struct irThreadClock_ts {
+    clockid_t clock;
+    int registered;
+} irThreadClock;
+
+static irThreadClock indexer_thread_clock, restorer_thread_clock, checkpointer_thread_clock;
+
+/*
+    Registers the CPU clock of the calling thread.
+*/
+void registerThreadCpuClock(irThreadClock *tc){
+  if(pthread_getcpuclockid(pthread_self(), &tc->clock) == 0)
+    tc->registered = 1;
+}
+
+/*
+    Unregisters the CPU clock of a thread. It must be called before the thread exits.
+*/
+void unregisterThreadCpuClock(irThreadClock *tc){
+  tc->registered = 0;
+}
+
+/*
+    Returns the CPU time (in microseconds) consumed by a registered thread.
+    If the thread is not running, returns -1.
+*/
+long long getThreadCpuTime(irThreadClock *tc){
+  struct timespec ts;
+
+  if(!tc->registered || clock_gettime(tc->clock, &ts) != 0)
+    return -1;
+  return (long long)ts.tv_sec*1000000 + ts.tv_nsec/1000;
+}
+
+/*
+    A sample of the resources used by the Redis process. The values are read directly from
+    /proc/self/stat, /proc/self/status and /proc/self/io.
+        time: time of the sample (microseconds)
+        utime, stime: user and system CPU time of the process (microseconds)
+        threads: number of threads of the process
+        vm_rss, vm_hwm: resident memory and its peak (kilobytes)
+        read_bytes, write_bytes: bytes read from and written to the storage layer
+        indexer_cpu, restorer_cpu, checkpointer_cpu: CPU time of the IR threads (microseconds)
+*/
+typedef struct systemSample_ts {
+    long long time;
+    long long utime;
+    long long stime;
+    long threads;
+    unsigned long long vm_rss;
+    unsigned long long vm_hwm;
+    unsigned long long read_bytes;
+    unsigned long long write_bytes;
+    long long indexer_cpu;
+    long long restorer_cpu;
+    long long checkpointer_cpu;
+} systemSample;
+
+/*
+    Reads a /proc file previously opened into buf. The file descriptor is kept open between
+    samples and read from offset zero, so no file is opened and no process is forked by sample.
+    Returns the number of bytes read or -1 on error.
+*/
+ssize_t readProcFile(int fd, char *buf, size_t size){
+  ssize_t nread;
+
+  if(fd == -1)
+    return -1;
+  nread = pread(fd, buf, size-1, 0);
+  if(nread < 0)
+    return -1;
+  buf[nread] = '\0';
+  return nread;
+}
+
+/*
+    Returns the value of a "Field: value" line from /proc/self/status or /proc/self/io.
+    If the field does not exist, returns 0.
+*/
+unsigned long long getProcField(char *buf, char *field){
+  char *p = strstr(buf, field);
+
+  if(p == NULL)
+    return 0;
+  p += strlen(field);
+  while(*p == ':' || *p == ' ' || *p == '\t')
+    p++;
+  return strtoull(p, NULL, 10);
+}
+
+/*
+    Collects a sample of the resources used by the process.
+    stat_fd, status_fd, io_fd: descriptors of /proc/self/stat, /proc/self/status and /proc/self/io
+    Returns 1 if the sample was collected. Otherwise, returns 0.
+*/
+int collectSystemSample(int stat_fd, int status_fd, int io_fd, systemSample *s){
+  static long ticks_per_second = 0;
+  char buf[4096], *p;
+  unsigned long long utime = 0, stime = 0;
+  long threads = 0;
+
+  if(ticks_per_second == 0)
+    ticks_per_second = sysconf(_SC_CLK_TCK);
+
+  s->time = ustime();
+
+  /* The command name in /proc/self/stat can contain spaces, so the fields are parsed
+     after its closing parenthesis. The first field after it is the state (field 3). */
+  if(readProcFile(stat_fd, buf, sizeof(buf)) == -1)
+    return 0;
+  p = strrchr(buf, ')');
+  if(p == NULL)
+    return 0;
+  if(sscanf(p+2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu %*d %*d %*d %*d %ld",
+            &utime, &stime, &threads) != 3)
+    return 0;
+  s->utime = utime*1000000/ticks_per_second;
+  s->stime = stime*1000000/ticks_per_second;
+  s->threads = threads;
+
+  if(readProcFile(status_fd, buf, sizeof(buf)) != -1){
+    s->vm_rss = getProcField(buf, "VmRSS");
+    s->vm_hwm = getProcField(buf, "VmHWM");
+  }else{
+    s->vm_rss = 0;
+    s->vm_hwm = 0;
+  }
+
+  //The file /proc/self/io can be unavailable without CONFIG_TASK_IO_ACCOUNTING
+  if(readProcFile(io_fd, buf, sizeof(buf)) != -1){
+    s->read_bytes = getProcField(buf, "read_bytes");
+    s->write_bytes = getProcField(buf, "write_bytes");
+  }else{
+    s->read_bytes = 0;
+    s->write_bytes = 0;
+  }
+
+  s->indexer_cpu = getThreadCpuTime(&indexer_thread_clock);
+  s->restorer_cpu = getThreadCpuTime(&restorer_thread_clock);
+  s->checkpointer_cpu = getThreadCpuTime(&checkpointer_thread_clock);
+
+  return 1;
+}
+
+/*
+    Returns the CPU usage (in percentage) of a CPU time between two samples.
+    If the CPU time is not available in one of the samples, returns 0.
+*/
+double cpuUsage(long long previous_cpu, long long current_cpu, long long elapsed_time){
+  if(previous_cpu == -1 || current_cpu == -1 || elapsed_time <= 0 || current_cpu < previous_cpu)
+    return 0;
+  return (double)(current_cpu - previous_cpu)*100/elapsed_time;
+}
+
 /*
     Flushes to a CSV file information about the usage of CPU and memory of the system, 
-    such as: memory in megabytes, cpu in percentage, and time of the information collection.
+    such as: memory in kilobytes, cpu in percentage, and time of the information collection.
+    The information is sampled from /proc/self in time intervals defined in milliseconds by 
+    system_monitoring_time_interval_ms.
     
     Time (in seconds) of the database startup, recovery, and benchmark execution. 
     When the time is not obtained, the value is setted as -1.
@@ -1461,28 +1696,54 @@ void waitCommandsExecutedFinish(){
        "Checkpoint"       <idCheckpoint>    <obtained time>     <obtained time>
        "Checkpoint End"   <idCheckpoint>                        <obtained time>
 
-    The remaind CSV data lines are really information obtained.
-        time               cpu                memory
-        <obtained time>    <obtained value>   <obtained value>
+    The remaind CSV data lines are really information obtained. The first three fields are
+    kept in the positions used by the graphics scripts.
+        time               cpu                memory             (the other fields)
+        <obtained time>    <obtained value>   <obtained value>   <obtained values>
+    Other fields: user and system CPU (%), number of threads, peak of resident memory (KB),
+    bytes read and written by the storage layer since the last sample, CPU (%) of the
+    Indexer, Restorer and Checkpointer threads, memory used by zmalloc, and allocated, 
+    active and resident memory reported by the allocator (jemalloc), in bytes.
 */
-
 void *printSysteMonitoringToCsv_thread() {
-    FILE *arq_temp, *arq_csv;
-    char str[200], program[100], line[100], system_monitoring_tmp[50] ="system_monitoring.tmp", system_monitoring_csv_filename[50];
-    int i = 0,error = 0, system_monitoring_time_delay = server.system_monitoring_time_interval;
-    char** tokens = NULL;
-
-    strcpy(system_monitoring_csv_filename, server.system_monitoring_csv_filename);
+    FILE *arq_csv;
+    char str[600];
+    systemSample previous, current;
+    size_t allocated = 0, active = 0, resident = 0;
+    long long system_monitoring_time_delay = (long long)server.system_monitoring_time_interval_ms*1000;
+
+    int stat_fd = open("/proc/self/stat", O_RDONLY),
+        status_fd = open("/proc/self/status", O_RDONLY),
+        io_fd = open("/proc/self/io", O_RDONLY);
+
+    if(stat_fd == -1){
+        serverLog(LL_NOTICE,"Problem on openning /proc/self/stat. System monitoring collecting aborted!\n");
+        if(status_fd != -1) close(status_fd);
+        if(io_fd != -1) close(io_fd);
+        server.system_monitoring = IR_OFF;
+        return (void *)1;
+    }
 
     if(server.overwrite_system_monitoring == IR_ON)
-      arq_csv = fopen(system_monitoring_csv_filename, "w");
+      arq_csv = fopen(server.system_monitoring_csv_filename, "w");
     else
-      arq_csv = fopen(system_monitoring_csv_filename, "a");
+      arq_csv = fopen(server.system_monitoring_csv_filename, "a");
+
+    if(arq_csv == NULL){
+        serverLog(LL_NOTICE,"Problem on openning the system monitoring file. System monitoring collecting aborted!\n");
+        close(stat_fd);
+        if(status_fd != -1) close(status_fd);
+        if(io_fd != -1) close(io_fd);
+        server.system_monitoring = IR_OFF;
+        return (void *)1;
+    }
 
     serverLog(LL_NOTICE, "Generating system monitoring ... ");
 
     //Flushes the CSV header
-    fputs("time;cpu;memory\n", arq_csv);
+    fputs("time;cpu;memory;user_cpu;system_cpu;threads;memory_peak;read_bytes;write_bytes;"
+          "indexer_cpu;restorer_cpu;checkpointer_cpu;zmalloc_used;allocator_allocated;"
+          "allocator_active;allocator_resident\n", arq_csv);
 
     //Flushes the database startup time.
     if(server.database_startup_time != -1){
@@ -1490,48 +1751,40 @@ void *printSysteMonitoringToCsv_thread() {
       fputs(str, arq_csv);
     }
 
-    do{
-        i++;
-        strcpy(program, "top -b -n 1 > ");
-        strcat(program, system_monitoring_tmp);
-        error = system(program);
-
-        if (error == -1){
-            serverLog(LL_NOTICE, "Problem in collecting system monitoring. Erro in command Top. Sytem monitoring collecting aborted!\n");
-            return (void *)1;
-        }
-
-        arq_temp = fopen(system_monitoring_tmp, "rt");
-        if (arq_temp == NULL){
-            serverLog(LL_NOTICE,"Problem on openning the system monitoring file. System monitoring collecting aborted!\n");
-            return (void *)1;
-        }
-        //printf("\nPID USUARIO PR NI VIRT RES SHR S CPU MEM TEMPO+ COMANDO\n");
-
-        while (!feof(arq_temp)){
-            if (fgets(line, 100, arq_temp))
-                if(strstr(line, "redis-s") != NULL){
-                    removesSpaces(line);
-                    //printf("%s\n",trim(line));
-
-                    tokens = str_split(trim(line), ' ');
-                    //printf("CPU = %s\n",tokens[8]);
-                    //printf("MEM = %s\n",tokens[5]);
-
-                    sprintf(str, "%lld;%s;%s\n", ustime(), tokens[8], tokens[5]);
-                    fputs(str, arq_csv);
-                    fflush(arq_csv);
-                    break;
-                }
-        }
-        zfree(tokens);
-        fclose(arq_temp);
-
-        if(server.system_monitoring == IR_OFF)
-          sleep(system_monitoring_time_delay);
+    if(!collectSystemSample(stat_fd, status_fd, io_fd, &previous))
+        memset(&previous, 0, sizeof(previous));
 
+    do{
+        usleep(system_monitoring_time_delay);
+
+        if(!collectSystemSample(stat_fd, status_fd, io_fd, &current))
+            continue;
+
+        long long elapsed_time = current.time - previous.time;
+        zmalloc_get_allocator_info(&allocated, &active, &resident);
+
+        sprintf(str, "%lld;%.2f;%llu;%.2f;%.2f;%ld;%llu;%llu;%llu;%.2f;%.2f;%.2f;%zu;%zu;%zu;%zu\n", 
+                current.time, 
+                cpuUsage(previous.utime + previous.stime, current.utime + current.stime, elapsed_time),
+                current.vm_rss,
+                cpuUsage(previous.utime, current.utime, elapsed_time),
+                cpuUsage(previous.stime, current.stime, elapsed_time),
+                current.threads, current.vm_hwm,
+                current.read_bytes - previous.read_bytes,
+                current.write_bytes - previous.write_bytes,
+                cpuUsage(previous.indexer_cpu, current.indexer_cpu, elapsed_time),
+                cpuUsage(previous.restorer_cpu, current.restorer_cpu, elapsed_time),
+                cpuUsage(previous.checkpointer_cpu, current.checkpointer_cpu, elapsed_time),
+                zmalloc_used_memory(), allocated, active, resident);
+        fputs(str, arq_csv);
+        fflush(arq_csv);
+
+        previous = current;
     }while(server.system_monitoring == IR_ON);
     fclose(arq_csv);
+    close(stat_fd);
+    if(status_fd != -1) close(status_fd);
+    if(io_fd != -1) close(io_fd);
 
     serverLog(LL_NOTICE,"System monitoring collecting finished!"
                         " See the file %s.\n", server.system_monitoring_csv_filename);
@@ -1880,6 +2133,8 @@ void printRecoveryReportToFile(){
 
         fputs("    Sequential log filename = ", ptr_file);
         fputs(server.aof_filename, ptr_file);
+        fputs("\n    Indexed log engine = ", ptr_file);
+        fputs(server.indexedlog_engine->name, ptr_file);
         fputs("\n    Data structure of the indexed log = ", ptr_file);
         if(strcmp(server.indexedlog_structure, "BTREE") == 0)
             fputs("B+-tree\n", ptr_file);
@@ -1888,6 +2143,8 @@ void printRecoveryReportToFile(){
                 fputs("Hash\n", ptr_file);
         fputs("\n    Indexed log filename = ", ptr_file);
         fputs(server.indexedlog_filename, ptr_file);
+        sprintf(str, "\n    Indexed log partitions = %d", server.indexedlog_partitions);
+        fputs(str, ptr_file);
         if(server.instant_recovery_synchronous == IR_OFF)
           fputs("\n    Asynchronous indexing\n", ptr_file);
         else
@@ -1938,7 +2195,7 @@ void printRecoveryReportToFile(){
         fputs(" seconds.\n", ptr_file);
 /*
         int ret;
-        DB *dbp = openIndexedLog(server.indexedlog_filename, 'R', &ret);
+        indexedLog *dbp = openIndexedLog(server.indexedlog_filename, 'R', &ret);
         if(ret == 0){
             fputs("    Records stored in indexed log = ", ptr_file);
             sprintf(str, "%llu",countRecordsIndexedLog(dbp));
@@ -2130,54 +2387,68 @@ redisContext *openRedisClient(int *result){
     return c;
 }
 
-/* 
-    Loads ON DEMAND one database record (key/value) into memory by replaying its log records
-    from the indexed. 
-    Returns true if the searched key was restored into memory.
-    key_searched: the key of the database record.
+/*
+    Returns the value of a key after redoing an INCR log record. The value given is freed.
 */
-int loadRecordFromIndexedLog(char *key_searched) {
-    //long long command_load_start = ustime();
+static sds incrLogRecordValue(sds value){
+    long long v = strtoll(value, NULL, 10);
 
+    sdsfree(value);
+    return sdsfromlonglong(v + 1);
+}
+
+/*
+    Loads on demand one database record from the partition of the indexed log that stores
+    the key, already opened by the caller. See loadRecordFromIndexedLog() below.
+    Returns -1 if the indexed log cannot be read.
+*/
+static int loadRecordFromIndexedLogPartition(indexedLog *dbp, char *key_searched) {
+    //long long command_load_start = ustime();
+    long long fetch_start = ustime(), apply_start;
+    mstime_t latency;
     int error;
-    DB *dbp = openIndexedLog(server.indexedlog_filename, 'W', &error);
-    if(error != 0){
-      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ");
-      return 0;
-    }
 
-    DBT key, data, key_searched_dbt;
-    /* Zero out the DBTs before using them. */
-    memset(&key, 0, sizeof(DBT));
-    memset(&data, 0, sizeof(DBT));
-    memset(&key_searched_dbt, 0, sizeof(DBT));
+    indexedLogRecord data, key_searched_dbt;
 
     key_searched_dbt.data = key_searched;
     key_searched_dbt.size = strlen(key_searched) + 1;
 
-    DBC *cursorp;
     /* Get a cursor */
-    dbp->cursor(dbp, NULL, &cursorp, 0);
+    indexedLogCursor *cursorp = indexedLogCursorOpen(dbp);
+    if(cursorp == NULL){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ");
+      return -1;
+    }
 
     // Position the cursor to the first record in the database whose key and data begin with the key searched.
-    error = cursorp->get(cursorp, &key_searched_dbt, &data, DB_SET);
+    error = indexedLogCursorGet(cursorp, &key_searched_dbt, &data, INDEXEDLOG_SET);
 
     //If the key searched is not found in the indexed log, returns false.
-    if(error == DB_NOTFOUND){
+    if(error == INDEXEDLOG_NOTFOUND){
       //Adds the key in the hash of restored keys to avoid a next search on the indexed log
-      addRestoredTuple(key_searched);
-      server.count_tuples_not_in_log = server.count_tuples_not_in_log + 1;
-      closeIndexedLog(dbp);
+      //(the keys evicted by the allkeys-indexedlog policy are also restored after the recovery)
+      if(server.instant_recovery_performing == IR_ON && !isRestoredTuple(key_searched)){
+        addRestoredTuple(key_searched);
+        atomicIncr(server.count_tuples_not_in_log, 1);
+      }
+      indexedLogCursorClose(cursorp);
+      latencyHistogramAddSample(LATENCY_HIST_ONDEMAND_FETCH, ustime()-fetch_start);
       return 0;
     }
+    if(error != 0){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! %s ⚠ ⚠ ⚠ ⚠ ", indexedLogStrerror(error));
+      indexedLogCursorClose(cursorp);
+      return -1;
+    }
 
     char **array_log_record_lines;
     int countArray;
     unsigned long long count_records = 0;
+    long long expireIR = -1;    //absolute expire time of the key in milliseconds, -1 if none
     sds commandIR = sdsnew(""), valueIR = sdsnew("0"), dataSds;
 
     /* Scans the Indexed Log and generates a new log record equivalent to the all log records to redo the key searched. */
-    while(error != DB_NOTFOUND) {
+    while(error == 0) {
         count_records++;
 
         dataSds = sdsnew((char *)data.data);
@@ -2192,35 +2463,74 @@ int loadRecordFromIndexedLog(char *key_searched) {
         if(strcmp(commandIR, "SET") == 0){
             sdsfree(valueIR);
             valueIR = sdsnew((char *) array_log_record_lines[6]);
+            expireIR = -1;
         }else{
             if(strcmp(commandIR, "INCR") == 0){
-                sprintf(valueIR, "%d",atoi(valueIR) + 1);
+                valueIR = incrLogRecordValue(valueIR);
+            }else{
+                if(strcmp(commandIR, "PEXPIREAT") == 0)
+                    expireIR = strtoll(array_log_record_lines[6], NULL, 10);
+                else if(strcmp(commandIR, "PERSIST") == 0)
+                    expireIR = -1;
             }
         } 
 
         sdsfreesplitres(array_log_record_lines, countArray);
-        error = cursorp->get(cursorp, &key_searched_dbt, &data, DB_NEXT_DUP);
+        error = indexedLogCursorGet(cursorp, &key_searched_dbt, &data, INDEXEDLOG_NEXT_DUP);
+    }
+    indexedLogCursorClose(cursorp);
+    sdsfree(commandIR);
+    apply_start = ustime();
+    latencyHistogramAddSample(LATENCY_HIST_ONDEMAND_FETCH, apply_start-fetch_start);
+
+    //A key that expired while it was only in the indexed log is not restored
+    long long ttl = 0;
+    if(expireIR != -1){
+      ttl = expireIR - mstime();
+      if(ttl <= 0){
+        if(server.instant_recovery_performing == IR_ON && !isRestoredTuple(key_searched)){
+          addRestoredTuple(key_searched);
+          atomicIncr(server.count_tuples_expired, 1);
+        }
+        sdsfree(valueIR);
+        return 0;
+      }
     }
 
     // Builds an array of strings contains the log record generated to redo the tuple (key_searched).
-    array_log_record_lines = zmalloc(sizeof(char*)*7);
+    // The expire is restored as the time to live in milliseconds (SETIR key value PX ttl).
+    int count_lines = ttl > 0 ? 11 : 7;
+    array_log_record_lines = zmalloc(sizeof(char*)*count_lines);
     array_log_record_lines[0] = zmalloc(sizeof(char)*10);
-    strcpy(array_log_record_lines[0], "*3");
+    strcpy(array_log_record_lines[0], ttl > 0 ? "*5" : "*3");
     array_log_record_lines[1] = zmalloc(sizeof(char)*10);
     strcpy(array_log_record_lines[1], "$5");
     array_log_record_lines[2] = zmalloc(sizeof(char)*10);
     strcpy(array_log_record_lines[2], "SETIR");
-    char strAux[120];
-    sprintf(strAux, "$%ld",sdslen(key_searched));
+    char strAux[120], *key;
+    //The key of the indexed log is qualified by the database of the key
+    int dbid = parseIndexedLogKey(key_searched, &key);
+    sprintf(strAux, "$%ld",strlen(key));
     array_log_record_lines[3] = zmalloc(sizeof(char)*110);
     strcpy(array_log_record_lines[3], strAux);
-    array_log_record_lines[4] = zmalloc(sizeof(char)*(sdslen(key_searched)+5));
-    strcpy(array_log_record_lines[4], key_searched);
+    array_log_record_lines[4] = zmalloc(sizeof(char)*(strlen(key)+5));
+    strcpy(array_log_record_lines[4], key);
     sprintf(strAux, "$%ld", sdslen(valueIR));
     array_log_record_lines[5] = zmalloc(sizeof(char)*110);
     strcpy(array_log_record_lines[5], strAux);
     array_log_record_lines[6] = zmalloc(sizeof(char)*(sdslen(valueIR)+5));
     strcpy(array_log_record_lines[6], valueIR);
+    sdsfree(valueIR);
+    if(ttl > 0){
+      array_log_record_lines[7] = zmalloc(sizeof(char)*10);
+      strcpy(array_log_record_lines[7], "$2");
+      array_log_record_lines[8] = zmalloc(sizeof(char)*10);
+      strcpy(array_log_record_lines[8], "PX");
+      array_log_record_lines[9] = zmalloc(sizeof(char)*110);
+      array_log_record_lines[10] = zmalloc(sizeof(char)*LONG_STR_SIZE);
+      ll2string(array_log_record_lines[10], LONG_STR_SIZE, ttl);
+      sprintf(array_log_record_lines[9], "$%ld", strlen(array_log_record_lines[10]));
+    }
 
     int argc, j, j_aux;
     unsigned long len;
@@ -2230,6 +2540,14 @@ int loadRecordFromIndexedLog(char *key_searched) {
     struct redisCommand *cmd;
     struct client *fakeClient;
     fakeClient = createFakeClient();
+    if(selectDb(fakeClient, dbid) == C_ERR){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! Invalid database %d. ⚠ ⚠ ⚠ ⚠ ", dbid);
+      for (j = 0; j < count_lines; j++)
+        zfree(array_log_record_lines[j]);
+      zfree(array_log_record_lines);
+      freeFakeClient(fakeClient);
+      return -1;
+    }
 
     strcpy(buf, array_log_record_lines[0]);
 
@@ -2252,7 +2570,7 @@ int loadRecordFromIndexedLog(char *key_searched) {
         j_aux+=2;
     }
 
-    for (j = 0; j <= 6; j++)
+    for (j = 0; j < count_lines; j++)
         zfree(array_log_record_lines[j]);
     zfree(array_log_record_lines);
 
@@ -2287,15 +2605,21 @@ int loadRecordFromIndexedLog(char *key_searched) {
      * argv/argc of the client instead of the local variables. */
     freeFakeClientArgv(fakeClient);
     fakeClient->cmd = NULL;
+    latencyHistogramAddSample(LATENCY_HIST_ONDEMAND_APPLY, ustime()-apply_start);
+
+    //The whole on-demand restore is also reported to the latency monitor (LATENCY LATEST/DOCTOR)
+    latency = (ustime()-fetch_start)/1000;
+    latencyAddSampleIfNeeded("ondemand-restore", latency);
 
-    server.count_tuples_loaded_ondemand = server.count_tuples_loaded_ondemand + 1;
     //Adds the key in the hash of restored keys to avoid a next search on indexed log
-    addRestoredTuple(key_searched);
+    if(server.instant_recovery_performing == IR_ON && !isRestoredTuple(key_searched)){
+      atomicIncr(server.count_tuples_loaded_ondemand, 1);
+      addRestoredTuple(key_searched);
+    }
     /*if(server.generate_setir_executed_commands_csv == IR_ON) 
         addCommandExecuted(&last_cmd_executed_List, key_searched, "setIR", command_load_start, ustime(), 'D');*/
 
     freeFakeClient(fakeClient);
-    closeIndexedLog(dbp);
 
     return 1;
 
@@ -2309,6 +2633,254 @@ fmterr: /* Format error. */
 }
 
 
+/* 
+    Loads ON DEMAND one database record (key/value) into memory by replaying its log records
+    from the indexed. 
+    Returns true if the searched key was restored into memory, 0 if it is not in the indexed
+    log (or expired) and -1 if the indexed log cannot be read.
+    key_searched: the key of the database record in the indexed log (see getIndexedLogKey()).
+*/
+int loadRecordFromIndexedLog(char *key_searched) {
+    int error, restored;
+    //Only the partition that stores the key is openned
+    indexedLog *dbp = openIndexedLogPartition(server.indexedlog_filename, getIndexedLogPartition(key_searched), 'W', &error);
+    if(error != 0){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ");
+      return -1;
+    }
+
+    restored = loadRecordFromIndexedLogPartition(dbp, key_searched);
+    closeIndexedLog(dbp);
+    return restored;
+}
+
+/*
+    A key to restore before the execution of a transaction or script, and the partition
+    of the indexed log that stores it.
+*/
+typedef struct keyToRestore {
+    sds key;                  //key in the indexed log (see getIndexedLogKey())
+    int dbid;
+    int partition;
+} keyToRestore;
+
+static int compareKeysToRestore(const void *a, const void *b){
+    const keyToRestore *ka = a, *kb = b;
+
+    if(ka->partition != kb->partition)
+      return ka->partition - kb->partition;
+    return sdscmp(ka->key, kb->key);
+}
+
+/*
+    Returns true if a key must be restored from the indexed log before it is accessed: 
+    the database is recovering and the key was not restored yet, or the key was evicted
+    to the indexed log (maxmemory-policy allkeys-indexedlog).
+*/
+static int isKeyToRestore(int dbid, sds key){
+    if(server.instant_recovery_state == IR_ON && server.instant_recovery_performing == IR_ON &&
+       !isRestoredTuple(key))
+      return 1;
+    return dbid == 0 && server.tiering_evicted_keys != NULL &&
+           dictFind(server.tiering_evicted_keys, key) != NULL;
+}
+
+/*
+    Adds to the array the keys of a command executed in a database that must be restored.
+*/
+static void addKeysToRestore(int dbid, struct redisCommand *cmd, robj **argv, int argc,
+  keyToRestore **keys, int *count){
+    int *keyindex, numkeys, j;
+
+    keyindex = getKeysFromCommand(cmd, argv, argc, &numkeys);
+    for(j = 0; j < numkeys; j++){
+      robj *keyobj = getDecodedObject(argv[keyindex[j]]);
+      sds ikey = getIndexedLogKey(dbid, keyobj->ptr);
+      if(isKeyToRestore(dbid, ikey)){
+        *keys = zrealloc(*keys, sizeof(keyToRestore)*(*count+1));
+        (*keys)[*count].key = ikey;
+        (*keys)[*count].dbid = dbid;
+        (*keys)[*count].partition = getIndexedLogPartition(ikey);
+        (*count)++;
+      }else{
+        sdsfree(ikey);
+      }
+      decrRefCount(keyobj);
+    }
+    getKeysFreeResult(keyindex);
+}
+
+/*
+    Restores all the keys declared by a transaction (EXEC), a script (EVAL/EVALSHA), a 
+    WATCH or a MIGRATE that are not in memory yet, before the command is executed. The commands of a 
+    transaction or script are executed by nested calls that would restore their keys one 
+    by one, so the keys are fetched at once, ordered by partition and key, opening each 
+    partition of the indexed log only once. The keys are restored before WATCH, so their 
+    restore cannot abort the transaction.
+*/
+void restoreKeysBeforeExecution(client *c){
+    keyToRestore *keys = NULL;
+    int count = 0, partition = -1, error, j;
+    indexedLog *dbp = NULL;
+    long long start = ustime();
+    mstime_t latency;
+
+    if(c->cmd->proc == execCommand){
+      //A SELECT in the transaction changes the database of the next commands
+      int dbid = c->db->id;
+      long long id;
+      for(j = 0; j < c->mstate.count; j++){
+        multiCmd *mc = c->mstate.commands+j;
+        if(mc->cmd->proc == selectCommand){
+          if(getLongLongFromObject(mc->argv[1], &id) == C_OK && id >= 0 && id < server.dbnum)
+            dbid = id;
+          continue;
+        }
+        addKeysToRestore(dbid, mc->cmd, mc->argv, mc->argc, &keys, &count);
+      }
+    }else{
+      addKeysToRestore(c->db->id, c->cmd, c->argv, c->argc, &keys, &count);
+    }
+    if(count == 0)
+      return;
+
+    qsort(keys, count, sizeof(keyToRestore), compareKeysToRestore);
+    for(j = 0; j < count; j++){
+      //Keys declared more than once are restored only once
+      if(j > 0 && keys[j].partition == keys[j-1].partition && sdscmp(keys[j].key, keys[j-1].key) == 0)
+        continue;
+      if(keys[j].partition != partition){
+        if(dbp != NULL)
+          closeIndexedLog(dbp);
+        partition = keys[j].partition;
+        dbp = openIndexedLogPartition(server.indexedlog_filename, partition, 'W', &error);
+        if(error != 0){
+          serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on loading data on-demand! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ");
+          dbp = NULL;
+        }
+      }
+      if(dbp == NULL)
+        continue;
+      //An evicted key stays evicted if it cannot be read from the indexed log
+      if(loadRecordFromIndexedLogPartition(dbp, keys[j].key) != -1 && keys[j].dbid == 0 &&
+         server.tiering_evicted_keys != NULL && dictDelete(server.tiering_evicted_keys, keys[j].key) == DICT_OK)
+        server.stat_tiering_restores++;
+    }
+    if(dbp != NULL)
+      closeIndexedLog(dbp);
+
+    for(j = 0; j < count; j++)
+      sdsfree(keys[j].key);
+    zfree(keys);
+
+    latency = (ustime()-start)/1000;
+    latencyAddSampleIfNeeded("ondemand-batch-restore", latency);
+}
+
+// ==================================================================================
+// Slot-level restore. The incremental restore marks the hash slots of each partition of
+// the indexed log as restored when the partition is finished. Cluster commands that move
+// or list the keys of a slot restore the whole slot before they are executed, so a slot
+// can be migrated before the end of the recovery.
+
+static unsigned char recovery_slots_restored[CLUSTER_SLOTS];
+
+/*
+    Marks the hash slots stored in a partition of the indexed log as restored.
+*/
+static void setPartitionSlotsRestored(int partition){
+    int slot;
+
+    for(slot = 0; slot < CLUSTER_SLOTS; slot++)
+      if(getIndexedLogSlotPartition(slot) == partition)
+        recovery_slots_restored[slot] = 1;
+}
+
+/*
+    Returns true if all the keys of a hash slot are in memory, i.e., the database is not
+    recovering or the slot was already restored.
+*/
+int isSlotRestored(int slot){
+    if(server.instant_recovery_state != IR_ON || server.instant_recovery_performing != IR_ON)
+      return 1;
+    return recovery_slots_restored[slot];
+}
+
+/*
+    Returns the number of hash slots whose keys are all in memory.
+*/
+int countSlotsRestored(void){
+    int slot, count = 0;
+
+    for(slot = 0; slot < CLUSTER_SLOTS; slot++)
+      count += isSlotRestored(slot);
+    return count;
+}
+
+/*
+    Restores now all the keys of a hash slot that are not in memory. The partition of the 
+    slot is scanned once and all its keys not in memory are restored as on demand, so all
+    the slots of the partition are restored together: the next slots of the partition (e.g.
+    GETKEYSINSLOT over all the slots of a node) don't scan the partition again.
+*/
+void restoreSlotFromIndexedLog(int slot){
+    indexedLog *dbp;
+    indexedLogCursor *cursorp;
+    indexedLogRecord key, data;
+    list *keys;
+    listIter li;
+    listNode *ln;
+    int error, partition = getIndexedLogSlotPartition(slot);
+    long long start = ustime();
+    mstime_t latency;
+
+    if(isSlotRestored(slot))
+      return;
+
+    dbp = openIndexedLogPartition(server.indexedlog_filename, partition, 'W', &error);
+    if(error != 0){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on restoring the hash slot %d! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ", slot);
+      return;
+    }
+    cursorp = indexedLogCursorOpen(dbp);
+    if(cursorp == NULL){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on restoring the hash slot %d! Error on indexed log connecting! ⚠ ⚠ ⚠ ⚠ ", slot);
+      closeIndexedLog(dbp);
+      return;
+    }
+
+    //The keys are collected before they are restored, which opens other cursors
+    keys = listCreate();
+    listSetFreeMethod(keys, (void (*)(void*)) sdsfree);
+    memset(&key, 0, sizeof(indexedLogRecord));
+    memset(&data, 0, sizeof(indexedLogRecord));
+    error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT);
+    while(error == 0){
+      if(!isRestoredTuple((char *)key.data))
+        listAddNodeTail(keys, sdsnew((char *)key.data));
+      error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT_NODUP);
+    }
+    indexedLogCursorClose(cursorp);
+    if(error != INDEXEDLOG_NOTFOUND){
+      serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error on restoring the hash slot %d! %s ⚠ ⚠ ⚠ ⚠ ", slot, indexedLogStrerror(error));
+      listRelease(keys);
+      closeIndexedLog(dbp);
+      return;
+    }
+
+    listRewind(keys, &li);
+    while((ln = listNext(&li)) != NULL)
+      loadRecordFromIndexedLogPartition(dbp, listNodeValue(ln));
+    closeIndexedLog(dbp);
+    setPartitionSlotsRestored(partition);
+
+    serverLog(LL_VERBOSE, "Hash slot %d restored from the indexed log with the partition %d: %lu keys.", 
+              slot, partition, listLength(keys));
+    listRelease(keys);
+    latency = (ustime()-start)/1000;
+    latencyAddSampleIfNeeded("slot-restore", latency);
+}
+
 //Display information about the database recovery in time intevals
 void displayRestorerInformation(long long *restoring_start_time, unsigned long long records_processed, char tag1[50], char tag2[50]){
   if(server.display_restorer_information == IR_ON){
@@ -2337,20 +2909,1567 @@ void displayRestorerInformation(long long *restoring_start_time, unsigned long l
   }
 }
 
+// ==================================================================================
+// Tiered storage on the indexed log (maxmemory-policy allkeys-indexedlog). When the
+// memory is full, keys whose last image is already in the indexed log are evicted only
+// from memory (the sequential log is not changed), and they are restored on demand,
+// as in the instant recovery, by the next command that accesses them.
+
+#define IR_TIERING_PINNED ULLONG_MAX    /* A key the indexed log cannot redo */
+
+/*
+    Keys written by commands appended to the sequential log that are not known to be 
+    in the indexed log yet. The value is the end offset of the last write of the key in
+    the sequential log, or IR_TIERING_PINNED if the last image of the key is not stored
+    in the indexed log (e.g. APPEND, or SET with a value larger than the indexer buffers).
+    The writes are kept in order in a list to forget the keys as the indexer advances.
+*/
+static dict *tiering_pending_keys = NULL;
+static list *tiering_pending_writes = NULL;
+/* All the writes since the startup were tracked, so a key that is not pending is in the
+   indexed log. Otherwise, the image of the key is checked in the indexed log before it
+   is evicted. */
+static int tiering_tracked_all = 1;
+
+typedef struct tieringWrite {
+  sds key;
+  unsigned long long offset;
+} tieringWrite;
+
+static void freeTieringWrite(void *ptr){
+  tieringWrite *w = ptr;
+  sdsfree(w->key);
+  zfree(w);
+}
+
+static void initTiering(){
+  if(tiering_pending_keys != NULL)
+    return;
+  tiering_pending_keys = dictCreate(&setDictType, NULL);
+  tiering_pending_writes = listCreate();
+  listSetFreeMethod(tiering_pending_writes, freeTieringWrite);
+  server.tiering_evicted_keys = dictCreate(&setDictType, NULL);
+}
+
+static void clearPendingKeys(){
+  dictEmpty(tiering_pending_keys, NULL);
+  while(listLength(tiering_pending_writes))
+    listDelNode(tiering_pending_writes, listFirst(tiering_pending_writes));
+}
+
+/*
+    Returns the offset of the sequential log up to which all the log records are 
+    flushed to the indexed log.
+*/
+static unsigned long long getIndexedLogDurableOffset(){
+  unsigned long long seek_log_file;
+
+  //The synchronous indexing writes the indexed log when the sequential log is written
+  if(server.instant_recovery_synchronous == IR_ON)
+    return server.aof_current_size;
+  atomicGet(server.seek_log_file, seek_log_file);
+  return seek_log_file;
+}
+
+/*
+    Tracks the keys written by a command appended to the sequential log. It is called
+    by feedAppendOnlyFile() after the command is added to the AOF buffer.
+*/
+void trackIndexedLogWrite(struct redisCommand *cmd, int dictid, robj **argv, int argc){
+  int *keys, numkeys, j;
+  unsigned long long offset;
+
+  initTiering();
+  //FLUSHALL and FLUSHDB also remove the evicted keys
+  if(cmd->proc == flushallCommand || (cmd->proc == flushdbCommand && dictid == 0)){
+    dictEmpty(server.tiering_evicted_keys, NULL);
+    clearPendingKeys();
+    return;
+  }
+
+  if(server.maxmemory_policy != MAXMEMORY_ALLKEYS_INDEXEDLOG){
+    //This write is not tracked, so the images of the keys in memory must be checked
+    if(tiering_tracked_all || dictSize(tiering_pending_keys)){
+      tiering_tracked_all = 0;
+      clearPendingKeys();
+    }
+    return;
+  }
+
+  //Only the database 0 is stored in the indexed log
+  if(dictid != 0)
+    return;
+
+  //The batch in flight in the AOF writer thread is not in aof_current_size yet
+  offset = server.aof_current_size + aofWriterPendingLength() + sdslen(server.aof_buf);
+  keys = getKeysFromCommand(cmd, argv, argc, &numkeys);
+  for(j = 0; j < numkeys; j++){
+    robj *keyobj = getDecodedObject(argv[keys[j]]);
+    sds key = keyobj->ptr;
+    dictEntry *de;
+
+    if(cmd->proc == delCommand || cmd->proc == unlinkCommand){
+      dictDelete(tiering_pending_keys, key);
+    }else{
+      de = dictFind(tiering_pending_keys, key);
+      if(de == NULL)
+        de = dictAddRaw(tiering_pending_keys, sdsdup(key), NULL);
+      //The indexer stores the image of the key only for SET without expire (see recordToIndex)
+      if(cmd->proc == setCommand && argc == 3 && sdslen(key) < IR_RECORD_FIELD_LEN && 
+         stringObjectLen(argv[2]) < IR_RECORD_FIELD_LEN){
+        tieringWrite *w = zmalloc(sizeof(tieringWrite));
+        w->key = sdsdup(key);
+        w->offset = offset;
+        listAddNodeTail(tiering_pending_writes, w);
+        dictSetUnsignedIntegerVal(de, offset);
+      }else{
+        dictSetUnsignedIntegerVal(de, IR_TIERING_PINNED);
+      }
+    }
+    decrRefCount(keyobj);
+  }
+  getKeysFreeResult(keys);
+  forgetIndexedLogWrites();
+}
+
+/*
+    Forgets the pending keys whose last write is already in the indexed log.
+*/
+void forgetIndexedLogWrites(void){
+  unsigned long long durable_offset = getIndexedLogDurableOffset();
+  listNode *ln;
+
+  initTiering();
+  while((ln = listFirst(tiering_pending_writes)) != NULL){
+    tieringWrite *w = listNodeValue(ln);
+    if(w->offset > durable_offset)
+      break;
+    dictEntry *de = dictFind(tiering_pending_keys, w->key);
+    if(de != NULL && dictGetUnsignedIntegerVal(de) == w->offset)
+      dictDelete(tiering_pending_keys, w->key);
+    listDelNode(tiering_pending_writes, ln);
+  }
+}
+
+/*
+    Returns true if a key can be evicted by the allkeys-indexedlog policy: a string 
+    without expire of the database 0 that has no write waiting for the indexer.
+*/
+int isIndexedLogEvictable(int dbid, sds key, robj *o){
+  if(server.instant_recovery_state != IR_ON || server.aof_state != AOF_ON)
+    return 0;
+  if(dbid != 0 || o->type != OBJ_STRING || dictFind(server.db[0].expires, key) != NULL)
+    return 0;
+  initTiering();
+  return dictFind(tiering_pending_keys, key) == NULL;
+}
+
+/*
+    Returns true if the last log record of the key in the indexed log redoes the value 
+    in memory.
+*/
+static int isIndexedLogImage(sds key, robj *o){
+  int error, count = 0, equals = 0;
+  indexedLog *dbp = openIndexedLogPartition(server.indexedlog_filename, getIndexedLogPartition(key), 'W', &error);
+  if(error != 0)
+    return 0;
+
+  char *record = getRecordIndexedLog(dbp, key);
+  closeIndexedLog(dbp);
+  if(record == NULL)
+    return 0;
+
+  //The record is "*3\n$3\nSET\n$<len>\n<key>\n$<len>\n<value>"
+  sds *lines = sdssplitlen(record, strlen(record), "\n", 1, &count);
+  if(count == 7 && strcasecmp(lines[2], "SET") == 0){
+    robj *value = getDecodedObject(o);
+    equals = sdscmp(lines[6], value->ptr) == 0;
+    decrRefCount(value);
+  }
+  sdsfreesplitres(lines, count);
+  zfree(record);
+  return equals;
+}
+
+/*
+    Evicts a key from memory to the indexed log. The caller deletes the key from the 
+    database without propagating the deletion. Returns false if the key is not in the 
+    indexed log: it is pinned in memory until it is written again.
+    Called with the key still in the database.
+*/
+int evictKeyToIndexedLog(redisDb *db, sds key){
+  initTiering();
+  if(!tiering_tracked_all){
+    dictEntry *de = dictFind(db->dict, key);
+    if(de == NULL || !isIndexedLogImage(key, dictGetVal(de))){
+      if(dictFind(tiering_pending_keys, key) == NULL){
+        de = dictAddRaw(tiering_pending_keys, sdsdup(key), NULL);
+        dictSetUnsignedIntegerVal(de, IR_TIERING_PINNED);
+      }
+      return 0;
+    }
+  }
+  dictAdd(server.tiering_evicted_keys, sdsdup(key), NULL);
+  server.stat_tiering_evictions++;
+  return 1;
+}
+
+/*
+    Restores from the indexed log the evicted keys accessed by a command, before the
+    command is executed.
+*/
+void restoreEvictedKeys(client *c){
+  int *keys, numkeys, j;
+
+  if(server.tiering_evicted_keys == NULL || dictSize(server.tiering_evicted_keys) == 0 || c->db->id != 0)
+    return;
+
+  keys = getKeysFromCommand(c->cmd, c->argv, c->argc, &numkeys);
+  for(j = 0; j < numkeys; j++){
+    robj *keyobj = getDecodedObject(c->argv[keys[j]]);
+    if(dictFind(server.tiering_evicted_keys, keyobj->ptr) != NULL){
+      //A plain SET overwrites the key, so the image is not read from the indexed log
+      if(c->cmd->proc == setCommand && c->argc == 3){
+        dictDelete(server.tiering_evicted_keys, keyobj->ptr);
+      }else if(loadRecordFromIndexedLog(keyobj->ptr) != -1){
+        //The key is forgotten only once it is restored (or known not to exist anymore)
+        dictDelete(server.tiering_evicted_keys, keyobj->ptr);
+        server.stat_tiering_restores++;
+      }
+    }
+    decrRefCount(keyobj);
+  }
+  getKeysFreeResult(keys);
+}
+
+/*
+    Restores into memory all the keys evicted to the indexed log. Called before the dataset
+    is dumped by a fork (BGSAVE, AOF rewrite, full resynchronization of replicas) or by 
+    SAVE, since the dump only iterates the keys in memory. The keys are restored ordered by
+    partition, opening each partition only once, and the eviction policy evicts them again
+    once the next commands are executed.
+    Returns C_ERR if a key cannot be restored: the dump would lose it.
+*/
+int restoreAllEvictedKeys(void){
+  keyToRestore *keys;
+  dictIterator *di;
+  dictEntry *de;
+  unsigned long count = 0, j;
+  int partition = -1, error, status = C_OK;
+  indexedLog *dbp = NULL;
+  long long start = ustime();
+
+  if(server.tiering_evicted_keys == NULL || dictSize(server.tiering_evicted_keys) == 0)
+    return C_OK;
+
+  keys = zmalloc(sizeof(keyToRestore)*dictSize(server.tiering_evicted_keys));
+  di = dictGetIterator(server.tiering_evicted_keys);
+  while((de = dictNext(di)) != NULL){
+    keys[count].key = sdsdup(dictGetKey(de));
+    keys[count].dbid = 0;
+    keys[count].partition = getIndexedLogPartition(keys[count].key);
+    count++;
+  }
+  dictReleaseIterator(di);
+
+  qsort(keys, count, sizeof(keyToRestore), compareKeysToRestore);
+  for(j = 0; j < count && status == C_OK; j++){
+    if(keys[j].partition != partition){
+      if(dbp != NULL)
+        closeIndexedLog(dbp);
+      partition = keys[j].partition;
+      dbp = openIndexedLogPartition(server.indexedlog_filename, partition, 'W', &error);
+      if(error != 0){
+        dbp = NULL;
+        status = C_ERR;
+        break;
+      }
+    }
+    if(loadRecordFromIndexedLogPartition(dbp, keys[j].key) == -1){
+      status = C_ERR;
+      break;
+    }
+    dictDelete(server.tiering_evicted_keys, keys[j].key);
+    server.stat_tiering_restores++;
+  }
+  if(dbp != NULL)
+    closeIndexedLog(dbp);
+
+  for(j = 0; j < count; j++)
+    sdsfree(keys[j].key);
+  zfree(keys);
+
+  if(status == C_ERR)
+    serverLog(LL_WARNING, "Can't dump the dataset: the keys evicted to the indexed log cannot be restored.");
+  else
+    serverLog(LL_NOTICE, "%lu keys evicted to the indexed log restored before the dump in %.3f seconds.",
+              count, (float)(ustime()-start)/1000000);
+  return status;
+}
+
+// ==================================================================================
+// Full resynchronization of replicas from the indexed log (replica_sync_from_indexedlog).
+// Instead of forking a BGSAVE, a thread writes the RDB file sent to the replicas from a
+// scan of the indexed log plus the log records of the sequential log not indexed yet,
+// i.e., the images of the keys the instant recovery would restore. The Indexer stops at
+// the end of the sequential log at the start of the snapshot, so the RDB matches the
+// replication offset of the full resynchronization.
+
+/*
+    Log record of the sequential log that was not indexed when the snapshot started.
+*/
+typedef struct snapshotLogRecord {
+  sds command;
+  sds value;
+} snapshotLogRecord;
+
+static pthread_t indexedlog_snapshot_thread;
+static int indexedlog_snapshot_in_progress = 0;
+static int indexedlog_snapshot_done = 0;        //set by the snapshot thread when it ends
+static int indexedlog_snapshot_status = C_ERR;
+static long long indexedlog_snapshot_start_time;
+static char indexedlog_snapshot_tmpfile[256];
+static rdbSaveInfo indexedlog_snapshot_rsi;
+static char indexedlog_snapshot_replid[CONFIG_RUN_ID_SIZE+1];
+static long long indexedlog_snapshot_repl_offset;
+
+static void freeSnapshotLogRecord(void *ptr){
+  snapshotLogRecord *r = ptr;
+  sdsfree(r->command);
+  sdsfree(r->value);
+  zfree(r);
+}
+
+static void snapshotLogRecordsDestructor(void *privdata, void *val){
+  UNUSED(privdata);
+  listRelease((list *)val);
+}
+
+/* Keys of the indexed log (sds) -> list of snapshotLogRecord. */
+static dictType snapshotLogRecordsDictType = {
+    dictSdsHash,                    /* hash function */
+    NULL,                           /* key dup */
+    NULL,                           /* val dup */
+    dictSdsKeyCompare,              /* key compare */
+    dictSdsDestructor,              /* key destructor */
+    snapshotLogRecordsDestructor    /* val destructor */
+};
+
+/*
+    Applies a log record to the image of a key, as the Restorer redoes it.
+*/
+void applySnapshotLogRecord(snapshotTuple *t, char *command, char *value){
+  if(!strcasecmp(command, "SET") || !strcasecmp(command, "SETCHECKPOINT")){
+    sdsfree(t->value);
+    t->value = sdsnew(value);
+    t->exists = 1;
+    t->expire = -1;
+  }else if(!strcasecmp(command, "INCR")){
+    if(!t->exists){
+      sdsfree(t->value);
+      t->value = sdsnew("0");
+      t->exists = 1;
+    }
+    t->value = incrLogRecordValue(t->value);
+  }else if(!strcasecmp(command, "PEXPIREAT")){
+    t->expire = strtoll(value, NULL, 10);
+  }else if(!strcasecmp(command, "PERSIST")){
+    t->expire = -1;
+  }else if(!strcasecmp(command, "DEL")){
+    t->exists = 0;
+    t->expire = -1;
+  }
+}
+
+/*
+    Reads the log records of the sequential log from 'seek' to 'end' (not indexed yet) and
+    keeps the ones the Indexer indexes in the 'records' dictionary, by key of the indexed log.
+    dbid is the database selected in the sequential log at 'seek'.
+    Returns C_OK or C_ERR on a read or format error.
+*/
+static int readSnapshotLogRecords(dict *records, unsigned long long seek, int dbid, 
+ unsigned long long end){
+  FILE *fp = fopen(server.aof_filename, "r");
+  sds command = sdsempty(), key = sdsempty(), value = sdsempty(), argsds;
+  char buf[128];
+  int argc, j, result = C_ERR;
+  unsigned long len;
+
+  if(fp == NULL || fseek(fp, seek, SEEK_SET) == -1)
+    goto end;
+
+  while(seek < end){
+    if(fgets(buf, sizeof(buf), fp) == NULL || buf[0] != '*')
+      goto end;
+    seek = seek + strlen(buf);
+    argc = atoi(buf+1);
+    if(argc < 1)
+      goto end;
+
+    sdsclear(key);
+    sdsclear(value);
+    for(j = 0; j < argc; j++){
+      if(fgets(buf, sizeof(buf), fp) == NULL || buf[0] != '$')
+        goto end;
+      seek = seek + strlen(buf);
+      len = strtol(buf+1, NULL, 10);
+      argsds = sdsnewlen(SDS_NOINIT, len);
+      if((len && fread(argsds, len, 1, fp) == 0) || fread(buf, 2, 1, fp) == 0){
+        sdsfree(argsds);
+        goto end;
+      }
+      seek = seek + len + 2;
+
+      if(j == 0){//Get the command
+        command = sdscpylen(command, argsds, len);
+        sdstoupper(command);
+      }
+      if(j == 1)//Get the key
+        key = sdscpylen(key, argsds, len);
+      if(j == 2)//Get the value
+        value = sdscpylen(value, argsds, len);
+      sdsfree(argsds);
+    }
+
+    //SELECT changes the database of the next log records
+    if(!strcmp(command, "SELECT")){
+      dbid = atoi(key);
+    }else if(!strcmp(command, "SET") || !strcmp(command, "SETCHECKPOINT") || !strcmp(command, "INCR") ||
+             !strcmp(command, "DEL") || !strcmp(command, "PEXPIREAT") || !strcmp(command, "PERSIST")){
+      sds ikey = getIndexedLogKey(dbid, key);
+      dictEntry *de = dictFind(records, ikey);
+      snapshotLogRecord *r = zmalloc(sizeof(snapshotLogRecord));
+
+      if(de == NULL){
+        list *l = listCreate();
+        listSetFreeMethod(l, freeSnapshotLogRecord);
+        de = dictAddRaw(records, ikey, NULL);
+        dictSetVal(records, de, l);
+      }else{
+        sdsfree(ikey);
+      }
+      r->command = sdsdup(command);
+      r->value = sdsdup(value);
+      listAddNodeTail(dictGetVal(de), r);
+    }
+  }
+  result = C_OK;
+
+end:
+  if(fp != NULL)
+    fclose(fp);
+  sdsfree(command);
+  sdsfree(key);
+  sdsfree(value);
+  return result;
+}
+
+/*
+    Writes the image of a key to the RDB. The RDB selects the database of the key only 
+    when it changes: rdb_dbid is the database selected in the RDB.
+    Returns C_OK or C_ERR on a write error.
+*/
+static int writeSnapshotTupleRdb(rio *rdb, int *rdb_dbid, int dbid, char *key, snapshotTuple *t){
+  if(dbid != *rdb_dbid){
+    if(rdbSaveType(rdb, RDB_OPCODE_SELECTDB) == -1) return C_ERR;
+    if(rdbSaveLen(rdb, dbid) == -1) return C_ERR;
+    *rdb_dbid = dbid;
+  }
+  if(t->expire != -1){
+    if(rdbSaveType(rdb, RDB_OPCODE_EXPIRETIME_MS) == -1) return C_ERR;
+    if(rdbSaveMillisecondTime(rdb, t->expire) == -1) return C_ERR;
+  }
+  if(rdbSaveType(rdb, RDB_TYPE_STRING) == -1) return C_ERR;
+  if(rdbSaveRawString(rdb, (unsigned char *)key, strlen(key)) == -1) return C_ERR;
+  if(rdbSaveRawString(rdb, (unsigned char *)t->value, sdslen(t->value)) == -1) return C_ERR;
+  return C_OK;
+}
+
+/*
+    Writes the image of a key as AOF commands: SET, and PEXPIREAT if the key has an expire.
+    aof_dbid is the database selected in the AOF.
+    Returns C_OK or C_ERR on a write error.
+*/
+static int writeSnapshotTupleAof(rio *aof, int *aof_dbid, int dbid, char *key, snapshotTuple *t){
+  if(dbid != *aof_dbid){
+    if(rioWriteBulkCount(aof, '*', 2) == 0) return C_ERR;
+    if(rioWriteBulkString(aof, "SELECT", 6) == 0) return C_ERR;
+    if(rioWriteBulkLongLong(aof, dbid) == 0) return C_ERR;
+    *aof_dbid = dbid;
+  }
+  if(rioWriteBulkCount(aof, '*', 3) == 0) return C_ERR;
+  if(rioWriteBulkString(aof, "SET", 3) == 0) return C_ERR;
+  if(rioWriteBulkString(aof, key, strlen(key)) == 0) return C_ERR;
+  if(rioWriteBulkString(aof, t->value, sdslen(t->value)) == 0) return C_ERR;
+  if(t->expire != -1){
+    if(rioWriteBulkCount(aof, '*', 3) == 0) return C_ERR;
+    if(rioWriteBulkString(aof, "PEXPIREAT", 9) == 0) return C_ERR;
+    if(rioWriteBulkString(aof, key, strlen(key)) == 0) return C_ERR;
+    if(rioWriteBulkLongLong(aof, t->expire) == 0) return C_ERR;
+  }
+  return C_OK;
+}
+
+/*
+    Applies the log records not indexed yet to the image of a key of the indexed log and
+    writes the key to the RDB (or as AOF commands if 'aof' is true) if it exists and did 
+    not expire. The log records applied are removed from 'records'. rdb_dbid is the 
+    database selected in the RDB.
+    Returns the number of keys written (0 or 1) or -1 on a write error.
+*/
+static int writeSnapshotTuple(rio *rdb, int *rdb_dbid, dict *records, char *ikey, snapshotTuple *t,
+ int aof){
+  dictEntry *de = dictFind(records, ikey);
+  listIter li;
+  listNode *ln;
+  char *key;
+  int dbid;
+
+  if(de != NULL){
+    listRewind(dictGetVal(de), &li);
+    while((ln = listNext(&li)) != NULL){
+      snapshotLogRecord *r = listNodeValue(ln);
+      applySnapshotLogRecord(t, r->command, r->value);
+    }
+  }
+
+  if(!t->exists || (t->expire != -1 && t->expire <= mstime())){
+    if(de != NULL)
+      dictDelete(records, ikey);
+    return 0;
+  }
+
+  dbid = parseIndexedLogKey(ikey, &key);
+  if((aof ? writeSnapshotTupleAof(rdb, rdb_dbid, dbid, key, t) :
+            writeSnapshotTupleRdb(rdb, rdb_dbid, dbid, key, t)) == C_ERR)
+    return -1;
+
+  //'ikey' may be the key of the dictionary entry
+  if(de != NULL)
+    dictDelete(records, ikey);
+  return 1;
+}
+
+/*
+    Writes the keys of one partition of the indexed log to the RDB (or as AOF commands if
+    'aof' is true). The cursor returns the log records key by key, so the image of a key 
+    is written when the next key starts.
+    Returns the number of keys written or -1 on error.
+*/
+static long long writeSnapshotPartition(rio *rdb, int *rdb_dbid, dict *records, indexedLog *dbp,
+ int aof){
+  indexedLogCursor *cursorp = indexedLogCursorOpen(dbp);
+  indexedLogRecord key, data;
+  snapshotTuple t = {0, NULL, -1};
+  sds current_key = NULL;
+  long long count = 0;
+  int error, written;
+
+  if(cursorp == NULL)
+    return -1;
+
+  memset(&key, 0, sizeof(key));
+  memset(&data, 0, sizeof(data));
+  while((error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT)) == 0){
+    if(current_key == NULL || strcmp(current_key, (char *)key.data) != 0){
+      if(current_key != NULL){
+        if((written = writeSnapshotTuple(rdb, rdb_dbid, records, current_key, &t, aof)) == -1)
+          break;
+        count += written;
+        current_key = sdscpy(current_key, (char *)key.data);
+      }else{
+        current_key = sdsnew((char *)key.data);
+      }
+      t.exists = 0;
+      t.expire = -1;
+    }
+
+    //Same parsing as the Restorer: line 2 is the command and line 6 the value
+    sds dataSds = sdsnew((char *)data.data);
+    char **lines;
+    int count_lines;
+    lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &count_lines);
+    sdsfree(dataSds);
+    if(count_lines > 2)
+      applySnapshotLogRecord(&t, lines[2], count_lines > 6 ? lines[6] : "");
+    sdsfreesplitres(lines, count_lines);
+  }
+  indexedLogCursorClose(cursorp);
+
+  if(error == INDEXEDLOG_NOTFOUND && current_key != NULL){
+    if((written = writeSnapshotTuple(rdb, rdb_dbid, records, current_key, &t, aof)) == -1)
+      error = INDEXEDLOG_ERR;
+    else
+      count += written;
+  }
+  sdsfree(current_key);
+  sdsfree(t.value);
+
+  if(error != INDEXEDLOG_NOTFOUND){
+    serverLog(LL_WARNING, "%s of the indexed log failed! %s", aof ? "AOF rewrite" : "Snapshot",
+              error == INDEXEDLOG_OK ? "Write error" : indexedLogStrerror(error));
+    return -1;
+  }
+  return count;
+}
+
+/*
+    Thread that writes the snapshot of the indexed log to a temporary RDB file. See 
+    startIndexedLogSnapshot().
+*/
+void *indexedLogSnapshot_thread(void *arg){
+  unsigned long long end;
+  long long seek, count = 0, written = 0;
+  int dbid, rdb_dbid = -1, partition, ret, status = C_ERR, locked = 1;
+  indexedLog **dbps = NULL;
+  dict *records = dictCreate(&snapshotLogRecordsDictType, NULL);
+  FILE *fp = NULL;
+  char magic[10];
+  uint64_t cksum;
+  rio rdb;
+  UNUSED(arg);
+
+  atomicGet(server.indexedlog_snapshot_limit, end);
+
+  //The Indexer does not write to the indexed log while the snapshot is read
+  pthread_mutex_lock(&server.lock_indexing);
+  if((seek = readFinalLogSeek(FINAL_LOG_SEEK)) == -1)
+    seek = 0;
+  dbid = readFinalLogSeekDb(FINAL_LOG_SEEK);
+
+  if(readSnapshotLogRecords(records, seek, dbid, end) == C_ERR){
+    serverLog(LL_WARNING, "Snapshot of the indexed log failed! Cannot read the sequential log from %lld to %llu",
+              seek, end);
+    goto end;
+  }
+
+  dbps = openIndexedLogPartitions(server.indexedlog_filename, 'R', &ret);
+  if(ret != 0){
+    serverLog(LL_WARNING, "Snapshot of the indexed log failed! Cannot open the indexed log!");
+    dbps = NULL;
+    goto end;
+  }
+
+  if((fp = fopen(indexedlog_snapshot_tmpfile, "w")) == NULL){
+    serverLog(LL_WARNING, "Snapshot of the indexed log failed! Cannot open %s: %s",
+              indexedlog_snapshot_tmpfile, strerror(errno));
+    goto end;
+  }
+  rioInitWithFile(&rdb, fp);
+  if(server.rdb_save_incremental_fsync)
+    rioSetAutoSync(&rdb, REDIS_AUTOSYNC_BYTES);
+  if(server.rdb_checksum)
+    rdb.update_cksum = rioGenericUpdateChecksum;
+
+  //Same header as rdbSaveRio(), with the replication information of the full resynchronization
+  snprintf(magic, sizeof(magic), "REDIS%04d", RDB_VERSION);
+  if(rioWrite(&rdb, magic, 9) == 0) goto werr;
+  if(rdbSaveAuxFieldStrStr(&rdb, "redis-ver", REDIS_VERSION) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "redis-bits", (sizeof(void*) == 8) ? 64 : 32) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "ctime", time(NULL)) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "used-mem", zmalloc_used_memory()) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "repl-stream-db", indexedlog_snapshot_rsi.repl_stream_db) == -1) goto werr;
+  if(rdbSaveAuxFieldStrStr(&rdb, "repl-id", indexedlog_snapshot_replid) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "repl-offset", indexedlog_snapshot_repl_offset) == -1) goto werr;
+  if(rdbSaveAuxFieldStrInt(&rdb, "aof-preamble", 0) == -1) goto werr;
+
+  for(partition = 0; partition < server.indexedlog_partitions; partition++){
+    if((written = writeSnapshotPartition(&rdb, &rdb_dbid, records, dbps[partition], 0)) == -1)
+      goto end;
+    count += written;
+  }
+  closeIndexedLogPartitions(dbps);
+  dbps = NULL;
+  pthread_mutex_unlock(&server.lock_indexing);
+  atomicSet(server.indexedlog_snapshot_limit, 0);
+  locked = 0;
+
+  //Keys that are only in the log records not indexed yet
+  while(dictSize(records)){
+    dictIterator *di = dictGetIterator(records);
+    dictEntry *de = dictNext(di);
+    sds ikey = sdsdup(dictGetKey(de));
+    snapshotTuple t = {0, NULL, -1};
+
+    dictReleaseIterator(di);
+    written = writeSnapshotTuple(&rdb, &rdb_dbid, records, ikey, &t, 0);
+    sdsfree(ikey);
+    sdsfree(t.value);
+    if(written == -1) goto werr;
+    count += written;
+  }
+
+  if(rdbSaveType(&rdb, RDB_OPCODE_EOF) == -1) goto werr;
+  cksum = rdb.cksum;
+  memrev64ifbe(&cksum);
+  if(rioWrite(&rdb, &cksum, 8) == 0) goto werr;
+  if(fflush(fp) == EOF || fsync(fileno(fp)) == -1) goto werr;
+
+  serverLog(LL_NOTICE, "Snapshot of the indexed log written: %lld keys (sequential log %lld to %llu)",
+            count, seek, end);
+  status = C_OK;
+  goto end;
+
+werr:
+  serverLog(LL_WARNING, "Snapshot of the indexed log failed! Write error on %s: %s",
+            indexedlog_snapshot_tmpfile, strerror(errno));
+end:
+  if(dbps != NULL)
+    closeIndexedLogPartitions(dbps);
+  if(locked){
+    pthread_mutex_unlock(&server.lock_indexing);
+    atomicSet(server.indexedlog_snapshot_limit, 0);
+  }
+  if(fp != NULL)
+    fclose(fp);
+  if(status == C_ERR)
+    unlink(indexedlog_snapshot_tmpfile);
+  dictRelease(records);
+
+  indexedlog_snapshot_status = status;
+  atomicSet(indexedlog_snapshot_done, 1);
+  return (void *)0;
+}
+
+/*
+    Returns true if the full resynchronization of replicas can be done from the indexed log
+    instead of a BGSAVE. The indexed log only holds the keys written by the indexed commands,
+    so it is refused when the dataset has keys it cannot restore (other types or commands, or
+    keys loaded from an RDB file).
+*/
+int isIndexedLogSnapshotEnabled(void){
+  return server.instant_recovery_state == IR_ON && server.replica_sync_from_indexedlog == IR_ON &&
+         !server.indexedlog_incomplete &&
+         server.instant_recovery_synchronous == IR_OFF && server.indexer_state == IR_ON &&
+         server.aof_state == AOF_ON && server.aof_child_pid == -1 &&
+         !isIndexedLogAofRewriteInProgress();
+}
+
+/*
+    Returns true if a snapshot of the indexed log for replication is being written.
+*/
+int isIndexedLogSnapshotInProgress(void){
+  return indexedlog_snapshot_in_progress;
+}
+
+/*
+    Starts the snapshot of the indexed log for the replicas waiting for a full 
+    resynchronization. The AOF buffer is written first, so the snapshot contains all the
+    commands up to the replication offset of the full resynchronization.
+    Returns C_OK if the snapshot thread was started, otherwise C_ERR.
+*/
+int startIndexedLogSnapshot(rdbSaveInfo *rsi){
+  if(indexedlog_snapshot_in_progress)
+    return C_ERR;
+
+  flushAppendOnlyFile(1);
+  if(sdslen(server.aof_buf) != 0){
+    serverLog(LL_WARNING, "Snapshot of the indexed log not started! The AOF buffer cannot be written.");
+    return C_ERR;
+  }
+
+  indexedlog_snapshot_rsi = *rsi;
+  memcpy(indexedlog_snapshot_replid, server.replid, sizeof(indexedlog_snapshot_replid));
+  indexedlog_snapshot_repl_offset = server.master_repl_offset;
+  snprintf(indexedlog_snapshot_tmpfile, sizeof(indexedlog_snapshot_tmpfile), 
+           "logs/temp-indexedlog-%d.rdb", (int) getpid());
+  indexedlog_snapshot_done = 0;
+  atomicSet(server.indexedlog_snapshot_limit, server.aof_current_size);
+
+  if(pthread_create(&indexedlog_snapshot_thread, NULL, indexedLogSnapshot_thread, NULL) != 0){
+    atomicSet(server.indexedlog_snapshot_limit, 0);
+    serverLog(LL_WARNING, "Snapshot of the indexed log not started! Cannot create the thread.");
+    return C_ERR;
+  }
+  indexedlog_snapshot_in_progress = 1;
+  indexedlog_snapshot_start_time = ustime();
+  serverLog(LL_NOTICE, "Snapshot of the indexed log for replication started (sequential log offset %lld)",
+            (long long) server.aof_current_size);
+  return C_OK;
+}
+
+/*
+    Called by serverCron(). When the snapshot thread ends, the RDB file is moved to 
+    INDEXEDLOG_SNAPSHOT and the replicas waiting for it are handled as after a BGSAVE.
+    'dbfilename' is never overwritten, since the snapshot is not a full dump of the dataset.
+*/
+void checkIndexedLogSnapshotDone(void){
+  int done, status;
+
+  if(!indexedlog_snapshot_in_progress)
+    return;
+  atomicGet(indexedlog_snapshot_done, done);
+  if(!done)
+    return;
+
+  pthread_join(indexedlog_snapshot_thread, NULL);
+  indexedlog_snapshot_in_progress = 0;
+  status = indexedlog_snapshot_status;
+  if(status == C_OK && rename(indexedlog_snapshot_tmpfile, INDEXEDLOG_SNAPSHOT) == -1){
+    serverLog(LL_WARNING, "Error moving the snapshot of the indexed log %s to %s: %s",
+              indexedlog_snapshot_tmpfile, INDEXEDLOG_SNAPSHOT, strerror(errno));
+    unlink(indexedlog_snapshot_tmpfile);
+    status = C_ERR;
+  }
+
+  if(status == C_OK){
+    server.stat_indexedlog_snapshots++;
+    serverLog(LL_NOTICE, "Snapshot of the indexed log for replication saved on disk in %.3f seconds",
+              (float)(ustime() - indexedlog_snapshot_start_time)/1000000);
+  }else{
+    serverLog(LL_WARNING, "Snapshot of the indexed log for replication failed");
+  }
+  updateSlavesWaitingBgsaveFromFile(status, RDB_CHILD_TYPE_DISK, INDEXEDLOG_SNAPSHOT);
+}
+
+// ==================================================================================
+// AOF rewrite from the indexed log. Instead of forking a child that dumps the dataset,
+// a thread writes the new AOF from the cursor scan of the indexed log plus the log 
+// records not indexed yet (the same scan as the snapshot for replication), followed by
+// the tail of the old AOF from the offset the scan ends at. The Indexer stops at that 
+// offset until the new AOF replaces the old one, and then goes on in the new AOF.
+
+static pthread_t indexedlog_rewrite_thread;
+static int indexedlog_rewrite_in_progress = 0;
+static int indexedlog_rewrite_done = 0;         //set to 1 by the rewrite thread when it ends
+static int indexedlog_rewrite_status = C_ERR;
+static char indexedlog_rewrite_tmpfile[256];
+static unsigned long long indexedlog_rewrite_end;   //old AOF offset the scan ends at
+static int indexedlog_rewrite_end_db;               //database selected in the old AOF at that offset
+static off_t indexedlog_rewrite_base;               //size of the new AOF before the tail
+static off_t indexedlog_rewrite_tail_copied;        //old AOF offset the tail is copied up to
+static int indexedlog_rewrite_tail_incomplete;      //the dataset became incomplete during the rewrite
+
+/*
+    Returns true if the Indexer indexes the command as it is written to the sequential log 
+    (see feedAppendOnlyFile()), i.e., the image of its key in the indexed log stays the same
+    as in the dataset. Any other command (MSET, APPEND, INCRBY, GETSET, LPUSH, UNLINK, ...)
+    makes the indexed log incomplete: the dataset cannot be rebuilt from it anymore.
+*/
+int isIndexedLogCommand(struct redisCommand *cmd, int argc){
+  //SETEX, PSETEX and the EXPIRE variants are written as SET and PEXPIREAT
+  if(!(cmd->flags & CMD_IR_INDEXED))
+    return 0;
+
+  //The Indexer only reads the first key of a log record
+  if(cmd->proc == delCommand || cmd->proc == incrCommand || cmd->proc == persistCommand)
+    return argc == 2;
+  if(cmd->proc == pexpireatCommand)
+    return argc == 3;
+  return 1;
+}
+
+/*
+    Marks the dataset as having keys the indexed log cannot rebuild (see 
+    server.indexedlog_incomplete). The flag is cleared when the AOF is rebuilt from the 
+    indexed log, unless this happens again while the rewrite is in progress.
+*/
+void setIndexedLogIncomplete(void){
+  server.indexedlog_incomplete = 1;
+  if(indexedlog_rewrite_in_progress)
+    indexedlog_rewrite_tail_incomplete = 1;
+}
+
+/*
+    Writes the offset the Indexer goes on at in the new AOF before the new AOF replaces the 
+    old one, with the inode of the new AOF. FINAL_LOG_SEEK is only written after the rename,
+    so a crash in between is fixed at the restart by recoverIndexedLogAofRewrite().
+    Returns C_OK or C_ERR on a write error.
+*/
+static int writeRewriteLogSeek(unsigned long long seek, int dbid, ino_t ino){
+  char tmpfile[256];
+  FILE *fp;
+  int ok;
+
+  snprintf(tmpfile, sizeof(tmpfile), "%s.tmp", FINAL_LOG_SEEK_REWRITE);
+  if((fp = fopen(tmpfile, "wb")) == NULL)
+    return C_ERR;
+  ok = fwrite(&seek, sizeof(seek), 1, fp) == 1 && fwrite(&dbid, sizeof(dbid), 1, fp) == 1 &&
+       fwrite(&ino, sizeof(ino), 1, fp) == 1 && fflush(fp) == 0 && fsync(fileno(fp)) == 0;
+  fclose(fp);
+  if(!ok || rename(tmpfile, FINAL_LOG_SEEK_REWRITE) == -1){
+    unlink(tmpfile);
+    return C_ERR;
+  }
+  return C_OK;
+}
+
+/*
+    Called at the startup, before the Indexer reads FINAL_LOG_SEEK. If the server crashed 
+    at the end of an AOF rewrite from the indexed log, FINAL_LOG_SEEK is set to the offset in
+    the new AOF if the new AOF replaced the old one (same inode), and left as is otherwise.
+*/
+void recoverIndexedLogAofRewrite(void){
+  FILE *fp = fopen(FINAL_LOG_SEEK_REWRITE, "rb");
+  unsigned long long seek;
+  struct stat sb;
+  int dbid;
+  ino_t ino;
+
+  if(fp == NULL)
+    return;
+  if(fread(&seek, sizeof(seek), 1, fp) == 1 && fread(&dbid, sizeof(dbid), 1, fp) == 1 &&
+     fread(&ino, sizeof(ino), 1, fp) == 1 && stat(server.aof_filename, &sb) == 0 && 
+     sb.st_ino == ino){
+    writeFinalLogSeek(FINAL_LOG_SEEK, seek, dbid);
+    //The AOF in place was rebuilt from the indexed log, as the dataset restored from it
+    server.indexedlog_incomplete = 0;
+    serverLog(LL_NOTICE, "AOF rewritten from the indexed log before the crash: the Indexer goes on at %llu",
+              seek);
+  }
+  fclose(fp);
+  unlink(FINAL_LOG_SEEK_REWRITE);
+}
+
+/*
+    Appends the bytes of the file 'fromfd' from 'start' to 'end' (or to the end of the file
+    if 'end' is -1) to the file 'tofd'.
+    Returns the offset of 'fromfd' copied up to, or -1 on error.
+*/
+static off_t copyAofRange(int fromfd, int tofd, off_t start, off_t end){
+  char buf[PROTO_IOBUF_LEN];
+  ssize_t nread;
+
+  while(end == -1 || start < end){
+    size_t len = sizeof(buf);
+
+    if(end != -1 && (off_t) len > end - start)
+      len = end - start;
+    if((nread = pread(fromfd, buf, len, start)) == -1)
+      return -1;
+    if(nread == 0)
+      break;
+    if(write(tofd, buf, nread) != nread)
+      return -1;
+    start += nread;
+  }
+  return start;
+}
+
+/*
+    Thread that writes the new AOF from the indexed log to a temporary file. See 
+    startIndexedLogAofRewrite().
+*/
+void *indexedLogAofRewrite_thread(void *arg){
+  long long seek, count = 0, written = 0;
+  int dbid, aof_dbid = -1, partition, ret, status = C_ERR, oldfd = -1;
+  indexedLog **dbps = NULL;
+  dict *records = dictCreate(&snapshotLogRecordsDictType, NULL);
+  FILE *fp = NULL;
+  rio aof;
+  UNUSED(arg);
+
+  //The Indexer does not write to the indexed log while it is read
+  pthread_mutex_lock(&server.lock_indexing);
+  if((seek = readFinalLogSeek(FINAL_LOG_SEEK)) == -1)
+    seek = 0;
+  dbid = readFinalLogSeekDb(FINAL_LOG_SEEK);
+
+  if(readSnapshotLogRecords(records, seek, dbid, indexedlog_rewrite_end) == C_ERR){
+    pthread_mutex_unlock(&server.lock_indexing);
+    serverLog(LL_WARNING, "AOF rewrite from the indexed log failed! Cannot read the sequential log from %lld to %llu",
+              seek, indexedlog_rewrite_end);
+    goto end;
+  }
+
+  dbps = openIndexedLogPartitions(server.indexedlog_filename, 'R', &ret);
+  if(ret != 0){
+    pthread_mutex_unlock(&server.lock_indexing);
+    serverLog(LL_WARNING, "AOF rewrite from the indexed log failed! Cannot open the indexed log!");
+    dbps = NULL;
+    goto end;
+  }
+
+  if((fp = fopen(indexedlog_rewrite_tmpfile, "w")) == NULL){
+    closeIndexedLogPartitions(dbps);
+    pthread_mutex_unlock(&server.lock_indexing);
+    serverLog(LL_WARNING, "AOF rewrite from the indexed log failed! Cannot open %s: %s",
+              indexedlog_rewrite_tmpfile, strerror(errno));
+    goto end;
+  }
+  rioInitWithFile(&aof, fp);
+  if(server.aof_rewrite_incremental_fsync)
+    rioSetAutoSync(&aof, REDIS_AUTOSYNC_BYTES);
+
+  for(partition = 0; partition < server.indexedlog_partitions && written != -1; partition++){
+    if((written = writeSnapshotPartition(&aof, &aof_dbid, records, dbps[partition], 1)) != -1)
+      count += written;
+  }
+  closeIndexedLogPartitions(dbps);
+  pthread_mutex_unlock(&server.lock_indexing);
+  if(written == -1)
+    goto werr;
+
+  //Keys that are only in the log records not indexed yet
+  while(dictSize(records)){
+    dictIterator *di = dictGetIterator(records);
+    dictEntry *de = dictNext(di);
+    sds ikey = sdsdup(dictGetKey(de));
+    snapshotTuple t = {0, NULL, -1};
+
+    dictReleaseIterator(di);
+    written = writeSnapshotTuple(&aof, &aof_dbid, records, ikey, &t, 1);
+    sdsfree(ikey);
+    sdsfree(t.value);
+    if(written == -1) goto werr;
+    count += written;
+  }
+
+  //The tail of the old AOF goes on in the database selected at its start. The SELECT also
+  //makes the base of the new AOF not empty, since the Indexer takes 0 as no offset.
+  if(rioWriteBulkCount(&aof, '*', 2) == 0) goto werr;
+  if(rioWriteBulkString(&aof, "SELECT", 6) == 0) goto werr;
+  if(rioWriteBulkLongLong(&aof, indexedlog_rewrite_end_db == -1 ? 0 : indexedlog_rewrite_end_db) == 0) goto werr;
+  if(fflush(fp) == EOF) goto werr;
+  indexedlog_rewrite_base = ftello(fp);
+
+  //Most of the tail is copied here, the rest by checkIndexedLogAofRewriteDone()
+  if((oldfd = open(server.aof_filename, O_RDONLY)) == -1) goto werr;
+  indexedlog_rewrite_tail_copied = copyAofRange(oldfd, fileno(fp), indexedlog_rewrite_end, -1);
+  if(indexedlog_rewrite_tail_copied == -1) goto werr;
+  if(fsync(fileno(fp)) == -1) goto werr;
+
+  serverLog(LL_NOTICE, "AOF rewrite from the indexed log written: %lld keys (sequential log %lld to %llu), "
+            "%lld bytes of the AOF tail", count, seek, indexedlog_rewrite_end,
+            (long long)(indexedlog_rewrite_tail_copied - indexedlog_rewrite_end));
+  status = C_OK;
+  goto end;
+
+werr:
+  serverLog(LL_WARNING, "AOF rewrite from the indexed log failed! Write error on %s: %s",
+            indexedlog_rewrite_tmpfile, strerror(errno));
+end:
+  if(oldfd != -1)
+    close(oldfd);
+  if(fp != NULL)
+    fclose(fp);
+  if(status == C_ERR)
+    unlink(indexedlog_rewrite_tmpfile);
+  dictRelease(records);
+
+  indexedlog_rewrite_status = status;
+  atomicSet(indexedlog_rewrite_done, 1);
+  return (void *)0;
+}
+
+/*
+    Returns true if BGREWRITEAOF can rewrite the AOF from the indexed log instead of forking.
+    The Indexer must be running, since the new AOF is built from the indexed log and it 
+    stops at the end of the scan. The dataset must only have keys the indexed log rebuilds,
+    i.e., every command logged was indexed (see isIndexedLogCommand()), otherwise the new 
+    AOF would lose data.
+*/
+int isIndexedLogAofRewriteEnabled(void){
+  return server.instant_recovery_state == IR_ON && server.aof_rewrite_from_indexedlog == IR_ON &&
+         server.instant_recovery_synchronous == IR_OFF && server.indexer_state == IR_ON &&
+         server.aof_state == AOF_ON && !server.indexedlog_incomplete &&
+         !isIndexedLogSnapshotInProgress();
+}
+
+/*
+    Returns true if an AOF rewrite from the indexed log is in progress.
+*/
+int isIndexedLogAofRewriteInProgress(void){
+  return indexedlog_rewrite_in_progress;
+}
+
+/*
+    Starts the AOF rewrite from the indexed log. The AOF buffer is written first, so the 
+    scan ends at a command boundary of the old AOF.
+    Returns C_OK if the rewrite thread was started, otherwise C_ERR.
+*/
+int startIndexedLogAofRewrite(void){
+  if(indexedlog_rewrite_in_progress)
+    return C_ERR;
+
+  flushAppendOnlyFile(1);
+  if(sdslen(server.aof_buf) != 0){
+    serverLog(LL_WARNING, "AOF rewrite from the indexed log not started! The AOF buffer cannot be written.");
+    return C_ERR;
+  }
+
+  snprintf(indexedlog_rewrite_tmpfile, sizeof(indexedlog_rewrite_tmpfile), 
+           "temp-rewriteaof-indexedlog-%d.aof", (int) getpid());
+  indexedlog_rewrite_end = server.aof_current_size;
+  indexedlog_rewrite_end_db = server.aof_selected_db;
+  indexedlog_rewrite_done = 0;
+  indexedlog_rewrite_tail_incomplete = 0;
+  atomicSet(server.indexer_paused_at_limit, 0);
+  atomicSet(server.indexedlog_snapshot_limit, indexedlog_rewrite_end);
+
+  if(pthread_create(&indexedlog_rewrite_thread, NULL, indexedLogAofRewrite_thread, NULL) != 0){
+    atomicSet(server.indexedlog_snapshot_limit, 0);
+    serverLog(LL_WARNING, "AOF rewrite from the indexed log not started! Cannot create the thread.");
+    return C_ERR;
+  }
+  indexedlog_rewrite_in_progress = 1;
+  server.aof_rewrite_scheduled = 0;
+  server.aof_rewrite_time_start = time(NULL);
+  serverLog(LL_NOTICE, "AOF rewrite from the indexed log started (sequential log offset %llu)",
+            indexedlog_rewrite_end);
+  return C_OK;
+}
+
+/*
+    Ends the AOF rewrite from the indexed log with an error.
+*/
+static void abortIndexedLogAofRewrite(void){
+  unlink(indexedlog_rewrite_tmpfile);
+  atomicSet(server.indexedlog_snapshot_limit, 0);
+  atomicSet(server.indexer_paused_at_limit, 0);
+  indexedlog_rewrite_in_progress = 0;
+  server.aof_lastbgrewrite_status = C_ERR;
+  server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
+  server.aof_rewrite_time_start = -1;
+  serverLog(LL_WARNING, "AOF rewrite from the indexed log failed");
+}
+
+/*
+    Called by serverCron(). When the rewrite thread ended and the Indexer reached the end
+    of the scan, the commands appended to the old AOF meanwhile are copied to the new AOF,
+    which replaces the old one as after a BGREWRITEAOF. The Indexer then goes on at the 
+    same log record in the new AOF.
+*/
+void checkIndexedLogAofRewriteDone(void){
+  int done, paused, newfd, oldfd, dbid;
+  struct stat sb;
+  off_t copied;
+
+  if(!indexedlog_rewrite_in_progress)
+    return;
+  atomicGet(indexedlog_rewrite_done, done);
+  if(!done)
+    return;
+  if(done == 1){
+    pthread_join(indexedlog_rewrite_thread, NULL);
+    indexedlog_rewrite_done = 2;    //joined, the Indexer may not be at the end of the scan yet
+  }
+
+  if(indexedlog_rewrite_status == C_ERR || server.aof_state != AOF_ON || 
+     server.indexer_performing == IR_OFF){
+    abortIndexedLogAofRewrite();
+    return;
+  }
+  atomicGet(server.indexer_paused_at_limit, paused);
+  if(!paused)
+    return;
+  flushAppendOnlyFile(1);
+  if(sdslen(server.aof_buf) != 0)
+    return;
+
+  if((newfd = open(indexedlog_rewrite_tmpfile, O_WRONLY|O_APPEND)) == -1){
+    serverLog(LL_WARNING, "Unable to open the AOF rewritten from the indexed log: %s", strerror(errno));
+    abortIndexedLogAofRewrite();
+    return;
+  }
+  if((oldfd = open(server.aof_filename, O_RDONLY)) == -1 ||
+     (copied = copyAofRange(oldfd, newfd, indexedlog_rewrite_tail_copied, server.aof_current_size)) == -1 ||
+     copied != server.aof_current_size){
+    serverLog(LL_WARNING, "Error copying the AOF tail to the AOF rewritten from the indexed log: %s", 
+              strerror(errno));
+    if(oldfd != -1) close(oldfd);
+    close(newfd);
+    abortIndexedLogAofRewrite();
+    return;
+  }
+  close(oldfd);
+
+  dbid = readFinalLogSeekDb(FINAL_LOG_SEEK);
+  if(fsync(newfd) == -1 || fstat(newfd, &sb) == -1 ||
+     writeRewriteLogSeek(indexedlog_rewrite_base, dbid, sb.st_ino) == C_ERR){
+    serverLog(LL_WARNING, "Error writing the indexer offset in the AOF rewritten from the indexed log: %s",
+              strerror(errno));
+    close(newfd);
+    abortIndexedLogAofRewrite();
+    return;
+  }
+  if(rename(indexedlog_rewrite_tmpfile, server.aof_filename) == -1){
+    serverLog(LL_WARNING, "Error trying to rename the temporary AOF file %s into %s: %s",
+              indexedlog_rewrite_tmpfile, server.aof_filename, strerror(errno));
+    close(newfd);
+    unlink(FINAL_LOG_SEEK_REWRITE);
+    abortIndexedLogAofRewrite();
+    return;
+  }
+  writeFinalLogSeek(FINAL_LOG_SEEK, indexedlog_rewrite_base, dbid);
+  unlink(FINAL_LOG_SEEK_REWRITE);
+
+  oldfd = aofSwitchToRewrittenFile(newfd);
+  bioCreateBackgroundJob(BIO_CLOSE_FILE, (void*)(long)oldfd, NULL, NULL);
+
+  //Releases the Indexer, see indexesSequentialLogToIndexedLogV2()
+  atomicSet(server.indexedlog_rewrite_seek, indexedlog_rewrite_base);
+
+  indexedlog_rewrite_in_progress = 0;
+  //The new AOF only has the keys of the indexed log, plus the tail written meanwhile
+  server.indexedlog_incomplete = indexedlog_rewrite_tail_incomplete;
+  server.stat_indexedlog_aof_rewrites++;
+  server.aof_lastbgrewrite_status = C_OK;
+  server.aof_rewrite_time_last = time(NULL)-server.aof_rewrite_time_start;
+  server.aof_rewrite_time_start = -1;
+  serverLog(LL_NOTICE, "AOF rewrite from the indexed log finished successfully (%lld bytes)",
+            (long long) server.aof_current_size);
+}
+
+// ==================================================================================
+// Crash points of recovery benchmarks (DEBUG CRASHAT). A crash point kills the server
+// with SIGKILL at a precise point of the Indexer or the Checkpointer, so experiments can
+// reproduce a failure in the middle of an indexer batch (the log records are in the
+// indexed log, but the indexer seek is not updated) or in the middle of a checkpoint.
+// Crash points are armed at runtime only, so the server does not crash again after the
+// restart.
+
+#define IR_CRASH_NONE 0
+#define IR_CRASH_INDEXER_BATCH 1
+#define IR_CRASH_CHECKPOINT 2
+
+static const char *crash_point_names[] = {"none", "indexer-batch", "checkpoint"};
+static int crash_point = IR_CRASH_NONE;
+static long long crash_point_countdown = 0;   //occurrences of the crash point left
+
+/*
+    Arms the crash point to kill the server at its 'count'th occurrence from now. It is
+    called by DEBUG CRASHAT (see debug.c).
+    Returns C_ERR if the crash point name is unknown.
+*/
+int armCrashPoint(char *name, long long count){
+  int point;
+
+  for(point = IR_CRASH_NONE; point <= IR_CRASH_CHECKPOINT; point++){
+    if(!strcasecmp(name, crash_point_names[point])){
+      atomicSet(crash_point_countdown, count);
+      atomicSet(crash_point, point);
+      if(point != IR_CRASH_NONE)
+        serverLog(LL_WARNING, "Crash point '%s' armed: the server will be killed at its occurrence %lld.",
+                  crash_point_names[point], count);
+      return C_OK;
+    }
+  }
+  return C_ERR;
+}
+
+/*
+    Called by the Indexer and the Checkpointer at their crash points. Kills the server if 
+    the crash point is armed and this is the occurrence expected.
+*/
+static void crashPointReached(int point){
+  long long countdown;
+  int armed;
+
+  atomicGet(crash_point, armed);
+  if(armed != point)
+    return;
+  atomicGetIncr(crash_point_countdown, countdown, -1);
+  if(countdown != 1)
+    return;
+
+  serverLog(LL_WARNING, "Crash point '%s' reached. Killing the server!", crash_point_names[point]);
+  kill(getpid(), SIGKILL);
+}
+
+// ==================================================================================
+// Recovery progress functions. They provide the INFO recovery section and the RECOVERY
+// command. The counters are updated atomically since they are written by the Restorer,
+// the Indexer and the main thread.
+
+/*
+    State of the flow control of the incremental restore.
+        rate_start, rate_tuples: time and tuples restored at the start of the rate window
+        throttle_start, throttle_tuples: time and tuples restored at the start of the throttle window
+        throttle: throttle used in the throttle window (tuples per second)
+*/
+typedef struct restorerFlow_ts {
+    long long rate_start;
+    unsigned long long rate_tuples;
+    long long throttle_start;
+    unsigned long long throttle_tuples;
+    long long throttle;
+} restorerFlow;
+
+/*
+    Returns the number of tuples restored into memory (incrementally and on demand).
+*/
+unsigned long long countTuplesRestored(){
+  unsigned long long incr, ondemand;
+
+  atomicGet(server.count_tuples_loaded_incr, incr);
+  atomicGet(server.count_tuples_loaded_ondemand, ondemand);
+  return incr + ondemand;
+}
+
+/*
+    Initializes the flow control of the incremental restore.
+*/
+void initRestorerFlow(restorerFlow *flow){
+  flow->rate_start = ustime();
+  flow->rate_tuples = countTuplesRestored();
+  flow->throttle_start = flow->rate_start;
+  flow->throttle_tuples = 0;
+  flow->throttle = 0;
+}
+
+/*
+    Pauses and throttles the incremental restore, and updates the restore rate. 
+    It is called by the Restorer after each tuple restored incrementally.
+    See the RECOVERY PAUSE, RESUME and THROTTLE commands.
+*/
+void restorerFlowControl(restorerFlow *flow){
+  int paused;
+  long long now, throttle;
+
+  //Waits while the restore is paused. On-demand restores go on during the pause.
+  atomicGet(server.instant_recovery_paused, paused);
+  if(paused == IR_ON){
+    atomicSet(server.restore_rate, 0);
+    serverLog(LL_NOTICE, "The incremental restore was paused!");
+    do{
+      usleep(10000);
+      atomicGet(server.instant_recovery_paused, paused);
+    }while(paused == IR_ON && server.instant_recovery_performing_stop == IR_OFF);
+    serverLog(LL_NOTICE, "The incremental restore was resumed!");
+    initRestorerFlow(flow);
+    return;
+  }
+
+  //Updates the restore rate (tuples per second) once per second
+  now = ustime();
+  if(now - flow->rate_start >= 1000000){
+    unsigned long long restored = countTuplesRestored();
+    atomicSet(server.restore_rate, (long long)((restored - flow->rate_tuples)*1000000/(now - flow->rate_start)));
+    flow->rate_start = now;
+    flow->rate_tuples = restored;
+  }
+
+  //Sleeps if the tuples restored in the throttle window are ahead of the throttle.
+  //The sleeps are grouped in at least 1 millisecond to avoid a sleep per tuple.
+  atomicGet(server.restore_throttle, throttle);
+  if(throttle != flow->throttle){
+    flow->throttle = throttle;
+    flow->throttle_start = now;
+    flow->throttle_tuples = 0;
+  }
+  if(throttle > 0){
+    flow->throttle_tuples++;
+    long long ahead = (long long)(flow->throttle_tuples*1000000/throttle) - (now - flow->throttle_start);
+    if(ahead >= 1000)
+      usleep(ahead);
+  }
+}
+
+/*
+    Counts the tuples stored in the indexed log to estimate the time to finish the recovery.
+    It runs in a thread in parallel with the Restorer.
+*/
+void *countTuplesToRestore(){
+  int error, partition;
+  unsigned long long count = 0;
+  indexedLog **dbps = openIndexedLogPartitions(server.indexedlog_filename, 'R', &error);
+  if(error != 0){
+    serverLog(LL_NOTICE, "The recovery ETA is not available! Cannot open the indexed log.");
+    return (void *)0;
+  }
+  for(partition = 0; partition < server.indexedlog_partitions; partition++)
+    count += countTuplesIndexedLog(dbps[partition]);
+  atomicSet(server.count_tuples_to_restore, (long long)count);
+  closeIndexedLogPartitions(dbps);
+
+  return (void *)1;
+}
+
+/*
+    Returns the recovery state name. While the dataset is loaded (sequential log, RDB or
+    preload), RECOVERY STATUS still answers, and reports "loading".
+*/
+char *getRecoveryStateName(){
+  int paused;
+
+  if(server.loading)
+    return "loading";
+  if(server.instant_recovery_state != IR_ON)
+    return "disabled";
+  if(server.instant_recovery_performing == IR_ON){
+    atomicGet(server.instant_recovery_paused, paused);
+    return paused == IR_ON ? "paused" : "restoring";
+  }
+  if(server.recovery_end_time > 0)
+    return "done";
+  return "waiting";
+}
+
+/*
+    Appends the INFO recovery section to info.
+    The fields about time are in seconds and the rates are in tuples per second.
+    The value -1 means that the information is not available yet.
+*/
+sds genRecoveryInfoString(sds info){
+  unsigned long long incr, ondemand, not_in_log, already_loaded, inconsistent_incr, 
+                     inconsistent_ondemand, expired, seek_log_file, records_written, records_indexed;
+  long long total, rate, throttle, elapsed = -1, eta = -1, lag_bytes = 0, lag_records = 0;
+  char *state = getRecoveryStateName();
+  double progress = -1;
+
+  atomicGet(server.count_tuples_loaded_incr, incr);
+  atomicGet(server.count_tuples_loaded_ondemand, ondemand);
+  atomicGet(server.count_tuples_not_in_log, not_in_log);
+  atomicGet(server.count_tuples_already_loaded, already_loaded);
+  atomicGet(server.count_inconsistent_load_incr, inconsistent_incr);
+  atomicGet(server.count_inconsistent_load_ondemand, inconsistent_ondemand);
+  atomicGet(server.count_tuples_expired, expired);
+  atomicGet(server.count_tuples_to_restore, total);
+  atomicGet(server.restore_rate, rate);
+  atomicGet(server.restore_throttle, throttle);
+  atomicGet(server.seek_log_file, seek_log_file);
+  atomicGet(server.count_log_records_written, records_written);
+  atomicGet(server.count_log_records_indexed, records_indexed);
+
+  if(!strcmp(state, "restoring") || !strcmp(state, "paused")){
+    elapsed = (ustime() - server.recovery_start_time)/1000000;
+    if(total > 0){
+      progress = (double)(incr + ondemand)*100/total;
+      if(progress > 100)
+        progress = 100;
+      if(rate > 0)
+        eta = total > (long long)(incr + ondemand) ? (total - (long long)(incr + ondemand))/rate : 0;
+    }
+  }else if(!strcmp(state, "done")){
+    elapsed = (server.recovery_end_time - server.recovery_start_time)/1000000;
+    progress = 100;
+    eta = 0;
+  }
+
+  //The indexer lag only exists in the asynchronous indexing
+  if(server.instant_recovery_state == IR_ON && server.instant_recovery_synchronous == IR_OFF){
+    if(server.aof_state == AOF_ON && (unsigned long long)server.aof_current_size > seek_log_file)
+      lag_bytes = server.aof_current_size - seek_log_file;
+    if(records_written > records_indexed)
+      lag_records = records_written - records_indexed;
+  }
+
+  info = sdscatprintf(info,
+    "# Recovery\r\n"
+    "recovery_state:%s\r\n"
+    "recovery_indexing:%s\r\n"
+    "recovery_elapsed_sec:%lld\r\n"
+    "recovery_tuples_total:%lld\r\n"
+    "recovery_tuples_restored:%llu\r\n"
+    "recovery_tuples_restored_incremental:%llu\r\n"
+    "recovery_tuples_restored_ondemand:%llu\r\n"
+    "recovery_progress_perc:%.2f\r\n"
+    "recovery_restore_rate:%lld\r\n"
+    "recovery_throttle:%lld\r\n"
+    "recovery_eta_sec:%lld\r\n"
+    "recovery_ondemand_hits:%llu\r\n"
+    "recovery_ondemand_misses:%llu\r\n"
+    "recovery_ondemand_already_restored:%llu\r\n"
+    "recovery_inconsistent_loads:%llu\r\n"
+    "recovery_tuples_expired:%llu\r\n"
+    "recovery_slots_restored:%d\r\n"
+    "recovery_indexer_state:%s\r\n"
+    "recovery_indexer_offset:%llu\r\n"
+    "recovery_indexer_lag_bytes:%lld\r\n"
+    "recovery_indexer_lag_records:%lld\r\n"
+    "recovery_tiering_evicted_keys:%lu\r\n"
+    "recovery_tiering_pending_keys:%lu\r\n"
+    "recovery_tiering_evictions:%lld\r\n"
+    "recovery_tiering_restores:%lld\r\n"
+    "recovery_replica_snapshot_in_progress:%d\r\n"
+    "recovery_replica_snapshots:%lld\r\n"
+    "recovery_aof_rewrite_in_progress:%d\r\n"
+    "recovery_aof_rewrites:%lld\r\n"
+    "recovery_rdb_keys_not_loaded:%lu\r\n"
+    "recovery_rdb_ondemand_loads:%lld\r\n",
+    state,
+    server.instant_recovery_synchronous == IR_ON ? "synchronous" : "asynchronous",
+    elapsed, total, incr + ondemand, incr, ondemand, progress, rate, throttle, eta,
+    ondemand, not_in_log, already_loaded, inconsistent_incr + inconsistent_ondemand, expired,
+    countSlotsRestored(),
+    server.indexer_performing == IR_ON ? "running" : "stopped",
+    seek_log_file, lag_bytes, lag_records,
+    server.tiering_evicted_keys ? dictSize(server.tiering_evicted_keys) : 0,
+    tiering_pending_keys ? dictSize(tiering_pending_keys) : 0,
+    server.stat_tiering_evictions, server.stat_tiering_restores,
+    isIndexedLogSnapshotInProgress(), server.stat_indexedlog_snapshots,
+    isIndexedLogAofRewriteInProgress(), server.stat_indexedlog_aof_rewrites,
+    server.rdb_key_directory ? dictSize(server.rdb_key_directory) : 0,
+    server.stat_rdb_ondemand_loads);
+
+  return info;
+}
+
+/*
+    Implements the RECOVERY command.
+    RECOVERY STATUS returns the INFO recovery section. RECOVERY PAUSE and RESUME pause and
+    resume the incremental restore (on-demand restores go on). RECOVERY THROTTLE <tuples> 
+    limits the incremental restore to a number of tuples per second (0 is unlimited).
+*/
+void recoveryCommand(client *c) {
+  if(c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "help")){
+    const char *help[] = {
+"STATUS -- Return the state and the progress of the instant recovery.",
+"PAUSE -- Pause the incremental restore. Keys are still restored on demand.",
+"RESUME -- Resume the incremental restore.",
+"THROTTLE <tuples> -- Limit the incremental restore to <tuples> per second (0 = unlimited).",
+"SLOT <slot> -- Return 1 if all the keys of the hash slot are restored, 0 otherwise.",
+"RESTORESLOT <slot> -- Restore now all the keys of the hash slot.",
+NULL
+    };
+    addReplyHelp(c, help);
+  }else if(c->argc == 2 && !strcasecmp(c->argv[1]->ptr, "status")){
+    addReplyBulkSds(c, genRecoveryInfoString(sdsempty()));
+  }else if(c->argc == 2 && (!strcasecmp(c->argv[1]->ptr, "pause") || !strcasecmp(c->argv[1]->ptr, "resume"))){
+    if(server.instant_recovery_state != IR_ON){
+      addReplyError(c, "Instant recovery is disabled");
+      return;
+    }
+    atomicSet(server.instant_recovery_paused, !strcasecmp(c->argv[1]->ptr, "pause") ? IR_ON : IR_OFF);
+    addReply(c, shared.ok);
+  }else if(c->argc == 3 && !strcasecmp(c->argv[1]->ptr, "throttle")){
+    long long throttle;
+
+    if(getLongLongFromObjectOrReply(c, c->argv[2], &throttle, NULL) != C_OK)
+      return;
+    if(throttle < 0){
+      addReplyError(c, "The throttle must be a positive number of tuples per second or 0");
+      return;
+    }
+    atomicSet(server.restore_throttle, throttle);
+    addReply(c, shared.ok);
+  }else if(c->argc == 3 && (!strcasecmp(c->argv[1]->ptr, "slot") || !strcasecmp(c->argv[1]->ptr, "restoreslot"))){
+    long long slot;
+
+    if(getLongLongFromObjectOrReply(c, c->argv[2], &slot, NULL) != C_OK)
+      return;
+    if(slot < 0 || slot >= CLUSTER_SLOTS){
+      addReplyError(c, "Invalid slot");
+      return;
+    }
+    if(!strcasecmp(c->argv[1]->ptr, "slot")){
+      addReplyLongLong(c, isSlotRestored(slot));
+    }else{
+      restoreSlotFromIndexedLog(slot);
+      addReply(c, shared.ok);
+    }
+  }else{
+    addReplySubcommandSyntaxError(c);
+  }
+}
+
 /* 
    Loads INCREMENTALLY all database tuple from indexel log into memory, except thouse
    loaded previously on demand.
-   It requires the extra-flag DB_DUP in openIndexedLog() function.
+   It requires the duplicate keys of the indexed log engines (see indexedlog.h).
    Return a unsigned long long int with the number of records loaded
 */
 void *loadDBFromIndexedLog () {
     server.recovery_start_time = ustime();
+    memset(recovery_slots_restored, 0, sizeof(recovery_slots_restored));
     server.instant_recovery_performing = IR_ON;
+    registerThreadCpuClock(&restorer_thread_clock);
 
-    DB *dbp;
+    indexedLog *dbp, **dbps;
     int error;
       
-    dbp = openIndexedLog(server.indexedlog_filename, 'W', &error);
+    dbps = openIndexedLogPartitions(server.indexedlog_filename, 'W', &error);
     if(error != 0){
         serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Database loading failed! Error when openning the Indexed Log. ⚠ ⚠ ⚠ ⚠ ");
         exit(0);
@@ -2372,123 +4491,187 @@ void *loadDBFromIndexedLog () {
 
     serverLog(LL_NOTICE, "Loading the database from indexed log ... ");
 
-    DBT key, data;
-    /* Zero out the DBTs before using them. */
-    memset(&key, 0, sizeof(DBT));
-    memset(&data, 0, sizeof(DBT));
-    DBC *cursorp;
-    /* Get a cursor */
-    dbp->cursor(dbp, NULL, &cursorp, 0); 
+    //Counts the tuples to restore in parallel to estimate the time to finish the recovery
+    if(server.estimate_recovery_eta == IR_ON){
+      pthread_t count_tuples_thread;
+      if(pthread_create(&count_tuples_thread, NULL, countTuplesToRestore, NULL) == 0)
+        pthread_detach(count_tuples_thread);
+    }
 
+    indexedLogRecord key, data;
+    indexedLogCursor *cursorp;
     char **array_log_record_lines;
-    int countArray;
+    int countArray, partition;
     unsigned long long count_records = 0, count_tuples_loaded = 0, count_inconsistent_load = 0, 
                         count_records_tuple = 0;
-
-    /* Iterate over the indexed log, retrieving each record in berkeley db and reloading the data on redis. */
-    error = cursorp->get(cursorp, &key, &data, DB_NEXT);
+    long long expireIR, ttl;    //absolute expire time of the key in milliseconds, -1 if none
+    int connection_db = 0, dbid;  //databases selected in the connection and of the key
+    char *key_restored;
     sds current_key = sdsnew(""), old_key = sdsnew(""), commandIR = sdsnew(""), keyIR = sdsnew(""), valueIR = sdsnew("0"), dataSds;
-    sdsfree(current_key);
-    current_key = sdsnew((char *)key.data);
     long long restoring_start_time = ustime();
+    restorerFlow flow;
+    initRestorerFlow(&flow);
+
+    //Restores the partitions of the indexed log one after the other
+    for(partition = 0; partition < server.indexedlog_partitions && server.instant_recovery_performing_stop == IR_OFF; partition++){
+      dbp = dbps[partition];
+      /* Zero out the records before using them. */
+      memset(&key, 0, sizeof(indexedLogRecord));
+      memset(&data, 0, sizeof(indexedLogRecord));
+      /* Get a cursor */
+      cursorp = indexedLogCursorOpen(dbp);
+      if(cursorp == NULL){
+          serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error when scanning the partition %d of the Indexed Log. ⚠ ⚠ ⚠ ⚠ ", partition);
+          continue;
+      }
 
-    while (error != DB_NOTFOUND && server.instant_recovery_performing_stop == IR_OFF) {
-        sdsfree(valueIR);
-        valueIR = sdsnew("0");
-        count_records_tuple = 0;
-
-        //If a key (current_key) has alread been restored, shifs until to find a key not loaded.
-        while(isRestoredTuple(current_key)){
-          count_records++;
-          error = cursorp->get(cursorp, &key, &data, DB_NEXT_NODUP);//DB_NEXT_NODUP gets the next non-duplicate record in the database. 
-          if(error != DB_NOTFOUND){
-              sdsfree(current_key);
-              current_key = sdsnew((char *)key.data);
-          }else{
-            break;
+      /* Iterate over the indexed log, retrieving each record in the indexed log and reloading the data on redis. */
+      error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT);
+      sdsfree(current_key);
+      current_key = sdsnew((char *)key.data);
+
+      while (error == 0 && server.instant_recovery_performing_stop == IR_OFF) {
+          sdsfree(valueIR);
+          valueIR = sdsnew("0");
+          expireIR = -1;
+          count_records_tuple = 0;
+
+          //If a key (current_key) has alread been restored, shifs until to find a key not loaded.
+          while(isRestoredTuple(current_key)){
+            count_records++;
+            error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT_NODUP);//INDEXEDLOG_NEXT_NODUP gets the next non-duplicate record in the database. 
+            if(error == 0){
+                sdsfree(current_key);
+                current_key = sdsnew((char *)key.data);
+            }else{
+              break;
+            }
+
+            displayRestorerInformation(&restoring_start_time, count_records,"1", "" );
           }
 
-          displayRestorerInformation(&restoring_start_time, count_records,"1", "" );
-        }
+          if(error != 0)
+              break;
 
-        if(error == DB_NOTFOUND)
-            break;
+          //long long command_load_start = usold_keytime();
+          sdsfree(old_key);
+          old_key = sdsnew(current_key);
 
-        //long long command_load_start = usold_keytime();
-        sdsfree(old_key);
-        old_key = sdsnew(current_key);
+          //Reads all the log records to restore a key and generats only one command to restore the key.
+          while(1) {
+              displayRestorerInformation(&restoring_start_time, count_records, current_key, old_key);
+
+              //Gets out the loop when the key changes, i.e., all the log records to restore the key were read.
+              if(sdscmp(current_key, old_key) != 0){
+                  sdsfree(old_key);
+                  old_key = sdsnew(current_key);
+                  break;
+              }
+              count_records++;
+              count_records_tuple++;
 
-        //Reads all the log records to restore a key and generats only one command to restore the key.
-        while(1) {
-            displayRestorerInformation(&restoring_start_time, count_records, current_key, old_key);
+              dataSds = sdsnew((char *)data.data);
+              //array_log_record_lines = str_split(dataSds, '\n');
+              //Watch out!!!! sdssplit() can be a source of memory overload. Always free the memory allocated through sdsfreesplitres()
+              array_log_record_lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &countArray);
+              sdsfree(dataSds);
 
-            //Gets out the loop when the key changes, i.e., all the log records to restore the key were read.
-            if(sdscmp(current_key, old_key) != 0){
-                sdsfree(old_key);
-                old_key = sdsnew(current_key);
-                break;
-            }
-            count_records++;
-            count_records_tuple++;
-
-            dataSds = sdsnew((char *)data.data);
-            //array_log_record_lines = str_split(dataSds, '\n');
-            //Watch out!!!! sdssplit() can be a source of memory overload. Always free the memory allocated through sdsfreesplitres()
-            array_log_record_lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &countArray);
-            sdsfree(dataSds);
-
-            sdsfree(commandIR);
-            commandIR = sdsnew((char *) array_log_record_lines[2]);
-            sdstoupper(commandIR);
-            if(strcmp(commandIR, "SET") == 0){
-                sdsfree(keyIR);
-                keyIR = sdsnew(current_key);
-                sdsfree(valueIR);
-                valueIR = sdsnew((char *) array_log_record_lines[6]);
-            }else{
-                if(strcmp(commandIR, "INCR") == 0){
-                    sdscpy(commandIR, "SET");
-                    sdsfree(keyIR);
-                    keyIR = sdsnew(current_key);
-                    sprintf(valueIR, "%d",atoi(valueIR) + 1);
-                }
-            }
+              sdsfree(commandIR);
+              commandIR = sdsnew((char *) array_log_record_lines[2]);
+              sdstoupper(commandIR);
+              if(strcmp(commandIR, "SET") == 0){
+                  sdsfree(keyIR);
+                  keyIR = sdsnew(current_key);
+                  sdsfree(valueIR);
+                  valueIR = sdsnew((char *) array_log_record_lines[6]);
+                  expireIR = -1;
+              }else{
+                  if(strcmp(commandIR, "INCR") == 0){
+                      commandIR = sdscpy(commandIR, "SET");
+                      sdsfree(keyIR);
+                      keyIR = sdsnew(current_key);
+                      valueIR = incrLogRecordValue(valueIR);
+                  }else{
+                      int is_expire = 0;
+                      if(strcmp(commandIR, "PEXPIREAT") == 0){
+                          expireIR = strtoll(array_log_record_lines[6], NULL, 10);
+                          is_expire = 1;
+                      }else if(strcmp(commandIR, "PERSIST") == 0){
+                          expireIR = -1;
+                          is_expire = 1;
+                      }
+                      //The expire only changes the key restored by a SET or INCR read before
+                      if(is_expire && sdscmp(keyIR, current_key) == 0)
+                          commandIR = sdscpy(commandIR, "SET");
+                  }
+              }
 
-            //It is very important to free to avoid memory overhaed
-            sdsfreesplitres(array_log_record_lines, countArray);
+              //It is very important to free to avoid memory overhaed
+              sdsfreesplitres(array_log_record_lines, countArray);
             
-            error = cursorp->get(cursorp, &key, &data, DB_NEXT);
-            if(error == DB_NOTFOUND)
-                break;
-            sdsfree(current_key);
-            current_key = sdsnew((char *)key.data); 
-        }
+              error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT);
+              if(error != 0)
+                  break;
+              sdsfree(current_key);
+              current_key = sdsnew((char *)key.data); 
+          }
 
-        sdstoupper(commandIR);
-        if(strcmp(commandIR, "SET") == 0){
-            //Executes the command SetIR that stores a key/value into memory with logging.
-            reply = redisCommand(redisConnection,"setIR %s %s", keyIR, valueIR);
-            addRestoredTuple(keyIR);
-            if(reply->str != NULL){
-              count_tuples_loaded++;
-              server.count_tuples_loaded_incr = count_tuples_loaded;
-            }
-            else{
-              count_inconsistent_load++;
-            }
+          sdstoupper(commandIR);
+          ttl = expireIR != -1 ? expireIR - mstime() : 0;
+          if(strcmp(commandIR, "SET") == 0 && expireIR != -1 && ttl <= 0){
+              //The key expired while it was only in the indexed log, so it is not restored
+              addRestoredTuple(keyIR);
+              atomicIncr(server.count_tuples_expired, 1);
+          }else if(strcmp(commandIR, "SET") == 0){
+              //Executes the command SetIR that stores a key/value into memory with logging.
+              long long restore_start = ustime();
+              //The key of the indexed log is qualified by the database of the key
+              dbid = parseIndexedLogKey(keyIR, &key_restored);
+              if(dbid != connection_db){
+                  reply = redisCommand(redisConnection,"SELECT %d", dbid);
+                  //Otherwise the key would be restored in the database of the previous one
+                  if(reply == NULL || reply->type == REDIS_REPLY_ERROR){
+                      serverLog(LL_WARNING, "Can't select the database %d to restore the key %s: %s. Exiting...",
+                                dbid, key_restored, reply != NULL ? reply->str : redisConnection->errstr);
+                      exit(1);
+                  }
+                  connection_db = dbid;
+                  freeReplyObject(reply);
+              }
+              if(expireIR != -1)
+                  reply = redisCommand(redisConnection,"setIR %s %s PX %lld", key_restored, valueIR, ttl);
+              else
+                  reply = redisCommand(redisConnection,"setIR %s %s", key_restored, valueIR);
+              latencyHistogramAddSample(LATENCY_HIST_RESTORE_INCREMENTAL, ustime()-restore_start);
+              addRestoredTuple(keyIR);
+              if(reply->str != NULL){
+                count_tuples_loaded++;
+                atomicSet(server.count_tuples_loaded_incr, count_tuples_loaded);
+              }
+              else{
+                count_inconsistent_load++;
+              }
             
-            count_records_tuple = 0;
+              count_records_tuple = 0;
+              restorerFlowControl(&flow);
 
-            //Logs a information about the command executed to restore the database.
-            /*if(server.generate_setir_executed_commands_csv == IR_ON) 
-                addCommandExecuted(&last_cmd_executed_List, keyIR, "setIR", command_load_start, ustime(), 'I');*/
-        }
+              //Logs a information about the command executed to restore the database.
+              /*if(server.generate_setir_executed_commands_csv == IR_ON) 
+                  addCommandExecuted(&last_cmd_executed_List, keyIR, "setIR", command_load_start, ustime(), 'I');*/
+          }
+
+          displayRestorerInformation(&restoring_start_time, count_records, "3", "");
+      }
 
-        displayRestorerInformation(&restoring_start_time, count_records, "3", "");
+      if(error != 0 && error != INDEXEDLOG_NOTFOUND)
+        serverLog(LL_NOTICE, "⚠ ⚠ ⚠ ⚠ Error when scanning the partition %d of the Indexed Log: %s ⚠ ⚠ ⚠ ⚠ ", partition, indexedLogStrerror(error));
+      else if(server.instant_recovery_performing_stop == IR_OFF)
+        setPartitionSlotsRestored(partition);
+      indexedLogCursorClose(cursorp);
     }
 
-  server.count_tuples_loaded_incr = count_tuples_loaded;
-  server.count_inconsistent_load_incr = count_inconsistent_load;
+  atomicSet(server.count_tuples_loaded_incr, count_tuples_loaded);
+  atomicSet(server.count_inconsistent_load_incr, count_inconsistent_load);
 
   sdsfree(current_key);
   sdsfree(old_key);
@@ -2496,9 +4679,7 @@ void *loadDBFromIndexedLog () {
   sdsfree(valueIR);
   sdsfree(commandIR);
   redisFree(redisConnection);
-  if (cursorp != NULL)
-    cursorp->close(cursorp);
-  closeIndexedLog(dbp);
+  closeIndexedLogPartitions(dbps);
   clearHashRestoredTuples();
 
   server.recovery_end_time = ustime();
@@ -2522,6 +4703,7 @@ void *loadDBFromIndexedLog () {
   }
 
   server.instant_recovery_performing = IR_OFF;
+  unregisterThreadCpuClock(&restorer_thread_clock);
 
   return (void *)count_records; 
 }
@@ -2564,6 +4746,25 @@ long long int readFinalLogSeek(char *filename){
     return seek;
 }
 
+/*
+    Reads the database selected in the sequential log at the position stored in a file
+    written by writeFinalLogSeek(). The files written before SELECT was supported have
+    no database, so 0 is returned, as when the file does not exist.
+*/
+int readFinalLogSeekDb(char *filename){
+  FILE *binaryFile = fopen(filename, "rb"); 
+  unsigned long long int seek;
+  int dbid = 0;
+
+  if (binaryFile == NULL)
+    return 0;
+  if(fread(&seek, sizeof(unsigned long long int), 1, binaryFile) == 0 || 
+     fread(&dbid, sizeof(int), 1, binaryFile) == 0)
+    dbid = 0;
+  fclose(binaryFile);
+  return dbid;
+}
+
 /*
     Writes a pointer to the last record writed in the sequential log file of indexed log, 
     indexed log replica, or full checkpoint.
@@ -2571,9 +4772,10 @@ long long int readFinalLogSeek(char *filename){
     filename: can be one of the contants FINAL_LOG_SEEK, FINAL_LOG_SEEK_REPLICA, and 
               CHECKPOINT_LOG_SEEK defined in server.h file.
     seek: a log record postion 
+    dbid: the database selected in the sequential log at that position
 */
 
-int writeFinalLogSeek(char *filename, unsigned long long seek){
+int writeFinalLogSeek(char *filename, unsigned long long seek, int dbid){
   FILE *binaryFile = fopen(filename, "wb");
 
     if (binaryFile == NULL){
@@ -2582,6 +4784,8 @@ int writeFinalLogSeek(char *filename, unsigned long long seek){
     }
     
   int result = fwrite (&seek, sizeof(unsigned long long int), 1, binaryFile);
+  if(result == 1)
+    result = fwrite (&dbid, sizeof(int), 1, binaryFile);
   fclose(binaryFile);
 
   return result;
@@ -2598,7 +4802,7 @@ void generateFinalLogSeek(char *filename){
         printf("Fail to open log file!\n");
     }else{
       fseek(logFile, 0, SEEK_END);
-      writeFinalLogSeek(FINAL_LOG_SEEK, ftell(logFile));
+      writeFinalLogSeek(FINAL_LOG_SEEK, ftell(logFile), 0);
   }
 }
 
@@ -2659,7 +4863,7 @@ void displayIndexerInformation(long long *indexing_start_time, unsigned long lon
 
 /* 
     Copies the records from the sequential log file to the indexed log.
-    It works with a B-tree or Hash and requires the extra-flag DB_DUP (allows duplicate keys) in openIndexedLog() function.
+    It works with any indexed log engine, since all of them allow duplicate keys (see indexedlog.h).
     This version stores the records to indexed log directly from sequential log.
     Returns the number of processed log records (unsigned long long int).
 
@@ -2696,7 +4900,7 @@ void *indexesSequentialLogToIndexedLogV1() {
         exit(1);
     }
 
-    DB *dbp = openIndexedLog(indexedlog_filename, 'W', &ret);
+    indexedLog *dbp = openIndexedLog(indexedlog_filename, 'W', &ret);
     if(ret != 0){
         serverLog(LL_NOTICE,"Indexer cannot start! Cannot open the indexed log!");
         server.indexer_state = IR_OFF;
@@ -2718,8 +4922,8 @@ void *indexesSequentialLogToIndexedLogV1() {
 
         if (fgets(buf,sizeof(buf),fp) == NULL) {
             fclose(fp);
-            dbp->sync(dbp, 0);
-            writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file);
+            indexedLogSync(dbp);
+            writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file, 0);
 
             //Stores the time when the last checkpoint command log record is indexed
             /*if(last_checkpoint_indexed){
@@ -2877,9 +5081,12 @@ fmterr: /* Format error. */
 */
 typedef struct recordToIndex_type {
   char command[20];
-  char key[50];         
-  char value[50];           
+  char key[IR_RECORD_FIELD_LEN];         
+  char value[IR_RECORD_FIELD_LEN];           
+  int dbid;                 //database of the key, selected by the last SELECT in the sequential log
+  int partition;            //partition of the indexed log that stores the key
   struct recordToIndex_type *next;
+  struct recordToIndex_type *next_partition;  //next record of the same partition (see writeToIndexedLog())
 }recordToIndex;
 
 recordToIndex *first_recordToIndex = NULL, *last_recordToIndex = NULL;
@@ -2900,13 +5107,15 @@ void insertFirstRecordToIndex (recordToIndex **first_recordToIndex, recordToInde
 /*
     Inserts a record at the end of a linked list .  
 */
-void addRecordToIndex (recordToIndex **last_recordToIndex, char command[20], char key[50], char value[50]){
+void addRecordToIndex (recordToIndex **last_recordToIndex, char command[20], char key[50], char value[50], int dbid){
   recordToIndex *new = (recordToIndex *) zmalloc(sizeof(recordToIndex));
 
   strcpy(new->command, command);
   strcpy(new->key, key);
   if(value != NULL)
     strcpy(new->value, value);
+  new->dbid = dbid;
+  new->partition = getIndexedLogPartition(key);
   new->next = NULL;
 
   (*last_recordToIndex)->next = new;
@@ -2947,7 +5156,7 @@ int clearListRecordToIndex(recordToIndex **first_recordToIndex, recordToIndex **
 
     THIS FUNCTION SHOULD BE updated IN THE FUTURE
 */
-void replicateIndexedLog(DB *dbp, recordToIndex *ri, unsigned long long seek_log_file){
+void replicateIndexedLog(indexedLog *dbp, recordToIndex *ri, unsigned long long seek_log_file){
   const char SET_COMMAND[5]  = "SET", INCR_COMMAND[6]  = "INCR", DEL_COMMAND[5]  = "DEL", 
               SETCHECKPOINT_COMMAND[15]  = "SETCHECKPOINT", CHECKPOINTEND_COMMAND[15]  = "CHECKPOINTEND";
 
@@ -2955,8 +5164,8 @@ void replicateIndexedLog(DB *dbp, recordToIndex *ri, unsigned long long seek_log
     //Checks if the indexer recieved a stop signal and exits the loop if true
     /*if(server.indexer_state == IR_OFF){
       //Flushes de records to disk and sets position of the last record indexed in sequential log before exit.
-      dbp->sync(dbp, 0);
-      writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file);
+      indexedLogSync(dbp);
+      writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file, 0);
       return IR_OFF;
     }*/
 
@@ -2986,83 +5195,289 @@ void replicateIndexedLog(DB *dbp, recordToIndex *ri, unsigned long long seek_log
     ri = ri->next;
   }
   //Flushes de records to disk and sets position of the last record indexed in sequential log.
-  dbp->sync(dbp, 0);
-  writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file);
+  indexedLogSync(dbp);
+  writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file, 0);
 }
 
 /*
-  Writes and fluhses log records to the indexed log from a linked list.
-    dbp: pointer to the indexed log.
-    ri: linked list of log records to index.
+  Writes and fluhses log records of one partition to the indexed log from a linked list.
+    dbp: pointer to the partition of the indexed log.
+    ri: linked list of the log records of the partition to index (linked by next_partition).
     count_records: returns the number of log records processed.
     count_records_indexed: returns the number o log records indexed.
   The function returns IR_OFF if the funciton recived a signal to exit the indexing processing.
   Otherwise, returns IR_ON.
 */
-int writeToIndexedLog(DB *dbp, recordToIndex *ri, unsigned long long seek_log_file,
+int writeToIndexedLogPartition(indexedLog *dbp, recordToIndex *ri,
  unsigned long long int *count_records, unsigned long long int *count_records_indexed){
   const char SET_COMMAND[5]  = "SET", INCR_COMMAND[6]  = "INCR", DEL_COMMAND[5]  = "DEL", 
-              SETCHECKPOINT_COMMAND[15]  = "SETCHECKPOINT", CHECKPOINTEND_COMMAND[15]  = "CHECKPOINTEND";
+              SETCHECKPOINT_COMMAND[15]  = "SETCHECKPOINT", CHECKPOINTEND_COMMAND[15]  = "CHECKPOINTEND",
+              PEXPIREAT_COMMAND[10]  = "PEXPIREAT", PERSIST_COMMAND[8]  = "PERSIST";
+  long long write_start = ustime(), sync_start;
   *count_records = 0;
   *count_records_indexed = 0;
 
   while(ri != NULL){
     //Checks if the indexer recieved a stop signal and exits the loop if true
     if(server.indexer_state == IR_OFF){
-      //Flushes de records to disk and sets position of the last record indexed in sequential log before exit.
-      dbp->sync(dbp, 0);
-      writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file);
+      //Flushes de records to disk before exit.
+      indexedLogSync(dbp);
       return IR_OFF;
     }
 
+    //The key in the indexed log is qualified by the database of the log record
+    sds ikey = getIndexedLogKey(ri->dbid, ri->key);
+
     if(strcmp(ri->command, SET_COMMAND) == 0){
-      //delRecordIndexdLog(dbp, ri->key);
+      //delRecordIndexdLog(dbp, ikey);
       char aux[200];
-      sprintf(aux, "*3\n$3\nSET\n$%ld\n%s\n$%ld\n%s", sdslen(ri->key), ri->key, sdslen(ri->value), ri->value);
-      addRecordIndexedLog(dbp, ri->key, aux);///createSetLogRecord(ri->key, ri->value)); //the function createSetLogRecord() is a source of memory overhead. So, we had to creat a record manually.
+      sprintf(aux, "*3\n$3\nSET\n$%ld\n%s\n$%ld\n%s", strlen(ri->key), ri->key, strlen(ri->value), ri->value);
+      addRecordIndexedLog(dbp, ikey, aux);///createSetLogRecord(ri->key, ri->value)); //the function createSetLogRecord() is a source of memory overhead. So, we had to creat a record manually.
       *count_records_indexed = *count_records_indexed + 1;
       //printf("set indexed\n");
     }else{
       if(strcmp(ri->command, INCR_COMMAND) == 0){
+        //INCR has no value in the sequential log and keeps the expire of the key, so it is
+        //indexed as is and redone by the restorer
         char aux[200];
-        sprintf(aux, "*3\n$3\nSET\n$%ld\n%s\n$%ld\n%s", sdslen(ri->key), ri->key, sdslen(ri->value), ri->value);
-        addRecordIndexedLog(dbp, ri->key, aux);///createSetLogRecord(ri->key, ri->value));
+        sprintf(aux, "*2\n$4\nINCR\n$%ld\n%s", strlen(ri->key), ri->key);
+        addRecordIndexedLog(dbp, ikey, aux);///createIncrLogRecord(ri->key));
         *count_records_indexed = *count_records_indexed + 1;
       }else{
         if(strcmp(ri->command, DEL_COMMAND) == 0){
-          delRecordIndexdLog(dbp, ri->key);
+          delRecordIndexdLog(dbp, ikey);
           *count_records_indexed = *count_records_indexed + 1;
         }else{
           if(strcmp(ri->command, SETCHECKPOINT_COMMAND) == 0){
-            delRecordIndexdLog(dbp, ri->key);
+            delRecordIndexdLog(dbp, ikey);
             char aux[200];
-            sprintf(aux, "*3\n$3\nSET\n$%ld\n%s\n$%ld\n%s", sdslen(ri->key), ri->key, sdslen(ri->value), ri->value);
-            addRecordIndexedLog(dbp, ri->key, aux);///createSetLogRecord(ri->key, ri->value));
+            sprintf(aux, "*3\n$3\nSET\n$%ld\n%s\n$%ld\n%s", strlen(ri->key), ri->key, strlen(ri->value), ri->value);
+            addRecordIndexedLog(dbp, ikey, aux);///createSetLogRecord(ri->key, ri->value));
             *count_records_indexed = *count_records_indexed + 1;
           }else{
             if(strcmp(ri->command, CHECKPOINTEND_COMMAND) == 0){
               ;//Fazer Checkpoint End aqui
+            }else{
+              //The absolute expire time of the key (EXPIRE, SET EX, etc. are logged as PEXPIREAT)
+              if(strcmp(ri->command, PEXPIREAT_COMMAND) == 0){
+                char aux[200];
+                sprintf(aux, "*3\n$9\nPEXPIREAT\n$%ld\n%s\n$%ld\n%s", strlen(ri->key), ri->key, strlen(ri->value), ri->value);
+                addRecordIndexedLog(dbp, ikey, aux);
+                *count_records_indexed = *count_records_indexed + 1;
+              }else{
+                if(strcmp(ri->command, PERSIST_COMMAND) == 0){
+                  char aux[200];
+                  sprintf(aux, "*2\n$7\nPERSIST\n$%ld\n%s", strlen(ri->key), ri->key);
+                  addRecordIndexedLog(dbp, ikey, aux);
+                  *count_records_indexed = *count_records_indexed + 1;
+                }
+              }
             }
           }
         }
       }
     }
 
+    sdsfree(ikey);
     *count_records = *count_records+1;
-    ri = ri->next;
+    ri = ri->next_partition;
   }
-  //Flushes de records to disk and sets position of the last record indexed in sequential log.
-  dbp->sync(dbp, 0);
-  writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file);
-  server.seek_log_file = seek_log_file;
+  sync_start = ustime();
+  latencyHistogramAddSample(LATENCY_HIST_INDEXER_WRITE, sync_start-write_start);
+  //Flushes de records to disk.
+  indexedLogSync(dbp);
+  latencyHistogramAddSample(LATENCY_HIST_INDEXER_SYNC, ustime()-sync_start);
 
   return IR_ON;
 }
 
+/*
+    Publishes the position of the last log record indexed in the sequential log and the
+    database selected there. They are set together, so a reader (the checkpoint) never
+    gets a position with the database of another one. seek_log_file alone can still be
+    read with atomicGet().
+*/
+static void setIndexedLogSeek(unsigned long long seek_log_file, int seek_log_db){
+  pthread_mutex_lock(&server.lock_seek_log);
+  atomicSet(server.seek_log_file, seek_log_file);
+  server.seek_log_db = seek_log_db;
+  pthread_mutex_unlock(&server.lock_seek_log);
+}
+
+/*
+    Reads the position and the database published by setIndexedLogSeek().
+*/
+static void getIndexedLogSeek(unsigned long long *seek_log_file, int *seek_log_db){
+  pthread_mutex_lock(&server.lock_seek_log);
+  *seek_log_file = server.seek_log_file;
+  *seek_log_db = server.seek_log_db;
+  pthread_mutex_unlock(&server.lock_seek_log);
+}
+
+/*
+    The log records of one partition of a batch, written by a thread of the pool below.
+*/
+typedef struct partitionWriter_type {
+  indexedLog *dbp;
+  recordToIndex *first;     //records of the partition, linked by next_partition
+  recordToIndex *last;
+  unsigned long long int count_records;
+  unsigned long long int count_records_indexed;
+  int signal;
+}partitionWriter;
+
+/*
+    Pool of threads that write the partitions of a batch in parallel. The threads are created
+    with the first batch and wait for the next ones. The indexer thread also writes partitions
+    of the batch until all of them are taken, so the batch is written even if no thread could
+    be created.
+*/
+static struct {
+  pthread_mutex_t lock;
+  pthread_cond_t work;          //signaled when a batch is handed to the pool
+  pthread_cond_t done;          //signaled when the last partition of the batch is written
+  int started;
+  int nthreads;
+  partitionWriter **pws;        //partitions of the batch in progress
+  int count;                    //partitions of the batch
+  int next;                     //next partition to take
+  int pending;                  //partitions not written yet
+} partitionWriters = {
+  .lock = PTHREAD_MUTEX_INITIALIZER,
+  .work = PTHREAD_COND_INITIALIZER,
+  .done = PTHREAD_COND_INITIALIZER,
+};
+
+/*
+    Takes the next partition of the batch and writes it. Called with the lock of the pool held,
+    that is released while the partition is written.
+*/
+static void writeNextPartition(){
+  partitionWriter *pw = partitionWriters.pws[partitionWriters.next++];
+
+  pthread_mutex_unlock(&partitionWriters.lock);
+  pw->signal = writeToIndexedLogPartition(pw->dbp, pw->first, &pw->count_records, &pw->count_records_indexed);
+  pthread_mutex_lock(&partitionWriters.lock);
+  if(--partitionWriters.pending == 0)
+    pthread_cond_signal(&partitionWriters.done);
+}
+
+/*
+    Thread of the pool that writes the partitions of the indexed log.
+*/
+static void *partitionWriter_thread(void *arg){
+  UNUSED(arg);
+
+  pthread_mutex_lock(&partitionWriters.lock);
+  while(1){
+    while(partitionWriters.next >= partitionWriters.count)
+      pthread_cond_wait(&partitionWriters.work, &partitionWriters.lock);
+    writeNextPartition();
+  }
+  return (void *)0;
+}
+
+/*
+    Starts the threads of the pool: one per partition, besides the indexer thread, up to 
+    IR_INDEXER_WRITERS_MAX threads.
+*/
+static void startPartitionWriters(){
+  pthread_t thread;
+  int j, nthreads = server.indexedlog_partitions-1;
+
+  partitionWriters.started = 1;
+  if(nthreads > IR_INDEXER_WRITERS_MAX)
+    nthreads = IR_INDEXER_WRITERS_MAX;
+  for(j = 0; j < nthreads; j++){
+    if(pthread_create(&thread, NULL, partitionWriter_thread, NULL) != 0){
+      serverLog(LL_WARNING, "Can't create a thread to write the indexed log: %s", strerror(errno));
+      break;
+    }
+    partitionWriters.nthreads++;
+  }
+}
+
+/*
+  Writes and fluhses log records to the indexed log from a linked list.
+  The records are bucketed by partition in a single pass, and if more than one partition 
+  has records, the partitions are written and flushed in parallel by the pool of threads
+  above. The partitions without records are not flushed.
+    dbps: pointers to the partitions of the indexed log.
+    ri: linked list of log records to index.
+    seek_log_file, seek_log_db: position in the sequential log after the log records, and
+      the database selected at that position.
+    count_records: returns the number of log records processed.
+    count_records_indexed: returns the number o log records indexed.
+  The function returns IR_OFF if the funciton recived a signal to exit the indexing processing.
+  Otherwise, returns IR_ON.
+*/
+int writeToIndexedLog(indexedLog **dbps, recordToIndex *ri, unsigned long long seek_log_file,
+ int seek_log_db, unsigned long long int *count_records, unsigned long long int *count_records_indexed){
+  int signal = IR_ON, count = 0, j;
+  partitionWriter *pws = zcalloc(sizeof(partitionWriter)*server.indexedlog_partitions);
+  partitionWriter **batch = zmalloc(sizeof(partitionWriter*)*server.indexedlog_partitions);
+
+  for(; ri != NULL; ri = ri->next){
+    partitionWriter *pw = &pws[ri->partition];
+    ri->next_partition = NULL;
+    if(pw->first == NULL){
+      pw->dbp = dbps[ri->partition];
+      pw->first = ri;
+      batch[count++] = pw;
+    }else{
+      pw->last->next_partition = ri;
+    }
+    pw->last = ri;
+  }
+
+  if(count == 1){
+    batch[0]->signal = writeToIndexedLogPartition(batch[0]->dbp, batch[0]->first, 
+                         &batch[0]->count_records, &batch[0]->count_records_indexed);
+  }else if(count > 1){
+    pthread_mutex_lock(&partitionWriters.lock);
+    if(!partitionWriters.started)
+      startPartitionWriters();
+    partitionWriters.pws = batch;
+    partitionWriters.count = count;
+    partitionWriters.next = 0;
+    partitionWriters.pending = count;
+    pthread_cond_broadcast(&partitionWriters.work);
+    while(partitionWriters.next < partitionWriters.count)
+      writeNextPartition();
+    while(partitionWriters.pending > 0)
+      pthread_cond_wait(&partitionWriters.done, &partitionWriters.lock);
+    partitionWriters.pws = NULL;
+    partitionWriters.count = 0;
+    partitionWriters.next = 0;
+    pthread_mutex_unlock(&partitionWriters.lock);
+  }
+
+  *count_records = 0;
+  *count_records_indexed = 0;
+  for(j = 0; j < count; j++){
+    *count_records = *count_records + batch[j]->count_records;
+    *count_records_indexed = *count_records_indexed + batch[j]->count_records_indexed;
+    if(batch[j]->signal == IR_OFF)
+      signal = IR_OFF;
+  }
+  zfree(batch);
+  zfree(pws);
+
+  //The batch is in the indexed log, but the indexer seek is not updated yet
+  crashPointReached(IR_CRASH_INDEXER_BATCH);
+
+  //Sets position of the last record indexed in sequential log.
+  writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file, seek_log_db);
+  if(signal == IR_ON)
+    setIndexedLogSeek(seek_log_file, seek_log_db);
+
+  return signal;
+}
+
 /*
   Copies the records from the sequential log file to the indexed log.
-  It works with a B-tree or Hash and requires the extra-flag DB_DUP (allows duplicate keys) 
-  in openIndexedLog() function.
+  It works with any indexed log engine, since all of them allow duplicate keys 
+  (see indexedlog.h).
   This version first stores the records in a linked list and after copies the records to 
   the indexed log.
   Returns the number of processed log records (unsigned long long int).
@@ -3074,10 +5489,11 @@ void *indexesSequentialLogToIndexedLogV2() {
     server.indexer_state = IR_ON;
     server.indexer_performing = IR_ON;
     serverLog(LL_NOTICE,"Indexer thread V2 started!");
+    registerThreadCpuClock(&indexer_thread_clock);
 
     unsigned long long seek_log_file = readFinalLogSeek(FINAL_LOG_SEEK);
+    int dbid = readFinalLogSeekDb(FINAL_LOG_SEEK); //database selected in the sequential log
     char *aof_filename = server.aof_filename;
-    char *indexedlog_filename = server.indexedlog_filename;
 
     FILE *fp = fopen(aof_filename,"r");
     fseek(fp, seek_log_file, SEEK_SET);
@@ -3088,18 +5504,19 @@ void *indexesSequentialLogToIndexedLogV2() {
     fclose(fp);
     
     int ret;
-    DB *dbp = openIndexedLog(indexedlog_filename, 'W', &ret);
+    indexedLog **dbps = openIndexedLogPartitions(server.indexedlog_filename, 'W', &ret);
     if(ret != 0){
         serverLog(LL_NOTICE,"Indexer cannot start! Cannot open the indexed log!");
         server.indexer_state = IR_OFF;
         server.indexer_performing = IR_OFF;
+        unregisterThreadCpuClock(&indexer_thread_clock);
         return (void *)0;
     }
     
   /*  THE REPLICATION SHOULD BE IMPLEMENTED IF IT IS NECESSARY
       SO SEE THE FUNCION replicateIndexedLog()
 
-    DB *dbp_replica = NULL;
+    indexedLog *dbp_replica = NULL;
     if(server.indexedlog_replicated == IR_ON){
       dbp_replica = openIndexedLog(server.indexedlog_replicated_filename, 'W', &ret);
       if(ret != 0){
@@ -3121,6 +5538,7 @@ void *indexesSequentialLogToIndexedLogV2() {
     long long indexing_start_time;
     int argc, j;
     unsigned long len;
+    unsigned long long snapshot_limit, rewrite_seek;
     char buf[128];
     sds argsds;
     indexing_start_time_ToDiplay = ustime();
@@ -3135,6 +5553,24 @@ void *indexesSequentialLogToIndexedLogV2() {
 
         usleep(server.indexer_time_interval);
 
+        //At the end of the scan of an AOF rewrite from the indexed log, the Indexer waits 
+        //for the new AOF and goes on at the same log record in it (see 
+        //checkIndexedLogAofRewriteDone())
+        atomicGet(server.indexedlog_snapshot_limit, snapshot_limit);
+        if(snapshot_limit && seek_log_file >= snapshot_limit){
+          atomicGet(server.indexedlog_rewrite_seek, rewrite_seek);
+          if(rewrite_seek){
+            seek_log_file = rewrite_seek;
+            setIndexedLogSeek(seek_log_file, dbid);
+            atomicSet(server.indexedlog_rewrite_seek, 0);
+            atomicSet(server.indexer_paused_at_limit, 0);
+            atomicSet(server.indexedlog_snapshot_limit, 0);
+          }else{
+            atomicSet(server.indexer_paused_at_limit, 1);
+            continue;
+          }
+        }
+
         fp = fopen(aof_filename, "r");
         fseek(fp, seek_log_file, SEEK_SET);
         if(fgets(buf,sizeof(buf),fp) == NULL)
@@ -3156,6 +5592,12 @@ void *indexesSequentialLogToIndexedLogV2() {
         if(server.indexer_state == IR_OFF)
           break;
 
+        //The log records after the end of a snapshot of the indexed log for replication are
+        //not indexed until the snapshot is read (see startIndexedLogSnapshot())
+        atomicGet(server.indexedlog_snapshot_limit, snapshot_limit);
+        if(snapshot_limit && seek_log_file >= snapshot_limit)
+          break;
+
         seek_log_file = seek_log_file + strlen(buf);
 
         log_record = sdscpy(log_record , buf); 
@@ -3199,7 +5641,11 @@ void *indexesSequentialLogToIndexedLogV2() {
             sdsfree(argsds);
         }
         
-        addRecordToIndex(&last_recordToIndex, command, key, value);
+        //SELECT changes the database of the next log records
+        if(strcmp(command, "SELECT") == 0)
+          dbid = atoi(key);
+        else
+          addRecordToIndex(&last_recordToIndex, command, key, value, dbid);
         //printf("processed! c=%s\n", command);
       }while(fgets(buf,sizeof(buf),fp) != NULL);
       fclose(fp);
@@ -3212,7 +5658,9 @@ void *indexesSequentialLogToIndexedLogV2() {
       if(ri != NULL){
         unsigned long long int count_recs, count_recs_indexed;
         
-        int signal = writeToIndexedLog(dbp, ri, seek_log_file, &count_recs, &count_recs_indexed);
+        pthread_mutex_lock(&server.lock_indexing);
+        int signal = writeToIndexedLog(dbps, ri, seek_log_file, dbid, &count_recs, &count_recs_indexed);
+        pthread_mutex_unlock(&server.lock_indexing);
         
         //Stores information to generate indexing report
         if(server.generate_indexing_report_csv == IR_ON)
@@ -3225,6 +5673,7 @@ void *indexesSequentialLogToIndexedLogV2() {
         
         count_records = count_records + count_recs;
         count_records_indexed = count_records_indexed +count_recs_indexed;
+        atomicIncr(server.count_log_records_indexed, count_recs);
         count_records_ToDiplay = count_records_ToDiplay + count_recs;
         count_records_indexed_ToDiplay = count_records_indexed_ToDiplay + count_recs_indexed;
 
@@ -3242,7 +5691,7 @@ void *indexesSequentialLogToIndexedLogV2() {
     sdsfree(key);
     sdsfree(log_record);
     sdsfree(command);
-    closeIndexedLog(dbp);
+    closeIndexedLogPartitions(dbps);
     /*  THE REPLICATION SHOULD BE IMPLEMENTED IF IT IS NECESSARY
     if(server.indexedlog_replicated == IR_ON)
       closeIndexedLog(dbp_replica);
@@ -3251,6 +5700,7 @@ void *indexesSequentialLogToIndexedLogV2() {
 
     server.indexer_state = IR_OFF;
     server.indexer_performing = IR_OFF;
+    unregisterThreadCpuClock(&indexer_thread_clock);
 
     serverLog(LL_WARNING,"Indexer thread stopped! Number of log records processed = %llu. "
       "Number of log records indexed = %llu", count_records, count_records_indexed);
@@ -3291,13 +5741,13 @@ void waitIndexerFinish(){
     Copies the remain records from the sequential log file to the indexed log on database restart.
     When the database crashes, log record could not be indexed because the de indexing is asynchronous.
     This version allows duplicate keys, i.e. a key can be more than a log record on indexed log.
-    It works with a B-tree or Hase and requires the extra-flag DB_DUP (allows duplicate keys) 
-    in openIndexedLog() function.
+    It works with any indexed log engine, since all of them allow duplicate keys 
+    (see indexedlog.h).
 */
 unsigned long long initialIndexesSequentialLogToIndexedLog() {
     server.initial_indexing_start_time = ustime();
 
-    int errorLog, errorSync = 0;
+    int errorLog, errorSync = 0, partition, replica_used = 0;
     //Reads the position of the last log record indexed on sequential log.
     long long int seek_log_file = readFinalLogSeek(FINAL_LOG_SEEK);
     if(seek_log_file == -1){
@@ -3305,50 +5755,86 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
         errorSync = 1;
         seek_log_file = 0;
     }
-    
-    //Open/create the indexed log to start the indexing.
-    DB *dbp = openIndexedLog(server.indexedlog_filename, 'R', &errorLog);
-    closeIndexedLog(dbp);
     if(errorSync != 0)
       serverLog(LL_NOTICE,"Cannot open the indexed log1!");
 
-    if(errorLog != 0 || errorSync != 0){
+    /* Each partition of the indexed log is indexed from its own position in the sequential log. 
+       It is the position of the last log record indexed if the partition is fine. Otherwise, 
+       only the partition is restored from its replica or rebuilt from the last checkpoint. */
+    long long int *partition_seek = zmalloc(sizeof(long long int)*server.indexedlog_partitions);
+    long long int start_seek = seek_log_file;
+    //Database selected in the sequential log at the start position
+    int dbid = readFinalLogSeekDb(FINAL_LOG_SEEK), partition_db, start_db = dbid;
+    indexedLog *dbp;
+    for(partition = 0; partition < server.indexedlog_partitions; partition++){
+      partition_seek[partition] = seek_log_file;
+      partition_db = dbid;
+
+      //Opens the partition to check it
+      dbp = openIndexedLogPartition(server.indexedlog_filename, partition, 'R', &errorLog);
+      closeIndexedLog(dbp);
+      if(errorLog == 0 && errorSync == 0)
+        continue;
+
+      sds partition_filename = getIndexedLogPartitionFilename(server.indexedlog_filename, partition);
+      int replica_found = 0;
       //Tries to use the indexed log file replica    
       if(server.indexedlog_replicated == IR_ON){
+        sds replica_filename = getIndexedLogPartitionFilename(server.indexedlog_replicated_filename, partition);
         serverLog(LL_NOTICE,"The system will try to use the indexed log file replica!");
-        remove(server.indexedlog_filename);
-        if(rename(server.indexedlog_replicated_filename, server.indexedlog_filename) == 0){
-            seek_log_file = readFinalLogSeek(FINAL_LOG_SEEK_REPLICA);
-            server.indexedlog_replicated = IR_OFF;
-            errorLog = 1;
-            serverLog(LL_NOTICE,"Indexed log file replica found!");
+        remove(partition_filename);
+        if(rename(replica_filename, partition_filename) == 0){
+            partition_seek[partition] = readFinalLogSeek(FINAL_LOG_SEEK_REPLICA);
+            partition_db = readFinalLogSeekDb(FINAL_LOG_SEEK_REPLICA);
+            replica_found = 1;
+            replica_used = 1;
+            serverLog(LL_NOTICE,"Indexed log file replica found! Partition = %d", partition);
           }else{
             serverLog(LL_NOTICE,"Cannot open the indexed log file replica!");
-            errorLog = 0;
           }
+        sdsfree(replica_filename);
       }
 
-      if(errorLog == 0){
+      if(!replica_found){
+        //A corrupted partition is removed to be rebuilt
+        if(errorLog != 0)
+          remove(partition_filename);
         //Tries to find the last checkpoint begining position
-        seek_log_file = readFinalLogSeek(CHECKPOINT_LOG_SEEK);
-        if(seek_log_file == -1){
-          seek_log_file = 0;
+        partition_seek[partition] = readFinalLogSeek(CHECKPOINT_LOG_SEEK);
+        partition_db = readFinalLogSeekDb(CHECKPOINT_LOG_SEEK);
+        if(partition_seek[partition] == -1){
+          partition_seek[partition] = 0;
+          partition_db = 0;
         }
         else
-          serverLog(LL_NOTICE,"The indexed log will be rebuild from the last checkpoint!");
+          serverLog(LL_NOTICE,"The partition %d of the indexed log will be rebuild from the last checkpoint!", partition);
+      }
+      sdsfree(partition_filename);
+
+      if(partition_seek[partition] < start_seek){
+        start_seek = partition_seek[partition];
+        start_db = partition_db;
       }
     }
+    if(replica_used)
+      server.indexedlog_replicated = IR_OFF;
+    seek_log_file = start_seek;
+    dbid = start_db;
 
-    DB *dbp_replica = NULL;
+    indexedLog **dbps_replica = NULL;
     if(server.indexedlog_replicated == IR_ON){
-      dbp_replica = openIndexedLog(server.indexedlog_replicated_filename, 'W', &errorLog);
-      //if(errorLog != 0)
-      //  serverLog(LL_NOTICE,"Cannot open the indexed log file replica!");
+      dbps_replica = openIndexedLogPartitions(server.indexedlog_replicated_filename, 'W', &errorLog);
+      if(errorLog != 0){
+        serverLog(LL_NOTICE,"Cannot open the indexed log file replica!");
+        server.indexedlog_replicated = IR_OFF;
+      }
     }
 
-    dbp = openIndexedLog(server.indexedlog_filename, 'W', &errorLog);
+    indexedLog **dbps = openIndexedLogPartitions(server.indexedlog_filename, 'W', &errorLog);
     if(errorLog != 0){
       serverLog(LL_NOTICE,"Cannot open the indexed log! The initial indexing could not start!");
+      zfree(partition_seek);
+      closeIndexedLogPartitions(dbps_replica);
       return 0;
     }
 
@@ -3379,17 +5865,23 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
         }else//If the indexed and sequential log files are empty ou don't exist.
             serverLog(LL_NOTICE,"The indexing could not start since sequential log file is empty!");
         seek_log_file = 0;
-        writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file);
-        closeIndexedLog(dbp);
+        writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file, 0);
+        closeIndexedLogPartitions(dbps);
+        closeIndexedLogPartitions(dbps_replica);
+        zfree(partition_seek);
         return 0;
     }
 
     serverLog(LL_NOTICE,"Indexing the remaining log records after the last shutdown/crash ... Wait!");
 
-    sds log_record = sdsnew(""), key = sdsnew(""), command = sdsnew("");
+    sds log_record = sdsnew(""), key = sdsnew(""), ikey = sdsnew(""), command = sdsnew("");
     const sds SET_COMMAND  = sdsnew("SET"), 
           INCR_COMMAND  = sdsnew("INCR"), 
-          DEL_COMMAND  = sdsnew("DEL");
+          DEL_COMMAND  = sdsnew("DEL"),
+          PEXPIREAT_COMMAND  = sdsnew("PEXPIREAT"),
+          PERSIST_COMMAND  = sdsnew("PERSIST");
+    indexedLog *dbp_replica = NULL;
+    long long int record_seek;
     /* Read the actual AOF file, in REPL format, command by command. */
     while(1) {
         int argc, j;
@@ -3402,6 +5894,7 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
         }
         count_records++;
 
+        record_seek = seek_log_file;
         seek_log_file = seek_log_file +  strlen(buf);
         log_record = sdscpy(log_record , buf);
         
@@ -3444,27 +5937,46 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
             sdsfree(argsds);
         } 
         
+        //SELECT changes the database of the next log records
         sdstoupper(command);
+        if(strcmp(command, "SELECT") == 0){
+            dbid = atoi(key);
+            continue;
+        }
+
+        //Skips the log records already indexed in the partition of the key
+        partition = getIndexedLogPartition(key);
+        if(record_seek < partition_seek[partition])
+            continue;
+        dbp = dbps[partition];
+        if(server.indexedlog_replicated == IR_ON)
+            dbp_replica = dbps_replica[partition];
+        //The key in the indexed log is qualified by the database of the log record
+        sdsfree(ikey);
+        ikey = getIndexedLogKey(dbid, key);
+
         if(sdscmp(command, SET_COMMAND) == 0){
-            delRecordIndexdLog(dbp, key);
-            addRecordIndexedLog(dbp, key, log_record);
+            delRecordIndexdLog(dbp, ikey);
+            addRecordIndexedLog(dbp, ikey, log_record);
             count_records_indexed++;
             if(server.indexedlog_replicated == IR_ON){
-              delRecordIndexdLog(dbp_replica, key);
-              addRecordIndexedLog(dbp_replica, key, log_record);
+              delRecordIndexdLog(dbp_replica, ikey);
+              addRecordIndexedLog(dbp_replica, ikey, log_record);
             }
         }else{
-            if(sdscmp(command, INCR_COMMAND) == 0){
-                addRecordIndexedLog(dbp, key, log_record);
+            //INCR and the expire (PEXPIREAT/PERSIST) are redone after the last SET of the key
+            if(sdscmp(command, INCR_COMMAND) == 0 || sdscmp(command, PEXPIREAT_COMMAND) == 0 ||
+               sdscmp(command, PERSIST_COMMAND) == 0){
+                addRecordIndexedLog(dbp, ikey, log_record);
                 count_records_indexed++;
                 if(server.indexedlog_replicated == IR_ON)
-                  addRecordIndexedLog(dbp_replica, key, log_record);
+                  addRecordIndexedLog(dbp_replica, ikey, log_record);
             }else{
                 if(sdscmp(command, DEL_COMMAND) == 0){
-                    delRecordIndexdLog(dbp, key);
+                    delRecordIndexdLog(dbp, ikey);
                     count_records_indexed++;
                     if(server.indexedlog_replicated == IR_ON)
-                      delRecordIndexdLog(dbp_replica, key);
+                      delRecordIndexdLog(dbp_replica, ikey);
                 }
             }
         }
@@ -3474,17 +5986,21 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
     server.count_initial_records_proc = count_records;
     server.initial_indexed_records = count_records_indexed;
 
-    writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file);
-    server.seek_log_file = seek_log_file;
+    writeFinalLogSeek(FINAL_LOG_SEEK, seek_log_file, dbid);
+    setIndexedLogSeek(seek_log_file, dbid);
     
     sdsfree(key);
     sdsfree(log_record);
     sdsfree(SET_COMMAND);
     sdsfree(INCR_COMMAND);
     sdsfree(DEL_COMMAND);
+    sdsfree(PEXPIREAT_COMMAND);
+    sdsfree(PERSIST_COMMAND);
     sdsfree(command);
+    sdsfree(ikey);
     fclose(fp);
-    closeIndexedLog(dbp);
+    closeIndexedLogPartitions(dbps);
+    zfree(partition_seek);
 
     serverLog(LL_NOTICE,"Initial log indexing finished: %.3f seconds. Number of log records processed = %llu."
       " Number of records on indexed log = %llu.",
@@ -3492,8 +6008,8 @@ unsigned long long initialIndexesSequentialLogToIndexedLog() {
         count_records, count_records_indexed);
 
     if(server.indexedlog_replicated == IR_ON){
-      writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file);
-      closeIndexedLog(dbp_replica);
+      writeFinalLogSeek(FINAL_LOG_SEEK_REPLICA, seek_log_file, dbid);
+      closeIndexedLogPartitions(dbps_replica);
       serverLog(LL_NOTICE,"The indexed log file replica was updated!");
     }
 
@@ -3512,6 +6028,9 @@ fmterr: /* Format error. */
 } 
 
 
+/* Database selected by the last SELECT written to the sequential log. */
+static int synchronous_indexing_db = 0;
+
 /*
     Indexes a log record on indexed log sychronously, i.e., the transaction should wait to an
     insertion in the indexed log. This fucntion is called by the aofWrite() function on aof.c .
@@ -3524,83 +6043,107 @@ void synchronousIndexing(const char *buf){
       if(server.instant_recovery_synchronous == IR_ON){
           //printf("record = %s, len = %ld\n", buf, strlen(buf));
           sds dataSds;
-          int ret, countArray;
-          DB *dbp = openIndexedLog(server.indexedlog_filename, 'W', &ret);
-          if(ret != 0){
-              serverLog(LL_NOTICE,"Cannot open the indexed log! Cannot index the log record synchronously!");
-          }else{
-              //char **array_log_record_lines = str_split((char *)buf, '\n');
+          int ret, countArray, partition;
+          //The partitions of the indexed log are openned only when a key of them is indexed
+          indexedLog *dbp, **dbps = zcalloc(sizeof(indexedLog*)*server.indexedlog_partitions);
+          //char **array_log_record_lines = str_split((char *)buf, '\n');
 
-              dataSds = sdsnew((char *)buf);
-              char ** array_log_record_lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &countArray);
-              sdsfree(dataSds);
+          dataSds = sdsnew((char *)buf);
+          char ** array_log_record_lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &countArray);
+          sdsfree(dataSds);
 
-              /*printf("array count = %d\n", countArray);
-              for(int j=0; j<=countArray; j++){
-                
-                if(array_log_record_lines[j] == NULL){
-                  printf("break line %d\n", j);
-                }else
-                  if(strlen(array_log_record_lines[j]) == 0){
-                    printf("empty line %d\n", j);
-                  }else
-                   printf("line %d: %s\n", j, array_log_record_lines[j]);
-              }*/
+          /*printf("array count = %d\n", countArray);
+          for(int j=0; j<=countArray; j++){
+            
+            if(array_log_record_lines[j] == NULL){
+              printf("break line %d\n", j);
+            }else
+              if(strlen(array_log_record_lines[j]) == 0){
+                printf("empty line %d\n", j);
+              }else
+               printf("line %d: %s\n", j, array_log_record_lines[j]);
+          }*/
+          
+
+          int k = 0, argc;
+          char log_record[600], key[50], value[50], command [50], str_aux[50];
+
+          int i = 1;
+          while( k <  countArray){
+            if(array_log_record_lines[k] == NULL){
+              //printf("break line %d\n", k);
+              break;
+            }
+            if(strlen(array_log_record_lines[k]) == 0){
+              //printf("empty line %d\n", k);
+              break;
+            }
+              //printf("i = %d, k = %d => ", i, k);
+              strcpy(str_aux, array_log_record_lines[k]);
+              argc = atoi(str_aux+1); //number of log record parameters
               
-
-              int k = 0, argc;
-              char log_record[600], key[50], value[50], command [50], str_aux[50];
-
-              int i = 1;
-              while( k <  countArray){
-                if(array_log_record_lines[k] == NULL){
-                  //printf("break line %d\n", k);
-                  break;
-                }
-                if(strlen(array_log_record_lines[k]) == 0){
-                  //printf("empty line %d\n", k);
-                  break;
-                }
-                  //printf("i = %d, k = %d => ", i, k);
-                  strcpy(str_aux, array_log_record_lines[k]);
-                  argc = atoi(str_aux+1); //number of log record parameters
-                  
-                  strcpy(command, array_log_record_lines[k+2]);
-                  command[strlen(command)-1] = '\0';
-                  if(strlen(command) == 0)
-                    break;
-                  strcpy(key, array_log_record_lines[k+4]);
-                  key[strlen(key)-1] = '\0';
-                  //printf("command = %s, key = %s\n", command, key);
-                  
-                  if(strcasecmp(command, "SET") == 0){
+              strcpy(command, array_log_record_lines[k+2]);
+              command[strlen(command)-1] = '\0';
+              if(strlen(command) == 0)
+                break;
+              strcpy(key, array_log_record_lines[k+4]);
+              key[strlen(key)-1] = '\0';
+              //printf("command = %s, key = %s\n", command, key);
+              
+              //SELECT changes the database of the next log records
+              if(strcasecmp(command, "SELECT") == 0)
+                  synchronous_indexing_db = atoi(key);
+
+              if(strcasecmp(command, "SET") == 0 || strcasecmp(command, "PEXPIREAT") == 0 ||
+                 strcasecmp(command, "PERSIST") == 0){
+                  //generates da log record
+                  if(strcasecmp(command, "SET") == 0)
+                      strcpy(log_record, "*3\n$3\nSET\n$");
+                  else if(strcasecmp(command, "PEXPIREAT") == 0)
+                      strcpy(log_record, "*3\n$9\nPEXPIREAT\n$");
+                  else
+                      strcpy(log_record, "*2\n$7\nPERSIST\n$");
+                  sprintf(str_aux, "%li", strlen(key));
+                  strcat(log_record, str_aux);
+                  strcat(log_record, "\n");
+                  strcat(log_record, key);
+                  if(argc == 3){
                       strcpy(value, array_log_record_lines[k+6]);
                       value[strlen(value)-1] = '\0';
-
-                      //generates da log record
-                      strcpy(log_record, "*3\n$3\nSET\n$");
-                      sprintf(str_aux, "%li", strlen(key));
-                      strcat(log_record, str_aux);
-                      strcat(log_record, "\n");
-                      strcat(log_record, key);
                       strcat(log_record, "\n$");
                       sprintf(str_aux, "%li", strlen(value));
                       strcat(log_record, str_aux);
                       strcat(log_record, "\n");
                       strcat(log_record, value);
-
-                      //indexes the log record
-                      delRecordIndexdLog(dbp, key);
-                      addRecordIndexedLog(dbp, key, log_record);
                   }
 
-                  //skips to the next log record
-                  k = k + 2*argc + 1;
-                  i++;
+                  //indexes the log record
+                  partition = getIndexedLogPartition(key);
+                  if(dbps[partition] == NULL){
+                      dbps[partition] = openIndexedLogPartition(server.indexedlog_filename, partition, 'W', &ret);
+                      if(ret != 0){
+                          serverLog(LL_NOTICE,"Cannot open the indexed log! Cannot index the log record synchronously!");
+                          closeIndexedLog(dbps[partition]);
+                          dbps[partition] = NULL;
+                      }
+                  }
+                  dbp = dbps[partition];
+                  if(dbp != NULL){
+                      sds ikey = getIndexedLogKey(synchronous_indexing_db, key);
+                      //The expire is redone after the last SET of the key
+                      if(strcasecmp(command, "SET") == 0)
+                          delRecordIndexdLog(dbp, ikey);
+                      addRecordIndexedLog(dbp, ikey, log_record);
+                      sdsfree(ikey);
+                  }
               }
 
-              closeIndexedLog(dbp); 
+              //skips to the next log record
+              k = k + 2*argc + 1;
+              i++;
           }
+
+          closeIndexedLogPartitions(dbps);
       }
   }
 }
@@ -3704,6 +6247,26 @@ unsigned long long countAccessedKeys(){
     return HASH_COUNT(hash_keys_access);
 }
 
+/*
+    Selects a database in the connection used by the checkpoint, if it is not selected yet.
+    Returns C_ERR if the database cannot be selected.
+*/
+static int selectCheckpointDb(redisContext *redisConnection, int *connection_db, int dbid){
+    if(*connection_db == dbid)
+      return C_OK;
+    redisReply *reply = redisCommand(redisConnection,"SELECT %d", dbid);
+    if(reply == NULL || reply->type == REDIS_REPLY_ERROR){
+      serverLog(LL_WARNING, "The checkpoint can't select the database %d: %s", 
+                dbid, reply != NULL ? reply->str : redisConnection->errstr);
+      if(reply != NULL)
+        freeReplyObject(reply);
+      return C_ERR;
+    }
+    *connection_db = dbid;
+    freeReplyObject(reply);
+    return C_OK;
+}
+
 /*
     Performs a checkpoint process.
 */
@@ -3712,8 +6275,10 @@ void checkpointProcess(int idCheckpoint){
       return;
 
     long long startTime = ustime();
-    //Gets the checkpoing beggining position in the sequential log
-    unsigned long long seek_log_file = server.seek_log_file;
+    //Gets the checkpoing beggining position in the sequential log, and the database selected there
+    int seek_log_db, connection_db = 0, aborted = 0, j;
+    unsigned long long seek_log_file;
+    getIndexedLogSeek(&seek_log_file, &seek_log_db);
 
     int error;
     redisContext *redisConnection = openRedisClient(&error);
@@ -3733,6 +6298,14 @@ void checkpointProcess(int idCheckpoint){
       serverLog(LL_NOTICE,"Checkpoint process %d started! Checkpointing ...", idCheckpoint);
 
     unsigned long long keysCheckpointed = 0;
+    //The checkpoint crash point is reached after checkpointing half of the keys
+    unsigned long long keysToCrash = 0;
+    if(server.checkpoints_only_mfu == IR_ON)
+      keysToCrash = HASH_COUNT(hash_keys_access);
+    else
+      for(j = 0; j < server.dbnum; j++)
+        keysToCrash += dictSize(server.db[j].dict);
+    keysToCrash = (keysToCrash+1)/2;
 
     //Performs a MFU checkpoint
     if(server.checkpoints_only_mfu == IR_ON){
@@ -3744,8 +6317,18 @@ void checkpointProcess(int idCheckpoint){
           serverLog(LL_NOTICE,"The checkpoint process was stopped before finishing! ");
           break;
         }
-        redisCommand(redisConnection,"SETCHECKPOINT %s %s", s->id, "NULL");
+        long long key_start = ustime();
+        //The accessed keys are qualified by their database (see getIndexedLogKey())
+        char *key;
+        if(selectCheckpointDb(redisConnection, &connection_db, parseIndexedLogKey(s->id, &key)) == C_ERR){
+          aborted = 1;
+          break;
+        }
+        redisCommand(redisConnection,"SETCHECKPOINT %s %s", key, "NULL");
+        latencyHistogramAddSample(LATENCY_HIST_CHECKPOINT_KEY, ustime()-key_start);
         keysCheckpointed++;
+        if(keysCheckpointed == keysToCrash)
+          crashPointReached(IR_CRASH_CHECKPOINT);
       }
       clearHashAccessedTuples();
       server.accessed_tuples_logger_state = IR_ON;
@@ -3753,18 +6336,30 @@ void checkpointProcess(int idCheckpoint){
     else{
       dictIterator *di;
       dictEntry *de;
-      //Gets the keys of tuples in the memory and generates setCheckpoint commands.    
-      di = dictGetSafeIterator(server.db->dict);
-      while((de = dictNext(di)) != NULL ) {
-        //If recieves a signal to stop the checkpoint than breaks
-        if(server.checkpoint_state != IR_ON){
-          serverLog(LL_NOTICE,"The checkpoint process was stopped before finishing! ");
+      //Gets the keys of tuples in the memory of each database and generates setCheckpoint commands.    
+      for(j = 0; j < server.dbnum && server.checkpoint_state == IR_ON && !aborted; j++){
+        if(dictSize(server.db[j].dict) == 0)
+          continue;
+        if(selectCheckpointDb(redisConnection, &connection_db, j) == C_ERR){
+          aborted = 1;
           break;
         }
-        redisCommand(redisConnection,"SETCHECKPOINT %s %s", dictGetKey(de), "NULL");
-        keysCheckpointed++;
+        di = dictGetSafeIterator(server.db[j].dict);
+        while((de = dictNext(di)) != NULL ) {
+          //If recieves a signal to stop the checkpoint than breaks
+          if(server.checkpoint_state != IR_ON){
+            serverLog(LL_NOTICE,"The checkpoint process was stopped before finishing! ");
+            break;
+          }
+          long long key_start = ustime();
+          redisCommand(redisConnection,"SETCHECKPOINT %s %s", dictGetKey(de), "NULL");
+          latencyHistogramAddSample(LATENCY_HIST_CHECKPOINT_KEY, ustime()-key_start);
+          keysCheckpointed++;
+          if(keysCheckpointed == keysToCrash)
+            crashPointReached(IR_CRASH_CHECKPOINT);
+        }
+        dictReleaseIterator(di);
       }
-      dictReleaseIterator(di);
     }
     
     //Sends a command to flush a end checkpoint log record
@@ -3773,9 +6368,11 @@ void checkpointProcess(int idCheckpoint){
     redisCommand(redisConnection,"checkpointEnd %s %s", id_str, "NULL");
     redisFree(redisConnection);
 
-    //Marks the checkpoint begginig postion in the sequential log
-    if(server.checkpoint_state == IR_ON && server.checkpoints_only_mfu == IR_OFF && server.checkpoint_state == IR_ON)
-      writeFinalLogSeek(CHECKPOINT_LOG_SEEK, seek_log_file);
+    //Marks the checkpoint begginig postion in the sequential log, unless the checkpoint was aborted
+    if(aborted)
+      serverLog(LL_WARNING, "Checkpoint process %d aborted!", idCheckpoint);
+    else if(server.checkpoint_state == IR_ON && server.checkpoints_only_mfu == IR_OFF && server.checkpoint_state == IR_ON)
+      writeFinalLogSeek(CHECKPOINT_LOG_SEEK, seek_log_file, seek_log_db);
  
     long long endTime = ustime();
     printCheckpointTimeToCSV(idCheckpoint, startTime, endTime);
@@ -3796,6 +6393,7 @@ void *executeCheckpoint(){
       return (void *)0;
 
     server.checkpint_performing = IR_ON;
+    registerThreadCpuClock(&checkpointer_thread_clock);
     if(server.checkpoints_only_mfu == IR_OFF)
       serverLog(LL_NOTICE,"Checkpointer thread started!"
                           " The first checkpointed wiil start in %d seconds.", 
@@ -3828,6 +6426,7 @@ void *executeCheckpoint(){
     serverLog(LL_NOTICE,"Checkpointer thread finished!");
 
     server.checkpint_performing = IR_OFF;
+    unregisterThreadCpuClock(&checkpointer_thread_clock);
 
     return (void *)1;  
 }
@@ -4113,13 +6712,14 @@ void *corruptIndexedLog(){
     stopMemtierBenchmark();
     stopIndexing();
 
-    //Simulate a log corruption
-    if(removeFile(server.indexedlog_filename) == 0)
-      serverLog(LL_NOTICE,"The indexed log was removed! %s", 
-                          server.indexedlog_replicated_filename);
+    //Simulate a log corruption. Only the first partition is removed, since the
+    //partitions are rebuilt individually.
+    sds partition_filename = getIndexedLogPartitionFilename(server.indexedlog_filename, 0);
+    if(removeFile(partition_filename) == 0)
+      serverLog(LL_NOTICE,"The indexed log was removed! %s", partition_filename);
     else
-      serverLog(LL_NOTICE,"The indexed log was not removed! %s",
-                          server.indexedlog_replicated_filename);
+      serverLog(LL_NOTICE,"The indexed log was not removed! %s", partition_filename);
+    sdsfree(partition_filename);
 
     waitMemtierBenchmarkFinish();
     waitIndexerFinish();
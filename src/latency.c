@@ -34,6 +34,7 @@
  */
 
 #include "server.h"
+#include "atomicvar.h"
 
 /* Dictionary type for latency events. */
 int dictStringKeyCompare(void *privdata, const void *key1, const void *key2) {
@@ -150,6 +151,176 @@ int latencyResetEvent(char *event_to_reset) {
     return resets;
 }
 
+/* ---------------------------- Latency histograms -------------------------- */
+
+static struct latencyHistogram latencyHistograms[LATENCY_HIST_NUM] = {
+    {"ondemand-fetch",0,0,{0}},
+    {"ondemand-apply",0,0,{0}},
+    {"restore-incremental",0,0,{0}},
+    {"indexer-write",0,0,{0}},
+    {"indexer-sync",0,0,{0}},
+    {"checkpoint-key",0,0,{0}}
+};
+
+/* Return the bucket of the histogram where the sample 'value' is counted.
+ * Values smaller than 2*LATENCY_HIST_SUB_COUNT have a bucket each, then
+ * every power of two is split in LATENCY_HIST_SUB_COUNT buckets. */
+static int latencyHistogramBucket(uint64_t value) {
+    int msb, shift;
+
+    if (value < 2*LATENCY_HIST_SUB_COUNT) return (int) value;
+    if (value >= (1ULL<<LATENCY_HIST_MAX_BITS))
+        value = (1ULL<<LATENCY_HIST_MAX_BITS)-1;
+    msb = 63 - __builtin_clzll(value);
+    shift = msb - LATENCY_HIST_SUB_BITS;
+    return (shift+1)*LATENCY_HIST_SUB_COUNT +
+           (int)(value >> shift) - LATENCY_HIST_SUB_COUNT;
+}
+
+/* Return the highest value counted in the specified bucket. */
+static uint64_t latencyHistogramBucketValue(int bucket) {
+    int shift;
+    uint64_t mantissa;
+
+    if (bucket < 2*LATENCY_HIST_SUB_COUNT) return bucket;
+    shift = bucket/LATENCY_HIST_SUB_COUNT - 1;
+    mantissa = bucket%LATENCY_HIST_SUB_COUNT + LATENCY_HIST_SUB_COUNT;
+    return ((mantissa+1) << shift) - 1;
+}
+
+/* Add a sample, in microseconds, to the histogram 'id'. Counters are
+ * updated atomically since the instant recovery threads record samples
+ * concurrently with the main thread. */
+void latencyHistogramAddSample(int id, long long usec) {
+    struct latencyHistogram *h = &latencyHistograms[id];
+
+    if (usec < 0) usec = 0;
+    atomicIncr(h->buckets[latencyHistogramBucket(usec)],1);
+    atomicIncr(h->sum,(uint64_t)usec);
+    atomicIncr(h->calls,1);
+}
+
+/* Reset the histogram of the specified event, or all the histograms if
+ * 'event' is NULL. Returns the number of histograms that had samples. */
+int latencyHistogramReset(char *event) {
+    int j, k, resets = 0;
+
+    for (j = 0; j < LATENCY_HIST_NUM; j++) {
+        struct latencyHistogram *h = &latencyHistograms[j];
+        uint64_t calls;
+
+        if (event != NULL && strcasecmp(event,h->name) != 0) continue;
+        atomicGet(h->calls,calls);
+        if (calls) resets++;
+        for (k = 0; k < LATENCY_HIST_BUCKETS; k++)
+            atomicSet(h->buckets[k],0);
+        atomicSet(h->sum,0);
+        atomicSet(h->calls,0);
+    }
+    return resets;
+}
+
+/* Copy the buckets of the histogram into 'buckets' and return the number
+ * of samples found. The total is computed from the copied buckets so that
+ * percentiles are consistent even when samples are added meanwhile. */
+static uint64_t latencyHistogramSnapshot(struct latencyHistogram *h, uint64_t *buckets) {
+    uint64_t total = 0;
+    int j;
+
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        atomicGet(h->buckets[j],buckets[j]);
+        total += buckets[j];
+    }
+    return total;
+}
+
+/* Return the value at the percentile 'perc' (0-100) of a snapshot. */
+static uint64_t latencyHistogramPercentile(uint64_t *buckets, uint64_t total, double perc) {
+    uint64_t target, seen = 0;
+    int j;
+
+    if (total == 0) return 0;
+    target = (uint64_t)((perc/100)*total + 0.5);
+    if (target == 0) target = 1;
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        seen += buckets[j];
+        if (seen >= target) return latencyHistogramBucketValue(j);
+    }
+    return latencyHistogramBucketValue(LATENCY_HIST_BUCKETS-1);
+}
+
+/* Return the highest value counted in a snapshot. */
+static uint64_t latencyHistogramMax(uint64_t *buckets) {
+    int j;
+
+    for (j = LATENCY_HIST_BUCKETS-1; j >= 0; j--)
+        if (buckets[j]) return latencyHistogramBucketValue(j);
+    return 0;
+}
+
+/* Append to 'info' one line for every histogram with samples, reporting
+ * the main percentiles in microseconds. Used by the INFO latencystats
+ * section. */
+sds genLatencyHistogramInfoString(sds info) {
+    uint64_t buckets[LATENCY_HIST_BUCKETS], total, sum;
+    int j;
+
+    for (j = 0; j < LATENCY_HIST_NUM; j++) {
+        struct latencyHistogram *h = &latencyHistograms[j];
+
+        total = latencyHistogramSnapshot(h,buckets);
+        if (total == 0) continue;
+        atomicGet(h->sum,sum);
+        info = sdscatprintf(info,
+            "latency_percentiles_usec_%s:p50=%llu,p99=%llu,p99.9=%llu,"
+            "max=%llu,calls=%llu,usec_per_call=%.2f\r\n",
+            h->name,
+            (unsigned long long) latencyHistogramPercentile(buckets,total,50),
+            (unsigned long long) latencyHistogramPercentile(buckets,total,99),
+            (unsigned long long) latencyHistogramPercentile(buckets,total,99.9),
+            (unsigned long long) latencyHistogramMax(buckets),
+            (unsigned long long) total,
+            (double) sum/total);
+    }
+    return info;
+}
+
+/* Reply with the histogram of the specified event: the number of calls,
+ * the main percentiles and the list of non empty buckets as pairs of
+ * highest value of the bucket (in microseconds) and count. */
+void latencyCommandReplyWithHistogram(client *c, struct latencyHistogram *h) {
+    uint64_t buckets[LATENCY_HIST_BUCKETS], total;
+    void *replylen;
+    int j, nonempty = 0;
+
+    total = latencyHistogramSnapshot(h,buckets);
+    addReplyMultiBulkLen(c,2);
+    addReplyBulkCString(c,h->name);
+    addReplyMultiBulkLen(c,14);
+    addReplyBulkCString(c,"calls");
+    addReplyLongLong(c,total);
+    addReplyBulkCString(c,"p50");
+    addReplyLongLong(c,latencyHistogramPercentile(buckets,total,50));
+    addReplyBulkCString(c,"p90");
+    addReplyLongLong(c,latencyHistogramPercentile(buckets,total,90));
+    addReplyBulkCString(c,"p99");
+    addReplyLongLong(c,latencyHistogramPercentile(buckets,total,99));
+    addReplyBulkCString(c,"p99.9");
+    addReplyLongLong(c,latencyHistogramPercentile(buckets,total,99.9));
+    addReplyBulkCString(c,"max");
+    addReplyLongLong(c,latencyHistogramMax(buckets));
+    addReplyBulkCString(c,"histogram_usec");
+    replylen = addDeferredMultiBulkLength(c);
+    for (j = 0; j < LATENCY_HIST_BUCKETS; j++) {
+        if (buckets[j] == 0) continue;
+        addReplyMultiBulkLen(c,2);
+        addReplyLongLong(c,latencyHistogramBucketValue(j));
+        addReplyLongLong(c,buckets[j]);
+        nonempty++;
+    }
+    setDeferredMultiBulkLength(c,replylen,nonempty);
+}
+
 /* ------------------------ Latency reporting (doctor) ---------------------- */
 
 /* Analyze the samples available for a given event and return a structure
@@ -564,6 +735,7 @@ sds latencyCommandGenSparkeline(char *event, struct latencyTimeSeries *ts) {
  * LATENCY LATEST: return the latest latency for all the events classes.
  * LATENCY DOCTOR: returns a human readable analysis of instance latency.
  * LATENCY GRAPH: provide an ASCII graph of the latency of the specified event.
+ * LATENCY HISTOGRAM: reply with the latency histograms of the instant recovery phases.
  * LATENCY RESET: reset data of a specified event or all the data if no event provided.
  */
 void latencyCommand(client *c) {
@@ -572,6 +744,8 @@ void latencyCommand(client *c) {
 "GRAPH   <event>     -- Returns an ASCII latency graph for the event class.",
 "HISTORY <event>     -- Returns time-latency samples for the event class.",
 "LATEST              -- Returns the latest latency samples for all events.",
+"HISTOGRAM [event ...] -- Returns latency histograms of the instant recovery",
+"                       phases. (default: all the histograms)",
 "RESET   [event ...] -- Resets latency data of one or more event classes.",
 "                       (default: reset all data for all event classes)",
 "HELP                -- Prints this help.",
@@ -610,15 +784,40 @@ NULL
 
         addReplyBulkCBuffer(c,report,sdslen(report));
         sdsfree(report);
+    } else if (!strcasecmp(c->argv[1]->ptr,"histogram") && c->argc >= 2) {
+        /* LATENCY HISTOGRAM [event ...] */
+        int j, k;
+
+        if (c->argc == 2) {
+            addReplyMultiBulkLen(c,LATENCY_HIST_NUM);
+            for (j = 0; j < LATENCY_HIST_NUM; j++)
+                latencyCommandReplyWithHistogram(c,&latencyHistograms[j]);
+        } else {
+            void *replylen = addDeferredMultiBulkLength(c);
+            int found = 0;
+
+            for (k = 2; k < c->argc; k++) {
+                for (j = 0; j < LATENCY_HIST_NUM; j++) {
+                    if (strcasecmp(c->argv[k]->ptr,latencyHistograms[j].name))
+                        continue;
+                    latencyCommandReplyWithHistogram(c,&latencyHistograms[j]);
+                    found++;
+                }
+            }
+            setDeferredMultiBulkLength(c,replylen,found);
+        }
     } else if (!strcasecmp(c->argv[1]->ptr,"reset") && c->argc >= 2) {
         /* LATENCY RESET */
         if (c->argc == 2) {
-            addReplyLongLong(c,latencyResetEvent(NULL));
+            addReplyLongLong(c,latencyResetEvent(NULL)+
+                               latencyHistogramReset(NULL));
         } else {
             int j, resets = 0;
 
-            for (j = 2; j < c->argc; j++)
+            for (j = 2; j < c->argc; j++) {
                 resets += latencyResetEvent(c->argv[j]->ptr);
+                resets += latencyHistogramReset(c->argv[j]->ptr);
+            }
             addReplyLongLong(c,resets);
         }
     } else if (!strcasecmp(c->argv[1]->ptr,"help") && c->argc >= 2) {
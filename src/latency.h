@@ -61,8 +61,37 @@ struct latencyStats {
     time_t period;          /* Number of seconds since first event and now. */
 };
 
+/* Latency histograms. Unlike the time series above, that only remember the
+ * worst sample of every second, histograms count every sample in log-linear
+ * buckets (HdrHistogram style: 16 sub buckets for every power of two, so the
+ * relative error is ~6%), and can be used to report percentiles. Samples are
+ * in microseconds and can be added from any thread. */
+#define LATENCY_HIST_SUB_BITS 4
+#define LATENCY_HIST_SUB_COUNT (1<<LATENCY_HIST_SUB_BITS)
+#define LATENCY_HIST_MAX_BITS 36 /* Samples are capped to 2^36 us (~19 hours). */
+#define LATENCY_HIST_BUCKETS ((LATENCY_HIST_MAX_BITS-LATENCY_HIST_SUB_BITS+1)*LATENCY_HIST_SUB_COUNT)
+
+/* Histograms of the instant recovery phases. */
+#define LATENCY_HIST_ONDEMAND_FETCH 0       /* Indexed log scan of one key. */
+#define LATENCY_HIST_ONDEMAND_APPLY 1       /* Replay of the rebuilt command. */
+#define LATENCY_HIST_RESTORE_INCREMENTAL 2  /* One key restored by the restorer. */
+#define LATENCY_HIST_INDEXER_WRITE 3        /* One batch written to the indexed log. */
+#define LATENCY_HIST_INDEXER_SYNC 4         /* Flush of one batch to disk. */
+#define LATENCY_HIST_CHECKPOINT_KEY 5       /* One key checkpointed. */
+#define LATENCY_HIST_NUM 6
+
+struct latencyHistogram {
+    const char *name;   /* Event name, as shown by LATENCY HISTOGRAM and INFO. */
+    uint64_t calls;     /* Number of samples. */
+    uint64_t sum;       /* Sum of all the samples, in microseconds. */
+    uint64_t buckets[LATENCY_HIST_BUCKETS];
+};
+
 void latencyMonitorInit(void);
 void latencyAddSample(char *event, mstime_t latency);
+void latencyHistogramAddSample(int id, long long usec);
+int latencyHistogramReset(char *event);
+sds genLatencyHistogramInfoString(sds info);
 int THPIsEnabled(void);
 
 /* Latency monitoring macros. */
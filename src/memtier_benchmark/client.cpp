@@ -522,6 +522,160 @@ bool verify_client::finished(void)
 
 ///////////////////////////////////////////////////////////////////////////
 
+replay_client::replay_client(client_group* group) : client(group),
+    m_reader(group->get_config()->aof_replay),
+    m_client_idx((group->get_config()->next_client_idx - 1) %
+                 (group->get_config()->clients * group->get_config()->threads)),
+    m_total_clients(group->get_config()->clients * group->get_config()->threads),
+    m_queue_ts(0), m_first_ts(0), m_eof(false)
+{
+    timerclear(&m_replay_start);
+
+    // every client streams the whole file, and replays its own share of it
+    if (m_initialized && !m_reader.open_file()) {
+        m_initialized = false;
+    }
+}
+
+// Returns the client that replays the current command, by hashing its
+// first key, or -1 for commands that have no key.
+int replay_client::get_key_owner(void)
+{
+    static const char *keyless[] = { "FLUSHALL", "FLUSHDB", "SWAPDB", "SCRIPT", "FUNCTION", NULL };
+
+    if (m_reader.get_argc() < 2) {
+        return -1;
+    }
+    for (int i = 0; keyless[i] != NULL; i++) {
+        if (m_reader.is_command(keyless[i])) {
+            return -1;
+        }
+    }
+
+    // FNV-1a
+    unsigned int key_len;
+    const char *key = m_reader.get_arg(1, &key_len);
+    unsigned int hash = 2166136261U;
+    for (unsigned int i = 0; i < key_len; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * 16777619U;
+    }
+
+    return hash % m_total_clients;
+}
+
+// Reads the trace until at least one command owned by this client is
+// queued.  All commands on a key go to the same client, so their order is
+// preserved; the order across keys owned by different clients is not.
+bool replay_client::load_commands(void)
+{
+    unsigned int cmd_len;
+    const char *cmd;
+
+    while (m_queue.empty()) {
+        if (m_eof || !m_reader.read_command()) {
+            m_eof = true;
+            return false;
+        }
+        if (!m_first_ts) {
+            m_first_ts = m_reader.get_timestamp();
+        }
+
+        cmd = m_reader.get_command(&cmd_len);
+
+        // SELECT is connection state, every client follows it
+        if (m_reader.is_command("SELECT")) {
+            m_queue.push_back(std::string(cmd, cmd_len));
+            continue;
+        }
+
+        // a transaction is replayed as a whole, by the owner of its first key
+        if (m_reader.is_command("MULTI")) {
+            std::deque<std::string> block;
+            int owner = -1;
+
+            block.push_back(std::string(cmd, cmd_len));
+            while (m_reader.read_command()) {
+                cmd = m_reader.get_command(&cmd_len);
+                block.push_back(std::string(cmd, cmd_len));
+
+                if (m_reader.is_command("EXEC") || m_reader.is_command("DISCARD")) {
+                    break;
+                }
+                if (owner < 0) {
+                    owner = get_key_owner();
+                }
+            }
+
+            if ((unsigned int) (owner < 0 ? 0 : owner) == m_client_idx) {
+                m_queue.insert(m_queue.end(), block.begin(), block.end());
+            }
+            continue;
+        }
+
+        // commands without a key are replayed once, by the first client
+        int owner = get_key_owner();
+        if ((unsigned int) (owner < 0 ? 0 : owner) == m_client_idx) {
+            m_queue.push_back(std::string(cmd, cmd_len));
+        }
+    }
+
+    m_queue_ts = m_reader.get_timestamp();
+    return true;
+}
+
+bool replay_client::hold_pipeline(unsigned int conn_id)
+{
+    if (client::hold_pipeline(conn_id)) {
+        return true;
+    }
+    if (!load_commands()) {
+        return true;
+    }
+
+    // paced replay: keep the original spacing of the #TS annotations,
+    // scaled by the replay speed
+    if (m_config->aof_replay_speed > 0 && m_queue_ts > 0) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+
+        if (!timerisset(&m_replay_start)) {
+            m_replay_start = now;
+        }
+
+        unsigned long long offset = (unsigned long long) ((m_queue_ts - m_first_ts) * 1000000.0 / m_config->aof_replay_speed);
+        unsigned long long due = (unsigned long long) m_replay_start.tv_sec * 1000000 + m_replay_start.tv_usec + offset;
+        unsigned long long cur = (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+
+        if (due > cur) {
+            m_connections[conn_id]->schedule_fill(due - cur);
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void replay_client::create_request(struct timeval timestamp, unsigned int conn_id)
+{
+    if (!load_commands()) {
+        return;
+    }
+
+    const std::string& cmd = m_queue.front();
+    m_connections[conn_id]->send_raw_command(&timestamp, cmd.data(), cmd.size());
+    m_queue.pop_front();
+    m_reqs_generated++;
+}
+
+bool replay_client::finished(void)
+{
+    if (m_eof && m_queue.empty() && m_reqs_processed >= m_reqs_generated)
+        return true;
+    return client::finished();
+}
+
+///////////////////////////////////////////////////////////////////////////
+
 client_group::client_group(benchmark_config* config, abstract_protocol *protocol, object_generator* obj_gen) :
     m_base(NULL), m_config(config), m_protocol(protocol), m_obj_gen(obj_gen)
 {
@@ -552,6 +706,8 @@ int client_group::create_clients(int num)
 
         if (m_config->cluster_mode)
             c = new cluster_client(this);
+        else if (m_config->aof_replay)
+            c = new replay_client(this);
         else
             c = new client(this);
 
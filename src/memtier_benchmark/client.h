@@ -26,6 +26,8 @@
 #include <sys/un.h>
 #include <vector>
 #include <queue>
+#include <deque>
+#include <string>
 #include <iterator>
 #include <event2/event.h>
 #include <event2/buffer.h>
@@ -35,6 +37,7 @@
 #include "shard_connection.h"
 #include "connections_manager.h"
 #include "obj_gen.h"
+#include "file_io.h"
 #include "memtier_benchmark.h"
 #include "run_stats.h"
 
@@ -124,6 +127,12 @@ public:
             return OBJECT_GENERATOR_KEY_RANDOM;
         } else if (cfg->key_pattern[index] == 'G') {
             return OBJECT_GENERATOR_KEY_GAUSSIAN;
+        } else if (cfg->key_pattern[index] == 'Z') {
+            return OBJECT_GENERATOR_KEY_ZIPFIAN;
+        } else if (cfg->key_pattern[index] == 'H') {
+            return OBJECT_GENERATOR_KEY_HOTSPOT;
+        } else if (cfg->key_pattern[index] == 'M') {
+            return OBJECT_GENERATOR_KEY_MOVING_HOTSPOT;
         } else {
             if (index == key_pattern_set)
                 return OBJECT_GENERATOR_KEY_SET_ITER;
@@ -137,6 +146,12 @@ public:
             return OBJECT_GENERATOR_KEY_RANDOM;
         } else if (cmd->key_pattern == 'G') {
             return OBJECT_GENERATOR_KEY_GAUSSIAN;
+        } else if (cmd->key_pattern == 'Z') {
+            return OBJECT_GENERATOR_KEY_ZIPFIAN;
+        } else if (cmd->key_pattern == 'H') {
+            return OBJECT_GENERATOR_KEY_HOTSPOT;
+        } else if (cmd->key_pattern == 'M') {
+            return OBJECT_GENERATOR_KEY_MOVING_HOTSPOT;
         } else {
             return index;
         }
@@ -159,6 +174,27 @@ public:
     unsigned long long int get_errors(void);
 };
 
+class replay_client : public client {
+protected:
+    aof_reader m_reader;
+    unsigned int m_client_idx;                    // index of this client among all clients
+    unsigned int m_total_clients;
+    std::deque<std::string> m_queue;              // commands owned by this client, not sent yet
+    long long m_queue_ts;                         // trace timestamp of the queued commands
+    long long m_first_ts;                         // first trace timestamp
+    struct timeval m_replay_start;
+    bool m_eof;
+
+    int get_key_owner(void);
+    bool load_commands(void);
+
+    virtual bool finished(void);
+    virtual void create_request(struct timeval timestamp, unsigned int conn_id);
+    virtual bool hold_pipeline(unsigned int conn_id);
+public:
+    replay_client(client_group* group);
+};
+
 class client_group {
 protected:
     struct event_base* m_base;
@@ -21,6 +21,7 @@
 #endif
 
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include "file_io.h"
 
@@ -415,3 +416,226 @@ bool file_writer::write_item(memcache_item *item)
 
     return true;
 }
+
+/////////////////////////////////////////////////////////////////////
+
+/** largest supported RESP header line (*<argc> or $<len>) */
+#define MAX_AOF_LINE        128
+
+/** \brief aof_reader constructor.
+ * \param filename name of file to open.
+ */
+
+aof_reader::aof_reader(const char *filename) :
+    m_filename(filename), m_file(NULL), m_offset(0),
+    m_cmd(NULL), m_cmd_len(0), m_cmd_size(0), m_timestamp(0)
+{
+}
+
+/** \brief aof_reader destructor.
+ */
+
+aof_reader::~aof_reader()
+{
+    if (m_file != NULL)
+        fclose(m_file);
+    if (m_cmd != NULL)
+        free(m_cmd);
+}
+
+/** \brief open file and prepare to read commands.
+ *
+ * this method verifies that the file is a plain RESP append only file; files
+ * that begin with an RDB preamble are not supported.
+ * \return true for success, false for error.
+ */
+
+bool aof_reader::open_file(void)
+{
+    char magic[5];
+
+    if (!m_filename)
+        return false;
+
+    if (m_file != NULL)
+        fclose(m_file);
+
+    m_file = fopen(m_filename, "r");
+    if (!m_file) {
+        perror(m_filename);
+        return false;
+    }
+
+    if (fread(magic, 1, sizeof(magic), m_file) == sizeof(magic) &&
+        memcmp(magic, "REDIS", sizeof(magic)) == 0) {
+        fprintf(stderr, "%s: invalid file, AOF with an RDB preamble is not supported.\n", m_filename);
+        return false;
+    }
+    rewind(m_file);
+
+    m_offset = 0;
+    m_timestamp = 0;
+    return true;
+}
+
+/** \brief determine if end of file has been reached.
+ * \return true on EOF, false otherwise.
+ */
+
+bool aof_reader::is_eof(void)
+{
+    return (feof(m_file) != 0);
+}
+
+/** \brief make room for len more bytes in the command buffer.
+ * \return true for success, false for error.
+ */
+
+bool aof_reader::reserve(unsigned int len)
+{
+    if (m_cmd_len + len <= m_cmd_size)
+        return true;
+
+    unsigned int new_size = m_cmd_size ? m_cmd_size : 1024;
+    while (new_size < m_cmd_len + len)
+        new_size *= 2;
+
+    char *new_cmd = (char *) realloc(m_cmd, new_size);
+    if (!new_cmd) {
+        fprintf(stderr, "%s: error: out of memory\n", m_filename);
+        return false;
+    }
+
+    m_cmd = new_cmd;
+    m_cmd_size = new_size;
+    return true;
+}
+
+/** \brief read a CRLF terminated line.
+ * \param line buffer to read into; the CRLF is kept.
+ * \param max_len size of buffer.
+ * \param len pointer to unsigned int in which the line length is returned.
+ * \return true for success, false on EOF or error.
+ */
+
+bool aof_reader::read_line(char *line, unsigned int max_len, unsigned int *len)
+{
+    if (fgets(line, max_len, m_file) == NULL)
+        return false;
+
+    *len = strlen(line);
+    if (*len < 2 || line[*len - 2] != '\r' || line[*len - 1] != '\n') {
+        // a partial line at the very end is a truncated write, not an error
+        if (!is_eof())
+            fprintf(stderr, "%s:%llu: error: malformed line.\n", m_filename, m_offset);
+        return false;
+    }
+
+    m_offset += *len;
+    return true;
+}
+
+/** \brief read the next command from the opened file.
+ *
+ * annotation lines (beginning with '#') are skipped, but the last #TS:<unix time>
+ * annotation is kept and returned by get_timestamp().  like the server, a command
+ * truncated at the end of the file is treated as end of file.
+ * \return true if a command was read, false on EOF or error.
+ */
+
+bool aof_reader::read_command(void)
+{
+    char line[MAX_AOF_LINE];
+    unsigned int line_len;
+
+    m_cmd_len = 0;
+    m_arg_offset.clear();
+    m_arg_len.clear();
+
+    do {
+        if (!read_line(line, sizeof(line), &line_len))
+            return false;
+        if (strncmp(line, "#TS:", 4) == 0)
+            m_timestamp = strtoll(line + 4, NULL, 10);
+    } while (line[0] == '#');
+
+    int argc = (line[0] == '*') ? strtol(line + 1, NULL, 10) : 0;
+    if (argc < 1) {
+        fprintf(stderr, "%s:%llu: error: expected a multi bulk command.\n",
+            m_filename, m_offset - line_len);
+        return false;
+    }
+
+    if (!reserve(line_len))
+        return false;
+    memcpy(m_cmd, line, line_len);
+    m_cmd_len = line_len;
+
+    for (int i = 0; i < argc; i++) {
+        if (!read_line(line, sizeof(line), &line_len))
+            return false;
+
+        long arg_len = (line[0] == '$') ? strtol(line + 1, NULL, 10) : -1;
+        if (arg_len < 0) {
+            fprintf(stderr, "%s:%llu: error: expected a bulk string.\n",
+                m_filename, m_offset - line_len);
+            return false;
+        }
+
+        if (!reserve(line_len + arg_len + 2))
+            return false;
+        memcpy(m_cmd + m_cmd_len, line, line_len);
+        m_cmd_len += line_len;
+
+        // read the argument and its CRLF straight into the command buffer
+        if (fread(m_cmd + m_cmd_len, 1, arg_len + 2, m_file) != (size_t) arg_len + 2)
+            return false;
+        if (m_cmd[m_cmd_len + arg_len] != '\r' || m_cmd[m_cmd_len + arg_len + 1] != '\n') {
+            fprintf(stderr, "%s:%llu: error: bulk string is not CRLF terminated.\n",
+                m_filename, m_offset);
+            return false;
+        }
+
+        m_arg_offset.push_back(m_cmd_len);
+        m_arg_len.push_back(arg_len);
+        m_cmd_len += arg_len + 2;
+        m_offset += arg_len + 2;
+    }
+
+    return true;
+}
+
+/** \brief return the current command, in its original RESP encoding.
+ * \param len pointer to unsigned int in which the command length is returned.
+ */
+
+const char* aof_reader::get_command(unsigned int *len) const
+{
+    *len = m_cmd_len;
+    return m_cmd;
+}
+
+/** \brief return an argument of the current command (0 is the command name).
+ * \param len pointer to unsigned int in which the argument length is returned.
+ * \return pointer to argument, or NULL if there is no such argument.
+ */
+
+const char* aof_reader::get_arg(unsigned int index, unsigned int *len) const
+{
+    if (index >= m_arg_offset.size())
+        return NULL;
+
+    *len = m_arg_len[index];
+    return m_cmd + m_arg_offset[index];
+}
+
+/** \brief check the name of the current command, case insensitive.
+ */
+
+bool aof_reader::is_command(const char *name) const
+{
+    unsigned int len;
+    const char *cmd = get_arg(0, &len);
+
+    return cmd != NULL && len == strlen(name) && strncasecmp(cmd, name, len) == 0;
+}
@@ -20,6 +20,7 @@
 #define _FILE_IO_H
 
 #include <stdio.h>
+#include <vector>
 #include "item.h"
 
 /** Provides a mechanism to read a CSV-like memcache_dump file and extract memcache
@@ -61,4 +62,38 @@ public:
     bool write_item(memcache_item *item);
 };
 
+/** Provides a mechanism to read the commands of a Redis append only file,
+ * one at a time, keeping each command in its original RESP encoding.
+ */
+class aof_reader {
+protected:
+    const char *m_filename;     /** name of file */
+    FILE *m_file;               /** handle of open file */
+    unsigned long long m_offset;    /** file offset of the next line */
+
+    char *m_cmd;                /** RESP bytes of the current command */
+    unsigned int m_cmd_len;     /** length of the current command */
+    unsigned int m_cmd_size;    /** allocated size of m_cmd */
+    std::vector<unsigned int> m_arg_offset;     /** offset of each argument in m_cmd */
+    std::vector<unsigned int> m_arg_len;        /** length of each argument */
+
+    long long m_timestamp;      /** last #TS annotation seen, or 0 */
+
+    bool reserve(unsigned int len);
+    bool read_line(char *line, unsigned int max_len, unsigned int *len);
+public:
+    aof_reader(const char *filename);
+    ~aof_reader();
+
+    bool open_file(void);
+    bool is_eof(void);
+    bool read_command(void);
+
+    const char* get_command(unsigned int *len) const;
+    unsigned int get_argc(void) const { return m_arg_offset.size(); }
+    const char* get_arg(unsigned int index, unsigned int *len) const;
+    bool is_command(const char *name) const;
+    long long get_timestamp(void) const { return m_timestamp; }
+};
+
 #endif  /* _FILE_IO_H */
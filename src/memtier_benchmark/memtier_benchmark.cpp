@@ -45,6 +45,7 @@
 #include "JSON_handler.h"
 #include "obj_gen.h"
 #include "memtier_benchmark.h"
+#include "recovery_monitor.h"
 
 
 static int log_level = 0;
@@ -104,6 +105,8 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         "test_time = %u\n"
         "ratio = %u:%u\n"
         "pipeline = %u\n"
+        "rate = %f\n"
+        "rate_per_connection = %f\n"
         "data_size = %u\n"
         "data_offset = %u\n"
         "random_data = %s\n"
@@ -121,6 +124,9 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         "key_pattern = %s\n"
         "key_stddev = %f\n"
         "key_median = %f\n"
+        "key_zipf_exp = %f\n"
+        "key_hotspot = %u:%u\n"
+        "key_hotspot_shift = %u\n"
         "reconnect_interval = %u\n"
         "multi_key_get = %u\n"
         "authenticate = %s\n"
@@ -129,7 +135,13 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         "wait-ratio = %u:%u\n"
         "num-slaves = %u-%u\n"
         "wait-timeout = %u-%u\n"
-        "json-out-file = %s\n",
+        "json-out-file = %s\n"
+        "stats-interval = %u\n"
+        "timeline-file-prefix = %s\n"
+        "aof-replay = %s\n"
+        "aof-replay-speed = %f\n"
+        "recovery-phases = %s\n"
+        "recovery-poll-interval = %u\n",
         cfg->server,
         cfg->port,
         cfg->unix_socket,
@@ -152,6 +164,8 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         cfg->test_time,
         cfg->ratio.a, cfg->ratio.b,
         cfg->pipeline,
+        cfg->rate,
+        cfg->rate_per_connection,
         cfg->data_size,
         cfg->data_offset,
         cfg->random_data ? "yes" : "no",
@@ -169,6 +183,9 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         cfg->key_pattern,
         cfg->key_stddev,
         cfg->key_median,
+        cfg->key_zipf_exp,
+        cfg->key_hotspot.a, cfg->key_hotspot.b,
+        cfg->key_hotspot_shift,
         cfg->reconnect_interval,
         cfg->multi_key_get,
         cfg->authenticate ? cfg->authenticate : "",
@@ -177,7 +194,13 @@ static void config_print(FILE *file, struct benchmark_config *cfg)
         cfg->wait_ratio.a, cfg->wait_ratio.b,
         cfg->num_slaves.min, cfg->num_slaves.max,
         cfg->wait_timeout.min, cfg->wait_timeout.max,
-        cfg->json_out_file);
+        cfg->json_out_file,
+        cfg->stats_interval,
+        cfg->timeline_prefix,
+        cfg->aof_replay,
+        cfg->aof_replay_speed,
+        cfg->recovery_phases ? "yes" : "no",
+        cfg->recovery_poll_interval);
 }
 
 static void config_print_to_json(json_handler * jsonhandler, struct benchmark_config *cfg)
@@ -208,6 +231,8 @@ static void config_print_to_json(json_handler * jsonhandler, struct benchmark_co
     jsonhandler->write_obj("test_time"         ,"%u",          	cfg->test_time);
     jsonhandler->write_obj("ratio"             ,"\"%u:%u\"",   	cfg->ratio.a, cfg->ratio.b);
     jsonhandler->write_obj("pipeline"          ,"%u",          	cfg->pipeline);
+    jsonhandler->write_obj("rate"              ,"%f",           cfg->rate);
+    jsonhandler->write_obj("rate_per_connection","%f",          cfg->rate_per_connection);
     jsonhandler->write_obj("data_size"         ,"%u",          	cfg->data_size);
     jsonhandler->write_obj("data_offset"       ,"%u",          	cfg->data_offset);
     jsonhandler->write_obj("random_data"       ,"\"%s\"",      	cfg->random_data ? "true" : "false");
@@ -225,6 +250,9 @@ static void config_print_to_json(json_handler * jsonhandler, struct benchmark_co
     jsonhandler->write_obj("key_pattern"       ,"\"%s\"",       cfg->key_pattern);
     jsonhandler->write_obj("key_stddev"        ,"%f",           cfg->key_stddev);
     jsonhandler->write_obj("key_median"        ,"%f",           cfg->key_median);
+    jsonhandler->write_obj("key_zipf_exp"      ,"%f",           cfg->key_zipf_exp);
+    jsonhandler->write_obj("key_hotspot"       ,"\"%u:%u\"",    cfg->key_hotspot.a, cfg->key_hotspot.b);
+    jsonhandler->write_obj("key_hotspot_shift" ,"%u",           cfg->key_hotspot_shift);
     jsonhandler->write_obj("reconnect_interval","%u",    		cfg->reconnect_interval);
     jsonhandler->write_obj("multi_key_get"     ,"%u",         	cfg->multi_key_get);
     jsonhandler->write_obj("authenticate"      ,"\"%s\"",      	cfg->authenticate ? cfg->authenticate : "");
@@ -233,6 +261,11 @@ static void config_print_to_json(json_handler * jsonhandler, struct benchmark_co
     jsonhandler->write_obj("wait-ratio"        ,"\"%u:%u\"",    cfg->wait_ratio.a, cfg->wait_ratio.b);
     jsonhandler->write_obj("num-slaves"        ,"\"%u:%u\"",    cfg->num_slaves.min, cfg->num_slaves.max);
     jsonhandler->write_obj("wait-timeout"      ,"\"%u-%u\"",   	cfg->wait_timeout.min, cfg->wait_timeout.max);
+    jsonhandler->write_obj("stats-interval"    ,"%u",           cfg->stats_interval);
+    jsonhandler->write_obj("aof-replay"        ,"\"%s\"",       cfg->aof_replay);
+    jsonhandler->write_obj("aof-replay-speed"  ,"%f",           cfg->aof_replay_speed);
+    jsonhandler->write_obj("recovery-phases"   ,"\"%s\"",       cfg->recovery_phases ? "true" : "false");
+    jsonhandler->write_obj("recovery-poll-interval","%u",       cfg->recovery_poll_interval);
 
     jsonhandler->close_nesting();
 }
@@ -255,6 +288,8 @@ static void config_init_defaults(struct benchmark_config *cfg)
         cfg->ratio = config_ratio("1:10");
     if (!cfg->pipeline)
         cfg->pipeline = 1;
+    if (cfg->rate > 0)
+        cfg->rate_per_connection = cfg->rate / (cfg->clients * cfg->threads);
     if (!cfg->data_size && !cfg->data_size_list.is_defined() && !cfg->data_size_range.is_defined() && !cfg->data_import)
         cfg->data_size = 32;
     if (cfg->generate_keys || !cfg->data_import) {
@@ -273,12 +308,18 @@ static void config_init_defaults(struct benchmark_config *cfg)
             cfg->requests = cfg->requests / (cfg->clients * cfg->threads) + 1;
         printf("setting requests to %llu\n", cfg->requests);
     }
-    if (!cfg->requests && !cfg->test_time)
+    if (!cfg->requests && !cfg->test_time && !cfg->aof_replay)
         cfg->requests = 10000;
     if (!cfg->hdr_prefix)
         cfg->hdr_prefix = "";
+    if (!cfg->timeline_prefix)
+        cfg->timeline_prefix = "";
+    else if (!cfg->stats_interval)
+        cfg->stats_interval = 1000;
     if (!cfg->print_percentiles.is_defined())
         cfg->print_percentiles = config_quantiles("50,99,99.9");
+    if (!cfg->recovery_poll_interval)
+        cfg->recovery_poll_interval = 100;
 }
 
 static int generate_random_seed()
@@ -299,6 +340,9 @@ static bool verify_cluster_option(struct benchmark_config *cfg) {
     if (cfg->reconnect_interval) {
         fprintf(stderr, "error: cluster mode dose not support reconnect-interval option.\n");
         return false;
+    } else if (cfg->rate > 0 || cfg->rate_per_connection > 0) {
+        fprintf(stderr, "error: cluster mode dose not support rate and rate-per-connection options.\n");
+        return false;
     } else if (cfg->multi_key_get) {
         fprintf(stderr, "error: cluster mode dose not support multi-key-get option.\n");
         return false;
@@ -314,11 +358,53 @@ static bool verify_cluster_option(struct benchmark_config *cfg) {
     } else if (cfg->arbitrary_commands->is_defined()) {
         fprintf(stderr, "error: cluster mode dose not support arbitrary command option.\n");
         return false;
+    } else if (cfg->aof_replay) {
+        fprintf(stderr, "error: cluster mode dose not support aof-replay option.\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool verify_aof_replay_option(struct benchmark_config *cfg) {
+    if (cfg->protocol && strcmp(cfg->protocol, "redis")) {
+        fprintf(stderr, "error: aof-replay supported only in redis protocol.\n");
+        return false;
+    } else if (cfg->arbitrary_commands->is_defined() || cfg->data_import) {
+        fprintf(stderr, "error: aof-replay cannot be used with command or data-import options.\n");
+        return false;
+    } else if (cfg->ratio.is_defined() || cfg->key_pattern || cfg->multi_key_get || cfg->wait_ratio.is_defined()) {
+        fprintf(stderr, "error: aof-replay cannot be used with ratio, key-pattern, multi-key-get or wait-ratio options.\n");
+        return false;
+    } else if (cfg->reconnect_interval) {
+        fprintf(stderr, "error: aof-replay does not support reconnect-interval option.\n");
+        return false;
+    } else if (cfg->aof_replay_speed > 0 && (cfg->rate > 0 || cfg->rate_per_connection > 0)) {
+        fprintf(stderr, "error: aof-replay-speed and rate options are mutually exclusive.\n");
+        return false;
     }
 
     return true;
 }
 
+static bool verify_recovery_phases_option(struct benchmark_config *cfg) {
+    if (cfg->protocol && strcmp(cfg->protocol, "redis")) {
+        fprintf(stderr, "error: recovery-phases supported only in redis protocol.\n");
+        return false;
+    } else if (cfg->cluster_mode) {
+        fprintf(stderr, "error: recovery-phases cannot be used with cluster-mode.\n");
+        return false;
+    }
+#ifdef USE_TLS
+    if (cfg->tls) {
+        fprintf(stderr, "error: recovery-phases does not support tls.\n");
+        return false;
+    }
+#endif
+
+    return true;
+}
+
 static bool verify_arbitrary_command_option(struct benchmark_config *cfg) {
     if (cfg->key_pattern) {
         fprintf(stderr, "error: when using arbitrary command, key pattern is configured with --command-key-pattern option.\n");
@@ -364,6 +450,9 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
         o_key_maximum,
         o_key_pattern,
         o_key_stddev,
+        o_key_zipf_exp,
+        o_key_hotspot,
+        o_key_hotspot_shift,
         o_key_median,
         o_show_config,
         o_hide_histogram,
@@ -390,7 +479,15 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
         o_tls_cacert,
         o_tls_skip_verify,
         o_tls_sni,
-        o_hdr_file_prefix
+        o_hdr_file_prefix,
+        o_rate,
+        o_rate_per_connection,
+        o_stats_interval,
+        o_timeline_file_prefix,
+        o_aof_replay,
+        o_aof_replay_speed,
+        o_recovery_phases,
+        o_recovery_poll_interval
     };
 
     static struct option long_options[] = {
@@ -408,6 +505,8 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
 #endif
         { "out-file",                   1, 0, 'o' },
         { "hdr-file-prefix",            1, 0, o_hdr_file_prefix },
+        { "stats-interval",             1, 0, o_stats_interval },
+        { "timeline-file-prefix",       1, 0, o_timeline_file_prefix },
         { "client-stats",               1, 0, o_client_stats },
         { "run-count",                  1, 0, 'x' },
         { "debug",                      0, 0, 'D' },
@@ -422,6 +521,8 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
         { "test-time",                  1, 0, o_test_time },
         { "ratio",                      1, 0, o_ratio },
         { "pipeline",                   1, 0, o_pipeline },
+        { "rate",                       1, 0, o_rate },
+        { "rate-per-connection",        1, 0, o_rate_per_connection },
         { "data-size",                  1, 0, 'd' },
         { "data-offset",                1, 0, o_data_offset },
         { "random-data",                0, 0, 'R' },
@@ -439,11 +540,18 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
         { "key-pattern",                1, 0, o_key_pattern },
         { "key-stddev",                 1, 0, o_key_stddev },
         { "key-median",                 1, 0, o_key_median },
+        { "key-zipf-exp",               1, 0, o_key_zipf_exp },
+        { "key-hotspot",                1, 0, o_key_hotspot },
+        { "key-hotspot-shift",          1, 0, o_key_hotspot_shift },
         { "reconnect-interval",         1, 0, o_reconnect_interval },
         { "multi-key-get",              1, 0, o_multi_key_get },
         { "authenticate",               1, 0, 'a' },
         { "select-db",                  1, 0, o_select_db },
         { "no-expiry",                  0, 0, o_no_expiry },
+        { "aof-replay",                 1, 0, o_aof_replay },
+        { "aof-replay-speed",           1, 0, o_aof_replay_speed },
+        { "recovery-phases",            0, 0, o_recovery_phases },
+        { "recovery-poll-interval",     1, 0, o_recovery_poll_interval },
         { "wait-ratio",                 1, 0, o_wait_ratio },
         { "num-slaves",                 1, 0, o_num_slaves },
         { "wait-timeout",               1, 0, o_wait_timeout },
@@ -504,6 +612,28 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
                 case o_hdr_file_prefix:
                     cfg->hdr_prefix = optarg;
                     break;
+                case o_stats_interval:
+                    endptr = NULL;
+                    cfg->stats_interval = (unsigned int) strtoul(optarg, &endptr, 10);
+                    if (cfg->stats_interval < 10 || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: stats-interval must be at least 10 msec.\n");
+                        return -1;
+                    }
+                    break;
+                case o_timeline_file_prefix:
+                    cfg->timeline_prefix = optarg;
+                    break;
+                case o_recovery_phases:
+                    cfg->recovery_phases = true;
+                    break;
+                case o_recovery_poll_interval:
+                    endptr = NULL;
+                    cfg->recovery_poll_interval = (unsigned int) strtoul(optarg, &endptr, 10);
+                    if (!cfg->recovery_poll_interval || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: recovery-poll-interval must be greater than zero.\n");
+                        return -1;
+                    }
+                    break;
                 case o_client_stats:
                     cfg->client_stats = optarg;
                     break;
@@ -597,6 +727,30 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
                         return -1;
                     }
                     break;
+                case o_rate:
+                    endptr = NULL;
+                    cfg->rate = strtod(optarg, &endptr);
+                    if (cfg->rate <= 0 || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: rate must be greater than zero.\n");
+                        return -1;
+                    }
+                    if (cfg->rate_per_connection > 0) {
+                        fprintf(stderr, "error: --rate and --rate-per-connection are mutually exclusive.\n");
+                        return -1;
+                    }
+                    break;
+                case o_rate_per_connection:
+                    endptr = NULL;
+                    cfg->rate_per_connection = strtod(optarg, &endptr);
+                    if (cfg->rate_per_connection <= 0 || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: rate-per-connection must be greater than zero.\n");
+                        return -1;
+                    }
+                    if (cfg->rate > 0) {
+                        fprintf(stderr, "error: --rate and --rate-per-connection are mutually exclusive.\n");
+                        return -1;
+                    }
+                    break;
                 case 'd':
                     endptr = NULL;
                     cfg->data_size = (unsigned int) strtoul(optarg, &endptr, 10);
@@ -655,6 +809,17 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
                     cfg->verify_only = 1;
                     cfg->data_verify = 1;   // Implied
                     break;
+                case o_aof_replay:
+                    cfg->aof_replay = optarg;
+                    break;
+                case o_aof_replay_speed:
+                    endptr = NULL;
+                    cfg->aof_replay_speed = strtod(optarg, &endptr);
+                    if (cfg->aof_replay_speed <= 0 || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: aof-replay-speed must be greater than zero.\n");
+                        return -1;
+                    }
+                    break;
                 case o_key_prefix:
                     cfg->key_prefix = optarg;
                     break;
@@ -690,19 +855,37 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
                         return -1;
                     }
                     break;
+                case o_key_zipf_exp:
+                    endptr = NULL;
+                    cfg->key_zipf_exp = strtod(optarg, &endptr);
+                    if (cfg->key_zipf_exp <= 0 || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: key-zipf-exp must be greater than zero.\n");
+                        return -1;
+                    }
+                    break;
+                case o_key_hotspot:
+                    cfg->key_hotspot = config_ratio(optarg);
+                    if (cfg->key_hotspot.a == 0 || cfg->key_hotspot.a > 100 ||
+                        cfg->key_hotspot.b == 0 || cfg->key_hotspot.b >= 100) {
+                        fprintf(stderr, "error: key-hotspot must be expressed as [1-100]:[1-99].\n");
+                        return -1;
+                    }
+                    break;
+                case o_key_hotspot_shift:
+                    endptr = NULL;
+                    cfg->key_hotspot_shift = (unsigned int) strtoul(optarg, &endptr, 10);
+                    if (!cfg->key_hotspot_shift || !endptr || *endptr != '\0') {
+                        fprintf(stderr, "error: key-hotspot-shift must be greater than zero.\n");
+                        return -1;
+                    }
+                    break;
                 case o_key_pattern:
                     cfg->key_pattern = optarg;
 
                     if (strlen(cfg->key_pattern) != 3 || cfg->key_pattern[key_pattern_delimiter] != ':' ||
-                        (cfg->key_pattern[key_pattern_set] != 'R' &&
-                         cfg->key_pattern[key_pattern_set] != 'S' &&
-                         cfg->key_pattern[key_pattern_set] != 'G' &&
-                         cfg->key_pattern[key_pattern_set] != 'P') ||
-                        (cfg->key_pattern[key_pattern_get] != 'R' &&
-                         cfg->key_pattern[key_pattern_get] != 'S' &&
-                         cfg->key_pattern[key_pattern_get] != 'G' &&
-                         cfg->key_pattern[key_pattern_get] != 'P')) {
-                        fprintf(stderr, "error: key-pattern must be in the format of [S/R/G/P]:[S/R/G/P].\n");
+                        !strchr("RSGZHMP", cfg->key_pattern[key_pattern_set]) ||
+                        !strchr("RSGZHMP", cfg->key_pattern[key_pattern_get])) {
+                        fprintf(stderr, "error: key-pattern must be in the format of [S/R/G/Z/H/M/P]:[S/R/G/Z/H/M/P].\n");
                         return -1;
                     }
 
@@ -840,7 +1023,22 @@ static int config_parse_args(int argc, char *argv[], struct benchmark_config *cf
     }
 
     if ((cfg->cluster_mode && !verify_cluster_option(cfg)) ||
-        (cfg->arbitrary_commands->is_defined() && !verify_arbitrary_command_option(cfg))) {
+        (cfg->arbitrary_commands->is_defined() && !verify_arbitrary_command_option(cfg)) ||
+        (cfg->aof_replay && !verify_aof_replay_option(cfg))) {
+        return -1;
+    }
+
+    if (cfg->aof_replay_speed > 0 && !cfg->aof_replay) {
+        fprintf(stderr, "error: aof-replay-speed can only be used with aof-replay.\n");
+        return -1;
+    }
+
+    if (cfg->recovery_phases && !verify_recovery_phases_option(cfg)) {
+        return -1;
+    }
+
+    if (cfg->recovery_poll_interval && !cfg->recovery_phases) {
+        fprintf(stderr, "error: recovery-poll-interval can only be used with recovery-phases.\n");
         return -1;
     }
 
@@ -877,10 +1075,17 @@ void usage() {
             "      --out-file=FILE            Name of output file (default: stdout)\n"
             "      --json-out-file=FILE       Name of JSON output file, if not set, will not print to json\n"
             "      --hdr-file-prefix=FILE     Prefix of HDR Latency Histogram output files, if not set, will not save latency histogram files\n"
+            "      --stats-interval=MSEC      Also keep a timeline of throughput and latency percentiles per MSEC\n"
+            "                                 interval (at least 10), written to the JSON output\n"
+            "      --timeline-file-prefix=FILE  Prefix of the CSV timeline output files (implies --stats-interval=1000\n"
+            "                                 if not set)\n"
             "      --show-config              Print detailed configuration before running\n"
             "      --hide-histogram           Don't print detailed latency histogram\n"
             "      --print-percentiles        Specify which percentiles info to print on the results table (by default prints percentiles: 50,99,99.9)\n"
             "      --cluster-mode             Run client in cluster mode\n"
+            "      --recovery-phases          Poll the server recovery state (RECOVERY STATUS) and break down\n"
+            "                                 throughput and latency by phase: Startup, Restoring and Restored\n"
+            "      --recovery-poll-interval=MSEC  Recovery state polling interval (default: 100)\n"
             "      --help                     Display this help\n"
             "      --version                  Display version information\n"
             "\n"
@@ -892,6 +1097,10 @@ void usage() {
             "      --test-time=SECS           Number of seconds to run the test\n"
             "      --ratio=RATIO              Set:Get ratio (default: 1:10)\n"
             "      --pipeline=NUMBER          Number of concurrent pipelined requests (default: 1)\n"
+            "      --rate=NUMBER              Open-loop mode: send NUMBER requests per second in total, spread\n"
+            "                                 over all the connections on a fixed schedule; latency is\n"
+            "                                 measured from the scheduled send time of each request\n"
+            "      --rate-per-connection=NUM  Open-loop mode: send NUM requests per second on each connection\n"
             "      --reconnect-interval=NUM   Number of requests after which re-connection is performed\n"
             "      --multi-key-get=NUM        Enable multi-key get commands, up to NUM keys (default: 0)\n"
             "      --select-db=DB             DB number to select, when testing a redis server\n"
@@ -908,6 +1117,9 @@ void usage() {
             "      --command-ratio            The number of times the command is sent in sequence.(default: 1)\n"
             "      --command-key-pattern      Key pattern for the command (default: R):\n"
             "                                 G for Gaussian distribution.\n"
+            "                                 Z for Zipfian distribution.\n"
+            "                                 H for Hotspot distribution.\n"
+            "                                 M for Moving hotspot distribution.\n"
             "                                 R for uniform Random.\n"
             "                                 S for Sequential.\n"
             "                                 P for Parallel (Sequential were each client has a subset of the key-range).\n"
@@ -932,12 +1144,23 @@ void usage() {
             "      --generate-keys            Generate keys for imported objects\n"
             "      --no-expiry                Ignore expiry information in imported data\n"
             "\n"
+            "AOF Replay Options:\n"
+            "      --aof-replay=FILE          Replay the commands of a Redis append only file, instead of\n"
+            "                                 generating requests. Commands are spread across all connections\n"
+            "                                 by their first key, so the order of commands on a key is kept.\n"
+            "                                 Replays as fast as possible unless --rate or --aof-replay-speed is used\n"
+            "      --aof-replay-speed=FACTOR  Replay at FACTOR times the original pace, taken from the #TS\n"
+            "                                 annotations of the file (e.g. 1 for original, 2 for twice as fast)\n"
+            "\n"
             "Key Options:\n"
             "      --key-prefix=PREFIX        Prefix for keys (default: \"memtier-\")\n"
             "      --key-minimum=NUMBER       Key ID minimum value (default: 0)\n"
             "      --key-maximum=NUMBER       Key ID maximum value (default: 10000000)\n"
             "      --key-pattern=PATTERN      Set:Get pattern (default: R:R)\n"
             "                                 G for Gaussian distribution.\n"
+            "                                 Z for Zipfian distribution (key-minimum is the most popular key).\n"
+            "                                 H for Hotspot distribution (see --key-hotspot).\n"
+            "                                 M for Moving hotspot distribution, the hot set drifts through the key range.\n"
             "                                 R for uniform Random.\n"
             "                                 S for Sequential.\n"
             "                                 P for Parallel (Sequential were each client has a subset of the key-range).\n"
@@ -945,6 +1168,10 @@ void usage() {
             "                                 (default is key range / 6)\n"
             "      --key-median               The median point used in the Gaussian distribution\n"
             "                                 (default is the center of the key range)\n"
+            "      --key-zipf-exp=EXP         The exponent used in the Zipfian distribution (default: 0.99)\n"
+            "      --key-hotspot=OPS:KEYS     Percent of the requests sent to the percent of the key range in the\n"
+            "                                 hot set, used in the Hotspot distributions (default: 90:10)\n"
+            "      --key-hotspot-shift=SECS   Seconds for the moving hot set to cross the whole key range (default: 60)\n"
             "\n"
             "WAIT Options:\n"
             "      --wait-ratio=RATIO         Set:Wait ratio (default is no WAIT commands - 1:0)\n"
@@ -1050,6 +1277,15 @@ run_stats run_benchmark(int run_id, benchmark_config* cfg, object_generator* obj
         threads.push_back(t);
     }
 
+    // watch the server recovery from now on
+    if (cfg->recovery_phases) {
+        cfg->phase_monitor = new recovery_monitor(cfg);
+        if (!cfg->phase_monitor->start()) {
+            benchmark_error_log("error: failed to start recovery monitor.\n");
+            exit(1);
+        }
+    }
+
     // launch threads
     fprintf(stderr, "[RUN #%u] Launching threads now...\n", run_id);
     for (std::vector<cg_thread*>::iterator i = threads.begin(); i != threads.end(); i++) {
@@ -1117,7 +1353,7 @@ run_stats run_benchmark(int run_id, benchmark_config* cfg, object_generator* obj
         double progress = 0;
         if(cfg->requests)
             progress = 100.0 * total_ops / ((double)cfg->requests*cfg->clients*cfg->threads);
-        else
+        else if (cfg->test_time)
             progress = 100.0 * (duration / 1000000.0)/cfg->test_time;
 
         fprintf(stderr, "[RUN #%u %.0f%%, %3u secs] %2u threads: %11lu ops, %7lu (avg: %7lu) ops/sec, %s/sec (avg: %s/sec), %5.2f (avg: %5.2f) msec latency\r",
@@ -1134,6 +1370,13 @@ run_stats run_benchmark(int run_id, benchmark_config* cfg, object_generator* obj
         (*i)->m_cg->merge_run_stats(&stats);
     }
 
+    if (cfg->phase_monitor) {
+        cfg->phase_monitor->stop();
+        stats.set_phases_duration(cfg->phase_monitor);
+        delete cfg->phase_monitor;
+        cfg->phase_monitor = NULL;
+    }
+
     // Do we need to produce client stats?
     if (cfg->client_stats != NULL) {
         unsigned int cg_id = 0;
@@ -1337,6 +1580,20 @@ int main(int argc, char *argv[])
         }
     }
 
+    // check the trace to replay, clients stream it later on
+    if (cfg.aof_replay) {
+        aof_reader reader(cfg.aof_replay);
+        if (!reader.open_file() || !reader.read_command()) {
+            fprintf(stderr, "error: %s: no command to replay.\n", cfg.aof_replay);
+            exit(1);
+        }
+        for (int i = 0; cfg.aof_replay_speed > 0 && i < 1000 && !reader.get_timestamp() && reader.read_command(); i++)
+            ;
+        if (cfg.aof_replay_speed > 0 && !reader.get_timestamp()) {
+            fprintf(stderr, "warning: %s has no #TS annotations, aof-replay-speed is ignored.\n", cfg.aof_replay);
+        }
+    }
+
     // create and configure object generator
     object_generator* obj_gen = NULL;
     imported_keylist* keylist = NULL;
@@ -1464,6 +1721,17 @@ int main(int argc, char *argv[])
         }
         obj_gen->set_key_distribution(cfg.key_stddev, cfg.key_median);
     }
+    if (cfg.key_zipf_exp>0 && !strchr(cfg.key_pattern, 'Z')) {
+        fprintf(stderr, "error: key-zipf-exp is only allowed together with key-pattern set to Z.\n");
+        usage();
+    }
+    if ((cfg.key_hotspot.is_defined() || cfg.key_hotspot_shift>0) &&
+        !strchr(cfg.key_pattern, 'H') && !strchr(cfg.key_pattern, 'M')) {
+        fprintf(stderr, "error: key-hotspot and key-hotspot-shift are only allowed together with key-pattern set to H or M.\n");
+        usage();
+    }
+    obj_gen->set_key_zipf(cfg.key_zipf_exp);
+    obj_gen->set_key_hotspot(cfg.key_hotspot.a, cfg.key_hotspot.b, cfg.key_hotspot_shift);
     obj_gen->set_expiry_range(cfg.expiry_range.min, cfg.expiry_range.max);
 
     // Prepare output file
@@ -1493,6 +1761,7 @@ int main(int argc, char *argv[])
             stats.save_hdr_get_command( &cfg,run_id );
             stats.save_hdr_set_command( &cfg,run_id );
             stats.save_hdr_arbitrary_commands( &cfg,run_id );
+            stats.save_csv_timeline( &cfg,run_id );
         }
         //
         // Print some run information
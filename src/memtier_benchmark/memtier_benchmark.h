@@ -35,6 +35,8 @@
 #define benchmark_error_log(...) \
     benchmark_log(LOGLEVEL_ERROR, __VA_ARGS__)
 
+#define UNUSED(x) (void)(x)
+
 enum key_pattern_index {
     key_pattern_set       = 0,
     key_pattern_delimiter = 1,
@@ -63,6 +65,8 @@ struct benchmark_config {
     unsigned int test_time;
     config_ratio ratio;
     unsigned int pipeline;
+    double rate;
+    double rate_per_connection;
     unsigned int data_size;
     unsigned int data_offset;
     bool random_data;
@@ -79,6 +83,9 @@ struct benchmark_config {
     unsigned long long key_maximum;
     double key_stddev;
     double key_median;
+    double key_zipf_exp;
+    config_ratio key_hotspot;
+    unsigned int key_hotspot_shift;
     const char *key_pattern;
     unsigned int reconnect_interval;
     int multi_key_get;
@@ -86,6 +93,13 @@ struct benchmark_config {
     int select_db;
     bool no_expiry;
     bool resolve_on_connect;
+    // AOF trace replay
+    const char *aof_replay;
+    double aof_replay_speed;
+    // recovery phases
+    bool recovery_phases;
+    unsigned int recovery_poll_interval;
+    class recovery_monitor *phase_monitor;
     // WAIT related
     config_ratio wait_ratio;
     config_range num_slaves;
@@ -95,6 +109,8 @@ struct benchmark_config {
     bool cluster_mode;
     struct arbitrary_command_list* arbitrary_commands;
     const char *hdr_prefix;
+    unsigned int stats_interval;
+    const char *timeline_prefix;
 #ifdef USE_TLS
     bool tls;
     const char *tls_cert;
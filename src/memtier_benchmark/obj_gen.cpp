@@ -26,6 +26,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <math.h>
+#include <sys/time.h>
 
 #ifdef HAVE_ASSERT_H
 #include <assert.h>
@@ -139,6 +140,69 @@ unsigned long long gaussian_noise::gaussian_distribution_range(double stddev, do
     return val;
 }
 
+// log(1+x)/x and (exp(x)-1)/x, with their Taylor series near zero
+static inline double zipf_helper1(double x)
+{
+    if (fabs(x) > 1e-8)
+        return log1p(x) / x;
+    return 1 - x * (0.5 - x * (1.0 / 3 - 0.25 * x));
+}
+
+static inline double zipf_helper2(double x)
+{
+    if (fabs(x) > 1e-8)
+        return expm1(x) / x;
+    return 1 + x * 0.5 * (1 + x * (1.0 / 3) * (1 + 0.25 * x));
+}
+
+double zipf_distribution::h(double x)
+{
+    return exp(-m_exponent * log(x));
+}
+
+double zipf_distribution::h_integral(double x)
+{
+    const double log_x = log(x);
+    return zipf_helper2((1 - m_exponent) * log_x) * log_x;
+}
+
+double zipf_distribution::h_integral_inverse(double x)
+{
+    double t = x * (1 - m_exponent);
+    if (t < -1)
+        t = -1;
+    return exp(zipf_helper1(t) * x);
+}
+
+void zipf_distribution::setup(unsigned long long n, double exponent)
+{
+    assert(n > 0 && exponent > 0);
+    m_n = n;
+    m_exponent = exponent;
+    m_h_integral_x1 = h_integral(1.5) - 1;
+    m_h_integral_n = h_integral(n + 0.5);
+    m_s = 2 - h_integral_inverse(h_integral(2.5) - h(2));
+}
+
+unsigned long long zipf_distribution::sample(random_generator& rnd)
+{
+    while (true) {
+        const double u = m_h_integral_n +
+            (rnd.get_random() / ((double) rnd.get_random_max())) * (m_h_integral_x1 - m_h_integral_n);
+        const double x = h_integral_inverse(u);
+
+        double k = floor(x + 0.5);
+        if (k < 1)
+            k = 1;
+        else if (k > m_n)
+            k = m_n;
+
+        // accepted right away most of the time, the rest is rejected
+        if (k - x <= m_s || u >= h_integral(k + 0.5) - h(k))
+            return (unsigned long long) k;
+    }
+}
+
 object_generator::object_generator(size_t n_key_iterators/*= OBJECT_GENERATOR_KEY_ITERATORS*/) :
     m_data_size_type(data_size_unknown),
     m_data_size_pattern(NULL),
@@ -150,6 +214,10 @@ object_generator::object_generator(size_t n_key_iterators/*= OBJECT_GENERATOR_KE
     m_key_max(0),
     m_key_stddev(0),
     m_key_median(0),
+    m_key_zipf_exp(0),
+    m_key_hotspot_ops(0),
+    m_key_hotspot_keys(0),
+    m_key_hotspot_shift(0),
     m_value_buffer(NULL),
     m_random_fd(-1),
     m_value_buffer_size(0),
@@ -158,6 +226,7 @@ object_generator::object_generator(size_t n_key_iterators/*= OBJECT_GENERATOR_KE
     m_next_key.resize(n_key_iterators, 0);
 
     m_data_size.size_list = NULL;
+    timerclear(&m_key_hotspot_start);
 }
 
 object_generator::object_generator(const object_generator& copy) :
@@ -172,6 +241,12 @@ object_generator::object_generator(const object_generator& copy) :
     m_key_max(copy.m_key_max),
     m_key_stddev(copy.m_key_stddev),
     m_key_median(copy.m_key_median),
+    m_key_zipf_exp(copy.m_key_zipf_exp),
+    m_key_zipf(copy.m_key_zipf),
+    m_key_hotspot_ops(copy.m_key_hotspot_ops),
+    m_key_hotspot_keys(copy.m_key_hotspot_keys),
+    m_key_hotspot_shift(copy.m_key_hotspot_shift),
+    m_key_hotspot_start(copy.m_key_hotspot_start),
     m_value_buffer(NULL),
     m_random_fd(-1),
     m_value_buffer_size(0),
@@ -348,6 +423,20 @@ void object_generator::set_key_distribution(double key_stddev, double key_median
     m_key_median = key_median;
 }
 
+void object_generator::set_key_zipf(double key_zipf_exp)
+{
+    m_key_zipf_exp = key_zipf_exp > 0 ? key_zipf_exp : 0.99;
+    m_key_zipf.setup(m_key_max - m_key_min + 1, m_key_zipf_exp);
+}
+
+void object_generator::set_key_hotspot(unsigned int ops_percent, unsigned int keys_percent, unsigned int shift_secs)
+{
+    m_key_hotspot_ops = ops_percent > 0 ? ops_percent : 90;
+    m_key_hotspot_keys = keys_percent > 0 ? keys_percent : 10;
+    m_key_hotspot_shift = shift_secs > 0 ? shift_secs : 60;
+    gettimeofday(&m_key_hotspot_start, NULL);
+}
+
 // return a random number between r_min and r_max
 unsigned long long object_generator::random_range(unsigned long long r_min, unsigned long long  r_max)
 {
@@ -361,15 +450,55 @@ unsigned long long object_generator::normal_distribution(unsigned long long r_mi
     return m_random.gaussian_distribution_range(r_stddev, r_median, r_min, r_max);
 }
 
+// return a random number between r_min and r_max using zipfian distribution,
+// r_min being the most popular. the ranks are wrapped over the range, which
+// is narrower than the one the distribution was set up with when the clients
+// split the key range (see set_key_range())
+unsigned long long object_generator::zipfian_distribution(unsigned long long r_min, unsigned long long r_max)
+{
+    return r_min + (m_key_zipf.sample(m_random) - 1) % (r_max - r_min + 1);
+}
+
+// return a random number between r_min and r_max, with m_key_hotspot_ops percent of
+// them in a hot set of m_key_hotspot_keys percent of the range. a moving hot set
+// drifts through the range, crossing it every m_key_hotspot_shift seconds
+unsigned long long object_generator::hotspot_distribution(unsigned long long r_min, unsigned long long r_max, bool moving)
+{
+    unsigned long long len = r_max - r_min + 1;
+    unsigned long long hot_len = (unsigned long long) (len * (m_key_hotspot_keys / 100.0));
+    if (hot_len == 0)
+        hot_len = 1;
+
+    unsigned long long hot_start = 0;
+    if (moving) {
+        struct timeval now;
+        gettimeofday(&now, NULL);
+        double elapsed = (now.tv_sec - m_key_hotspot_start.tv_sec) +
+                         (now.tv_usec - m_key_hotspot_start.tv_usec) / 1000000.0;
+        hot_start = (unsigned long long) (fmod(elapsed / m_key_hotspot_shift, 1.0) * len);
+    }
+
+    unsigned long long offset;
+    if (hot_len >= len || random_range(1, 100) <= m_key_hotspot_ops)
+        offset = hot_start + random_range(0, hot_len - 1);
+    else
+        offset = hot_start + hot_len + random_range(0, len - hot_len - 1);
+    return r_min + offset % len;
+}
+
 unsigned long long object_generator::get_key_index(int iter)
 {
-    assert(iter < static_cast<int>(m_next_key.size()) && iter >= OBJECT_GENERATOR_KEY_GAUSSIAN);
+    assert(iter < static_cast<int>(m_next_key.size()) && iter >= OBJECT_GENERATOR_KEY_MOVING_HOTSPOT);
 
     unsigned long long k;
     if (iter==OBJECT_GENERATOR_KEY_RANDOM) {
         k = random_range(m_key_min, m_key_max);
     } else if(iter==OBJECT_GENERATOR_KEY_GAUSSIAN) {
         k = normal_distribution(m_key_min, m_key_max, m_key_stddev, m_key_median);
+    } else if(iter==OBJECT_GENERATOR_KEY_ZIPFIAN) {
+        k = zipfian_distribution(m_key_min, m_key_max);
+    } else if(iter==OBJECT_GENERATOR_KEY_HOTSPOT || iter==OBJECT_GENERATOR_KEY_MOVING_HOTSPOT) {
+        k = hotspot_distribution(m_key_min, m_key_max, iter==OBJECT_GENERATOR_KEY_MOVING_HOTSPOT);
     } else {
         if (m_next_key[iter] < m_key_min)
             m_next_key[iter] = m_key_min;
@@ -20,6 +20,7 @@
 #define _OBJ_GEN_H
 
 #include <vector>
+#include <sys/time.h>
 #include "file_io.h"
 
 struct random_data;
@@ -50,6 +51,24 @@ private:
 	double m_spare;
 };
 
+// Zipfian distribution over 1..n, sampled by rejection-inversion
+// (Hormann and Derflinger), O(1) per sample and without any table.
+class zipf_distribution {
+public:
+    zipf_distribution() : m_n(0), m_exponent(0) {}
+    void setup(unsigned long long n, double exponent);
+    unsigned long long sample(random_generator& rnd);
+private:
+    double h(double x);
+    double h_integral(double x);
+    double h_integral_inverse(double x);
+    unsigned long long m_n;
+    double m_exponent;
+    double m_h_integral_x1;
+    double m_h_integral_n;
+    double m_s;
+};
+
 class data_object {
 protected:
     const char *m_key;
@@ -75,6 +94,9 @@ public:
 #define OBJECT_GENERATOR_KEY_GET_ITER   0
 #define OBJECT_GENERATOR_KEY_RANDOM    -1
 #define OBJECT_GENERATOR_KEY_GAUSSIAN  -2
+#define OBJECT_GENERATOR_KEY_ZIPFIAN   -3
+#define OBJECT_GENERATOR_KEY_HOTSPOT   -4
+#define OBJECT_GENERATOR_KEY_MOVING_HOTSPOT -5
 
 class object_generator {
 public:
@@ -98,6 +120,12 @@ protected:
     unsigned long long m_key_max;
     double m_key_stddev;
     double m_key_median;
+    double m_key_zipf_exp;
+    zipf_distribution m_key_zipf;
+    unsigned int m_key_hotspot_ops;         // percent of the requests on the hot set
+    unsigned int m_key_hotspot_keys;        // percent of the key range in the hot set
+    unsigned int m_key_hotspot_shift;       // seconds for the moving hot set to cross the key range
+    struct timeval m_key_hotspot_start;
     data_object m_object;
 
     std::vector<unsigned long long> m_next_key;
@@ -121,6 +149,8 @@ public:
 
     unsigned long long random_range(unsigned long long r_min, unsigned long long r_max);
     unsigned long long normal_distribution(unsigned long long r_min, unsigned long long r_max, double r_stddev, double r_median);
+    unsigned long long zipfian_distribution(unsigned long long r_min, unsigned long long r_max);
+    unsigned long long hotspot_distribution(unsigned long long r_min, unsigned long long r_max, bool moving);
 
     void set_random_data(bool random_data);
     void set_data_size_fixed(unsigned int size);
@@ -131,6 +161,8 @@ public:
     void set_key_prefix(const char *key_prefix);
     void set_key_range(unsigned long long key_min, unsigned long long key_max);
     void set_key_distribution(double key_stddev, double key_median);
+    void set_key_zipf(double key_zipf_exp);
+    void set_key_hotspot(unsigned int ops_percent, unsigned int keys_percent, unsigned int shift_secs);
     void set_random_seed(int seed);
 
     unsigned long long get_key_index(int iter);
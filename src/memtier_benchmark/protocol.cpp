@@ -180,6 +180,9 @@ public:
     virtual bool format_arbitrary_command(arbitrary_command &cmd);
     int write_arbitrary_command(const command_arg *arg);
     int write_arbitrary_command(const char *val, int val_len);
+
+    // handle pre-encoded command (trace replay)
+    virtual int write_command_raw(const char *cmd, int cmd_len);
 };
 
 int redis_protocol::select_db(int db)
@@ -624,6 +627,14 @@ int redis_protocol::write_arbitrary_command(const char *rand_val, int rand_val_l
     return size;
 }
 
+int redis_protocol::write_command_raw(const char *cmd, int cmd_len) {
+    // the command is already RESP encoded (e.g. read from an AOF), so
+    // it is forwarded as is
+    evbuffer_add(m_write_buf, cmd, cmd_len);
+
+    return cmd_len;
+}
+
 bool redis_protocol::format_arbitrary_command(arbitrary_command &cmd) {
     for (unsigned int i = 0; i < cmd.command_args.size(); i++) {
         command_arg* current_arg = &cmd.command_args[i];
@@ -693,6 +704,8 @@ public:
     virtual int write_arbitrary_command(const command_arg *arg);
     virtual int write_arbitrary_command(const char *val, int val_len);
 
+    // handle pre-encoded command (trace replay)
+    virtual int write_command_raw(const char *cmd, int cmd_len);
 };
 
 int memcache_text_protocol::select_db(int db)
@@ -882,6 +895,10 @@ int memcache_text_protocol::write_arbitrary_command(const char *val, int val_len
     assert(0);
 }
 
+int memcache_text_protocol::write_command_raw(const char *cmd, int cmd_len) {
+    assert(0);
+}
+
 /////////////////////////////////////////////////////////////////////////
 
 class memcache_binary_protocol : public abstract_protocol {
@@ -908,6 +925,9 @@ public:
     virtual bool format_arbitrary_command(arbitrary_command& cmd);
     virtual int write_arbitrary_command(const command_arg *arg);
     virtual int write_arbitrary_command(const char *val, int val_len);
+
+    // handle pre-encoded command (trace replay)
+    virtual int write_command_raw(const char *cmd, int cmd_len);
 };
 
 int memcache_binary_protocol::select_db(int db)
@@ -1152,6 +1172,10 @@ int memcache_binary_protocol::write_arbitrary_command(const char *val, int val_l
     assert(0);
 }
 
+int memcache_binary_protocol::write_command_raw(const char *cmd, int cmd_len) {
+    assert(0);
+}
+
 /////////////////////////////////////////////////////////////////////////
 
 class abstract_protocol *protocol_factory(const char *proto_name)
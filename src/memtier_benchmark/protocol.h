@@ -196,6 +196,9 @@ public:
     virtual int write_arbitrary_command(const command_arg *arg) = 0;
     virtual int write_arbitrary_command(const char *val, int val_len) = 0;
 
+    // handle pre-encoded command (trace replay)
+    virtual int write_command_raw(const char *cmd, int cmd_len) = 0;
+
     struct protocol_response* get_response(void) { return &m_last_response; }
 };
 
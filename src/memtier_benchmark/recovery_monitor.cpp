@@ -0,0 +1,281 @@
+/*
+ * Copyright (C) 2011-2017 Redis Labs Ltd.
+ *
+ * This file is part of memtier_benchmark.
+ *
+ * memtier_benchmark is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * memtier_benchmark is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with memtier_benchmark.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+#ifdef HAVE_NETINET_TCP_H
+#include <netinet/tcp.h>
+#endif
+#include <sys/un.h>
+#include <string>
+
+#ifdef HAVE_ASSERT_H
+#include <assert.h>
+#endif
+
+#include "memtier_benchmark.h"
+#include "config_types.h"
+#include "recovery_monitor.h"
+
+// the status is a few hundred bytes, anything bigger is not a status reply
+#define MAX_STATUS_REPLY    16384
+
+static const char recovery_status_command[] = "*2\r\n$8\r\nRECOVERY\r\n$6\r\nSTATUS\r\n";
+
+static unsigned long long usec_now(void)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (unsigned long long) now.tv_sec * 1000000 + now.tv_usec;
+}
+
+void* recovery_monitor_thread(void *ctx)
+{
+    recovery_monitor *monitor = (recovery_monitor *) ctx;
+    monitor->run();
+
+    return NULL;
+}
+
+recovery_monitor::recovery_monitor(benchmark_config *config) :
+    m_config(config), m_started(false), m_stop(false), m_sockfd(-1)
+{
+    for (int i = 0; i < recovery_phase_count; i++) {
+        m_phase_start[i] = 0;
+    }
+}
+
+recovery_monitor::~recovery_monitor()
+{
+    stop();
+    disconnect_server();
+}
+
+bool recovery_monitor::start(void)
+{
+    m_phase_start[recovery_phase_startup] = usec_now();
+
+    if (pthread_create(&m_thread, NULL, recovery_monitor_thread, (void *) this) != 0) {
+        return false;
+    }
+
+    m_started = true;
+    return true;
+}
+
+void recovery_monitor::stop(void)
+{
+    if (m_started) {
+        m_stop = true;
+        pthread_join(m_thread, NULL);
+        m_started = false;
+    }
+}
+
+bool recovery_monitor::connect_server(void)
+{
+    struct timeval timeout = { 1, 0 };
+
+    if (m_config->unix_socket) {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, m_config->unix_socket, sizeof(addr.sun_path)-1);
+
+        m_sockfd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (m_sockfd < 0) {
+            return false;
+        }
+        setsockopt(m_sockfd, SOL_SOCKET, SO_RCVTIMEO, (void *) &timeout, sizeof(timeout));
+        setsockopt(m_sockfd, SOL_SOCKET, SO_SNDTIMEO, (void *) &timeout, sizeof(timeout));
+
+        if (connect(m_sockfd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            disconnect_server();
+            return false;
+        }
+    } else {
+        struct connect_info ci;
+        int flags = 1;
+
+        if (m_config->server_addr->get_connect_info(&ci) < 0) {
+            return false;
+        }
+
+        m_sockfd = socket(ci.ci_family, ci.ci_socktype, ci.ci_protocol);
+        if (m_sockfd < 0) {
+            return false;
+        }
+        setsockopt(m_sockfd, IPPROTO_TCP, TCP_NODELAY, (void *) &flags, sizeof(flags));
+        setsockopt(m_sockfd, SOL_SOCKET, SO_RCVTIMEO, (void *) &timeout, sizeof(timeout));
+        setsockopt(m_sockfd, SOL_SOCKET, SO_SNDTIMEO, (void *) &timeout, sizeof(timeout));
+
+        if (connect(m_sockfd, ci.ci_addr, ci.ci_addrlen) < 0) {
+            disconnect_server();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void recovery_monitor::disconnect_server(void)
+{
+    if (m_sockfd >= 0) {
+        close(m_sockfd);
+        m_sockfd = -1;
+    }
+}
+
+// Asks the server for its recovery state, and returns the matching phase,
+// or -1 if the server did not answer.
+int recovery_monitor::poll_phase(void)
+{
+    if (m_sockfd < 0 && !connect_server()) {
+        return -1;
+    }
+
+    if (send(m_sockfd, recovery_status_command, sizeof(recovery_status_command)-1, 0) !=
+        (ssize_t) sizeof(recovery_status_command)-1) {
+        disconnect_server();
+        return -1;
+    }
+
+    // read a whole reply: an error line, or a bulk string
+    std::string reply;
+    size_t expected = 0;
+    while (expected == 0 || reply.size() < expected) {
+        char buf[1024];
+        ssize_t len = recv(m_sockfd, buf, sizeof(buf), 0);
+        if (len <= 0 || reply.size() + len > MAX_STATUS_REPLY) {
+            disconnect_server();
+            return -1;
+        }
+        reply.append(buf, len);
+
+        size_t eol = reply.find("\r\n");
+        if (expected == 0 && eol != std::string::npos) {
+            if (reply[0] == '$') {
+                expected = eol + 2 + strtol(reply.c_str() + 1, NULL, 10) + 2;
+            } else {
+                expected = eol + 2;
+            }
+        }
+    }
+
+    if (reply[0] == '-') {
+        // a server without instant recovery
+        return recovery_phase_restored;
+    }
+
+    size_t pos = reply.find("recovery_state:");
+    if (reply[0] != '$' || pos == std::string::npos) {
+        return recovery_phase_restored;
+    }
+
+    std::string state = reply.substr(pos + strlen("recovery_state:"),
+                                     reply.find("\r\n", pos) - pos - strlen("recovery_state:"));
+    if (state == "restoring" || state == "paused") {
+        return recovery_phase_restoring;
+    } else if (state == "waiting" || state == "loading") {
+        return recovery_phase_startup;
+    }
+
+    return recovery_phase_restored;
+}
+
+void recovery_monitor::set_phase(int phase, unsigned long long now)
+{
+    // phases only move forward, a skipped phase keeps a zero start time
+    for (int i = phase; i < recovery_phase_count; i++) {
+        if (m_phase_start[i]) {
+            return;
+        }
+    }
+    m_phase_start[phase] = now;
+
+    benchmark_debug_log("recovery phase: %s\n", get_phase_name(phase));
+}
+
+void recovery_monitor::run(void)
+{
+    while (!m_stop) {
+        int phase = poll_phase();
+        if (phase > recovery_phase_startup) {
+            set_phase(phase, usec_now());
+        }
+
+        // nothing left to watch
+        if (phase == recovery_phase_restored) {
+            break;
+        }
+
+        usleep(m_config->recovery_poll_interval * 1000);
+    }
+
+    disconnect_server();
+}
+
+int recovery_monitor::get_phase(unsigned long long usec) const
+{
+    for (int i = recovery_phase_count - 1; i > recovery_phase_startup; i--) {
+        if (m_phase_start[i] && m_phase_start[i] <= usec) {
+            return i;
+        }
+    }
+
+    return recovery_phase_startup;
+}
+
+unsigned long long recovery_monitor::get_phase_duration(int phase, unsigned long long end_usec) const
+{
+    unsigned long long start = m_phase_start[phase];
+    if (!start) {
+        return 0;
+    }
+
+    unsigned long long end = end_usec;
+    for (int i = phase + 1; i < recovery_phase_count; i++) {
+        if (m_phase_start[i]) {
+            end = m_phase_start[i];
+            break;
+        }
+    }
+
+    return end > start ? end - start : 0;
+}
+
+const char* recovery_monitor::get_phase_name(int phase)
+{
+    static const char *names[recovery_phase_count] = { "Startup", "Restoring", "Restored" };
+
+    assert(phase >= 0 && phase < recovery_phase_count);
+    return names[phase];
+}
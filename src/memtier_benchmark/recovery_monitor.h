@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2011-2017 Redis Labs Ltd.
+ *
+ * This file is part of memtier_benchmark.
+ *
+ * memtier_benchmark is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 2.
+ *
+ * memtier_benchmark is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with memtier_benchmark.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef MEMTIER_BENCHMARK_RECOVERY_MONITOR_H
+#define MEMTIER_BENCHMARK_RECOVERY_MONITOR_H
+
+#include <pthread.h>
+#include <sys/time.h>
+
+struct benchmark_config;
+
+// Recovery phases of the server, in the order they happen
+enum recovery_phase {
+    recovery_phase_startup = 0,     // the server has not answered yet
+    recovery_phase_restoring,       // incremental restore in progress
+    recovery_phase_restored,        // restore complete, or no recovery at all
+    recovery_phase_count
+};
+
+/** Polls the recovery state of the server on a side connection, and keeps
+ * the time each recovery phase started.  Phases only move forward.
+ */
+class recovery_monitor {
+protected:
+    benchmark_config *m_config;
+    pthread_t m_thread;
+    bool m_started;
+    volatile bool m_stop;
+    int m_sockfd;
+
+    // start time of each phase, in usec from the epoch ( 0 = not reached )
+    volatile unsigned long long m_phase_start[recovery_phase_count];
+
+    friend void* recovery_monitor_thread(void *ctx);
+
+    bool connect_server(void);
+    void disconnect_server(void);
+    int poll_phase(void);
+    void set_phase(int phase, unsigned long long now);
+    void run(void);
+
+public:
+    recovery_monitor(benchmark_config *config);
+    ~recovery_monitor();
+
+    bool start(void);
+    void stop(void);
+
+    int get_phase(unsigned long long usec) const;
+    unsigned long long get_phase_duration(int phase, unsigned long long end_usec) const;
+    static const char* get_phase_name(int phase);
+};
+
+#endif //MEMTIER_BENCHMARK_RECOVERY_MONITOR_H
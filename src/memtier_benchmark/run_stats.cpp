@@ -113,7 +113,9 @@ inline timeval timeval_factorial_average(timeval a, timeval b, unsigned int weig
 run_stats::run_stats(benchmark_config *config) :
            m_config(config),
            m_totals(),
-           m_cur_stats(0)
+           m_cur_stats(0),
+           m_cur_interval(0),
+           m_cur_interval_latency(LATENCY_HDR_MAX_VALUE)
 {
     memset(&m_start_time, 0, sizeof(m_start_time));
     memset(&m_end_time, 0, sizeof(m_end_time));
@@ -121,6 +123,13 @@ run_stats::run_stats(benchmark_config *config) :
     if (config->arbitrary_commands->is_defined()) {
         setup_arbitrary_commands(config->arbitrary_commands->size());
     }
+
+    if (config->recovery_phases) {
+        for (int i = 0; i < recovery_phase_count; i++) {
+            m_phases.push_back(interval_stats(i));
+            m_phases_latency_histograms.push_back(safe_hdr_histogram(LATENCY_HDR_MAX_VALUE));
+        }
+    }
 }
 
 void run_stats::setup_arbitrary_commands(size_t n_arbitrary_commands) {
@@ -149,6 +158,17 @@ void run_stats::set_end_time(struct timeval* end_time)
     }
     m_end_time = *end_time;
     m_stats.push_back(m_cur_stats);
+    close_cur_interval();
+}
+
+void run_stats::set_phases_duration(const recovery_monitor* monitor)
+{
+    const unsigned long long end = (unsigned long long) m_end_time.tv_sec * 1000000 + m_end_time.tv_usec;
+
+    m_phases_duration.clear();
+    for (int i = 0; i < recovery_phase_count; i++) {
+        m_phases_duration.push_back(monitor->get_phase_duration(i, end));
+    }
 }
 
 void run_stats::roll_cur_stats(struct timeval* ts)
@@ -160,10 +180,62 @@ void run_stats::roll_cur_stats(struct timeval* ts)
     }
 }
 
+void run_stats::roll_cur_interval(struct timeval* ts)
+{
+    // intervals are numbered from the epoch, so the timelines of all
+    // clients line up regardless of when each client started
+    const unsigned long long interval = ((unsigned long long) ts->tv_sec * 1000000 + ts->tv_usec) /
+                                        ((unsigned long long) m_config->stats_interval * 1000);
+    if (interval > m_cur_interval.m_interval) {
+        close_cur_interval();
+        m_cur_interval = interval_stats(interval);
+    }
+}
+
+void run_stats::close_cur_interval(void)
+{
+    if (m_cur_interval.m_ops > 0) {
+        m_cur_interval.save_latency(m_cur_interval_latency);
+        m_intervals.push_back(m_cur_interval);
+        hdr_reset(m_cur_interval_latency);
+    }
+    m_cur_interval = interval_stats(m_cur_interval.m_interval);
+}
+
+void run_stats::update_interval_op(struct timeval* ts, unsigned int bytes, unsigned int latency)
+{
+    roll_cur_interval(ts);
+
+    m_cur_interval.update_op(bytes, latency);
+    // a stall may outlast the histogram range, keep it as the top value instead of losing it
+    hdr_record_value(m_cur_interval_latency, MIN(latency, LATENCY_HDR_MAX_VALUE));
+}
+
+void run_stats::update_phase_op(struct timeval* ts, unsigned int bytes, unsigned int latency)
+{
+    if (m_phases.empty()) {
+        return;
+    }
+
+    // a request belongs to the phase the server was in when it was sent
+    const unsigned long long sent = (unsigned long long) ts->tv_sec * 1000000 + ts->tv_usec - latency;
+    const int phase = m_config->phase_monitor->get_phase(sent);
+
+    m_phases[phase].update_op(bytes, latency);
+    hdr_record_value(m_phases_latency_histograms[phase], MIN(latency, LATENCY_HDR_MAX_VALUE));
+}
+
 void run_stats::update_get_op(struct timeval* ts, unsigned int bytes, unsigned int latency, unsigned int hits, unsigned int misses)
 {
     roll_cur_stats(ts);
     m_cur_stats.m_get_cmd.update_op(bytes, latency, hits, misses);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_get_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_get_latency_histogram,latency);
 
@@ -174,6 +246,13 @@ void run_stats::update_set_op(struct timeval* ts, unsigned int bytes, unsigned i
     roll_cur_stats(ts);
 
     m_cur_stats.m_set_cmd.update_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_set_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_set_latency_histogram,latency);
 }
@@ -183,6 +262,13 @@ void run_stats::update_moved_get_op(struct timeval* ts, unsigned int bytes, unsi
     roll_cur_stats(ts);
 
     m_cur_stats.m_get_cmd.update_moved_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_get_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_get_latency_histogram,latency);
 }
@@ -192,6 +278,13 @@ void run_stats::update_moved_set_op(struct timeval* ts, unsigned int bytes, unsi
     roll_cur_stats(ts);
 
     m_cur_stats.m_set_cmd.update_moved_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_set_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_set_latency_histogram,latency);
 }
@@ -201,6 +294,13 @@ void run_stats::update_ask_get_op(struct timeval* ts, unsigned int bytes, unsign
     roll_cur_stats(ts);
 
     m_cur_stats.m_get_cmd.update_ask_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_get_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_get_latency_histogram,latency);
 }
@@ -210,6 +310,13 @@ void run_stats::update_ask_set_op(struct timeval* ts, unsigned int bytes, unsign
     roll_cur_stats(ts);
 
     m_cur_stats.m_set_cmd.update_ask_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+        m_cur_interval.m_set_ops++;
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
     hdr_record_value(m_set_latency_histogram,latency);
 }
@@ -219,6 +326,12 @@ void run_stats::update_wait_op(struct timeval *ts, unsigned int latency)
     roll_cur_stats(ts);
 
     m_cur_stats.m_wait_cmd.update_op(0, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, 0, latency);
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, 0, latency);
+    }
     m_totals.update_op(0, latency);
     hdr_record_value(m_wait_latency_histogram,latency);
 }
@@ -228,6 +341,12 @@ void run_stats::update_arbitrary_op(struct timeval *ts, unsigned int bytes,
     roll_cur_stats(ts);
 
     m_cur_stats.m_ar_commands.at(request_index).update_op(bytes, latency);
+    if (m_config->stats_interval) {
+        update_interval_op(ts, bytes, latency);
+    }
+    if (m_config->phase_monitor) {
+        update_phase_op(ts, bytes, latency);
+    }
     m_totals.update_op(bytes, latency);
 
     struct hdr_histogram* hist = m_ar_commands_latency_histograms.at(request_index);
@@ -620,6 +739,73 @@ bool run_stats::save_hdr_arbitrary_commands(benchmark_config *config,int run_num
     return true;
 }
 
+// the timeline with an empty entry for every interval without responses,
+// so stalls show up as zero throughput rather than as missing rows
+std::vector<interval_stats> run_stats::get_timeline(void)
+{
+    std::vector<interval_stats> result;
+    if (m_intervals.empty())
+        return result;
+
+    result.reserve(m_intervals.back().m_interval - m_intervals.front().m_interval + 1);
+    for (std::vector<interval_stats>::iterator i = m_intervals.begin();
+         i != m_intervals.end(); i++) {
+        while (!result.empty() && result.back().m_interval + 1 < i->m_interval) {
+            result.push_back(interval_stats(result.back().m_interval + 1));
+        }
+        result.push_back(*i);
+    }
+    return result;
+}
+
+bool run_stats::save_csv_timeline(benchmark_config *config, int run_number)
+{
+    if (!strcmp(config->timeline_prefix, "") || m_intervals.empty())
+        return true;
+
+    char filename[1024];
+    snprintf(filename, sizeof(filename) - 1, "%s_TIMELINE_run_%d.csv", config->timeline_prefix, run_number);
+    fprintf(stderr, "Writing %u msec stats timeline to %s...\n", config->stats_interval, filename);
+
+    FILE *f = fopen(filename, "w");
+    if (!f) {
+        perror(filename);
+        return false;
+    }
+
+    std::vector<float> &quantile_list = config->print_percentiles.quantile_list;
+    fprintf(f, "Time (msec),Ops/sec,Sets/sec,Gets/sec,KB/sec,Average Latency");
+    for (std::size_t i = 0; i < quantile_list.size(); i++)
+        fprintf(f, ",p%.2f Latency", quantile_list[i]);
+    fprintf(f, ",Max Latency\n");
+
+    const double intervals_per_sec = 1000.0 / config->stats_interval;
+    const long long start_time_ms = ((long long) m_start_time.tv_sec * 1000000 + m_start_time.tv_usec) / 1000;
+    safe_hdr_histogram latency(LATENCY_HDR_MAX_VALUE);
+
+    std::vector<interval_stats> timeline = get_timeline();
+    for (std::vector<interval_stats>::iterator i = timeline.begin(); i != timeline.end(); i++) {
+        hdr_reset(latency);
+        i->load_latency(latency);
+
+        fprintf(f, "%lld,%.2f,%.2f,%.2f,%.2f,%.3f",
+                (long long) (i->m_interval * config->stats_interval) - start_time_ms,
+                i->m_ops * intervals_per_sec,
+                i->m_set_ops * intervals_per_sec,
+                i->m_get_ops * intervals_per_sec,
+                i->m_bytes * intervals_per_sec / 1024,
+                i->m_ops ? i->m_total_latency / (double) i->m_ops / LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+        for (std::size_t j = 0; j < quantile_list.size(); j++) {
+            fprintf(f, ",%.3f", i->m_ops ?
+                    hdr_value_at_percentile(latency, quantile_list[j]) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+        }
+        fprintf(f, ",%.3f\n", i->m_ops ? hdr_max(latency) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+    }
+
+    fclose(f);
+    return true;
+}
+
 bool run_stats::save_csv(const char *filename, benchmark_config *config)
 {
     FILE *f = fopen(filename, "w");
@@ -735,6 +921,36 @@ void run_stats::merge(const run_stats& other, int iteration)
         sort(m_stats.begin(), m_stats.end(), one_second_stats_predicate);
     }
 
+    // aggregate the timelines, both are sorted by interval
+    if (!other.m_intervals.empty()) {
+        safe_hdr_histogram scratch(LATENCY_HDR_MAX_VALUE);
+        std::vector<interval_stats> merged;
+        merged.reserve(MAX(m_intervals.size(), other.m_intervals.size()));
+
+        std::vector<interval_stats>::const_iterator i = m_intervals.begin();
+        std::vector<interval_stats>::const_iterator other_i = other.m_intervals.begin();
+        while (i != m_intervals.end() || other_i != other.m_intervals.end()) {
+            if (other_i == other.m_intervals.end() ||
+                (i != m_intervals.end() && i->m_interval < other_i->m_interval)) {
+                merged.push_back(*i++);
+            } else if (i == m_intervals.end() || other_i->m_interval < i->m_interval) {
+                merged.push_back(*other_i++);
+            } else {
+                merged.push_back(*i++);
+                merged.back().merge(*other_i++, scratch);
+            }
+        }
+        m_intervals.swap(merged);
+    }
+
+    // aggregate the recovery phases
+    for (unsigned int j = 0; j < m_phases.size() && j < other.m_phases.size(); j++) {
+        m_phases[j].m_ops += other.m_phases[j].m_ops;
+        m_phases[j].m_bytes += other.m_phases[j].m_bytes;
+        m_phases[j].m_total_latency += other.m_phases[j].m_total_latency;
+        hdr_add(m_phases_latency_histograms[j], other.m_phases_latency_histograms[j]);
+    }
+
     // aggregate totals
     m_totals.add(other.m_totals);
 
@@ -1191,6 +1407,138 @@ void run_stats::print_json(json_handler *jsonhandler, arbitrary_command_list& co
                          );
 }
 
+void run_stats::print_timeline_json(json_handler *jsonhandler, std::vector<float> quantile_list) {
+    const double intervals_per_sec = 1000.0 / m_config->stats_interval;
+    const long long start_time_ms = ((long long) m_start_time.tv_sec * 1000000 + m_start_time.tv_usec) / 1000;
+    safe_hdr_histogram latency(LATENCY_HDR_MAX_VALUE);
+
+    jsonhandler->open_nesting("Timeline");
+    jsonhandler->write_obj("Interval","%u", m_config->stats_interval);
+    jsonhandler->write_obj("Time unit","\"%s\"","MILLISECONDS");
+    jsonhandler->open_nesting("Intervals", NESTED_ARRAY);
+
+    std::vector<interval_stats> timeline = get_timeline();
+    for (std::vector<interval_stats>::iterator i = timeline.begin(); i != timeline.end(); i++) {
+        hdr_reset(latency);
+        i->load_latency(latency);
+
+        jsonhandler->open_nesting(NULL);
+        jsonhandler->write_obj("Time","%lld", (long long) (i->m_interval * m_config->stats_interval) - start_time_ms);
+        jsonhandler->write_obj("Ops/sec","%.2f", i->m_ops * intervals_per_sec);
+        jsonhandler->write_obj("Sets/sec","%.2f", i->m_set_ops * intervals_per_sec);
+        jsonhandler->write_obj("Gets/sec","%.2f", i->m_get_ops * intervals_per_sec);
+        jsonhandler->write_obj("KB/sec","%.2f", i->m_bytes * intervals_per_sec / 1024);
+        jsonhandler->write_obj("Average Latency","%.3f",
+                               i->m_ops ? i->m_total_latency / (double) i->m_ops / LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+        for (std::size_t j = 0; j < quantile_list.size(); j++) {
+            char quantile_header[8];
+            snprintf(quantile_header, sizeof(quantile_header)-1, "p%.2f", quantile_list[j]);
+            jsonhandler->write_obj(quantile_header,"%.3f", i->m_ops ?
+                                   hdr_value_at_percentile(latency, quantile_list[j]) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+        }
+        jsonhandler->write_obj("Max Latency","%.3f", i->m_ops ? hdr_max(latency) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0);
+        jsonhandler->close_nesting();
+    }
+
+    jsonhandler->close_nesting();
+    jsonhandler->close_nesting();
+}
+
+void run_stats::print_phases(FILE *out, json_handler *jsonhandler, std::vector<float> quantile_list) {
+    output_table table;
+    table_el el;
+    table_column phase_column(12), duration_column(10), ops_column(12), ops_sec_column(12),
+                 avg_column(15), max_column(15), kb_sec_column(12);
+    std::vector<table_column> quantile_columns;
+
+    phase_column.elements.push_back(*el.init_str("%-12s ", "Phase"));
+    phase_column.elements.push_back(*el.init_str("%s", "-------------"));
+    duration_column.elements.push_back(*el.init_str("%10s ", "Secs"));
+    duration_column.elements.push_back(*el.init_str("%s", "-----------"));
+    ops_column.elements.push_back(*el.init_str("%12s ", "Ops"));
+    ops_column.elements.push_back(*el.init_str("%s", "-------------"));
+    ops_sec_column.elements.push_back(*el.init_str("%12s ", "Ops/sec"));
+    ops_sec_column.elements.push_back(*el.init_str("%s", "-------------"));
+    avg_column.elements.push_back(*el.init_str("%15s ", "Avg. Latency"));
+    avg_column.elements.push_back(*el.init_str("%s", "----------------"));
+    for (std::size_t i = 0; i < quantile_list.size(); i++) {
+        char quantile_header[50];
+        snprintf(quantile_header, sizeof(quantile_header)-1, "p%g Latency", quantile_list[i]);
+
+        quantile_columns.push_back(table_column(15));
+        quantile_columns.back().elements.push_back(*el.init_str("%15s ", quantile_header));
+        quantile_columns.back().elements.push_back(*el.init_str("%s", "----------------"));
+    }
+    max_column.elements.push_back(*el.init_str("%15s ", "Max Latency"));
+    max_column.elements.push_back(*el.init_str("%s", "----------------"));
+    kb_sec_column.elements.push_back(*el.init_str("%12s ", "KB/sec"));
+    kb_sec_column.elements.push_back(*el.init_str("%s", "-------------"));
+
+    if (jsonhandler != NULL) {
+        jsonhandler->open_nesting("Recovery Phases");
+    }
+
+    for (int i = 0; i < recovery_phase_count; i++) {
+        const char *name = recovery_monitor::get_phase_name(i);
+        const interval_stats& phase = m_phases[i];
+        struct hdr_histogram* latency = m_phases_latency_histograms[i];
+        const double secs = m_phases_duration[i] / 1000000.0;
+        const double ops_sec = secs > 0 ? phase.m_ops / secs : 0;
+        const double kb_sec = secs > 0 ? phase.m_bytes / 1024.0 / secs : 0;
+        const double avg_latency = phase.m_ops ? phase.m_total_latency / (double) phase.m_ops / LATENCY_HDR_RESULTS_MULTIPLIER : 0.0;
+        const double max_latency = phase.m_ops ? hdr_max(latency) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0;
+
+        phase_column.elements.push_back(*el.init_str("%-12s ", name));
+        duration_column.elements.push_back(*el.init_double("%10.2f ", secs));
+        ops_column.elements.push_back(*el.init_double("%12.0f ", phase.m_ops));
+        ops_sec_column.elements.push_back(*el.init_double("%12.2f ", ops_sec));
+        avg_column.elements.push_back(*el.init_double("%15.05f ", avg_latency));
+        max_column.elements.push_back(*el.init_double("%15.05f ", max_latency));
+        kb_sec_column.elements.push_back(*el.init_double("%12.2f ", kb_sec));
+
+        if (jsonhandler != NULL) {
+            jsonhandler->open_nesting(name);
+            jsonhandler->write_obj("Duration","%.3f", secs);
+            jsonhandler->write_obj("Count","%lu", phase.m_ops);
+            jsonhandler->write_obj("Ops/sec","%.2f", ops_sec);
+            jsonhandler->write_obj("Average Latency","%.3f", avg_latency);
+        }
+
+        for (std::size_t j = 0; j < quantile_list.size(); j++) {
+            const double value = phase.m_ops ? hdr_value_at_percentile(latency, quantile_list[j]) / (double) LATENCY_HDR_RESULTS_MULTIPLIER : 0.0;
+            quantile_columns[j].elements.push_back(*el.init_double("%15.05f ", value));
+
+            if (jsonhandler != NULL) {
+                char quantile_header[8];
+                snprintf(quantile_header, sizeof(quantile_header)-1, "p%.2f", quantile_list[j]);
+                jsonhandler->write_obj(quantile_header,"%.3f", value);
+            }
+        }
+
+        if (jsonhandler != NULL) {
+            jsonhandler->write_obj("Max Latency","%.3f", max_latency);
+            jsonhandler->write_obj("KB/sec","%.2f", kb_sec);
+            jsonhandler->close_nesting();
+        }
+    }
+
+    if (jsonhandler != NULL) {
+        jsonhandler->close_nesting();
+    }
+
+    table.add_column(phase_column);
+    table.add_column(duration_column);
+    table.add_column(ops_column);
+    table.add_column(ops_sec_column);
+    table.add_column(avg_column);
+    for (std::size_t i = 0; i < quantile_columns.size(); i++) {
+        table.add_column(quantile_columns[i]);
+    }
+    table.add_column(max_column);
+    table.add_column(kb_sec_column);
+    table.print(out, "RECOVERY PHASES");
+}
+
 void run_stats::print_histogram(FILE *out, json_handler *jsonhandler, arbitrary_command_list& command_list) {
     fprintf(out,
             "\n\n"
@@ -1328,6 +1676,14 @@ void run_stats::print(FILE *out, benchmark_config *config,
         }
 
         print_json(jsonhandler, *config->arbitrary_commands, config->cluster_mode, config->print_percentiles.quantile_list);
+
+        if (!m_intervals.empty()) {
+            print_timeline_json(jsonhandler, config->print_percentiles.quantile_list);
+        }
+    }
+
+    if (!m_phases_duration.empty()) {
+        print_phases(out, jsonhandler, config->print_percentiles.quantile_list);
     }
 
     if (!config->hide_histogram) {
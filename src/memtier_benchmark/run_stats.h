@@ -27,6 +27,7 @@
 
 #include "memtier_benchmark.h"
 #include "run_stats_types.h"
+#include "recovery_monitor.h"
 #include "JSON_handler.h"
 #include "deps/hdr_histogram/hdr_histogram.h"
 #include "deps/hdr_histogram/hdr_histogram_log.h"
@@ -106,13 +107,29 @@ protected:
     safe_hdr_histogram m_wait_latency_histogram;
     std::vector<safe_hdr_histogram> m_ar_commands_latency_histograms;
 
+    // sub-second timeline ( --stats-interval, closed intervals only )
+    std::vector<interval_stats> m_intervals;
+    interval_stats m_cur_interval;
+    safe_hdr_histogram m_cur_interval_latency;
+
+    // per recovery phase ( --recovery-phases ), by the time requests were sent
+    std::vector<interval_stats> m_phases;
+    std::vector<safe_hdr_histogram> m_phases_latency_histograms;
+    std::vector<unsigned long long> m_phases_duration;
+
     void roll_cur_stats(struct timeval* ts);
+    void roll_cur_interval(struct timeval* ts);
+    void close_cur_interval(void);
+    void update_interval_op(struct timeval* ts, unsigned int bytes, unsigned int latency);
+    void update_phase_op(struct timeval* ts, unsigned int bytes, unsigned int latency);
+    std::vector<interval_stats> get_timeline(void);
 
 public:
     run_stats(benchmark_config *config);
     void setup_arbitrary_commands(size_t n_arbitrary_commands);
     void set_start_time(struct timeval* start_time);
     void set_end_time(struct timeval* end_time);
+    void set_phases_duration(const recovery_monitor* monitor);
 
     void update_get_op(struct timeval* ts, unsigned int bytes, unsigned int latency, unsigned int hits, unsigned int misses);
     void update_set_op(struct timeval* ts, unsigned int bytes, unsigned int latency);
@@ -154,6 +171,7 @@ public:
     bool save_hdr_arbitrary_commands(benchmark_config *config,int run_number);
 
     bool save_csv(const char *filename, benchmark_config *config);
+    bool save_csv_timeline(benchmark_config *config, int run_number);
     void debug_dump(void);
 
     // function to handle the results output
@@ -169,6 +187,8 @@ public:
     void print_kb_sec_column(output_table &table);
     void print_json(json_handler *jsonhandler, arbitrary_command_list& command_list, bool cluster_mode, std::vector<float> quantile_list);
     void print_histogram(FILE *out, json_handler* jsonhandler, arbitrary_command_list& command_list);
+    void print_timeline_json(json_handler *jsonhandler, std::vector<float> quantile_list);
+    void print_phases(FILE *out, json_handler *jsonhandler, std::vector<float> quantile_list);
     void print(FILE *file, benchmark_config *config,
                const char* header = NULL, json_handler* jsonhandler = NULL);
 
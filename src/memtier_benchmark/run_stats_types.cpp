@@ -166,6 +166,50 @@ void one_second_stats::merge(const one_second_stats& other) {
 
 ///////////////////////////////////////////////////////////////////////////
 
+interval_stats::interval_stats(unsigned long long interval) :
+    m_interval(interval),
+    m_ops(0),
+    m_set_ops(0),
+    m_get_ops(0),
+    m_bytes(0),
+    m_total_latency(0) {
+}
+
+void interval_stats::update_op(unsigned int bytes, unsigned int latency) {
+    m_bytes += bytes;
+    m_ops++;
+    m_total_latency += latency;
+}
+
+void interval_stats::save_latency(struct hdr_histogram* hdr) {
+    struct hdr_iter iter;
+
+    m_latency.clear();
+    hdr_iter_recorded_init(&iter, hdr);
+    while (hdr_iter_next(&iter)) {
+        m_latency.push_back(std::make_pair(iter.value, iter.count));
+    }
+}
+
+void interval_stats::load_latency(struct hdr_histogram* hdr) const {
+    for (size_t i = 0; i < m_latency.size(); i++) {
+        hdr_record_values(hdr, m_latency[i].first, m_latency[i].second);
+    }
+}
+
+void interval_stats::merge(const interval_stats& other, struct hdr_histogram* scratch) {
+    m_ops += other.m_ops;
+    m_set_ops += other.m_set_ops;
+    m_get_ops += other.m_get_ops;
+    m_bytes += other.m_bytes;
+    m_total_latency += other.m_total_latency;
+
+    hdr_reset(scratch);
+    load_latency(scratch);
+    other.load_latency(scratch);
+    save_latency(scratch);
+}
+
 totals_cmd::totals_cmd() :
         m_ops_sec(0),
         m_bytes_sec(0),
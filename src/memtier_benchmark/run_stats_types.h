@@ -28,6 +28,10 @@
 #define LATENCY_HDR_RESULTS_MULTIPLIER 1000
 #define LATENCY_HDR_GRANULARITY 10
 
+#include <stdint.h>
+#include <vector>
+#include <utility>
+
 #include "deps/hdr_histogram/hdr_histogram.h"
 #include "memtier_benchmark.h"
 
@@ -52,12 +56,20 @@ public:
         hdr_close(m_hdr);
     }
 
-    safe_hdr_histogram(const safe_hdr_histogram& other) {
+    explicit safe_hdr_histogram(int64_t max_value) {
         hdr_init(
             LATENCY_HDR_MIN_VALUE,          // Minimum value
-            LATENCY_HDR_SEC_MAX_VALUE,      // Maximum value
+            max_value,                      // Maximum value
             LATENCY_HDR_SEC_SIGDIGTS,       // Number of significant figures
             &m_hdr);
+    }
+
+    safe_hdr_histogram(const safe_hdr_histogram& other) {
+        hdr_init(
+            other.m_hdr->lowest_trackable_value,
+            other.m_hdr->highest_trackable_value,
+            other.m_hdr->significant_figures,
+            &m_hdr);
         hdr_add(m_hdr, other.m_hdr);
     }
 
@@ -127,6 +139,25 @@ public:
     void merge(const one_second_stats& other);
 };
 
+// Stats of one interval of the sub-second timeline (--stats-interval).
+// Short intervals leave most histogram buckets empty, so a closed interval
+// keeps only the recorded latency values and their counts.
+class interval_stats {
+public:
+    unsigned long long m_interval;  // interval number, from the epoch
+    unsigned long int m_ops;
+    unsigned long int m_set_ops;
+    unsigned long int m_get_ops;
+    unsigned long int m_bytes;
+    unsigned long long int m_total_latency;
+    std::vector<std::pair<int64_t, int64_t> > m_latency;
+    interval_stats(unsigned long long interval);
+    void update_op(unsigned int bytes, unsigned int latency);
+    void save_latency(struct hdr_histogram* hdr);
+    void load_latency(struct hdr_histogram* hdr) const;
+    void merge(const interval_stats& other, struct hdr_histogram* scratch);
+};
+
 class totals_cmd {
 public:
     double m_ops_sec;
@@ -71,6 +71,16 @@ void cluster_client_event_handler(bufferevent *bev, short events, void *ctx)
     sc->handle_event(events);
 }
 
+void cluster_client_rate_timer_handler(evutil_socket_t fd, short what, void *ctx)
+{
+    UNUSED(fd);
+    UNUSED(what);
+    shard_connection *sc = (shard_connection *) ctx;
+
+    assert(sc != NULL);
+    sc->handle_rate_timer();
+}
+
 request::request(request_type type, unsigned int size, struct timeval* sent_time, unsigned int keys)
         : m_type(type), m_size(size), m_keys(keys)
 {
@@ -123,7 +133,7 @@ verify_request::~verify_request(void)
 shard_connection::shard_connection(unsigned int id, connections_manager* conns_man, benchmark_config* config,
                                    struct event_base* event_base, abstract_protocol* abs_protocol) :
         m_address(NULL), m_port(NULL), m_unix_sockaddr(NULL),
-        m_bev(NULL), m_pending_resp(0), m_connection_state(conn_disconnected),
+        m_bev(NULL), m_pending_resp(0), m_rate_timer(NULL), m_rate_sent(0), m_connection_state(conn_disconnected),
         m_authentication(auth_done), m_db_selection(select_done), m_cluster_slots(slots_done) {
     m_id = id;
     m_conns_manager = conns_man;
@@ -145,6 +155,11 @@ shard_connection::shard_connection(unsigned int id, connections_manager* conns_m
     m_pipeline = new std::queue<request *>;
     assert(m_pipeline != NULL);
 
+    if (m_config->rate_per_connection > 0 || m_config->aof_replay_speed > 0) {
+        m_rate_timer = evtimer_new(m_event_base, cluster_client_rate_timer_handler, (void *)this);
+        assert(m_rate_timer != NULL);
+    }
+    timerclear(&m_rate_start);
 }
 
 shard_connection::~shard_connection() {
@@ -168,6 +183,11 @@ shard_connection::~shard_connection() {
         m_bev = NULL;
     }
 
+    if (m_rate_timer != NULL) {
+        event_free(m_rate_timer);
+        m_rate_timer = NULL;
+    }
+
     if (m_protocol != NULL) {
         delete m_protocol;
         m_protocol = NULL;
@@ -288,6 +308,10 @@ void shard_connection::disconnect() {
     }
     m_bev = NULL;
 
+    if (m_rate_timer) {
+        evtimer_del(m_rate_timer);
+    }
+
     m_connection_state = conn_disconnected;
 
     // by default no need to send any setup request
@@ -469,6 +493,15 @@ void shard_connection::process_response(void)
 void shard_connection::process_first_request() {
     m_conns_manager->set_start_time();
     fill_pipeline();
+
+    // nothing was sent at all (e.g. a replay connection that owns no keys)
+    if (m_pending_resp == 0) {
+        bufferevent_disable(m_bev, EV_WRITE|EV_READ);
+
+        if (m_conns_manager->finished()) {
+            m_conns_manager->set_end_time();
+        }
+    }
 }
 
 
@@ -486,11 +519,80 @@ void shard_connection::fill_pipeline(void)
             break;
         }
 
+        // open-loop mode: requests are due on a fixed schedule, and stamped with
+        // the time they were due, so latency also covers the time they waited
+        if (m_config->rate_per_connection > 0) {
+            struct timeval scheduled;
+            if (!get_scheduled_time(&now, &scheduled)) {
+                break;
+            }
+
+            size_t queued = m_pipeline->size();
+            m_conns_manager->create_request(scheduled, m_id);
+            if (m_pipeline->size() > queued) {
+                m_rate_sent++;
+            }
+            continue;
+        }
+
         // client manage requests logic
         m_conns_manager->create_request(now, m_id);
     }
 }
 
+bool shard_connection::get_scheduled_time(struct timeval* now, struct timeval* scheduled)
+{
+    // the schedule starts with the first request and is kept across
+    // reconnections, so requests missed while disconnected are sent late
+    if (!timerisset(&m_rate_start)) {
+        m_rate_start = *now;
+    }
+
+    unsigned long long offset = (unsigned long long) (m_rate_sent * 1000000.0 / m_config->rate_per_connection);
+    unsigned long long due = (unsigned long long) m_rate_start.tv_sec * 1000000 + m_rate_start.tv_usec + offset;
+    unsigned long long cur = (unsigned long long) now->tv_sec * 1000000 + now->tv_usec;
+
+    if (due > cur) {
+        // not due yet, wake up when it is
+        schedule_fill(due - cur);
+        return false;
+    }
+
+    scheduled->tv_sec = due / 1000000;
+    scheduled->tv_usec = due % 1000000;
+    return true;
+}
+
+void shard_connection::schedule_fill(unsigned long long delay_usec)
+{
+    assert(m_rate_timer != NULL);
+
+    if (!evtimer_pending(m_rate_timer, NULL)) {
+        struct timeval delay;
+        delay.tv_sec = delay_usec / 1000000;
+        delay.tv_usec = delay_usec % 1000000;
+        evtimer_add(m_rate_timer, &delay);
+    }
+}
+
+void shard_connection::handle_rate_timer(void)
+{
+    if (m_connection_state != conn_connected) {
+        return;
+    }
+
+    fill_pipeline();
+
+    // wake up the connection, process_response() disables it when idle
+    if (m_bev != NULL && m_pending_resp > 0) {
+        bufferevent_enable(m_bev, EV_READ|EV_WRITE);
+    }
+
+    if (m_conns_manager->finished()) {
+        m_conns_manager->set_end_time();
+    }
+}
+
 void shard_connection::handle_event(short events)
 {
     // connect() returning to us?  normally we expect EV_WRITE, but for UNIX domain
@@ -632,3 +734,13 @@ int shard_connection::send_arbitrary_command(const command_arg *arg, const char
 void shard_connection::send_arbitrary_command_end(size_t command_index, struct timeval* sent_time, int cmd_size) {
     push_req(new arbitrary_request(command_index, rt_arbitrary, cmd_size, sent_time));
 }
+
+void shard_connection::send_raw_command(struct timeval* sent_time, const char *cmd, int cmd_len) {
+    int cmd_size = 0;
+
+    benchmark_debug_log("server %s: raw command len=%d\n", get_readable_id(), cmd_len);
+    cmd_size = m_protocol->write_command_raw(cmd, cmd_len);
+
+    // an AOF holds write commands only, so they are accounted as sets
+    push_req(new request(rt_set, cmd_size, sent_time, 1));
+}
@@ -81,6 +81,7 @@ struct verify_request : public request {
 class shard_connection {
     friend void cluster_client_read_handler(bufferevent *bev, void *ctx);
     friend void cluster_client_event_handler(bufferevent *bev, short events, void *ctx);
+    friend void cluster_client_rate_timer_handler(evutil_socket_t fd, short what, void *ctx);
 
 public:
     shard_connection(unsigned int id, connections_manager* conn_man, benchmark_config* config,
@@ -105,6 +106,8 @@ public:
     int send_arbitrary_command(const command_arg *arg);
     int send_arbitrary_command(const command_arg *arg, const char *val, int val_len);
     void send_arbitrary_command_end(size_t command_index, struct timeval* sent_time, int cmd_size);
+    void send_raw_command(struct timeval* sent_time, const char *cmd, int cmd_len);
+    void schedule_fill(unsigned long long delay_usec);
 
     void set_authentication() {
         m_authentication = auth_none;
@@ -157,6 +160,8 @@ private:
     void process_subsequent_requests(void);
     void process_first_request();
     void fill_pipeline(void);
+    bool get_scheduled_time(struct timeval* now, struct timeval* scheduled);
+    void handle_rate_timer(void);
 
     void handle_event(short evtype);
 
@@ -177,6 +182,11 @@ private:
 
     int m_pending_resp;
 
+    // open-loop (--rate) and replay pacing schedule
+    struct event* m_rate_timer;
+    struct timeval m_rate_start;
+    unsigned long long m_rate_sent;
+
     enum connection_state m_connection_state;
 
     enum authentication_state m_authentication;
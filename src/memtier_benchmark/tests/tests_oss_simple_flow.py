@@ -144,3 +144,116 @@ def test_default_set_get_3_runs(env):
     overall_request_count = agg_info_commandstats(master_nodes_connections, merged_command_stats)
     assert_minimum_memtier_outcomes(config, env, memtier_ok, merged_command_stats, overall_expected_request_count,
                                     overall_request_count)
+
+
+# run each test on different env
+def test_default_set_get_rate_per_connection(env):
+    env.skipOnCluster()
+    benchmark_specs = {"name": env.testName, "args": ['--rate-per-connection=2000']}
+    addTLSArgs(benchmark_specs, env)
+    config = get_default_memtier_config()
+    master_nodes_list = env.getMasterNodesList()
+    overall_expected_request_count = get_expected_request_count(config)
+
+    add_required_env_arguments(benchmark_specs, config, env, master_nodes_list)
+
+    # Create a temporary directory
+    test_dir = tempfile.mkdtemp()
+
+    config = RunConfig(test_dir, env.testName, config, {})
+    ensure_clean_benchmark_folder(config.results_dir)
+
+    benchmark = Benchmark.from_json(config, benchmark_specs)
+
+    # benchmark.run() returns True if the return code of memtier_benchmark was 0
+    memtier_ok = benchmark.run()
+    debugPrintMemtierOnError(config, env, memtier_ok)
+
+    master_nodes_connections = env.getOSSMasterNodesConnectionList()
+    merged_command_stats = {'cmdstat_set': {'calls': 0}, 'cmdstat_get': {'calls': 0}}
+    overall_request_count = agg_info_commandstats(master_nodes_connections, merged_command_stats)
+    assert_minimum_memtier_outcomes(config, env, memtier_ok, merged_command_stats, overall_expected_request_count,
+                                    overall_request_count)
+
+
+def test_aof_replay(env):
+    env.skipOnCluster()
+    # Create a temporary directory
+    test_dir = tempfile.mkdtemp()
+
+    # one SELECT, then 1000 SETs on 100 keys, the last value of each key must win
+    aof_file = '{0}/replay.aof'.format(test_dir)
+    with open(aof_file, 'w') as aof:
+        aof.write('*2\r\n$6\r\nSELECT\r\n$1\r\n0\r\n')
+        for i in range(1000):
+            key = 'replay-{0}'.format(i % 100)
+            value = str(i)
+            aof.write('*3\r\n$3\r\nSET\r\n${0}\r\n{1}\r\n${2}\r\n{3}\r\n'.format(
+                len(key), key, len(value), value))
+
+    benchmark_specs = {"name": env.testName, "args": ['--aof-replay={0}'.format(aof_file)]}
+    addTLSArgs(benchmark_specs, env)
+    config = get_default_memtier_config()
+    master_nodes_list = env.getMasterNodesList()
+    overall_expected_request_count = 1000
+
+    add_required_env_arguments(benchmark_specs, config, env, master_nodes_list)
+
+    config = RunConfig(test_dir, env.testName, config, {})
+    ensure_clean_benchmark_folder(config.results_dir)
+
+    benchmark = Benchmark.from_json(config, benchmark_specs)
+
+    # benchmark.run() returns True if the return code of memtier_benchmark was 0
+    memtier_ok = benchmark.run()
+    debugPrintMemtierOnError(config, env, memtier_ok)
+
+    master_nodes_connections = env.getOSSMasterNodesConnectionList()
+    merged_command_stats = {'cmdstat_set': {'calls': 0}}
+    overall_request_count = agg_info_commandstats(master_nodes_connections, merged_command_stats)
+    assert_minimum_memtier_outcomes(config, env, memtier_ok, merged_command_stats, overall_expected_request_count,
+                                    overall_request_count)
+
+    # commands on a key are replayed in order
+    for k in range(100):
+        env.assertEqual(int(master_nodes_connections[0].execute_command('GET', 'replay-{0}'.format(k))), 900 + k)
+
+
+def test_recovery_phases(env):
+    env.skipOnCluster()
+    if env.useTLS:
+        env.skip()
+    benchmark_specs = {"name": env.testName, "args": ['--recovery-phases', '--recovery-poll-interval=10']}
+    config = get_default_memtier_config()
+    master_nodes_list = env.getMasterNodesList()
+    overall_expected_request_count = get_expected_request_count(config)
+
+    add_required_env_arguments(benchmark_specs, config, env, master_nodes_list)
+
+    # Create a temporary directory
+    test_dir = tempfile.mkdtemp()
+
+    config = RunConfig(test_dir, env.testName, config, {})
+    ensure_clean_benchmark_folder(config.results_dir)
+
+    benchmark = Benchmark.from_json(config, benchmark_specs)
+
+    # benchmark.run() returns True if the return code of memtier_benchmark was 0
+    memtier_ok = benchmark.run()
+    debugPrintMemtierOnError(config, env, memtier_ok)
+
+    master_nodes_connections = env.getOSSMasterNodesConnectionList()
+    merged_command_stats = {'cmdstat_set': {'calls': 0}, 'cmdstat_get': {'calls': 0}}
+    overall_request_count = agg_info_commandstats(master_nodes_connections, merged_command_stats)
+    assert_minimum_memtier_outcomes(config, env, memtier_ok, merged_command_stats, overall_expected_request_count,
+                                    overall_request_count)
+
+    # every request is counted in exactly one phase
+    json_filename = '{0}/mb.json'.format(config.results_dir)
+    with open(json_filename) as results_json:
+        results_dict = json.load(results_json)
+        phases = results_dict['ALL STATS']['Recovery Phases']
+        env.assertEqual(sorted(phases.keys()), ['Restored', 'Restoring', 'Startup'])
+        env.assertEqual(sum([phases[p]['Count'] for p in phases]), overall_expected_request_count)
+        # a server without instant recovery is restored right away
+        env.assertEqual(phases['Restoring']['Count'], 0)
@@ -765,6 +765,7 @@ int RM_CreateCommand(RedisModuleCtx *ctx, const char *name, RedisModuleCmdFunc c
     cp->rediscmd->calls = 0;
     dictAdd(server.commands,sdsdup(cmdname),cp->rediscmd);
     dictAdd(server.orig_commands,sdsdup(cmdname),cp->rediscmd);
+    buildCommandLookupTable();
     return REDISMODULE_OK;
 }
 
@@ -2881,6 +2882,7 @@ RedisModuleCallReply *RM_Call(RedisModuleCtx *ctx, const char *cmdname, const ch
     c->flags |= CLIENT_MODULE;
     c->db = ctx->client->db;
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     if (ctx->module) ctx->module->in_call++;
 
@@ -5106,6 +5108,7 @@ void moduleCallCommandFilters(client *c) {
 
     c->argv = filter.argv;
     c->argc = filter.argc;
+    if (c->argv_len < c->argc) c->argv_len = c->argc;
 }
 
 /* Return the number of arguments a filtered command has.  The number of
@@ -5302,6 +5305,7 @@ void moduleUnregisterCommands(struct RedisModule *module) {
         }
     }
     dictReleaseIterator(di);
+    buildCommandLookupTable();
 }
 
 /* Load a module and initialize it. On success C_OK is returned, otherwise
@@ -34,7 +34,21 @@
 #include <math.h>
 #include <ctype.h>
 
+/* IOV_MAX is defined by <limits.h> on POSIX systems. */
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
 static void setProtocolError(const char *errstr, client *c);
+int postponeClientRead(client *c);
+
+/* What the I/O threads are doing right now, see the "Threaded I/O" section
+ * at the end of this file. */
+#define IO_THREADS_OP_IDLE 0
+#define IO_THREADS_OP_READ 1
+#define IO_THREADS_OP_WRITE 2
+static int io_threads_op = IO_THREADS_OP_IDLE;
+static void releaseReplyObject(robj *o);
 
 /* Return the size consumed from the allocator, for the specified SDS string,
  * including internal fragmentation. This function is used in order to compute
@@ -58,12 +72,18 @@ size_t getStringObjectSdsUsedMemory(robj *o) {
 /* Client.reply list dup and free methods. */
 void *dupClientReplyValue(void *o) {
     clientReplyBlock *old = o;
-    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + old->size);
-    memcpy(buf, o, sizeof(clientReplyBlock) + old->size);
+    size_t bufsize = old->obj ? 0 : old->size;
+    clientReplyBlock *buf = zmalloc(sizeof(clientReplyBlock) + bufsize);
+    memcpy(buf, o, sizeof(clientReplyBlock) + bufsize);
+    if (buf->obj) incrRefCount(buf->obj);
     return buf;
 }
 
 void freeClientReplyValue(void *o) {
+    clientReplyBlock *block = o;
+    /* The dummy node of addDeferredMultiBulkLength() holds no block. */
+    if (block == NULL) return;
+    if (block->obj) releaseReplyObject(block->obj);
     zfree(o);
 }
 
@@ -118,6 +138,10 @@ client *createClient(int fd) {
     c->reqtype = 0;
     c->argc = 0;
     c->argv = NULL;
+    c->argv_len = 0;
+    c->argv_pool_len = 0;
+    c->aof_lsn = 0;
+    c->aof_wait_node = NULL;
     c->cmd = c->lastcmd = NULL;
     c->multibulklen = 0;
     c->bulklen = -1;
@@ -170,9 +194,10 @@ client *createClient(int fd) {
  * buffers can hold, then we'll really install the handler. */
 void clientInstallWriteHandler(client *c) {
     /* Schedule the client to write the output buffers to the socket only
-     * if not already done and, for slaves, if the slave can actually receive
-     * writes at this stage. */
-    if (!(c->flags & CLIENT_PENDING_WRITE) &&
+     * if not already done (or waiting for the AOF, see aofHoldClientReply())
+     * and, for slaves, if the slave can actually receive writes at this
+     * stage. */
+    if (!(c->flags & CLIENT_PENDING_WRITE) && c->aof_wait_node == NULL &&
         (c->replstate == REPL_STATE_NONE ||
          (c->replstate == SLAVE_STATE_ONLINE && !c->repl_put_online_on_ack)))
     {
@@ -225,8 +250,13 @@ int prepareClientToWrite(client *c) {
     if (c->fd <= 0) return C_ERR; /* Fake client for AOF loading. */
 
     /* Schedule the client to write the output buffers to the socket, unless
-     * it should already be setup to do so (it has already pending data). */
-    if (!clientHasPendingReplies(c)) clientInstallWriteHandler(c);
+     * it should already be setup to do so (it has already pending data).
+     *
+     * If CLIENT_PENDING_READ is set, we're in an I/O thread and should
+     * not install a write handler. Instead, it will be done by
+     * handleClientsWithPendingReadsUsingThreads() upon return. */
+    if (!clientHasPendingReplies(c) && !(c->flags & CLIENT_PENDING_READ))
+        clientInstallWriteHandler(c);
 
     /* Authorize the caller to queue in the output buffer of this client. */
     return C_OK;
@@ -263,8 +293,9 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
      * addDeferredMultiBulkLength() is used, it sets a dummy node to NULL just
      * fo fill it later, when the size of the bulk length is set. */
 
-    /* Append to tail string when possible. */
-    if (tail) {
+    /* Append to tail string when possible. Blocks referencing an object
+     * have no room left by definition. */
+    if (tail && !tail->obj) {
         /* Copy the part we can fit into the tail, and leave the rest for a
          * new node */
         size_t avail = tail->size - tail->used;
@@ -282,6 +313,7 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
         /* take over the allocation's internal fragmentation */
         tail->size = zmalloc_usable(tail) - sizeof(clientReplyBlock);
         tail->used = len;
+        tail->obj = NULL;
         memcpy(tail->buf, s, len);
         listAddNodeTail(c->reply, tail);
         c->reply_bytes += tail->size;
@@ -289,6 +321,32 @@ void _addReplyStringToList(client *c, const char *s, size_t len) {
     asyncCloseClientOnOutputBufferLimitReached(c);
 }
 
+/* Add a block referencing the string of 'obj' to the reply list, instead of
+ * copying it: writeToClient() sends it straight from the object. This is
+ * only safe because commands modifying strings in place unshare objects
+ * with more than one reference first (see dbUnshareStringValue()). The
+ * string length still counts in the output buffer limits. */
+void _addReplyObjectToList(client *c, robj *obj) {
+    if (c->flags & CLIENT_CLOSE_AFTER_REPLY) return;
+
+    clientReplyBlock *block = zmalloc(sizeof(clientReplyBlock));
+    block->size = block->used = sdslen(obj->ptr);
+    block->obj = obj;
+    incrRefCount(obj);
+    listAddNodeTail(c->reply, block);
+    c->reply_bytes += block->size;
+    asyncCloseClientOnOutputBufferLimitReached(c);
+}
+
+/* Return true if the string object 'obj' should be added to the output
+ * buffer of 'c' by reference. Lua and module clients read back the reply
+ * blocks as plain buffers, so they always get a copy. */
+static int canReplyWithObject(client *c, robj *obj) {
+    return obj->encoding == OBJ_ENCODING_RAW &&
+           sdslen(obj->ptr) >= PROTO_REPLY_SHARED_MIN_BYTES &&
+           !(c->flags & (CLIENT_LUA|CLIENT_MODULE));
+}
+
 /* -----------------------------------------------------------------------------
  * Higher level functions to queue data on the client output buffer.
  * The following functions are the ones that commands implementations will call.
@@ -299,7 +357,9 @@ void addReply(client *c, robj *obj) {
     if (prepareClientToWrite(c) != C_OK) return;
 
     if (sdsEncodedObject(obj)) {
-        if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
+        if (canReplyWithObject(c,obj))
+            _addReplyObjectToList(c,obj);
+        else if (_addReplyToBuffer(c,obj->ptr,sdslen(obj->ptr)) != C_OK)
             _addReplyStringToList(c,obj->ptr,sdslen(obj->ptr));
     } else if (obj->encoding == OBJ_ENCODING_INT) {
         /* For integer encoded strings we just convert it into a string
@@ -445,11 +505,11 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
      * our protocol in the node immediately after to it, in order to save a
      * write(2) syscall later. Conditions needed to do it:
      *
-     * - The next node is non-NULL,
+     * - The next node is non-NULL, and not referencing an object,
      * - It has enough room already allocated
      * - And not too large (avoid large memmove) */
     if (ln->next != NULL && (next = listNodeValue(ln->next)) &&
-        next->size - next->used >= lenstr_len &&
+        !next->obj && next->size - next->used >= lenstr_len &&
         next->used < PROTO_REPLY_CHUNK_BYTES * 4) {
         memmove(next->buf + lenstr_len, next->buf, next->used);
         memcpy(next->buf, lenstr, lenstr_len);
@@ -461,6 +521,7 @@ void setDeferredMultiBulkLength(client *c, void *node, long length) {
         /* Take over the allocation's internal fragmentation */
         buf->size = zmalloc_usable(buf) - sizeof(clientReplyBlock);
         buf->used = lenstr_len;
+        buf->obj = NULL;
         memcpy(buf->buf, lenstr, lenstr_len);
         listNodeValue(ln) = buf;
         c->reply_bytes += buf->size;
@@ -770,12 +831,39 @@ void acceptUnixHandler(aeEventLoop *el, int fd, void *privdata, int mask) {
     }
 }
 
+/* Release the arguments of the current command. The argv array itself is
+ * kept for the next command unless it grew too big, and small EMBSTR
+ * arguments nobody else references are kept in the client pool, so that
+ * the parser can build the next command without hitting the allocator. */
 static void freeClientArgv(client *c) {
     int j;
-    for (j = 0; j < c->argc; j++)
-        decrRefCount(c->argv[j]);
+    for (j = 0; j < c->argc; j++) {
+        robj *o = c->argv[j];
+
+        if (o->refcount == 1 && o->encoding == OBJ_ENCODING_EMBSTR &&
+            c->argv_pool_len < PROTO_ARGV_POOL_SIZE)
+        {
+            c->argv_pool[c->argv_pool_len++] = o;
+        } else {
+            decrRefCount(o);
+        }
+    }
     c->argc = 0;
     c->cmd = NULL;
+    if (c->argv_len > PROTO_ARGV_MAX_KEEP) {
+        zfree(c->argv);
+        c->argv = NULL;
+        c->argv_len = 0;
+    }
+}
+
+/* Make sure c->argv can hold 'argc' arguments. The current arguments, if
+ * any, must have already been released. */
+static void ensureClientArgvSize(client *c, int argc) {
+    if (argc <= c->argv_len) return;
+    zfree(c->argv);
+    c->argv = zmalloc(sizeof(robj*)*argc);
+    c->argv_len = argc;
 }
 
 /* Close all the slaves connections. This is useful in chained replication
@@ -834,6 +922,20 @@ void unlinkClient(client *c) {
         c->flags &= ~CLIENT_PENDING_WRITE;
     }
 
+    /* Remove from the list of clients waiting for the AOF if needed. */
+    if (c->aof_wait_node) {
+        listDelNode(server.clients_waiting_aof,c->aof_wait_node);
+        c->aof_wait_node = NULL;
+    }
+
+    /* Remove from the list of pending reads if needed. */
+    if (c->flags & CLIENT_PENDING_READ) {
+        ln = listSearchKey(server.clients_pending_read,c);
+        serverAssert(ln != NULL);
+        listDelNode(server.clients_pending_read,ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+    }
+
     /* When client was just unblocked because of a blocking operation,
      * remove it from the list of unblocked clients. */
     if (c->flags & CLIENT_UNBLOCKED) {
@@ -939,6 +1041,7 @@ void freeClient(client *c) {
      * and finally release the client structure itself. */
     if (c->name) decrRefCount(c->name);
     zfree(c->argv);
+    while (c->argv_pool_len) decrRefCount(c->argv_pool[--c->argv_pool_len]);
     freeClientMultiState(c);
     sdsfree(c->peerid);
     zfree(c);
@@ -949,9 +1052,34 @@ void freeClient(client *c) {
  * a context where calling freeClient() is not possible, because the client
  * should be valid for the continuation of the flow of the program. */
 void freeClientAsync(client *c) {
+    /* We need to handle concurrent access to the server.clients_to_close list
+     * only in the freeClientAsync() function, since it's the only function
+     * that may access the list while Redis uses I/O threads. All the other
+     * accesses are in the context of the main thread while the other threads
+     * are idle. */
+    static pthread_mutex_t async_free_queue_mutex = PTHREAD_MUTEX_INITIALIZER;
+
     if (c->flags & CLIENT_CLOSE_ASAP || c->flags & CLIENT_LUA) return;
     c->flags |= CLIENT_CLOSE_ASAP;
+    if (server.io_threads_num == 1) {
+        /* No need to bother with locking if there's just the main thread. */
+        listAddNodeTail(server.clients_to_close,c);
+        return;
+    }
+    pthread_mutex_lock(&async_free_queue_mutex);
     listAddNodeTail(server.clients_to_close,c);
+    pthread_mutex_unlock(&async_free_queue_mutex);
+}
+
+/* Free a client from the read and write paths. While the I/O threads are
+ * reading or writing, clients can't be released synchronously (not even by
+ * the main thread, that serves its share of clients as well), so they are
+ * scheduled for freeing once the threads are done. */
+static void freeClientFromIO(client *c) {
+    if (io_threads_op != IO_THREADS_OP_IDLE)
+        freeClientAsync(c);
+    else
+        freeClient(c);
 }
 
 void freeClientsInAsyncFreeQueue(void) {
@@ -974,15 +1102,91 @@ client *lookupClientByID(uint64_t id) {
     return (c == raxNotFound) ? NULL : c;
 }
 
+/* Send the static buffer and the blocks of the reply list with a single
+ * writev(2) call, gathering at most IOV_MAX buffers and about
+ * NET_MAX_WRITES_PER_EVENT bytes. The blocks referencing an object are sent
+ * straight from the object string. Blocks that were fully sent are released,
+ * and the return value is the one of writev(2). */
+static ssize_t writevToClient(int fd, client *c) {
+    struct iovec iov[IOV_MAX];
+    int iovcnt = 0;
+    size_t iov_bytes_len = 0;
+    ssize_t nwritten, remaining;
+    listIter li;
+    listNode *ln;
+    clientReplyBlock *o;
+
+    /* If the static reply buffer is not empty, it goes first. */
+    if (c->bufpos > 0) {
+        iov[iovcnt].iov_base = c->buf + c->sentlen;
+        iov[iovcnt].iov_len = c->bufpos - c->sentlen;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+    }
+
+    /* The sent length refers to the head of the reply list only when the
+     * static buffer is empty. */
+    size_t offset = c->bufpos > 0 ? 0 : c->sentlen;
+    listRewind(c->reply,&li);
+    while((ln = listNext(&li)) && iovcnt < IOV_MAX &&
+          iov_bytes_len < NET_MAX_WRITES_PER_EVENT)
+    {
+        o = listNodeValue(ln);
+        if (o->used == 0) { /* Empty node, just release it and skip. */
+            c->reply_bytes -= o->size;
+            listDelNode(c->reply,ln);
+            offset = 0;
+            continue;
+        }
+        iov[iovcnt].iov_base = (o->obj ? (char*)o->obj->ptr : o->buf) + offset;
+        iov[iovcnt].iov_len = o->used - offset;
+        iov_bytes_len += iov[iovcnt++].iov_len;
+        offset = 0;
+    }
+    if (iovcnt == 0) return 0;
+
+    nwritten = writev(fd,iov,iovcnt);
+    if (nwritten <= 0) return nwritten;
+
+    /* Consume the static buffer first, then release all the blocks that
+     * were fully sent, leaving the sent length of the new head. */
+    remaining = nwritten;
+    if (c->bufpos > 0) {
+        ssize_t buflen = c->bufpos - c->sentlen;
+        if (remaining < buflen) {
+            c->sentlen += remaining;
+            return nwritten;
+        }
+        c->bufpos = 0;
+        c->sentlen = 0;
+        remaining -= buflen;
+    }
+    while(remaining > 0) {
+        ln = listFirst(c->reply);
+        o = listNodeValue(ln);
+        if (remaining < (ssize_t)(o->used - c->sentlen)) {
+            c->sentlen += remaining;
+            break;
+        }
+        remaining -= o->used - c->sentlen;
+        c->reply_bytes -= o->size;
+        listDelNode(c->reply,ln);
+        c->sentlen = 0;
+    }
+
+    /* If there are no longer objects in the list, we expect
+     * the count of reply bytes to be exactly zero. */
+    if (listLength(c->reply) == 0)
+        serverAssert(c->reply_bytes == 0);
+    return nwritten;
+}
+
 /* Write data in output buffers to client. Return C_OK if the client
  * is still valid after the call, C_ERR if it was freed. */
 int writeToClient(int fd, client *c, int handler_installed) {
     ssize_t nwritten = 0, totwritten = 0;
-    size_t objlen;
-    clientReplyBlock *o;
 
     while(clientHasPendingReplies(c)) {
-        if (c->bufpos > 0) {
+        if (c->bufpos > 0 && listLength(c->reply) == 0) {
             nwritten = write(fd,c->buf+c->sentlen,c->bufpos-c->sentlen);
             if (nwritten <= 0) break;
             c->sentlen += nwritten;
@@ -995,30 +1199,12 @@ int writeToClient(int fd, client *c, int handler_installed) {
                 c->sentlen = 0;
             }
         } else {
-            o = listNodeValue(listFirst(c->reply));
-            objlen = o->used;
-
-            if (objlen == 0) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                continue;
-            }
-
-            nwritten = write(fd, o->buf + c->sentlen, objlen - c->sentlen);
+            /* Gather the static buffer and the reply list blocks, so that
+             * large replies take a single syscall and no copy at all for
+             * the blocks referencing an object. */
+            nwritten = writevToClient(fd,c);
             if (nwritten <= 0) break;
-            c->sentlen += nwritten;
             totwritten += nwritten;
-
-            /* If we fully sent the object on head go to the next one */
-            if (c->sentlen == objlen) {
-                c->reply_bytes -= o->size;
-                listDelNode(c->reply,listFirst(c->reply));
-                c->sentlen = 0;
-                /* If there are no longer objects in the list, we expect
-                 * the count of reply bytes to be exactly zero. */
-                if (listLength(c->reply) == 0)
-                    serverAssert(c->reply_bytes == 0);
-            }
         }
         /* Note that we avoid to send more than NET_MAX_WRITES_PER_EVENT
          * bytes, in a single threaded server it's a good idea to serve
@@ -1037,14 +1223,14 @@ int writeToClient(int fd, client *c, int handler_installed) {
              zmalloc_used_memory() < server.maxmemory) &&
             !(c->flags & CLIENT_SLAVE)) break;
     }
-    server.stat_net_output_bytes += totwritten;
+    atomicIncr(server.stat_net_output_bytes, totwritten);
     if (nwritten == -1) {
         if (errno == EAGAIN) {
             nwritten = 0;
         } else {
             serverLog(LL_VERBOSE,
                 "Error writing to client: %s", strerror(errno));
-            freeClient(c);
+            freeClientFromIO(c);
             return C_ERR;
         }
     }
@@ -1061,7 +1247,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 
         /* Close connection after entire reply has been sent. */
         if (c->flags & CLIENT_CLOSE_AFTER_REPLY) {
-            freeClient(c);
+            freeClientFromIO(c);
             return C_ERR;
         }
     }
@@ -1072,6 +1258,7 @@ int writeToClient(int fd, client *c, int handler_installed) {
 void sendReplyToClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
+    if (aofHoldClientReply(privdata)) return;
     writeToClient(fd,privdata,1);
 }
 
@@ -1223,10 +1410,7 @@ int processInlineBuffer(client *c) {
     c->qb_pos += querylen+linefeed_chars;
 
     /* Setup argv array on client structure */
-    if (argc) {
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*argc);
-    }
+    if (argc) ensureClientArgvSize(c,argc);
 
     /* Create redis objects for all arguments. */
     for (c->argc = 0, j = 0; j < argc; j++) {
@@ -1322,8 +1506,7 @@ int processMultibulkBuffer(client *c) {
         c->multibulklen = ll;
 
         /* Setup argv array on client structure */
-        if (c->argv) zfree(c->argv);
-        c->argv = zmalloc(sizeof(robj*)*c->multibulklen);
+        ensureClientArgvSize(c,c->multibulklen);
     }
 
     serverAssertWithInfo(c,NULL,c->multibulklen > 0);
@@ -1402,7 +1585,8 @@ int processMultibulkBuffer(client *c) {
                 sdsclear(c->querybuf);
             } else {
                 c->argv[c->argc++] =
-                    createStringObject(c->querybuf+c->qb_pos,c->bulklen);
+                    createStringObjectFromPool(c->argv_pool,&c->argv_pool_len,
+                        c->querybuf+c->qb_pos,c->bulklen);
                 c->qb_pos += c->bulklen+2;
             }
             c->bulklen = -1;
@@ -1417,21 +1601,59 @@ int processMultibulkBuffer(client *c) {
     return C_ERR;
 }
 
+/* Execute the command already parsed in the client argv, and reset the
+ * client if the command was actually executed. Returns C_ERR if the client
+ * was freed while executing the command, C_OK otherwise. */
+int processCommandAndResetClient(client *c) {
+    int deadclient = 0;
+    client *old_client = server.current_client;
+
+    server.current_client = c;
+    if (processCommand(c) == C_OK) {
+        if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
+            /* Update the applied replication offset of our master. */
+            c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
+        }
+
+        /* Don't reset the client structure for clients blocked in a
+         * module blocking command, so that the reply callback will
+         * still be able to access the client argv and argc field.
+         * The client will be reset in unblockClientFromModule(). */
+        if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
+            resetClient(c);
+    }
+    /* freeMemoryIfNeeded may flush slave output buffers. This may
+     * result into a slave, that may be the active client, to be
+     * freed. */
+    if (server.current_client == NULL) deadclient = 1;
+    server.current_client = old_client;
+    return deadclient ? C_ERR : C_OK;
+}
+
 /* This function is called every time, in the client structure 'c', there is
  * more query buffer to process, because we read more data from the socket
  * or because a client was blocked and later reactivated, so there could be
- * pending query buffer, already representing a full command, to process. */
+ * pending query buffer, already representing a full command, to process.
+ *
+ * When called from an I/O thread (CLIENT_PENDING_READ is set) the function
+ * only parses the next command, flagging the client with
+ * CLIENT_PENDING_COMMAND: the command is executed later by the main thread
+ * in handleClientsWithPendingReadsUsingThreads(). */
 void processInputBuffer(client *c) {
-    server.current_client = c;
-
     /* Keep processing while there is something in the input buffer */
     while(c->qb_pos < sdslen(c->querybuf)) {
-        /* Return if clients are paused. */
-        if (!(c->flags & CLIENT_SLAVE) && clientsArePaused()) break;
+        /* Return if clients are paused. The I/O threads leave the check to
+         * the main thread, since clientsArePaused() may unpause clients. */
+        if (!(c->flags & (CLIENT_SLAVE|CLIENT_PENDING_READ)) &&
+            clientsArePaused()) break;
 
         /* Immediately abort if the client is in the middle of something. */
         if (c->flags & CLIENT_BLOCKED) break;
 
+        /* Don't parse a new command while the one parsed by an I/O thread
+         * is still waiting to be executed. */
+        if (c->flags & CLIENT_PENDING_COMMAND) break;
+
         /* Don't process input from the master while there is a busy script
          * condition on the slave. We want just to accumulate the replication
          * stream (instead of replying -BUSY like we do with other clients) and
@@ -1466,34 +1688,25 @@ void processInputBuffer(client *c) {
         if (c->argc == 0) {
             resetClient(c);
         } else {
-            /* Only reset the client when the command was executed. */
-            if (processCommand(c) == C_OK) {
-                if (c->flags & CLIENT_MASTER && !(c->flags & CLIENT_MULTI)) {
-                    /* Update the applied replication offset of our master. */
-                    c->reploff = c->read_reploff - sdslen(c->querybuf) + c->qb_pos;
-                }
-
-                /* Don't reset the client structure for clients blocked in a
-                 * module blocking command, so that the reply callback will
-                 * still be able to access the client argv and argc field.
-                 * The client will be reset in unblockClientFromModule(). */
-                if (!(c->flags & CLIENT_BLOCKED) || c->btype != BLOCKED_MODULE)
-                    resetClient(c);
+            /* If we are in the context of an I/O thread, we can't really
+             * execute the command here. All we can do is to flag the client
+             * as one that needs to process the command. */
+            if (c->flags & CLIENT_PENDING_READ) {
+                c->flags |= CLIENT_PENDING_COMMAND;
+                break;
             }
-            /* freeMemoryIfNeeded may flush slave output buffers. This may
-             * result into a slave, that may be the active client, to be
-             * freed. */
-            if (server.current_client == NULL) break;
+
+            /* We are finally ready to execute the command. Return ASAP if
+             * the client was freed meanwhile. */
+            if (processCommandAndResetClient(c) == C_ERR) return;
         }
     }
 
     /* Trim to pos */
-    if (server.current_client != NULL && c->qb_pos) {
+    if (c->qb_pos) {
         sdsrange(c->querybuf,c->qb_pos,-1);
         c->qb_pos = 0;
     }
-
-    server.current_client = NULL;
 }
 
 /* This is a wrapper for processInputBuffer that also cares about handling
@@ -1522,6 +1735,10 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     UNUSED(el);
     UNUSED(mask);
 
+    /* Check if we want to read from the client later when exiting from
+     * the event loop. This is the case if threaded I/O is enabled. */
+    if (postponeClientRead(c)) return;
+
     readlen = PROTO_IOBUF_LEN;
     /* If this is a multi bulk request, and we are processing a bulk reply
      * that is large enough, try to maximize the probability that the query
@@ -1548,12 +1765,12 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
             return;
         } else {
             serverLog(LL_VERBOSE, "Reading from client: %s",strerror(errno));
-            freeClient(c);
+            freeClientFromIO(c);
             return;
         }
     } else if (nread == 0) {
         serverLog(LL_VERBOSE, "Client closed connection");
-        freeClient(c);
+        freeClientFromIO(c);
         return;
     } else if (c->flags & CLIENT_MASTER) {
         /* Append the query buffer to the pending (not applied) buffer
@@ -1566,7 +1783,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
     sdsIncrLen(c->querybuf,nread);
     c->lastinteraction = server.unixtime;
     if (c->flags & CLIENT_MASTER) c->read_reploff += nread;
-    server.stat_net_input_bytes += nread;
+    atomicIncr(server.stat_net_input_bytes, nread);
     if (sdslen(c->querybuf) > server.client_max_querybuf_len) {
         sds ci = catClientInfoString(sdsempty(),c), bytes = sdsempty();
 
@@ -1574,7 +1791,7 @@ void readQueryFromClient(aeEventLoop *el, int fd, void *privdata, int mask) {
         serverLog(LL_WARNING,"Closing client that reached max query buffer length: %s (qbuf initial bytes: %s)", ci, bytes);
         sdsfree(ci);
         sdsfree(bytes);
-        freeClient(c);
+        freeClientFromIO(c);
         return;
     }
 
@@ -1974,6 +2191,7 @@ void rewriteClientCommandVector(client *c, int argc, ...) {
     zfree(c->argv);
     /* Replace argv and argc with our new versions. */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -1985,6 +2203,7 @@ void replaceClientCommandVector(client *c, int argc, robj **argv) {
     freeClientArgv(c);
     zfree(c->argv);
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
     c->cmd = lookupCommandOrOriginal(c->argv[0]->ptr);
     serverAssertWithInfo(c,NULL,c->cmd != NULL);
@@ -2005,7 +2224,10 @@ void rewriteClientCommandArgument(client *c, int i, robj *newval) {
     robj *oldval;
 
     if (i >= c->argc) {
-        c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
+        if (i >= c->argv_len) {
+            c->argv = zrealloc(c->argv,sizeof(robj*)*(i+1));
+            c->argv_len = i+1;
+        }
         c->argc = i+1;
         c->argv[i] = NULL;
     }
@@ -2233,9 +2455,16 @@ int clientsArePaused(void) {
  * write, close sequence needed to serve a client.
  *
  * The function returns the total number of events processed. */
+int ProcessingEventsWhileBlocked = 0;
 int processEventsWhileBlocked(void) {
     int iterations = 4; /* See the function top-comment. */
     int count = 0;
+
+    /* Note: when we are processing events while blocked (for instance during
+     * busy Lua scripts), we set a global flag. When such flag is set, we
+     * avoid handling the read part of clients using threaded I/O, since
+     * beforeSleep() is not called here to run the postponed commands. */
+    ProcessingEventsWhileBlocked = 1;
     while (iterations--) {
         int events = 0;
         events += aeProcessEvents(server.el, AE_FILE_EVENTS|AE_DONT_WAIT);
@@ -2243,5 +2472,346 @@ int processEventsWhileBlocked(void) {
         if (!events) break;
         count += events;
     }
+    ProcessingEventsWhileBlocked = 0;
     return count;
 }
+
+/* ==========================================================================
+ * Threaded I/O
+ * ========================================================================== */
+
+/* The main thread keeps executing every command, the I/O threads only read
+ * and parse the query buffers, and write the output buffers, of the clients
+ * handled in the current event loop iteration. The main thread fans the
+ * clients out to the threads, serves its own share, and then waits for the
+ * other threads before going on: this way no client is ever accessed by two
+ * threads at the same time. */
+
+pthread_t io_threads[IO_THREADS_MAX_NUM];
+pthread_mutex_t io_threads_mutex[IO_THREADS_MAX_NUM];
+unsigned long io_threads_pending[IO_THREADS_MAX_NUM];
+int io_threads_active;  /* Are the threads currently spinning waiting I/O? */
+
+/* This is the list of clients each thread will serve when threaded I/O is
+ * used. We spawn io_threads_num-1 threads, since one is the main thread
+ * itself. */
+list *io_threads_list[IO_THREADS_MAX_NUM];
+
+/* Objects referenced by the reply blocks released in the I/O threads. The
+ * reference count of an object shared by clients served by different
+ * threads can't be touched concurrently, so the main thread releases the
+ * objects once the threads are done. */
+list *io_threads_objects_to_release;
+pthread_mutex_t io_threads_objects_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void releaseReplyObject(robj *o) {
+    if (io_threads_op == IO_THREADS_OP_IDLE) {
+        decrRefCount(o);
+        return;
+    }
+    pthread_mutex_lock(&io_threads_objects_mutex);
+    listAddNodeTail(io_threads_objects_to_release,o);
+    pthread_mutex_unlock(&io_threads_objects_mutex);
+}
+
+static inline unsigned long getIOPendingCount(int i) {
+    unsigned long count = 0;
+    atomicGetWithSync(io_threads_pending[i],count);
+    return count;
+}
+
+static inline void setIOPendingCount(int i, unsigned long count) {
+    atomicSetWithSync(io_threads_pending[i],count);
+}
+
+/* Serve the clients in the list of the I/O thread 'id', according to the
+ * current io_threads_op, and empty the list. */
+static void processIOThreadList(int id) {
+    listIter li;
+    listNode *ln;
+
+    listRewind(io_threads_list[id],&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        if (io_threads_op == IO_THREADS_OP_WRITE) {
+            writeToClient(c->fd,c,0);
+        } else if (io_threads_op == IO_THREADS_OP_READ) {
+            readQueryFromClient(server.el,c->fd,c,0);
+        } else {
+            serverPanic("io_threads_op value is unknown");
+        }
+    }
+    listEmpty(io_threads_list[id]);
+}
+
+void *IOThreadMain(void *myid) {
+    /* The ID is the thread number (from 0 to server.io_threads_num-1), and is
+     * used by the thread to just manipulate a single sub-array of clients. */
+    long id = (unsigned long)myid;
+
+    while(1) {
+        /* Wait for start */
+        for (int j = 0; j < 1000000; j++) {
+            if (getIOPendingCount(id) != 0) break;
+        }
+
+        /* Give the main thread a chance to stop this thread. */
+        if (getIOPendingCount(id) == 0) {
+            pthread_mutex_lock(&io_threads_mutex[id]);
+            pthread_mutex_unlock(&io_threads_mutex[id]);
+            continue;
+        }
+
+        serverAssert(getIOPendingCount(id) != 0);
+
+        /* Process: note that the main thread will never touch our list
+         * before we drop the pending count to 0. */
+        processIOThreadList(id);
+        setIOPendingCount(id, 0);
+    }
+}
+
+/* Initialize the data structures needed for threaded I/O. */
+void initThreadedIO(void) {
+    io_threads_active = 0; /* We start with threads not active. */
+
+    /* Don't spawn any thread if the user selected a single thread:
+     * we'll handle I/O directly from the main thread. */
+    if (server.io_threads_num == 1) return;
+
+    if (server.io_threads_num > IO_THREADS_MAX_NUM) {
+        serverLog(LL_WARNING,"Fatal: too many I/O threads configured. "
+                             "The maximum number is %d.", IO_THREADS_MAX_NUM);
+        exit(1);
+    }
+
+    io_threads_objects_to_release = listCreate();
+    listSetFreeMethod(io_threads_objects_to_release,decrRefCountVoid);
+
+    /* Spawn and initialize the I/O threads. */
+    for (int i = 0; i < server.io_threads_num; i++) {
+        /* Things we do for all the threads including the main thread. */
+        io_threads_list[i] = listCreate();
+        if (i == 0) continue; /* Thread 0 is the main thread. */
+
+        /* Things we do only for the additional threads. */
+        pthread_t tid;
+        pthread_mutex_init(&io_threads_mutex[i],NULL);
+        setIOPendingCount(i, 0);
+        pthread_mutex_lock(&io_threads_mutex[i]); /* Thread will be stopped. */
+        if (pthread_create(&tid,NULL,IOThreadMain,(void*)(long)i) != 0) {
+            serverLog(LL_WARNING,"Fatal: Can't initialize I/O threads.");
+            exit(1);
+        }
+        io_threads[i] = tid;
+    }
+    serverLog(LL_NOTICE,"Threaded I/O enabled with %d threads (reads %s).",
+        server.io_threads_num,
+        server.io_threads_do_reads ? "enabled" : "disabled");
+}
+
+void startThreadedIO(void) {
+    serverAssert(io_threads_active == 0);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_unlock(&io_threads_mutex[j]);
+    io_threads_active = 1;
+}
+
+void stopThreadedIO(void) {
+    /* We may have still clients with pending reads when this function
+     * is called: handle them before stopping the threads. */
+    handleClientsWithPendingReadsUsingThreads();
+    serverAssert(io_threads_active == 1);
+    for (int j = 1; j < server.io_threads_num; j++)
+        pthread_mutex_lock(&io_threads_mutex[j]);
+    io_threads_active = 0;
+}
+
+/* This function checks if there are not enough pending clients to justify
+ * taking the I/O threads active: in that case I/O threads are stopped if
+ * currently active. We track the pending writes as a measure of clients
+ * we need to handle in parallel, however the I/O threading is disabled
+ * globally for reads as well if we have too little pending clients.
+ *
+ * The function returns 0 if the I/O threading should be used because there
+ * are enough active threads, otherwise 1 is returned and the I/O threads
+ * could be possibly stopped (if already active) as a side effect. */
+int stopThreadedIOIfNeeded(void) {
+    int pending = listLength(server.clients_pending_write);
+
+    /* Return ASAP if I/O threads are disabled (single threaded mode). */
+    if (server.io_threads_num == 1) return 1;
+
+    if (pending < (server.io_threads_num*2)) {
+        if (io_threads_active) stopThreadedIO();
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* Hand the clients in the per thread lists over to the I/O threads for the
+ * given operation, serve the share of the main thread, and wait for all the
+ * threads to be done. */
+static void runIOThreadsOp(int op) {
+    io_threads_op = op;
+    for (int j = 1; j < server.io_threads_num; j++) {
+        int count = listLength(io_threads_list[j]);
+        setIOPendingCount(j, count);
+    }
+
+    /* Also use the main thread to process a slice of clients. */
+    processIOThreadList(0);
+
+    /* Wait for all the other threads to end their work. */
+    while(1) {
+        unsigned long pending = 0;
+        for (int j = 1; j < server.io_threads_num; j++)
+            pending += getIOPendingCount(j);
+        if (pending == 0) break;
+    }
+    io_threads_op = IO_THREADS_OP_IDLE;
+
+    /* Release the objects of the reply blocks sent by the threads. */
+    listEmpty(io_threads_objects_to_release);
+}
+
+int handleClientsWithPendingWritesUsingThreads(void) {
+    int processed = listLength(server.clients_pending_write);
+    if (processed == 0) return 0; /* Return ASAP if there are no clients. */
+
+    /* If I/O threads are disabled or we have few clients to serve, don't
+     * use I/O threads, but the boring synchronous code. */
+    if (server.io_threads_num == 1 || stopThreadedIOIfNeeded()) {
+        return handleClientsWithPendingWrites();
+    }
+
+    /* Start threads if needed. */
+    if (!io_threads_active) startThreadedIO();
+
+    /* Distribute the clients across N different lists. */
+    listIter li;
+    listNode *ln;
+    int item_id = 0;
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_WRITE;
+
+        /* If a client is protected, don't do anything,
+         * that may trigger write error or recreate handler. Clients
+         * scheduled for closing don't need their replies either. */
+        if (c->flags & (CLIENT_PROTECTED|CLIENT_CLOSE_ASAP)) {
+            listDelNode(server.clients_pending_write,ln);
+            continue;
+        }
+
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+    server.stat_io_writes_processed += item_id;
+    runIOThreadsOp(IO_THREADS_OP_WRITE);
+
+    /* Run the list of clients again to install the write handler where
+     * needed. */
+    listRewind(server.clients_pending_write,&li);
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+
+        /* Install the write handler if there are pending writes in some
+         * of the clients. */
+        if (!(c->flags & CLIENT_CLOSE_ASAP) && clientHasPendingReplies(c)) {
+            int ae_flags = AE_WRITABLE;
+            /* Same AE_BARRIER logic of handleClientsWithPendingWrites(). */
+            if (server.aof_state == AOF_ON &&
+                server.aof_fsync == AOF_FSYNC_ALWAYS)
+            {
+                ae_flags |= AE_BARRIER;
+            }
+            if (aeCreateFileEvent(server.el, c->fd, ae_flags,
+                sendReplyToClient, c) == AE_ERR)
+            {
+                    freeClientAsync(c);
+            }
+        }
+    }
+    listEmpty(server.clients_pending_write);
+    return processed;
+}
+
+/* Return 1 if we want to handle the client read later using threaded I/O.
+ * This is called by the readable handler of the event loop.
+ * As a side effect of calling this function the client is put in the
+ * pending read clients and flagged as such. Masters and slaves are always
+ * served by the main thread, since their input feeds the replication
+ * stream, and so are blocked clients. */
+int postponeClientRead(client *c) {
+    if (io_threads_active &&
+        server.io_threads_do_reads &&
+        !ProcessingEventsWhileBlocked &&
+        !server.clients_paused &&
+        !(c->flags & (CLIENT_MASTER|CLIENT_SLAVE|CLIENT_PENDING_READ|
+                      CLIENT_BLOCKED)))
+    {
+        c->flags |= CLIENT_PENDING_READ;
+        listAddNodeHead(server.clients_pending_read,c);
+        return 1;
+    } else {
+        return 0;
+    }
+}
+
+/* When threaded I/O is also enabled for the reading + parsing side, the
+ * readable handler will just put normal clients into a queue of clients to
+ * process (instead of serving them synchronously). This function runs
+ * the queue using the I/O threads, and process them in order to accumulate
+ * the reads in the buffers, and also parse the first command available
+ * rendering it in the client structures. */
+int handleClientsWithPendingReadsUsingThreads(void) {
+    if (!io_threads_active || !server.io_threads_do_reads) return 0;
+    int processed = listLength(server.clients_pending_read);
+    if (processed == 0) return 0;
+
+    /* Distribute the clients across N different lists. */
+    listIter li;
+    listNode *ln;
+    listRewind(server.clients_pending_read,&li);
+    int item_id = 0;
+    while((ln = listNext(&li))) {
+        client *c = listNodeValue(ln);
+        int target_id = item_id % server.io_threads_num;
+        listAddNodeTail(io_threads_list[target_id],c);
+        item_id++;
+    }
+    server.stat_io_reads_processed += processed;
+    runIOThreadsOp(IO_THREADS_OP_READ);
+
+    /* Run the list of clients again to process the new buffers. */
+    while(listLength(server.clients_pending_read)) {
+        ln = listFirst(server.clients_pending_read);
+        client *c = listNodeValue(ln);
+        c->flags &= ~CLIENT_PENDING_READ;
+        listDelNode(server.clients_pending_read,ln);
+
+        /* The thread may have scheduled the client for closing. */
+        if (c->flags & CLIENT_CLOSE_ASAP) continue;
+
+        if (c->flags & CLIENT_PENDING_COMMAND) {
+            c->flags &= ~CLIENT_PENDING_COMMAND;
+            if (processCommandAndResetClient(c) == C_ERR) {
+                /* If the client is no longer valid, we avoid
+                 * processing the client later. So we just go
+                 * to the next. */
+                continue;
+            }
+        }
+        processInputBuffer(c);
+
+        /* We may have pending replies if a thread readQueryFromClient() produced
+         * replies and did not install a write handler (it can't). */
+        if (!(c->flags & CLIENT_PENDING_WRITE) && clientHasPendingReplies(c))
+            clientInstallWriteHandler(c);
+    }
+    return processed;
+}
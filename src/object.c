@@ -78,11 +78,9 @@ robj *createRawStringObject(const char *ptr, size_t len) {
     return createObject(OBJ_STRING, sdsnewlen(ptr,len));
 }
 
-/* Create a string object with encoding OBJ_ENCODING_EMBSTR, that is
- * an object where the sds string is actually an unmodifiable string
- * allocated in the same chunk as the object itself. */
-robj *createEmbeddedStringObject(const char *ptr, size_t len) {
-    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+/* Initialize the allocation 'o', big enough for a string of 'len' bytes,
+ * as an OBJ_ENCODING_EMBSTR object. */
+static robj *initEmbeddedStringObject(robj *o, const char *ptr, size_t len) {
     struct sdshdr8 *sh = (void*)(o+1);
 
     o->type = OBJ_STRING;
@@ -109,6 +107,14 @@ robj *createEmbeddedStringObject(const char *ptr, size_t len) {
     return o;
 }
 
+/* Create a string object with encoding OBJ_ENCODING_EMBSTR, that is
+ * an object where the sds string is actually an unmodifiable string
+ * allocated in the same chunk as the object itself. */
+robj *createEmbeddedStringObject(const char *ptr, size_t len) {
+    robj *o = zmalloc(sizeof(robj)+sizeof(struct sdshdr8)+len+1);
+    return initEmbeddedStringObject(o,ptr,len);
+}
+
 /* Create a string object with EMBSTR encoding if it is smaller than
  * OBJ_ENCODING_EMBSTR_SIZE_LIMIT, otherwise the RAW encoding is
  * used.
@@ -123,6 +129,27 @@ robj *createStringObject(const char *ptr, size_t len) {
         return createRawStringObject(ptr,len);
 }
 
+/* Like createStringObject(), but when the string fits an EMBSTR object,
+ * reuse the allocation of one of the '*count' unused EMBSTR objects in
+ * 'pool' that is big enough, removing it from the pool. This is used to
+ * recycle the argument objects of a client from one command to the next. */
+robj *createStringObjectFromPool(robj **pool, int *count, const char *ptr,
+                                 size_t len)
+{
+    if (len <= OBJ_ENCODING_EMBSTR_SIZE_LIMIT) {
+        size_t needed = sizeof(robj)+sizeof(struct sdshdr8)+len+1;
+        int j;
+
+        for (j = *count-1; j >= 0; j--) {
+            robj *o = pool[j];
+            if (zmalloc_size(o) < needed) continue;
+            pool[j] = pool[--(*count)];
+            return initEmbeddedStringObject(o,ptr,len);
+        }
+    }
+    return createStringObject(ptr,len);
+}
+
 /* Create a string object from a long long value. When possible returns a
  * shared integer object, or at least an integer encoded one.
  *
@@ -1027,6 +1054,7 @@ struct redisMemOverhead *getMemoryOverheadData(void) {
     mem = 0;
     if (server.aof_state != AOF_OFF) {
         mem += sdsalloc(server.aof_buf);
+        mem += aofWriterBufferSize();
         mem += aofRewriteBufferSize();
     }
     mh->aof_buffer = mem;
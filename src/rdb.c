@@ -1132,6 +1132,34 @@ ssize_t rdbSaveSingleModuleAux(rio *rdb, int when, moduleType *mt) {
     return io.bytes;
 }
 
+/* Append an entry for 'key' of the database 'dbid', saved at 'offset' of the
+ * RDB file, to the key directory 'dir'. See RDB_KEY_DIRECTORY_MAGIC. */
+static sds rdbKeyDirectoryAddEntry(sds dir, int dbid, sds key, uint64_t offset) {
+    uint32_t dbid32 = dbid, keylen = sdslen(key);
+
+    memrev32ifbe(&dbid32);
+    memrev32ifbe(&keylen);
+    memrev64ifbe(&offset);
+    dir = sdscatlen(dir,&dbid32,4);
+    dir = sdscatlen(dir,&keylen,4);
+    dir = sdscatlen(dir,key,sdslen(key));
+    return sdscatlen(dir,&offset,8);
+}
+
+/* Write the key directory 'dir' with 'count' entries, and its footer. It is
+ * written after the checksum, so it is ignored by the RDB loading code. */
+static int rdbSaveKeyDirectory(rio *rdb, sds dir, uint64_t count) {
+    uint64_t offset = rdb->processed_bytes;
+
+    memrev64ifbe(&offset);
+    memrev64ifbe(&count);
+    if (rioWrite(rdb,dir,sdslen(dir)) == 0) return -1;
+    if (rioWrite(rdb,&offset,8) == 0) return -1;
+    if (rioWrite(rdb,&count,8) == 0) return -1;
+    if (rioWrite(rdb,RDB_KEY_DIRECTORY_MAGIC,8) == 0) return -1;
+    return 1;
+}
+
 /* Produces a dump of the database in RDB format sending it to the specified
  * Redis I/O channel. On success C_OK is returned, otherwise C_ERR
  * is returned and part of the output, or all the output, can be
@@ -1147,6 +1175,8 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     int j;
     uint64_t cksum;
     size_t processed = 0;
+    sds keydir = (flags & RDB_SAVE_KEY_DIRECTORY) ? sdsempty() : NULL;
+    uint64_t keydir_count = 0;
 
     if (server.rdb_checksum)
         rdb->update_cksum = rioGenericUpdateChecksum;
@@ -1184,6 +1214,11 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
 
             initStaticStringObject(key,keystr);
             expire = getExpire(db,&key);
+            if (keydir) {
+                keydir = rdbKeyDirectoryAddEntry(keydir,j,keystr,
+                                                 rdb->processed_bytes);
+                keydir_count++;
+            }
             if (rdbSaveKeyValuePair(rdb,&key,o,expire) == -1) goto werr;
 
             /* When this RDB is produced as part of an AOF rewrite, move
@@ -1225,11 +1260,18 @@ int rdbSaveRio(rio *rdb, int *error, int flags, rdbSaveInfo *rsi) {
     cksum = rdb->cksum;
     memrev64ifbe(&cksum);
     if (rioWrite(rdb,&cksum,8) == 0) goto werr;
+
+    /* Key directory used to load keys on demand (indexed_rdb). */
+    if (keydir) {
+        if (rdbSaveKeyDirectory(rdb,keydir,keydir_count) == -1) goto werr;
+        sdsfree(keydir);
+    }
     return C_OK;
 
 werr:
     if (error) *error = errno;
     if (di) dictReleaseIterator(di);
+    sdsfree(keydir);
     return C_ERR;
 }
 
@@ -1267,6 +1309,16 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     rio rdb;
     int error = 0;
 
+    /* The keys not loaded yet from the RDB would be lost, see
+     * rdbLoadWithKeyDirectory(). */
+    if (server.rdb_key_directory) {
+        serverLog(LL_WARNING,"Can't save the DB while it is loaded on demand");
+        return C_ERR;
+    }
+    /* The keys evicted to the indexed log (allkeys-indexedlog) are not in
+     * memory, so they are restored before the dump. */
+    if (restoreAllEvictedKeys() == C_ERR) return C_ERR;
+
     snprintf(tmpfile,256,"temp-%d.rdb", (int) getpid());
     fp = fopen(tmpfile,"w");
     if (!fp) {
@@ -1285,7 +1337,8 @@ int rdbSave(char *filename, rdbSaveInfo *rsi) {
     if (server.rdb_save_incremental_fsync)
         rioSetAutoSync(&rdb,REDIS_AUTOSYNC_BYTES);
 
-    if (rdbSaveRio(&rdb,&error,RDB_SAVE_NONE,rsi) == C_ERR) {
+    if (rdbSaveRio(&rdb,&error,server.indexed_rdb == IR_ON ?
+                   RDB_SAVE_KEY_DIRECTORY : RDB_SAVE_NONE,rsi) == C_ERR) {
         errno = error;
         goto werr;
     }
@@ -1328,6 +1381,9 @@ int rdbSaveBackground(char *filename, rdbSaveInfo *rsi) {
     long long start;
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    /* Not while the RDB is loaded on demand, see rdbSave(). */
+    if (server.rdb_key_directory) return C_ERR;
+    if (restoreAllEvictedKeys() == C_ERR) return C_ERR;
 
     server.dirty_before_bgsave = server.dirty;
     server.lastbgsave_try = time(NULL);
@@ -1870,11 +1926,332 @@ void stopLoading(void) {
     server.loading = 0;
 }
 
+/* ---------------------------------------------------------------------------
+ * Parallel loading
+ *
+ * With rdb-load-threads > 0, rdbLoadRio() does not decode the keys: it only
+ * slices the stream, copying the raw key and value of each key to a batch,
+ * and the batches are decoded (LZF decompression and object construction)
+ * by a pool of threads while the main thread reads the next ones. The main
+ * thread then adds the decoded batches to the DB in the order they were read,
+ * so the loading progress only counts the keys already added. The opcodes,
+ * and the stream and module values, are still handled by the main thread.
+ * ------------------------------------------------------------------------- */
+
+#define RDB_LOAD_BATCH_BYTES (1024*256) /* Raw bytes sliced per batch. */
+
+static int rdbClaimKeyFromDirectory(redisDb *db, robj *key);
+
+/* A key of the RDB, with the attributes set by the opcodes before it. */
+typedef struct rdbLoadEntry {
+    int type;                   /* RDB type of the value. */
+    redisDb *db;
+    long long expiretime, lfu_freq, lru_idle;
+    robj *key, *val;            /* NULL until decoded, or on error. */
+} rdbLoadEntry;
+
+/* Keys sliced from the stream: 'buf' has the raw key and value of every
+ * entry, one after the other. */
+typedef struct rdbLoadBatch {
+    sds buf;
+    rdbLoadEntry *entries;
+    int count, size;
+    off_t end;                  /* Stream offset at the end of the batch. */
+    int decoded;                /* Set by the decoder thread. */
+} rdbLoadBatch;
+
+static struct {
+    int nthreads;               /* Decoder threads, 0 if loading serially. */
+    pthread_t threads[RDB_LOAD_THREADS_MAX];
+    pthread_mutex_t lock;
+    pthread_cond_t todo;        /* A batch was submitted, or stop is set. */
+    pthread_cond_t done;        /* A batch was decoded. */
+    int stop;
+    rdbLoadBatch *batches;      /* Ring of batches, the oldest is 'added'. */
+    int nbatches;
+    long long submitted, claimed, added; /* Batch sequence numbers. */
+    sds *capture;               /* Where the stream read is copied, if any. */
+    off_t added_bytes;          /* Stream offset of the last batch added. */
+    long long now, lru_clock;   /* Time of the loading start. */
+    int loading_aof;
+} rdbLoader = {
+    .lock = PTHREAD_MUTEX_INITIALIZER,
+    .todo = PTHREAD_COND_INITIALIZER,
+    .done = PTHREAD_COND_INITIALIZER
+};
+
+/* Only the types that rdbSkipObject() knows are sliced. */
+#define rdbLoadIsSliced(t) ((t >= RDB_TYPE_STRING && t <= RDB_TYPE_ZSET_2) || \
+                            (t >= RDB_TYPE_HASH_ZIPMAP && t <= RDB_TYPE_LIST_QUICKLIST))
+
+/* Read 'len' bytes of the stream without keeping them: while slicing, the
+ * bytes read are copied to the batch by rdbLoadProgressCallback(). */
+static int rdbSkipRaw(rio *rdb, uint64_t len) {
+    char buf[PROTO_IOBUF_LEN];
+
+    while (len) {
+        size_t chunk = len > sizeof(buf) ? sizeof(buf) : len;
+        if (rioRead(rdb,buf,chunk) == 0) return -1;
+        len -= chunk;
+    }
+    return 0;
+}
+
+/* Like rdbGenericLoadStringObject() but only reads the string. */
+static int rdbSkipString(rio *rdb) {
+    int isencoded;
+    uint64_t len, clen;
+
+    if (rdbLoadLenByRef(rdb,&isencoded,&len) == -1) return -1;
+    if (isencoded) {
+        switch(len) {
+        case RDB_ENC_INT8: return rdbSkipRaw(rdb,1);
+        case RDB_ENC_INT16: return rdbSkipRaw(rdb,2);
+        case RDB_ENC_INT32: return rdbSkipRaw(rdb,4);
+        case RDB_ENC_LZF:
+            if ((clen = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+            if (rdbLoadLen(rdb,NULL) == RDB_LENERR) return -1;
+            return rdbSkipRaw(rdb,clen);
+        default:
+            rdbExitReportCorruptRDB("Unknown RDB string encoding type %d",len);
+        }
+    }
+    return rdbSkipRaw(rdb,len);
+}
+
+/* Like rdbLoadDoubleValue() but only reads the value. */
+static int rdbSkipDoubleValue(rio *rdb) {
+    unsigned char len;
+
+    if (rioRead(rdb,&len,1) == 0) return -1;
+    return len >= 253 ? 0 : rdbSkipRaw(rdb,len);
+}
+
+/* Like rdbLoadObject() but only reads the value, for the types accepted by
+ * rdbLoadIsSliced(). */
+static int rdbSkipObject(int rdbtype, rio *rdb) {
+    uint64_t len;
+
+    if (rdbtype == RDB_TYPE_STRING ||
+        (rdbtype >= RDB_TYPE_HASH_ZIPMAP && rdbtype <= RDB_TYPE_HASH_ZIPLIST))
+        return rdbSkipString(rdb);  /* Types encoded as a single string. */
+
+    if ((len = rdbLoadLen(rdb,NULL)) == RDB_LENERR) return -1;
+    while(len--) {
+        if (rdbSkipString(rdb) == -1) return -1;
+        if (rdbtype == RDB_TYPE_HASH && rdbSkipString(rdb) == -1) return -1;
+        if (rdbtype == RDB_TYPE_ZSET && rdbSkipDoubleValue(rdb) == -1) return -1;
+        if (rdbtype == RDB_TYPE_ZSET_2 && rdbSkipRaw(rdb,sizeof(double)) == -1)
+            return -1;
+    }
+    return 0;
+}
+
+/* Add a loaded key to the DB, unless it expired or was already loaded. */
+static void rdbLoadAddEntry(rdbLoadEntry *e) {
+    /* Check if the key already expired. This function is used when loading
+     * an RDB file from disk, either at startup, or when an RDB was
+     * received from the master. In the latter case, the master is
+     * responsible for key expiry. If we would expire keys here, the
+     * snapshot taken by the master may not be reflected on the slave. */
+    if (server.rdb_key_directory && !rdbClaimKeyFromDirectory(e->db,e->key)) {
+        /* Already loaded on demand, see rdbLoadKeyFromDirectory(). */
+        decrRefCount(e->key);
+        decrRefCount(e->val);
+    } else if (server.masterhost == NULL && !rdbLoader.loading_aof &&
+               e->expiretime != -1 && e->expiretime < rdbLoader.now)
+    {
+        decrRefCount(e->key);
+        decrRefCount(e->val);
+    } else {
+        /* Add the new object in the hash table */
+        dbAdd(e->db,e->key,e->val);
+
+        /* Set the expire time if needed */
+        if (e->expiretime != -1) setExpire(NULL,e->db,e->key,e->expiretime);
+
+        /* Set usage information (for eviction). */
+        objectSetLRUOrLFU(e->val,e->lfu_freq,e->lru_idle,rdbLoader.lru_clock);
+
+        /* Decrement the key refcount since dbAdd() will take its
+         * own reference. */
+        decrRefCount(e->key);
+    }
+}
+
+/* Decode the keys and the values of a batch. On error the entries left have
+ * a NULL value. */
+static void rdbLoadDecodeBatch(rdbLoadBatch *b) {
+    rio payload;
+    int j;
+
+    rioInitWithBuffer(&payload,b->buf);
+    for (j = 0; j < b->count; j++) {
+        rdbLoadEntry *e = b->entries+j;
+
+        if ((e->key = rdbLoadStringObject(&payload)) == NULL) break;
+        if ((e->val = rdbLoadObject(e->type,&payload,e->key)) == NULL) break;
+    }
+}
+
+static void *rdbLoaderThreadMain(void *arg) {
+    UNUSED(arg);
+
+    while(1) {
+        rdbLoadBatch *b;
+
+        pthread_mutex_lock(&rdbLoader.lock);
+        while (!rdbLoader.stop && rdbLoader.claimed == rdbLoader.submitted)
+            pthread_cond_wait(&rdbLoader.todo,&rdbLoader.lock);
+        if (rdbLoader.claimed == rdbLoader.submitted) {
+            pthread_mutex_unlock(&rdbLoader.lock);
+            break;
+        }
+        b = rdbLoader.batches + (rdbLoader.claimed++ % rdbLoader.nbatches);
+        pthread_mutex_unlock(&rdbLoader.lock);
+
+        rdbLoadDecodeBatch(b);
+
+        pthread_mutex_lock(&rdbLoader.lock);
+        b->decoded = 1;
+        pthread_cond_broadcast(&rdbLoader.done);
+        pthread_mutex_unlock(&rdbLoader.lock);
+    }
+    return NULL;
+}
+
+/* Wait for the oldest batch submitted to be decoded and add its keys to the
+ * DB. Returns C_ERR if a key of the batch could not be decoded. */
+static int rdbLoadAddBatch(void) {
+    rdbLoadBatch *b = rdbLoader.batches + (rdbLoader.added % rdbLoader.nbatches);
+    int j, retval = C_OK;
+
+    pthread_mutex_lock(&rdbLoader.lock);
+    while (!b->decoded)
+        pthread_cond_wait(&rdbLoader.done,&rdbLoader.lock);
+    pthread_mutex_unlock(&rdbLoader.lock);
+
+    for (j = 0; j < b->count; j++) {
+        rdbLoadEntry *e = b->entries+j;
+
+        if (e->val == NULL) {
+            if (e->key) decrRefCount(e->key);
+            retval = C_ERR;
+        } else {
+            rdbLoadAddEntry(e);
+        }
+    }
+    b->count = 0;
+    sdsclear(b->buf);
+    rdbLoader.added++;
+    rdbLoader.added_bytes = b->end;
+    return retval;
+}
+
+/* Hand the batch being filled to the decoder threads. When all the batches
+ * are in use, the oldest one is added to the DB to make room for the next. */
+static int rdbLoadSubmitBatch(rio *rdb) {
+    rdbLoadBatch *b = rdbLoader.batches + (rdbLoader.submitted % rdbLoader.nbatches);
+
+    b->end = rdb->processed_bytes;
+    b->decoded = 0;
+    pthread_mutex_lock(&rdbLoader.lock);
+    rdbLoader.submitted++;
+    pthread_cond_signal(&rdbLoader.todo);
+    pthread_mutex_unlock(&rdbLoader.lock);
+
+    if (rdbLoader.submitted - rdbLoader.added == rdbLoader.nbatches)
+        return rdbLoadAddBatch();
+    return C_OK;
+}
+
+/* Copy the raw key and value of 'e' from the stream to the batch being
+ * filled. */
+static int rdbLoadSlice(rio *rdb, rdbLoadEntry *e) {
+    rdbLoadBatch *b = rdbLoader.batches + (rdbLoader.submitted % rdbLoader.nbatches);
+    int retval;
+
+    if (b->count == b->size) {
+        b->size = b->size ? b->size*2 : 64;
+        b->entries = zrealloc(b->entries,sizeof(rdbLoadEntry)*b->size);
+    }
+    rdbLoader.capture = &b->buf;
+    retval = rdbSkipString(rdb) == -1 || rdbSkipObject(e->type,rdb) == -1;
+    rdbLoader.capture = NULL;
+    if (retval) return C_ERR;
+
+    e->key = e->val = NULL;
+    b->entries[b->count++] = *e;
+    if (sdslen(b->buf) >= RDB_LOAD_BATCH_BYTES) return rdbLoadSubmitBatch(rdb);
+    return C_OK;
+}
+
+/* Called by rdbLoadRio() before the keys are read: starts the decoder
+ * threads if rdb-load-threads is set. */
+static void rdbLoadStart(int loading_aof) {
+    int j;
+
+    rdbLoader.now = mstime();
+    rdbLoader.lru_clock = LRU_CLOCK();
+    rdbLoader.loading_aof = loading_aof;
+    rdbLoader.nthreads = 0;
+    if (server.rdb_load_threads == 0 || rdbCheckMode) return;
+
+    rdbLoader.stop = 0;
+    rdbLoader.submitted = rdbLoader.claimed = rdbLoader.added = 0;
+    rdbLoader.added_bytes = 0;
+    rdbLoader.nbatches = server.rdb_load_threads*2;
+    rdbLoader.batches = zcalloc(sizeof(rdbLoadBatch)*rdbLoader.nbatches);
+    for (j = 0; j < rdbLoader.nbatches; j++)
+        rdbLoader.batches[j].buf = sdsempty();
+    for (j = 0; j < server.rdb_load_threads; j++) {
+        if (pthread_create(&rdbLoader.threads[j],NULL,rdbLoaderThreadMain,NULL) != 0) {
+            serverLog(LL_WARNING,"Can't create an RDB load thread: %s",
+                strerror(errno));
+            break;
+        }
+        rdbLoader.nthreads++;
+    }
+    if (rdbLoader.nthreads)
+        serverLog(LL_NOTICE,"Loading the RDB with %d decoder threads",
+            rdbLoader.nthreads);
+}
+
+/* Called by rdbLoadRio() at the end of the keys: adds the batches left to
+ * the DB and stops the decoder threads. */
+static int rdbLoadFinish(rio *rdb) {
+    int j, retval = C_OK;
+
+    if (rdbLoader.nthreads == 0) return C_OK;
+    if (rdbLoader.batches[rdbLoader.submitted % rdbLoader.nbatches].count)
+        retval = rdbLoadSubmitBatch(rdb);
+    while (rdbLoader.added < rdbLoader.submitted)
+        if (rdbLoadAddBatch() == C_ERR) retval = C_ERR;
+
+    pthread_mutex_lock(&rdbLoader.lock);
+    rdbLoader.stop = 1;
+    pthread_cond_broadcast(&rdbLoader.todo);
+    pthread_mutex_unlock(&rdbLoader.lock);
+    for (j = 0; j < rdbLoader.nthreads; j++)
+        pthread_join(rdbLoader.threads[j],NULL);
+    rdbLoader.nthreads = 0;
+
+    for (j = 0; j < rdbLoader.nbatches; j++) {
+        sdsfree(rdbLoader.batches[j].buf);
+        zfree(rdbLoader.batches[j].entries);
+    }
+    zfree(rdbLoader.batches);
+    rdbLoader.batches = NULL;
+    return retval;
+}
+
 /* Track loading progress in order to serve client's from time to time
    and if needed calculate rdb checksum  */
 void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
     if (server.rdb_checksum)
         rioGenericUpdateChecksum(r, buf, len);
+    if (rdbLoader.capture)
+        *rdbLoader.capture = sdscatlen(*rdbLoader.capture,buf,len);
     if (server.loading_process_events_interval_bytes &&
         (r->processed_bytes + len)/server.loading_process_events_interval_bytes > r->processed_bytes/server.loading_process_events_interval_bytes)
     {
@@ -1884,11 +2261,254 @@ void rdbLoadProgressCallback(rio *r, const void *buf, size_t len) {
         updateCachedTime(0);
         if (server.masterhost && server.repl_state == REPL_STATE_TRANSFER)
             replicationSendNewlineToMaster();
-        loadingProgress(r->processed_bytes);
+        loadingProgress(rdbLoader.nthreads ? rdbLoader.added_bytes :
+                                             (off_t)r->processed_bytes);
         processEventsWhileBlocked();
     }
 }
 
+/* ---------------------------------------------------------------------------
+ * Key directory (indexed RDB)
+ *
+ * When the RDB file has a key directory (see RDB_KEY_DIRECTORY_MAGIC), the
+ * startup loading serves the clients while the file is loaded: the keys of a
+ * command executed during the loading are loaded on demand from their offset
+ * in the file before the command is executed, like the instant recovery does
+ * with the indexed log, and rdbLoadRio() skips them later.
+ * ------------------------------------------------------------------------- */
+
+/* Return the key of the directory dictionary for 'key' of the database
+ * 'dbid'. The caller must free it. */
+static sds rdbKeyDirectoryKey(int dbid, void *key, size_t keylen) {
+    sds dirkey = sdsnewlen(&dbid,sizeof(dbid));
+    return sdscatlen(dirkey,key,keylen);
+}
+
+/* Read the key directory at the end of the RDB file 'filename', already
+ * open as 'fp'. On success the directory of the keys not loaded yet and a
+ * second stream to load them on demand are set in the server, and C_OK is
+ * returned. C_ERR is returned if the file has no valid key directory. */
+static int rdbOpenKeyDirectory(char *filename, FILE *fp) {
+    unsigned char footer[RDB_KEY_DIRECTORY_FOOTER_SIZE], *buf = NULL, *p, *end;
+    uint64_t offset, count, entries = 0;
+    struct redis_stat sb;
+    dict *dir = NULL;
+
+    if (redis_fstat(fileno(fp),&sb) == -1 ||
+        sb.st_size < RDB_KEY_DIRECTORY_FOOTER_SIZE ||
+        pread(fileno(fp),footer,sizeof(footer),
+              sb.st_size-RDB_KEY_DIRECTORY_FOOTER_SIZE) != sizeof(footer) ||
+        memcmp(footer+16,RDB_KEY_DIRECTORY_MAGIC,8) != 0) return C_ERR;
+
+    memcpy(&offset,footer,8);
+    memcpy(&count,footer+8,8);
+    memrev64ifbe(&offset);
+    memrev64ifbe(&count);
+    if (offset > (uint64_t)sb.st_size-RDB_KEY_DIRECTORY_FOOTER_SIZE)
+        goto err;
+
+    /* Read the whole directory, it only contains the keys. */
+    size_t len = sb.st_size-RDB_KEY_DIRECTORY_FOOTER_SIZE-offset;
+    buf = zmalloc(len ? len : 1);
+    if (len && pread(fileno(fp),buf,len,offset) != (ssize_t)len) goto err;
+
+    dir = dictCreate(&setDictType,NULL);
+    dictExpand(dir,count);
+    p = buf;
+    end = buf+len;
+    while (p < end) {
+        uint32_t dbid, keylen;
+        uint64_t keyoffset;
+        sds dirkey;
+
+        if (end-p < 8) goto err;
+        memcpy(&dbid,p,4);
+        memcpy(&keylen,p+4,4);
+        memrev32ifbe(&dbid);
+        memrev32ifbe(&keylen);
+        p += 8;
+        if ((uint64_t)(end-p) < (uint64_t)keylen+8 ||
+            dbid >= (unsigned)server.dbnum) goto err;
+        memcpy(&keyoffset,p+keylen,8);
+        memrev64ifbe(&keyoffset);
+
+        dirkey = rdbKeyDirectoryKey(dbid,p,keylen);
+        p += keylen+8;
+        if (keyoffset >= offset) {
+            sdsfree(dirkey);
+            goto err;
+        }
+        dictEntry *de = dictAddRaw(dir,dirkey,NULL);
+        if (de == NULL) {
+            sdsfree(dirkey);
+            goto err;
+        }
+        dictSetUnsignedIntegerVal(de,keyoffset);
+        entries++;
+    }
+    if (entries != count) goto err;
+
+    if ((server.rdb_key_directory_fp = fopen(filename,"r")) == NULL) goto err;
+    server.rdb_key_directory = dir;
+    zfree(buf);
+    return C_OK;
+
+err:
+    serverLog(LL_WARNING,"The key directory of the RDB file is corrupted "
+        "and it is ignored: the DB is loaded before the clients are served.");
+    if (dir) dictRelease(dir);
+    zfree(buf);
+    return C_ERR;
+}
+
+/* Free the directory of the keys not loaded yet at the end of the loading. */
+static void rdbCloseKeyDirectory(void) {
+    if (server.rdb_key_directory == NULL) return;
+    dictRelease(server.rdb_key_directory);
+    fclose(server.rdb_key_directory_fp);
+    server.rdb_key_directory = NULL;
+    server.rdb_key_directory_fp = NULL;
+}
+
+/* Remove 'key' of 'db' from the directory of the keys not loaded yet before
+ * rdbLoadRio() adds it. Returns 0 if the key must be skipped, since it was
+ * already loaded on demand or written by a client. */
+static int rdbClaimKeyFromDirectory(redisDb *db, robj *key) {
+    sds dirkey = rdbKeyDirectoryKey(db->id,key->ptr,sdslen(key->ptr));
+    int claimed = dictDelete(server.rdb_key_directory,dirkey) == DICT_OK;
+
+    sdsfree(dirkey);
+    return claimed && dictFind(db->dict,key->ptr) == NULL;
+}
+
+/* Load 'key' of 'db' now from its offset in the RDB file, if it was not loaded
+ * yet. Returns 1 if the key was added to the DB, otherwise 0. */
+int rdbLoadKeyFromDirectory(redisDb *db, robj *key) {
+    long long lru_idle = -1, lfu_freq = -1, expiretime = -1;
+    dictEntry *de;
+    uint64_t offset;
+    sds dirkey;
+    robj *val;
+    int type;
+    rio rdb;
+
+    if (server.rdb_key_directory == NULL) return 0;
+    key = getDecodedObject(key);
+    dirkey = rdbKeyDirectoryKey(db->id,key->ptr,sdslen(key->ptr));
+    de = dictFind(server.rdb_key_directory,dirkey);
+    if (de == NULL) {
+        sdsfree(dirkey);
+        decrRefCount(key);
+        return 0;
+    }
+    offset = dictGetUnsignedIntegerVal(de);
+    dictDelete(server.rdb_key_directory,dirkey);
+    sdsfree(dirkey);
+    if (dictFind(db->dict,key->ptr) != NULL) {
+        decrRefCount(key);
+        return 0;
+    }
+
+    /* Same opcodes rdbLoadRio() handles before the type of a key. */
+    if (fseeko(server.rdb_key_directory_fp,offset,SEEK_SET) == -1) goto eoferr;
+    rioInitWithFile(&rdb,server.rdb_key_directory_fp);
+    while(1) {
+        if ((type = rdbLoadType(&rdb)) == -1) goto eoferr;
+        if (type == RDB_OPCODE_EXPIRETIME) {
+            expiretime = rdbLoadTime(&rdb);
+            expiretime *= 1000;
+        } else if (type == RDB_OPCODE_EXPIRETIME_MS) {
+            expiretime = rdbLoadMillisecondTime(&rdb,RDB_VERSION);
+        } else if (type == RDB_OPCODE_FREQ) {
+            uint8_t byte;
+            if (rioRead(&rdb,&byte,1) == 0) goto eoferr;
+            lfu_freq = byte;
+        } else if (type == RDB_OPCODE_IDLE) {
+            uint64_t qword;
+            if ((qword = rdbLoadLen(&rdb,NULL)) == RDB_LENERR) goto eoferr;
+            lru_idle = qword;
+        } else {
+            break;
+        }
+    }
+    if (!rdbIsObjectType(type))
+        rdbExitReportCorruptRDB("Bad key type %d in the key directory",type);
+
+    /* Skip the key, it is the one requested. */
+    sds keystr = rdbGenericLoadStringObject(&rdb,RDB_LOAD_SDS,NULL);
+    if (keystr == NULL) goto eoferr;
+    sdsfree(keystr);
+    if ((val = rdbLoadObject(type,&rdb,key)) == NULL) goto eoferr;
+
+    if (server.masterhost == NULL && expiretime != -1 && expiretime < mstime()) {
+        decrRefCount(val);
+        decrRefCount(key);
+        return 0;
+    }
+    dbAdd(db,key,val);
+    if (expiretime != -1) setExpire(NULL,db,key,expiretime);
+    objectSetLRUOrLFU(val,lfu_freq,lru_idle,LRU_CLOCK());
+    decrRefCount(key);
+    server.stat_rdb_ondemand_loads++;
+    return 1;
+
+eoferr:
+    serverLog(LL_WARNING,"Short read loading a key on demand from the RDB. Unrecoverable error, aborting now.");
+    rdbExitReportCorruptRDB("Unexpected EOF reading RDB file");
+    return 0; /* Just to avoid warning */
+}
+
+/* Called by call() while the RDB is loaded on demand: loads the keys of the
+ * command before it is executed. */
+void rdbLoadKeysFromDirectory(client *c) {
+    int *keys, numkeys, j;
+
+    if (server.rdb_key_directory == NULL ||
+        dictSize(server.rdb_key_directory) == 0) return;
+    keys = getKeysFromCommand(c->cmd,c->argv,c->argc,&numkeys);
+    for (j = 0; j < numkeys; j++)
+        rdbLoadKeyFromDirectory(c->db,c->argv[keys[j]]);
+    getKeysFreeResult(keys);
+}
+
+/* Return true if the command can be executed while the RDB is loaded on
+ * demand. Commands that access keys they don't declare, or the whole key
+ * space, still wait for the end of the loading. */
+int rdbKeyDirectoryAllowsCommand(struct redisCommand *cmd) {
+    if (server.rdb_key_directory == NULL) return 0;
+    if (cmd->proc == selectCommand || cmd->proc == multiCommand ||
+        cmd->proc == execCommand || cmd->proc == discardCommand ||
+        cmd->proc == unwatchCommand || cmd->proc == echoCommand) return 1;
+    if (cmd->proc == moveCommand || cmd->proc == sortCommand) return 0;
+    return cmd->firstkey != 0 || cmd->getkeys_proc != NULL;
+}
+
+/* Like rdbLoad(), but if the RDB file has a key directory the clients are
+ * served during the loading, see rdbLoadKeyFromDirectory(). */
+int rdbLoadWithKeyDirectory(char *filename, rdbSaveInfo *rsi) {
+    off_t interval = server.loading_process_events_interval_bytes;
+    FILE *fp;
+    rio rdb;
+    int retval;
+
+    if ((fp = fopen(filename,"r")) == NULL) return C_ERR;
+    startLoading(fp);
+    if (rdbOpenKeyDirectory(filename,fp) == C_OK) {
+        serverLog(LL_NOTICE,"RDB key directory found: the %lu keys are also "
+            "loaded on demand while the DB is loading",
+            dictSize(server.rdb_key_directory));
+        server.loading_process_events_interval_bytes =
+            RDB_KEY_DIRECTORY_EVENTS_INTERVAL_BYTES;
+    }
+    rioInitWithFile(&rdb,fp);
+    retval = rdbLoadRio(&rdb,rsi,0);
+    rdbCloseKeyDirectory();
+    server.loading_process_events_interval_bytes = interval;
+    fclose(fp);
+    stopLoading();
+    return retval;
+}
+
 /* Load an RDB file from the rio stream 'rdb'. On success C_OK is returned,
  * otherwise C_ERR is returned and 'errno' is set accordingly. */
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
@@ -1914,11 +2534,14 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
     }
 
     /* Key-specific attributes, set by opcodes before the key type. */
-    long long lru_idle = -1, lfu_freq = -1, expiretime = -1, now = mstime();
-    long long lru_clock = LRU_CLOCK();
-    
+    long long lru_idle = -1, lfu_freq = -1, expiretime = -1;
+
+    /* The keys of an RDB are not in the indexed log of the instant
+     * recovery. */
+    setIndexedLogIncomplete();
+    rdbLoadStart(loading_aof);
     while(1) {
-        robj *key, *val;
+        rdbLoadEntry e;
 
         /* Read type. */
         if ((type = rdbLoadType(rdb)) == -1) goto eoferr;
@@ -2069,31 +2692,20 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
             }
         }
 
-        /* Read key */
-        if ((key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
-        /* Read value */
-        if ((val = rdbLoadObject(type,rdb,key)) == NULL) goto eoferr;
-        /* Check if the key already expired. This function is used when loading
-         * an RDB file from disk, either at startup, or when an RDB was
-         * received from the master. In the latter case, the master is
-         * responsible for key expiry. If we would expire keys here, the
-         * snapshot taken by the master may not be reflected on the slave. */
-        if (server.masterhost == NULL && !loading_aof && expiretime != -1 && expiretime < now) {
-            decrRefCount(key);
-            decrRefCount(val);
+        e.type = type;
+        e.db = db;
+        e.expiretime = expiretime;
+        e.lfu_freq = lfu_freq;
+        e.lru_idle = lru_idle;
+        if (rdbLoader.nthreads && rdbLoadIsSliced(type)) {
+            /* Decoded by the loader threads, see rdbLoadSlice(). */
+            if (rdbLoadSlice(rdb,&e) == C_ERR) goto eoferr;
         } else {
-            /* Add the new object in the hash table */
-            dbAdd(db,key,val);
-
-            /* Set the expire time if needed */
-            if (expiretime != -1) setExpire(NULL,db,key,expiretime);
-            
-            /* Set usage information (for eviction). */
-            objectSetLRUOrLFU(val,lfu_freq,lru_idle,lru_clock);
-
-            /* Decrement the key refcount since dbAdd() will take its
-             * own reference. */
-            decrRefCount(key);
+            /* Read key */
+            if ((e.key = rdbLoadStringObject(rdb)) == NULL) goto eoferr;
+            /* Read value */
+            if ((e.val = rdbLoadObject(type,rdb,e.key)) == NULL) goto eoferr;
+            rdbLoadAddEntry(&e);
         }
 
         /* Reset the state that is key-specified and is populated by
@@ -2102,6 +2714,8 @@ int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof) {
         lfu_freq = -1;
         lru_idle = -1;
     }
+    if (rdbLoadFinish(rdb) == C_ERR) goto eoferr;
+
     /* Verify the checksum if RDB version is >= 5 */
     if (rdbver >= 5) {
         uint64_t cksum, expected = rdb->cksum;
@@ -2304,6 +2918,9 @@ int rdbSaveToSlavesSockets(rdbSaveInfo *rsi) {
     int pipefds[2];
 
     if (server.aof_child_pid != -1 || server.rdb_child_pid != -1) return C_ERR;
+    /* Not while the RDB is loaded on demand, see rdbSave(). */
+    if (server.rdb_key_directory) return C_ERR;
+    if (restoreAllEvictedKeys() == C_ERR) return C_ERR;
 
     /* Before to fork, create a pipe that will be used in order to
      * send back to the parent the IDs of the slaves that successfully
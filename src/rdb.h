@@ -123,6 +123,17 @@
 
 #define RDB_SAVE_NONE 0
 #define RDB_SAVE_AOF_PREAMBLE (1<<0)
+#define RDB_SAVE_KEY_DIRECTORY (1<<1)
+
+/* Key directory appended after the checksum of the RDB file (indexed_rdb in
+ * redis_ir.conf). Each entry is the database id and the length of the key
+ * (32 bit), the key, and the offset of the key in the file (64 bit). The
+ * footer is the offset of the directory, the number of entries (64 bit) and
+ * the magic string. All the integers are little endian. */
+#define RDB_KEY_DIRECTORY_MAGIC "REDISDIR"
+#define RDB_KEY_DIRECTORY_FOOTER_SIZE 24
+/* Clients are served every 64k loaded while keys are loaded on demand. */
+#define RDB_KEY_DIRECTORY_EVENTS_INTERVAL_BYTES (1024*64)
 
 int rdbSaveType(rio *rdb, unsigned char type);
 int rdbLoadType(rio *rdb);
@@ -149,12 +160,18 @@ ssize_t rdbSaveSingleModuleAux(rio *rdb, int when, moduleType *mt);
 robj *rdbLoadStringObject(rio *rdb);
 ssize_t rdbSaveStringObject(rio *rdb, robj *obj);
 ssize_t rdbSaveRawString(rio *rdb, unsigned char *s, size_t len);
+ssize_t rdbSaveAuxFieldStrStr(rio *rdb, char *key, char *val);
+ssize_t rdbSaveAuxFieldStrInt(rio *rdb, char *key, long long val);
 void *rdbGenericLoadStringObject(rio *rdb, int flags, size_t *lenptr);
 int rdbSaveBinaryDoubleValue(rio *rdb, double val);
 int rdbLoadBinaryDoubleValue(rio *rdb, double *val);
 int rdbSaveBinaryFloatValue(rio *rdb, float val);
 int rdbLoadBinaryFloatValue(rio *rdb, float *val);
 int rdbLoadRio(rio *rdb, rdbSaveInfo *rsi, int loading_aof);
+int rdbLoadWithKeyDirectory(char *filename, rdbSaveInfo *rsi);
+int rdbKeyDirectoryAllowsCommand(struct redisCommand *cmd);
+int rdbLoadKeyFromDirectory(redisDb *db, robj *key);
+void rdbLoadKeysFromDirectory(client *c);
 rdbSaveInfo *rdbPopulateSaveInfo(rdbSaveInfo *rsi);
 
 #endif
@@ -0,0 +1,861 @@
+/* Redis-IR indexed log tool.
+ *
+ * Prepares and inspects the indexed log of the instant recovery offline, without
+ * a running server (see indexedlog.h):
+ *
+ *   build    Indexes an AOF into a new indexed log, the way the Indexer does, and
+ *            writes the final log seek, so the server only indexes what is
+ *            appended to the AOF afterwards.
+ *   convert  Copies an indexed log to another engine, structure (BTREE or HASH)
+ *            or number of partitions.
+ *   compact  Copies an indexed log keeping one SET record per key (plus a
+ *            PEXPIREAT record if the key has an expire). Deleted and expired keys
+ *            are dropped.
+ *   stats    Prints the number of keys and log records, and the histograms of the
+ *            chain lengths (log records per key) and of the log record sizes.
+ *
+ * Like redis-check-aof, the tool is part of the redis-server executable and runs
+ * when it is invoked as redis-ir-tool.
+ *
+ * The indexed log is written by one thread per partition: the engines allow one
+ * writer per file, and the keys of a partition never go to another partition, so
+ * the order of the log records of a key is kept. The AOF (build) or each source
+ * partition (convert, compact) is read by its own thread, which hands batches of
+ * log records to the writers. The stats scan every partition in its own thread.
+ * Use as many partitions as cores to build or convert with all the cores.
+ *
+ * The defaults of the engine, structure and number of partitions are the
+ * settings of redis_ir.conf, when the file can be read.
+ */
+
+#include "server.h"
+#include "cluster.h"
+
+#include <sys/stat.h>
+#include <libconfig.h>
+
+#define IR_TOOL_BATCH_SIZE 1024     /* Log records handed to a writer at once. */
+#define IR_TOOL_MAX_BATCHES 64      /* Batches queued per writer before the readers wait. */
+#define IR_TOOL_HISTOGRAM_BUCKETS 40
+
+#define IR_TOOL_PUT 0
+#define IR_TOOL_DEL 1
+
+/* Settings of an indexed log. */
+typedef struct irToolLog {
+    char *filename;
+    indexedLogType *engine;
+    char structure[20];
+    int partitions;
+} irToolLog;
+
+/* A log record to add to a key of the indexed log, or a deletion of the key. */
+typedef struct irToolRecord {
+    int op;
+    sds key;
+    sds data;
+} irToolRecord;
+
+typedef struct irToolBatch {
+    irToolRecord records[IR_TOOL_BATCH_SIZE];
+    int count;
+    struct irToolBatch *next;
+} irToolBatch;
+
+/* Thread that writes the log records of one partition of the indexed log. */
+typedef struct irToolWriter {
+    indexedLog *dbp;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    irToolBatch *head, *tail;
+    int queued;
+    int done;                       /* No more batches will be queued. */
+    unsigned long long records;
+    int error;
+} irToolWriter;
+
+/* Batches of log records being filled by a reader, one per writer. */
+typedef struct irToolSink {
+    irToolWriter *writers;
+    int partitions;
+    irToolBatch **batches;
+} irToolSink;
+
+/* Counters of the stats, merged from the threads of the partitions. */
+typedef struct irToolStats {
+    unsigned long long keys;
+    unsigned long long records;
+    unsigned long long key_bytes;
+    unsigned long long record_bytes;
+    unsigned long long max_chain;
+    unsigned long long chains[IR_TOOL_HISTOGRAM_BUCKETS];
+    unsigned long long sizes[IR_TOOL_HISTOGRAM_BUCKETS];
+    int error;
+} irToolStats;
+
+/* Thread that reads one partition of the source indexed log. */
+typedef struct irToolReader {
+    indexedLog *dbp;
+    int partition;
+    int compact;
+    irToolSink sink;
+    irToolStats stats;
+    unsigned long long keys_dropped;
+    pthread_t thread;
+} irToolReader;
+
+/* ----------------------------------------------------------------------------
+ * Settings
+ * --------------------------------------------------------------------------*/
+
+static void irToolUsage(char *name) {
+    fprintf(stderr,
+"Usage: %s build [options] <aof-file> <indexed-log>\n"
+"       %s convert [options] <indexed-log> <new-indexed-log>\n"
+"       %s compact [options] <indexed-log> <new-indexed-log>\n"
+"       %s stats [options] <indexed-log>\n"
+"\n"
+"Options:\n"
+"  --config <file>       Redis-IR settings with the defaults below (default: ../redis_ir.conf)\n"
+"  --engine <name>       Engine of the indexed log read, or built: HASHLOG or BDB\n"
+"  --structure <name>    Structure of a BDB indexed log: BTREE or HASH\n"
+"  --partitions <n>      Number of partitions of the indexed log\n"
+"  --to-engine <name>    Engine of the new indexed log (default: --engine)\n"
+"  --to-structure <name> Structure of the new indexed log (default: --structure)\n"
+"  --to-partitions <n>   Number of partitions of the new indexed log (default: --partitions)\n"
+"  --seek-file <file>    build: final log seek written for the Indexer (default: %s)\n",
+        name, name, name, name, FINAL_LOG_SEEK);
+    exit(1);
+}
+
+static indexedLogType *lookupEngine(const char *name) {
+    indexedLogType *engine = indexedLogLookupType(name);
+
+    if (engine == NULL) {
+        fprintf(stderr, "Unknown indexed log engine '%s'. Use HASHLOG or BDB "
+                        "(only if Redis was built with USE_BERKELEYDB=yes).\n", name);
+        exit(1);
+    }
+    return engine;
+}
+
+static void setStructure(irToolLog *log, const char *name) {
+    if (strcmp(name, "BTREE") != 0 && strcmp(name, "HASH") != 0) {
+        fprintf(stderr, "Invalid indexed log structure '%s'. Use BTREE or HASH.\n", name);
+        exit(1);
+    }
+    strcpy(log->structure, name);
+}
+
+static int parsePartitions(const char *value) {
+    char *end;
+    long partitions = strtol(value, &end, 10);
+
+    if (*end != '\0' || partitions < 1 || partitions > CLUSTER_SLOTS) {
+        fprintf(stderr, "Invalid number of partitions '%s'. Use a value between 1 and %d.\n",
+            value, CLUSTER_SLOTS);
+        exit(1);
+    }
+    return partitions;
+}
+
+/* Takes the defaults of the indexed log from the Redis-IR settings file. The
+ * defaults of the server are kept if the file cannot be read, unless it was
+ * given with --config. */
+static void loadSettings(irToolLog *log, const char *filename, int required) {
+    config_t cfg;
+    const char *str;
+    int partitions;
+
+    config_init(&cfg);
+    if (!config_read_file(&cfg, filename)) {
+        if (required) {
+            fprintf(stderr, "Cannot read %s: %s (line %d)\n", filename,
+                config_error_text(&cfg), config_error_line(&cfg));
+            exit(1);
+        }
+        config_destroy(&cfg);
+        return;
+    }
+    if (config_lookup_string(&cfg, "indexedlog_engine", &str))
+        log->engine = lookupEngine(str);
+    if (config_lookup_string(&cfg, "indexedlog_structure", &str))
+        setStructure(log, str);
+    if (config_lookup_int(&cfg, "indexedlog_partitions", &partitions) &&
+        partitions >= 1 && partitions <= CLUSTER_SLOTS)
+        log->partitions = partitions;
+    config_destroy(&cfg);
+}
+
+/* ----------------------------------------------------------------------------
+ * Partitions of an indexed log
+ * --------------------------------------------------------------------------*/
+
+/* Same file names as getIndexedLogPartitionFilename(), for any number of
+ * partitions. */
+static sds partitionFilename(irToolLog *log, int partition) {
+    if (log->partitions <= 1)
+        return sdsnew(log->filename);
+    return sdscatprintf(sdsempty(), "%s.%d", log->filename, partition);
+}
+
+/* Same mapping as getIndexedLogPartition(), for any number of partitions. */
+static int keyPartition(char *ikey, int partitions) {
+    char *key;
+
+    if (partitions <= 1)
+        return 0;
+    parseIndexedLogKey(ikey, &key);
+    return keyHashSlot(key, strlen(key)) % partitions;
+}
+
+/* Opens all the partitions of an indexed log. The engines read the structure
+ * from the server settings when the file is opened. */
+static indexedLog **openPartitions(irToolLog *log, char mode) {
+    indexedLog **dbps = zcalloc(sizeof(indexedLog*)*log->partitions);
+    struct stat sb;
+    int partition, ret;
+
+    if (!indexedLogInit(log->engine)) {
+        fprintf(stderr, "Cannot start the %s indexed log engine.\n", log->engine->name);
+        exit(1);
+    }
+    strcpy(server.indexedlog_structure, log->structure);
+
+    for (partition = 0; partition < log->partitions; partition++) {
+        sds filename = partitionFilename(log, partition);
+
+        /* A new indexed log is never added to an existing one. */
+        if (mode == 'W' && stat(filename, &sb) == 0) {
+            fprintf(stderr, "%s already exists, remove it first.\n", filename);
+            exit(1);
+        }
+        if (mode == 'R' && stat(filename, &sb) == -1) {
+            fprintf(stderr, "Cannot open %s: %s\n", filename, strerror(errno));
+            exit(1);
+        }
+        dbps[partition] = indexedLogOpen(log->engine, filename, mode, &ret);
+        if (dbps[partition] == NULL || ret != 0) {
+            fprintf(stderr, "Cannot open %s: %s\n", filename, indexedLogStrerror(ret));
+            exit(1);
+        }
+        sdsfree(filename);
+    }
+    return dbps;
+}
+
+static void closePartitions(indexedLog **dbps, int partitions) {
+    int partition;
+
+    for (partition = 0; partition < partitions; partition++)
+        indexedLogClose(dbps[partition], 1);
+    zfree(dbps);
+}
+
+/* ----------------------------------------------------------------------------
+ * Writers
+ * --------------------------------------------------------------------------*/
+
+static void writeBatch(irToolWriter *w, irToolBatch *b) {
+    indexedLogRecord key, data;
+    int j, error;
+
+    for (j = 0; j < b->count; j++) {
+        irToolRecord *r = &b->records[j];
+
+        key.data = r->key;
+        key.size = sdslen(r->key) + 1;
+        if (r->op == IR_TOOL_DEL) {
+            error = indexedLogDel(w->dbp, &key);
+            if (error == INDEXEDLOG_NOTFOUND)
+                error = 0;
+        } else {
+            data.data = r->data;
+            data.size = sdslen(r->data) + 1;
+            error = indexedLogPut(w->dbp, &key, &data);
+        }
+        if (error != 0 && !w->error) {
+            fprintf(stderr, "Error writing the indexed log: %s\n", indexedLogStrerror(error));
+            w->error = error;
+        }
+        w->records++;
+        sdsfree(r->key);
+        sdsfree(r->data);
+    }
+}
+
+static void *writerThread(void *arg) {
+    irToolWriter *w = arg;
+    irToolBatch *b;
+
+    while (1) {
+        pthread_mutex_lock(&w->lock);
+        while (w->head == NULL && !w->done)
+            pthread_cond_wait(&w->cond, &w->lock);
+        b = w->head;
+        if (b != NULL) {
+            w->head = b->next;
+            if (w->head == NULL) w->tail = NULL;
+            w->queued--;
+            pthread_cond_broadcast(&w->cond);
+        }
+        pthread_mutex_unlock(&w->lock);
+
+        if (b == NULL)
+            break;
+        writeBatch(w, b);
+        zfree(b);
+    }
+
+    if (indexedLogSync(w->dbp) != 0 && !w->error)
+        w->error = INDEXEDLOG_ERR;
+    return NULL;
+}
+
+static irToolWriter *startWriters(indexedLog **dbps, int partitions) {
+    irToolWriter *writers = zcalloc(sizeof(irToolWriter)*partitions);
+    int partition;
+
+    for (partition = 0; partition < partitions; partition++) {
+        irToolWriter *w = &writers[partition];
+
+        w->dbp = dbps[partition];
+        pthread_mutex_init(&w->lock, NULL);
+        pthread_cond_init(&w->cond, NULL);
+        if (pthread_create(&w->thread, NULL, writerThread, w) != 0) {
+            fprintf(stderr, "Cannot create the writer thread of the partition %d.\n", partition);
+            exit(1);
+        }
+    }
+    return writers;
+}
+
+/* Waits for the writers to write all the batches queued. Returns the number of
+ * log records written, or -1 if a writer failed. */
+static long long stopWriters(irToolWriter *writers, int partitions) {
+    long long records = 0;
+    int partition, error = 0;
+
+    for (partition = 0; partition < partitions; partition++) {
+        irToolWriter *w = &writers[partition];
+
+        pthread_mutex_lock(&w->lock);
+        w->done = 1;
+        pthread_cond_broadcast(&w->cond);
+        pthread_mutex_unlock(&w->lock);
+    }
+    for (partition = 0; partition < partitions; partition++) {
+        irToolWriter *w = &writers[partition];
+
+        pthread_join(w->thread, NULL);
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        records += w->records;
+        if (w->error) error = 1;
+    }
+    zfree(writers);
+    return error ? -1 : records;
+}
+
+static void initSink(irToolSink *sink, irToolWriter *writers, int partitions) {
+    sink->writers = writers;
+    sink->partitions = partitions;
+    sink->batches = zcalloc(sizeof(irToolBatch*)*partitions);
+}
+
+/* Queues the batch of a partition to its writer, waiting if the writer is too
+ * far behind. */
+static void flushSinkBatch(irToolSink *sink, int partition) {
+    irToolWriter *w = &sink->writers[partition];
+    irToolBatch *b = sink->batches[partition];
+
+    if (b == NULL)
+        return;
+    sink->batches[partition] = NULL;
+
+    pthread_mutex_lock(&w->lock);
+    while (w->queued >= IR_TOOL_MAX_BATCHES)
+        pthread_cond_wait(&w->cond, &w->lock);
+    if (w->tail) w->tail->next = b;
+    else w->head = b;
+    w->tail = b;
+    w->queued++;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void flushSink(irToolSink *sink) {
+    int partition;
+
+    for (partition = 0; partition < sink->partitions; partition++)
+        flushSinkBatch(sink, partition);
+    zfree(sink->batches);
+    sink->batches = NULL;
+}
+
+/* Adds a log record to the key of the indexed log (IR_TOOL_PUT), or removes the
+ * log records of the key (IR_TOOL_DEL). The sds strings are taken by the sink. */
+static void sinkRecord(irToolSink *sink, int op, sds ikey, sds data) {
+    int partition = keyPartition(ikey, sink->partitions);
+    irToolBatch *b = sink->batches[partition];
+    irToolRecord *r;
+
+    if (b == NULL) {
+        b = zmalloc(sizeof(irToolBatch));
+        b->count = 0;
+        b->next = NULL;
+        sink->batches[partition] = b;
+    }
+    r = &b->records[b->count++];
+    r->op = op;
+    r->key = ikey;
+    r->data = data;
+    if (b->count == IR_TOOL_BATCH_SIZE)
+        flushSinkBatch(sink, partition);
+}
+
+/* ----------------------------------------------------------------------------
+ * build
+ * --------------------------------------------------------------------------*/
+
+/* Log record of a command of the AOF, as writeToIndexedLogPartition() writes it. */
+static sds buildLogRecord(sds command, sds key, sds value, int argc) {
+    if (argc == 2)
+        return sdscatprintf(sdsempty(), "*2\n$%zu\n%s\n$%zu\n%s",
+            sdslen(command), command, sdslen(key), key);
+    return sdscatprintf(sdsempty(), "*3\n$%zu\n%s\n$%zu\n%s\n$%zu\n%s",
+        sdslen(command), command, sdslen(key), key, sdslen(value), value);
+}
+
+/* Indexes the log records of a command of the AOF, as the Indexer does. Returns
+ * 1 if the command is indexed. */
+static int indexCommand(irToolSink *sink, int dbid, sds command, sds key, sds value) {
+    if (!strcmp(command, "SET") || !strcmp(command, "PEXPIREAT")) {
+        sinkRecord(sink, IR_TOOL_PUT, getIndexedLogKey(dbid, key), buildLogRecord(command, key, value, 3));
+    } else if (!strcmp(command, "INCR") || !strcmp(command, "PERSIST")) {
+        sinkRecord(sink, IR_TOOL_PUT, getIndexedLogKey(dbid, key), buildLogRecord(command, key, value, 2));
+    } else if (!strcmp(command, "DEL")) {
+        sinkRecord(sink, IR_TOOL_DEL, getIndexedLogKey(dbid, key), NULL);
+    } else if (!strcmp(command, "SETCHECKPOINT")) {
+        /* The checkpoint image replaces the log records of the key. */
+        sds set = sdsnew("SET");
+
+        sinkRecord(sink, IR_TOOL_DEL, getIndexedLogKey(dbid, key), NULL);
+        sinkRecord(sink, IR_TOOL_PUT, getIndexedLogKey(dbid, key), buildLogRecord(set, key, value, 3));
+        sdsfree(set);
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+static int buildIndexedLog(char *aof_filename, irToolLog *log, char *seek_filename) {
+    FILE *fp = fopen(aof_filename, "r");
+    sds command = sdsempty(), key = sdsempty(), value = sdsempty();
+    unsigned long long seek = 0, commands = 0, indexed = 0;
+    long long start = ustime(), records;
+    char buf[128];
+    int argc, j, dbid = 0, truncated = 0;
+    unsigned long len;
+    irToolSink sink;
+
+    if (fp == NULL) {
+        fprintf(stderr, "Cannot open %s: %s\n", aof_filename, strerror(errno));
+        exit(1);
+    }
+    setvbuf(fp, NULL, _IOFBF, 1024*1024);
+    if (fread(buf, 5, 1, fp) == 1 && memcmp(buf, "REDIS", 5) == 0) {
+        fprintf(stderr, "%s has an RDB preamble, the Indexer cannot index it.\n", aof_filename);
+        exit(1);
+    }
+    rewind(fp);
+
+    indexedLog **dbps = openPartitions(log, 'W');
+    irToolWriter *writers = startWriters(dbps, log->partitions);
+    initSink(&sink, writers, log->partitions);
+
+    /* Same parsing as indexesSequentialLogToIndexedLogV2(). A command cut by the
+     * end of the file is left to the Indexer. */
+    while (fgets(buf, sizeof(buf), fp) != NULL) {
+        unsigned long long cmd_seek = seek + strlen(buf);
+
+        if (buf[0] != '*' || (argc = atoi(buf+1)) < 1) {
+            fprintf(stderr, "Bad file format reading %s at offset %llu.\n", aof_filename, seek);
+            exit(1);
+        }
+        sdsclear(key);
+        sdsclear(value);
+        for (j = 0; j < argc; j++) {
+            sds arg;
+
+            if (fgets(buf, sizeof(buf), fp) == NULL) {
+                truncated = 1;
+                break;
+            }
+            if (buf[0] != '$') {
+                fprintf(stderr, "Bad file format reading %s at offset %llu.\n", aof_filename, seek);
+                exit(1);
+            }
+            cmd_seek += strlen(buf);
+            len = strtol(buf+1, NULL, 10);
+            arg = sdsnewlen(SDS_NOINIT, len);
+            if ((len && fread(arg, len, 1, fp) == 0) || fread(buf, 2, 1, fp) == 0) {
+                sdsfree(arg);
+                truncated = 1;
+                break;
+            }
+            cmd_seek += len + 2;
+
+            if (j == 0) {
+                command = sdscpylen(command, arg, len);
+                sdstoupper(command);
+            } else if (j == 1) {
+                key = sdscpylen(key, arg, len);
+            } else if (j == 2) {
+                value = sdscpylen(value, arg, len);
+            }
+            sdsfree(arg);
+        }
+        if (truncated)
+            break;
+
+        seek = cmd_seek;
+        commands++;
+        if (!strcmp(command, "SELECT"))
+            dbid = atoi(key);
+        else
+            indexed += indexCommand(&sink, dbid, command, key, value);
+    }
+    fclose(fp);
+    sdsfree(command);
+    sdsfree(key);
+    sdsfree(value);
+
+    flushSink(&sink);
+    records = stopWriters(writers, log->partitions);
+    closePartitions(dbps, log->partitions);
+    if (records == -1)
+        return 1;
+
+    if (writeFinalLogSeek(seek_filename, seek, dbid) != 1) {
+        fprintf(stderr, "Cannot write the final log seek to %s.\n", seek_filename);
+        return 1;
+    }
+
+    printf("Indexed %llu of %llu commands of %s into %s (%s, %d partitions) in %.2f seconds.\n",
+        indexed, commands, aof_filename, log->filename, log->engine->name, log->partitions,
+        (double)(ustime()-start)/1000000);
+    if (truncated)
+        printf("The last command of the AOF is incomplete, the Indexer indexes it from offset %llu.\n", seek);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * convert, compact and stats
+ * --------------------------------------------------------------------------*/
+
+static int histogramBucket(unsigned long long value) {
+    int bucket = 0;
+
+    while (value > 1 && bucket < IR_TOOL_HISTOGRAM_BUCKETS-1) {
+        value >>= 1;
+        bucket++;
+    }
+    return bucket;
+}
+
+static void countChain(irToolStats *stats, unsigned long long chain) {
+    if (chain == 0)
+        return;
+    stats->keys++;
+    stats->chains[histogramBucket(chain)]++;
+    if (chain > stats->max_chain)
+        stats->max_chain = chain;
+}
+
+/* Writes the image of a key, rebuilt from its log records, as a SET record plus
+ * a PEXPIREAT record. Returns 0 if the key is deleted or expired. */
+static int sinkTuple(irToolSink *sink, char *ikey, snapshotTuple *t, long long now) {
+    sds command, key, value;
+    char *k;
+
+    if (!t->exists || (t->expire != -1 && t->expire <= now))
+        return 0;
+
+    parseIndexedLogKey(ikey, &k);
+    key = sdsnew(k);
+    command = sdsnew("SET");
+    sinkRecord(sink, IR_TOOL_PUT, sdsnew(ikey), buildLogRecord(command, key, t->value, 3));
+    if (t->expire != -1) {
+        command = sdscpy(command, "PEXPIREAT");
+        value = sdsfromlonglong(t->expire);
+        sinkRecord(sink, IR_TOOL_PUT, sdsnew(ikey), buildLogRecord(command, key, value, 3));
+        sdsfree(value);
+    }
+    sdsfree(command);
+    sdsfree(key);
+    return 1;
+}
+
+/* Scans one partition of the source indexed log. The log records are copied to
+ * the sink, or folded key by key (compact), or only counted (stats, no sink). */
+static void *readerThread(void *arg) {
+    irToolReader *r = arg;
+    indexedLogCursor *cursorp = indexedLogCursorOpen(r->dbp);
+    indexedLogRecord key, data;
+    snapshotTuple t = {0, NULL, -1};
+    sds current_key = NULL;
+    unsigned long long chain = 0;
+    long long now = mstime();
+    int error;
+
+    if (cursorp == NULL) {
+        r->stats.error = INDEXEDLOG_ERR;
+        return NULL;
+    }
+
+    memset(&key, 0, sizeof(key));
+    memset(&data, 0, sizeof(data));
+    while ((error = indexedLogCursorGet(cursorp, &key, &data, INDEXEDLOG_NEXT)) == 0) {
+        if (current_key == NULL || strcmp(current_key, (char *)key.data) != 0) {
+            if (current_key != NULL && r->compact && !sinkTuple(&r->sink, current_key, &t, now))
+                r->keys_dropped++;
+            countChain(&r->stats, chain);
+            chain = 0;
+            t.exists = 0;
+            t.expire = -1;
+            if (current_key == NULL)
+                current_key = sdsnew((char *)key.data);
+            else
+                current_key = sdscpy(current_key, (char *)key.data);
+            r->stats.key_bytes += key.size;
+        }
+        chain++;
+        r->stats.records++;
+        r->stats.record_bytes += data.size;
+        r->stats.sizes[histogramBucket(data.size)]++;
+
+        if (r->compact) {
+            /* Same parsing as the Restorer: line 2 is the command and line 6 the value */
+            sds dataSds = sdsnew((char *)data.data);
+            char **lines;
+            int count_lines;
+
+            lines = sdssplitlen(dataSds, sdslen(dataSds), "\n", 1, &count_lines);
+            sdsfree(dataSds);
+            if (count_lines > 2)
+                applySnapshotLogRecord(&t, lines[2], count_lines > 6 ? lines[6] : "");
+            sdsfreesplitres(lines, count_lines);
+        } else if (r->sink.writers != NULL) {
+            sinkRecord(&r->sink, IR_TOOL_PUT, sdsnew((char *)key.data), sdsnew((char *)data.data));
+        }
+    }
+    indexedLogCursorClose(cursorp);
+
+    if (current_key != NULL && r->compact && !sinkTuple(&r->sink, current_key, &t, now))
+        r->keys_dropped++;
+    countChain(&r->stats, chain);
+    sdsfree(current_key);
+    sdsfree(t.value);
+
+    if (error != INDEXEDLOG_NOTFOUND) {
+        fprintf(stderr, "Error reading the partition %d: %s\n", r->partition, indexedLogStrerror(error));
+        r->stats.error = error;
+    }
+    if (r->sink.writers != NULL)
+        flushSink(&r->sink);
+    return NULL;
+}
+
+/* Scans the partitions of an indexed log in parallel. If 'to' is given, the log
+ * records are written to the new indexed log, folded if 'compact' is set. The
+ * stats of the scan are merged in 'stats'. Returns 0 on success. */
+static int scanIndexedLog(irToolLog *from, irToolLog *to, int compact, irToolStats *stats,
+ unsigned long long *keys_dropped, long long *records_written) {
+    indexedLog **src = openPartitions(from, 'R');
+    indexedLog **dst = NULL;
+    irToolWriter *writers = NULL;
+    irToolReader *readers = zcalloc(sizeof(irToolReader)*from->partitions);
+    int partition, j, error = 0;
+
+    if (to != NULL) {
+        dst = openPartitions(to, 'W');
+        writers = startWriters(dst, to->partitions);
+    }
+
+    memset(stats, 0, sizeof(*stats));
+    *keys_dropped = 0;
+    for (partition = 0; partition < from->partitions; partition++) {
+        irToolReader *r = &readers[partition];
+
+        r->dbp = src[partition];
+        r->partition = partition;
+        r->compact = compact;
+        if (to != NULL)
+            initSink(&r->sink, writers, to->partitions);
+        if (pthread_create(&r->thread, NULL, readerThread, r) != 0) {
+            fprintf(stderr, "Cannot create the reader thread of the partition %d.\n", partition);
+            exit(1);
+        }
+    }
+
+    for (partition = 0; partition < from->partitions; partition++) {
+        irToolReader *r = &readers[partition];
+
+        pthread_join(r->thread, NULL);
+        stats->keys += r->stats.keys;
+        stats->records += r->stats.records;
+        stats->key_bytes += r->stats.key_bytes;
+        stats->record_bytes += r->stats.record_bytes;
+        if (r->stats.max_chain > stats->max_chain)
+            stats->max_chain = r->stats.max_chain;
+        for (j = 0; j < IR_TOOL_HISTOGRAM_BUCKETS; j++) {
+            stats->chains[j] += r->stats.chains[j];
+            stats->sizes[j] += r->stats.sizes[j];
+        }
+        if (r->stats.error) error = 1;
+        *keys_dropped += r->keys_dropped;
+    }
+    zfree(readers);
+
+    if (to != NULL) {
+        *records_written = stopWriters(writers, to->partitions);
+        if (*records_written == -1) error = 1;
+        closePartitions(dst, to->partitions);
+    }
+    closePartitions(src, from->partitions);
+    return error;
+}
+
+static void printHistogram(const char *title, unsigned long long *buckets, unsigned long long total) {
+    int j, first = -1, last = -1;
+
+    for (j = 0; j < IR_TOOL_HISTOGRAM_BUCKETS; j++) {
+        if (buckets[j] && first == -1) first = j;
+        if (buckets[j]) last = j;
+    }
+    printf("%s:\n", title);
+    for (j = first; j >= 0 && j <= last; j++) {
+        unsigned long long low = j ? 1ULL << j : 0, high = (1ULL << (j+1)) - 1;
+
+        printf("  %12llu - %-12llu %12llu  %6.2f%%\n", low, high, buckets[j],
+            total ? (double)buckets[j]*100/total : 0);
+    }
+}
+
+static int printStats(irToolLog *log) {
+    irToolStats stats;
+    unsigned long long keys_dropped;
+    long long start = ustime();
+
+    if (scanIndexedLog(log, NULL, 0, &stats, &keys_dropped, NULL))
+        return 1;
+
+    printf("Indexed log %s (%s, %s, %d partitions), scanned in %.2f seconds\n", log->filename,
+        log->engine->name, log->structure, log->partitions, (double)(ustime()-start)/1000000);
+    printf("Keys: %llu (%llu bytes)\n", stats.keys, stats.key_bytes);
+    printf("Log records: %llu (%llu bytes)\n", stats.records, stats.record_bytes);
+    printf("Log records per key: %.2f average, %llu max\n",
+        stats.keys ? (double)stats.records/stats.keys : 0, stats.max_chain);
+    printHistogram("Chain length (log records per key)", stats.chains, stats.keys);
+    printHistogram("Log record size (bytes)", stats.sizes, stats.records);
+    return 0;
+}
+
+static int copyIndexedLog(irToolLog *from, irToolLog *to, int compact) {
+    irToolStats stats;
+    unsigned long long keys_dropped;
+    long long start = ustime(), records = 0;
+
+    if (scanIndexedLog(from, to, compact, &stats, &keys_dropped, &records))
+        return 1;
+
+    printf("%s %llu log records of %llu keys of %s into %llu log records of %s (%s, %s, %d partitions) "
+        "in %.2f seconds.\n", compact ? "Compacted" : "Converted", stats.records, stats.keys, from->filename,
+        (unsigned long long) records, to->filename, to->engine->name, to->structure, to->partitions,
+        (double)(ustime()-start)/1000000);
+    if (compact)
+        printf("%llu deleted or expired keys dropped.\n", keys_dropped);
+    return 0;
+}
+
+/* ----------------------------------------------------------------------------
+ * Main
+ * --------------------------------------------------------------------------*/
+
+int redis_ir_tool_main(int argc, char **argv) {
+    irToolLog from, to;
+    char *config = "../redis_ir.conf", *seek_filename = FINAL_LOG_SEEK, *command;
+    char *to_engine = NULL, *to_structure = NULL, *to_partitions = NULL;
+    char *engine = NULL, *structure = NULL, *partitions = NULL;
+    char *files[2];
+    int j, nfiles = 0, config_given = 0, ret = 1;
+
+    if (argc < 2)
+        irToolUsage(argv[0]);
+    command = argv[1];
+
+    for (j = 2; j < argc; j++) {
+        int lastarg = j == argc-1;
+
+        if (!strcmp(argv[j], "--config") && !lastarg) {
+            config = argv[++j];
+            config_given = 1;
+        } else if (!strcmp(argv[j], "--engine") && !lastarg) {
+            engine = argv[++j];
+        } else if (!strcmp(argv[j], "--structure") && !lastarg) {
+            structure = argv[++j];
+        } else if (!strcmp(argv[j], "--partitions") && !lastarg) {
+            partitions = argv[++j];
+        } else if (!strcmp(argv[j], "--to-engine") && !lastarg) {
+            to_engine = argv[++j];
+        } else if (!strcmp(argv[j], "--to-structure") && !lastarg) {
+            to_structure = argv[++j];
+        } else if (!strcmp(argv[j], "--to-partitions") && !lastarg) {
+            to_partitions = argv[++j];
+        } else if (!strcmp(argv[j], "--seek-file") && !lastarg) {
+            seek_filename = argv[++j];
+        } else if (argv[j][0] != '-' && nfiles < 2) {
+            files[nfiles++] = argv[j];
+        } else {
+            fprintf(stderr, "Invalid argument: %s\n", argv[j]);
+            irToolUsage(argv[0]);
+        }
+    }
+
+    /* Settings of the indexed log read (or built), then of the new one. */
+    from.filename = NULL;
+    from.engine = server.indexedlog_engine;
+    strcpy(from.structure, server.indexedlog_structure);
+    from.partitions = server.indexedlog_partitions;
+    loadSettings(&from, config, config_given);
+    if (engine) from.engine = lookupEngine(engine);
+    if (structure) setStructure(&from, structure);
+    if (partitions) from.partitions = parsePartitions(partitions);
+
+    to = from;
+    if (to_engine) to.engine = lookupEngine(to_engine);
+    if (to_structure) setStructure(&to, to_structure);
+    if (to_partitions) to.partitions = parsePartitions(to_partitions);
+
+    if (!strcmp(command, "build") && nfiles == 2) {
+        from.filename = files[1];
+        ret = buildIndexedLog(files[0], &from, seek_filename);
+    } else if ((!strcmp(command, "convert") || !strcmp(command, "compact")) && nfiles == 2) {
+        from.filename = files[0];
+        to.filename = files[1];
+        if (!strcmp(from.filename, to.filename)) {
+            fprintf(stderr, "The new indexed log must be a different file.\n");
+            exit(1);
+        }
+        ret = copyIndexedLog(&from, &to, !strcmp(command, "compact"));
+    } else if (!strcmp(command, "stats") && nfiles == 1) {
+        from.filename = files[0];
+        ret = printStats(&from);
+    } else {
+        irToolUsage(argv[0]);
+    }
+
+    exit(ret);
+}
@@ -0,0 +1,908 @@
+/* Redis-IR crash recovery benchmark.
+ *
+ * Runs the same crash experiment against several recovery setups of the server
+ * on a single Linux box, and reports how fast each one comes back:
+ *
+ *   1. Starts a fresh redis-server in <dir>/<mode>, with a redis_ir.conf written
+ *      for the mode (instant recovery with a B+-tree, hash or HASHLOG indexed log,
+ *      sequential log (AOF) replay, or RDB load).
+ *   2. Preloads the keys and updates them following the key distribution, then
+ *      runs the workload for a while to measure the baseline throughput.
+ *   3. Kills the server with SIGKILL at the crash point: right after the
+ *      workload, in the middle of an indexer batch or in the middle of a
+ *      checkpoint (DEBUG CRASHAT, instant recovery only).
+ *   4. Restarts the server with the clients already knocking at the door, and
+ *      records the throughput and the latency of each time interval.
+ *
+ * The report gives the time to the first request served, the time to get back
+ * 90% of the baseline throughput and the time to the full restore (the end of
+ * the loading or of the incremental restore), in milliseconds from the restart.
+ * The timeline of every mode is written to a CSV file.
+ *
+ * The run is deterministic for a given seed: the same keys are written and
+ * requested in the same order by each client in every mode.
+ */
+
+#include "fmacros.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <signal.h>
+#include <limits.h>
+#include <ftw.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "hiredis.h"
+#include "zmalloc.h"
+#include "atomicvar.h"
+
+#define UNUSED(V) ((void) V)
+
+#define DIST_UNIFORM 0
+#define DIST_ZIPF 1
+
+#define CRASH_AFTER_WORKLOAD 0
+#define CRASH_INDEXER_BATCH 1
+#define CRASH_CHECKPOINT 2
+
+#define PIPELINE_SIZE 1000
+#define MAX_VALUE_SIZE 49           /* Log records fields of the Indexer are 50 bytes */
+#define LATENCY_BUCKETS 256         /* See latencyBucket() */
+
+static const char *crash_point_names[] = {"after-workload", "indexer-batch", "checkpoint"};
+static pid_t server_pid = -1;       /* Server running, killed if the benchmark fails */
+
+/* A recovery setup of the server, written to its redis_ir.conf. */
+typedef struct recoveryMode {
+    const char *name;
+    const char *description;
+    int instant_recovery;           /* instant_recovery_state */
+    int sequential_log;             /* sequential_log_state */
+    const char *engine;             /* indexedlog_engine */
+    const char *structure;          /* indexedlog_structure */
+    int indexed_rdb;                /* indexed_rdb */
+} recoveryMode;
+
+static recoveryMode recovery_modes[] = {
+    {"ir-btree", "instant recovery, Berkeley DB B+-tree indexed log", 1, 1, "BDB", "BTREE", 0},
+    {"ir-hash", "instant recovery, Berkeley DB hash indexed log", 1, 1, "BDB", "HASH", 0},
+    {"ir-hashlog", "instant recovery, HASHLOG indexed log", 1, 1, "HASHLOG", "BTREE", 0},
+    {"aof", "sequential log (AOF) replay", 0, 1, NULL, "BTREE", 0},
+    {"rdb", "RDB load (SAVE right before the crash)", 0, 0, NULL, "BTREE", 0},
+    {"rdb-indexed", "RDB load with keys loaded on demand (indexed_rdb)", 0, 0, NULL, "BTREE", 1},
+    {NULL, NULL, 0, 0, NULL, NULL, 0}
+};
+
+static struct config {
+    char server_path[PATH_MAX];
+    const char *dir;
+    const char *modes;
+    const char *csv;
+    const char *ir_settings;        /* Lines appended to every redis_ir.conf */
+    int port;
+    long long keys;
+    long long updates;
+    long long tail_writes;
+    int value_size;
+    int distribution;
+    double zipf_theta;
+    int crash_point;
+    int checkpoint_interval;
+    int clients;
+    int get_ratio;
+    int baseline_secs;
+    int duration_secs;
+    int interval_ms;
+    int timeout_secs;
+    unsigned long long seed;
+    char value[MAX_VALUE_SIZE+1];
+    /* Zipfian generator state, see nextZipf(). */
+    double zipf_zetan;
+    double zipf_alpha;
+    double zipf_eta;
+} config;
+
+/* Requests and latencies of one interval of the timeline. Updated atomically
+ * by all the clients. */
+typedef struct intervalStats {
+    long long ops;
+    long long errors;
+    long long latency_sum;
+    long long latency[LATENCY_BUCKETS];
+} intervalStats;
+
+/* A phase of the workload: the baseline or the recovery after the restart. */
+typedef struct phase {
+    long long start;                /* Start of the phase, in microseconds */
+    long long end;
+    int nintervals;
+    intervalStats *intervals;
+    int recovery;                   /* Monitor the end of the recovery */
+    long long restored;             /* Time of the full restore from the start, -1 if not yet */
+} phase;
+
+typedef struct benchClient {
+    pthread_t thread;
+    int id;
+    phase *ph;
+    uint64_t rng;
+    long long first_ok;             /* First request served from the phase start, -1 if none */
+} benchClient;
+
+typedef struct modeResult {
+    recoveryMode *mode;
+    int crashed;                    /* The crash point was reached */
+    double baseline_ops;
+    long long keys_before;
+    long long first_request_us;
+    long long throughput90_us;
+    long long restored_us;
+    phase recovery;
+} modeResult;
+
+/* Implementation */
+static long long ustime(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((long long)ts.tv_sec)*1000000 + ts.tv_nsec/1000;
+}
+
+static void fatal(const char *fmt, ...) {
+    va_list ap;
+
+    va_start(ap, fmt);
+    fprintf(stderr, "redis-recovery-benchmark: ");
+    vfprintf(stderr, fmt, ap);
+    fprintf(stderr, "\n");
+    va_end(ap);
+    if (server_pid != -1) kill(server_pid, SIGKILL);
+    exit(1);
+}
+
+/* xorshift64* generator: every client gets its own deterministic stream. */
+static uint64_t nextRandom(uint64_t *state) {
+    uint64_t x = *state;
+
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+static double nextRandomDouble(uint64_t *state) {
+    return (nextRandom(state) >> 11) * (1.0/9007199254740992.0);
+}
+
+static uint64_t seedRandom(unsigned long long seed, int stream) {
+    uint64_t state = seed*0x9E3779B97F4A7C15ULL + (uint64_t)stream*0xBF58476D1CE4E5B9ULL;
+
+    return state ? state : 0x2545F4914F6CDD1DULL;
+}
+
+/* Zipfian key ranks as in "Quickly generating billion-record synthetic
+ * databases" (Gray et al.): rank 0 is the most requested key. */
+static void initZipf(void) {
+    double zeta2 = 1 + pow(0.5, config.zipf_theta);
+    long long i;
+
+    config.zipf_zetan = 0;
+    for (i = 1; i <= config.keys; i++)
+        config.zipf_zetan += 1/pow((double)i, config.zipf_theta);
+    config.zipf_alpha = 1/(1-config.zipf_theta);
+    config.zipf_eta = (1-pow(2.0/config.keys, 1-config.zipf_theta)) /
+                      (1-zeta2/config.zipf_zetan);
+}
+
+static long long nextZipf(uint64_t *state) {
+    double u = nextRandomDouble(state);
+    double uz = u*config.zipf_zetan;
+    long long rank;
+
+    if (uz < 1) return 0;
+    if (uz < 1+pow(0.5, config.zipf_theta)) return 1;
+    rank = (long long)(config.keys*pow(config.zipf_eta*u-config.zipf_eta+1, config.zipf_alpha));
+    return rank >= config.keys ? config.keys-1 : rank;
+}
+
+static long long nextKey(uint64_t *state) {
+    if (config.distribution == DIST_ZIPF) return nextZipf(state);
+    return nextRandom(state) % config.keys;
+}
+
+/* Latencies in microseconds are counted in log-linear buckets: exact up to
+ * 15us, then 8 buckets per power of two (12.5% precision). */
+static int latencyBucket(long long us) {
+    int msb, bucket;
+
+    if (us < 16) return us < 0 ? 0 : (int)us;
+    msb = 63 - __builtin_clzll((unsigned long long)us);
+    bucket = 16 + (msb-4)*8 + (int)((us >> (msb-3)) & 7);
+    return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS-1;
+}
+
+static long long latencyBucketValue(int bucket) {
+    int msb;
+
+    if (bucket < 16) return bucket;
+    msb = (bucket-16)/8 + 4;
+    return ((long long)(8 + (bucket-16)%8 + 1) << (msb-3)) - 1;
+}
+
+static long long intervalPercentile(intervalStats *is, double perc) {
+    long long seen = 0, total = 0;
+    int j;
+
+    for (j = 0; j < LATENCY_BUCKETS; j++) total += is->latency[j];
+    if (total == 0) return 0;
+    for (j = 0; j < LATENCY_BUCKETS; j++) {
+        seen += is->latency[j];
+        if (seen >= (long long)ceil(total*perc/100)) return latencyBucketValue(j);
+    }
+    return latencyBucketValue(LATENCY_BUCKETS-1);
+}
+
+/* ----------------------------------------------------------------------------
+ * Server process
+ * ------------------------------------------------------------------------- */
+
+static int removeTreeEntry(const char *path, const struct stat *sb, int flag, struct FTW *ftw) {
+    UNUSED(sb);
+    UNUSED(flag);
+    UNUSED(ftw);
+    return remove(path);
+}
+
+static void makeDir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST)
+        fatal("can't create the directory %s: %s", path, strerror(errno));
+}
+
+/* Creates an empty run directory for the mode: <dir>/<mode>/redis_ir.conf is
+ * read by the server started in <dir>/<mode>/work (the server always reads
+ * ../redis_ir.conf). */
+static void prepareRunDir(recoveryMode *mode, char *rundir, size_t len) {
+    char path[PATH_MAX+32];
+    FILE *fp;
+
+    snprintf(rundir, len, "%s/%s", config.dir, mode->name);
+    if (access(rundir, F_OK) == 0 &&
+        nftw(rundir, removeTreeEntry, 16, FTW_DEPTH|FTW_PHYS) == -1)
+        fatal("can't remove the previous run in %s: %s", rundir, strerror(errno));
+    makeDir(config.dir);
+    makeDir(rundir);
+    snprintf(path, sizeof(path), "%s/work", rundir);
+    makeDir(path);
+    snprintf(path, sizeof(path), "%s/work/logs", rundir);
+    makeDir(path);
+
+    snprintf(path, sizeof(path), "%s/redis_ir.conf", rundir);
+    if ((fp = fopen(path, "w")) == NULL)
+        fatal("can't write %s: %s", path, strerror(errno));
+    fprintf(fp, "// Written by redis-recovery-benchmark for the mode '%s'.\n", mode->name);
+    fprintf(fp, "aof_filename = \"logs/sequentialLog.aof\";\n");
+    fprintf(fp, "instant_recovery_state = \"%s\";\n", mode->instant_recovery ? "ON" : "OFF");
+    fprintf(fp, "sequential_log_state = \"%s\";\n", mode->sequential_log ? "ON" : "OFF");
+    if (mode->engine) fprintf(fp, "indexedlog_engine = \"%s\";\n", mode->engine);
+    fprintf(fp, "indexedlog_structure = \"%s\";\n", mode->structure);
+    fprintf(fp, "indexedlog_filename = \"logs/indexedLog.db\";\n");
+    fprintf(fp, "indexed_rdb = \"%s\";\n", mode->indexed_rdb ? "ON" : "OFF");
+    fprintf(fp, "checkpoint_state = \"%s\";\n",
+        config.crash_point == CRASH_CHECKPOINT ? "ON" : "OFF");
+    fprintf(fp, "selftune_checkpoint_time_interval = \"OFF\";\n");
+    fprintf(fp, "checkpoint_time_interval = %d;\n", config.checkpoint_interval);
+    fprintf(fp, "first_checkpoint_start_time = %d;\n", config.checkpoint_interval);
+    fprintf(fp, "redisPort = %d;\n", config.port);
+    fprintf(fp, "memtier_benchmark_state = \"OFF\";\n");
+    fprintf(fp, "generate_recovery_report = \"OFF\";\n");
+    fprintf(fp, "generate_executed_commands_csv = \"OFF\";\n");
+    fprintf(fp, "generate_indexing_report_csv = \"OFF\";\n");
+    fprintf(fp, "system_monitoring = \"OFF\";\n");
+    if (config.ir_settings) fprintf(fp, "%s\n", config.ir_settings);
+    fclose(fp);
+}
+
+/* Starts the server in the work directory of the run. Its output is
+ * appended to <rundir>/server.log. */
+static pid_t startServer(const char *rundir) {
+    char path[PATH_MAX+32], port[16];
+    pid_t pid;
+    int fd;
+
+    snprintf(port, sizeof(port), "%d", config.port);
+    if ((pid = fork()) == -1) fatal("fork: %s", strerror(errno));
+    if (pid > 0) return server_pid = pid;
+
+    snprintf(path, sizeof(path), "%s/server.log", rundir);
+    if ((fd = open(path, O_WRONLY|O_CREAT|O_APPEND, 0644)) != -1) {
+        dup2(fd, STDOUT_FILENO);
+        dup2(fd, STDERR_FILENO);
+        close(fd);
+    }
+    snprintf(path, sizeof(path), "%s/work", rundir);
+    if (chdir(path) == -1) _exit(1);
+    execl(config.server_path, config.server_path, "--port", port, "--dir", ".",
+          "--daemonize", "no", "--save", "", (char*)NULL);
+    _exit(1);
+}
+
+/* Waits for the server to exit. Returns 1 if it exited, 0 on timeout. */
+static int waitServer(pid_t pid, int timeout_secs) {
+    long long deadline = ustime() + (long long)timeout_secs*1000000;
+    int status;
+
+    while (ustime() < deadline) {
+        pid_t ret = waitpid(pid, &status, WNOHANG);
+        if (ret == pid || (ret == -1 && errno == ECHILD)) {
+            server_pid = -1;
+            return 1;
+        }
+        usleep(10000);
+    }
+    return 0;
+}
+
+static void killServer(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitServer(pid, config.timeout_secs);
+}
+
+static redisContext *connectServer(int timeout_ms) {
+    struct timeval tv = {timeout_ms/1000, (timeout_ms%1000)*1000};
+    redisContext *c = redisConnectWithTimeout("127.0.0.1", config.port, tv);
+
+    if (c == NULL) return NULL;
+    if (c->err) {
+        redisFree(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* Waits for the server to reply to PING. Returns the connection or exits. */
+static redisContext *waitServerReady(pid_t pid) {
+    long long deadline = ustime() + (long long)config.timeout_secs*1000000;
+    redisContext *c;
+    redisReply *r;
+    int status;
+
+    while (ustime() < deadline) {
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            server_pid = -1;
+            fatal("the server exited at the startup, see server.log in %s", config.dir);
+        }
+        if ((c = connectServer(100)) != NULL) {
+            r = redisCommand(c, "PING");
+            if (r && r->type == REDIS_REPLY_STATUS) {
+                freeReplyObject(r);
+                return c;
+            }
+            if (r) freeReplyObject(r);
+            redisFree(c);
+        }
+        usleep(10000);
+    }
+    killServer(pid);
+    fatal("the server is not ready after %d seconds", config.timeout_secs);
+    return NULL;
+}
+
+static redisReply *commandOrExit(redisContext *c, const char *fmt, ...) {
+    redisReply *r;
+    va_list ap;
+
+    va_start(ap, fmt);
+    r = redisvCommand(c, fmt, ap);
+    va_end(ap);
+    if (r == NULL) fatal("connection error: %s", c->errstr);
+    if (r->type == REDIS_REPLY_ERROR) fatal("%s", r->str);
+    return r;
+}
+
+/* Returns the integer value of an INFO field, or -1 if it is missing. The
+ * string value is copied to 'value' if not NULL. */
+static long long infoField(const char *info, const char *field, char *value, size_t len) {
+    char pattern[64];
+    const char *p;
+    size_t n = 0;
+
+    snprintf(pattern, sizeof(pattern), "\n%s:", field);
+    if ((p = strstr(info, pattern)) == NULL) return -1;
+    p += strlen(pattern);
+    if (value) {
+        while (p[n] != '\r' && p[n] != '\n' && p[n] != '\0' && n < len-1) n++;
+        memcpy(value, p, n);
+        value[n] = '\0';
+    }
+    return strtoll(p, NULL, 10);
+}
+
+/* Writes 'count' keys with SET: the keys 0..count-1 if 'sequential', otherwise
+ * following the key distribution. Stops quietly if the connection is lost and
+ * 'may_crash' is set. */
+static void writeKeys(redisContext *c, long long count, int sequential, uint64_t *rng, int may_crash) {
+    long long i, pending = 0;
+    redisReply *r;
+
+    for (i = 0; i < count; i++) {
+        long long key = sequential ? i : nextKey(rng);
+
+        redisAppendCommand(c, "SET key:%lld %s", key, config.value);
+        pending++;
+        if (pending == PIPELINE_SIZE || i == count-1) {
+            while (pending--) {
+                if (redisGetReply(c, (void**)&r) != REDIS_OK) {
+                    if (may_crash) return;
+                    fatal("connection error: %s", c->errstr);
+                }
+                if (r->type == REDIS_REPLY_ERROR && !may_crash) fatal("%s", r->str);
+                freeReplyObject(r);
+            }
+            pending = 0;
+        }
+    }
+}
+
+/* ----------------------------------------------------------------------------
+ * Workload
+ * ------------------------------------------------------------------------- */
+
+static int stop_clients = 0;
+
+static void initPhase(phase *ph, int secs, int recovery) {
+    ph->start = ustime();
+    ph->end = ph->start + (long long)secs*1000000;
+    ph->nintervals = (secs*1000 + config.interval_ms - 1)/config.interval_ms;
+    ph->intervals = zcalloc(sizeof(intervalStats)*ph->nintervals);
+    ph->recovery = recovery;
+    ph->restored = -1;
+}
+
+static void recordRequest(phase *ph, long long start, long long end, int error) {
+    long long idx = (end - ph->start)/(config.interval_ms*1000LL);
+    intervalStats *is;
+
+    if (idx < 0 || idx >= ph->nintervals) return;
+    is = ph->intervals+idx;
+    if (error) {
+        atomicIncr(is->errors, 1);
+    } else {
+        atomicIncr(is->ops, 1);
+        atomicIncr(is->latency_sum, end-start);
+        atomicIncr(is->latency[latencyBucket(end-start)], 1);
+    }
+}
+
+/* A client of the workload. It keeps reconnecting while the server is down,
+ * and counts the error replies (such as -LOADING) apart from the requests
+ * served. */
+static void *clientThread(void *arg) {
+    benchClient *bc = arg;
+    phase *ph = bc->ph;
+    redisContext *c = NULL;
+    redisReply *r;
+    long long start, end, key;
+    int stop;
+
+    bc->first_ok = -1;
+    while (1) {
+        atomicGet(stop_clients, stop);
+        if (stop || (start = ustime()) >= ph->end) break;
+        if (c == NULL && (c = connectServer(100)) == NULL) {
+            usleep(1000);
+            continue;
+        }
+        key = nextKey(&bc->rng);
+        if ((int)(nextRandom(&bc->rng) % 100) < config.get_ratio)
+            r = redisCommand(c, "GET key:%lld", key);
+        else
+            r = redisCommand(c, "SET key:%lld %s", key, config.value);
+        end = ustime();
+        if (r == NULL) {
+            redisFree(c);
+            c = NULL;
+            continue;
+        }
+        recordRequest(ph, start, end, r->type == REDIS_REPLY_ERROR);
+        if (r->type != REDIS_REPLY_ERROR && bc->first_ok == -1)
+            bc->first_ok = end - ph->start;
+        freeReplyObject(r);
+    }
+    if (c) redisFree(c);
+    return NULL;
+}
+
+/* Polls INFO to find the end of the recovery: the end of the loading, and
+ * the end of the incremental restore with the instant recovery. */
+static void *monitorThread(void *arg) {
+    phase *ph = arg;
+    redisContext *c = NULL;
+    char state[32];
+    redisReply *r;
+    int stop;
+
+    while (ph->restored == -1 && ustime() < ph->end) {
+        atomicGet(stop_clients, stop);
+        if (stop) break;
+        if (c == NULL) c = connectServer(100);
+        if (c && (r = redisCommand(c, "INFO")) != NULL) {
+            if (r->type == REDIS_REPLY_STRING &&
+                infoField(r->str, "loading", NULL, 0) == 0 &&
+                (infoField(r->str, "recovery_state", state, sizeof(state)) == -1 ||
+                 (strcmp(state, "restoring") && strcmp(state, "paused") && strcmp(state, "waiting"))))
+            {
+                ph->restored = ustime() - ph->start;
+            }
+            freeReplyObject(r);
+        } else if (c) {
+            redisFree(c);
+            c = NULL;
+        }
+        if (ph->restored == -1) usleep(config.interval_ms*1000/4);
+    }
+    if (c) redisFree(c);
+    return NULL;
+}
+
+/* Runs the workload with all the clients during the phase. Returns the time
+ * of the first request served from the start of the phase, -1 if none. */
+static long long runWorkload(phase *ph, int stream) {
+    benchClient *clients = zcalloc(sizeof(benchClient)*config.clients);
+    long long first_ok = -1;
+    pthread_t monitor;
+    int j;
+
+    atomicSet(stop_clients, 0);
+    for (j = 0; j < config.clients; j++) {
+        clients[j].id = j;
+        clients[j].ph = ph;
+        clients[j].rng = seedRandom(config.seed, stream*1000+j+1);
+        if (pthread_create(&clients[j].thread, NULL, clientThread, clients+j) != 0)
+            fatal("can't create the client threads");
+    }
+    if (ph->recovery && pthread_create(&monitor, NULL, monitorThread, ph) != 0)
+        fatal("can't create the monitor thread");
+
+    for (j = 0; j < config.clients; j++) {
+        pthread_join(clients[j].thread, NULL);
+        if (clients[j].first_ok != -1 && (first_ok == -1 || clients[j].first_ok < first_ok))
+            first_ok = clients[j].first_ok;
+    }
+    atomicSet(stop_clients, 1);
+    if (ph->recovery) pthread_join(monitor, NULL);
+    zfree(clients);
+    return first_ok;
+}
+
+static double phaseThroughput(phase *ph) {
+    long long ops = 0;
+    int j;
+
+    for (j = 0; j < ph->nintervals; j++) ops += ph->intervals[j].ops;
+    return (double)ops*1000000/(ph->end - ph->start);
+}
+
+/* ----------------------------------------------------------------------------
+ * Experiment
+ * ------------------------------------------------------------------------- */
+
+static void runMode(recoveryMode *mode, modeResult *res) {
+    char rundir[PATH_MAX];
+    uint64_t rng = seedRandom(config.seed, 0);
+    redisContext *c;
+    redisReply *r;
+    phase baseline;
+    pid_t pid;
+    int j;
+
+    memset(res, 0, sizeof(*res));
+    res->mode = mode;
+    prepareRunDir(mode, rundir, sizeof(rundir));
+    printf("====== %s: %s ======\n", mode->name, mode->description);
+
+    /* Preload and baseline. */
+    pid = startServer(rundir);
+    c = waitServerReady(pid);
+    printf("  preloading %lld keys and %lld updates...\n", config.keys, config.updates);
+    writeKeys(c, config.keys, 1, &rng, 0);
+    writeKeys(c, config.updates, 0, &rng, 0);
+    initPhase(&baseline, config.baseline_secs, 0);
+    runWorkload(&baseline, 1);
+    res->baseline_ops = phaseThroughput(&baseline);
+    zfree(baseline.intervals);
+    r = commandOrExit(c, "DBSIZE");
+    res->keys_before = r->integer;
+    freeReplyObject(r);
+    printf("  baseline: %.0f requests per second, %lld keys\n", res->baseline_ops, res->keys_before);
+
+    /* Crash. */
+    if (!mode->sequential_log) freeReplyObject(commandOrExit(c, "SAVE"));
+    if (config.crash_point == CRASH_AFTER_WORKLOAD) {
+        redisFree(c);
+        killServer(pid);
+        res->crashed = 1;
+    } else {
+        freeReplyObject(commandOrExit(c, "DEBUG CRASHAT %s 1",
+            crash_point_names[config.crash_point]));
+        if (config.crash_point == CRASH_INDEXER_BATCH)
+            writeKeys(c, config.tail_writes, 0, &rng, 1);
+        redisFree(c);
+        res->crashed = waitServer(pid, config.timeout_secs);
+        if (!res->crashed) {
+            fprintf(stderr, "  the crash point %s was not reached in %d seconds, killing the server\n",
+                crash_point_names[config.crash_point], config.timeout_secs);
+            killServer(pid);
+        }
+    }
+    printf("  %s, restarting...\n", res->crashed ? "crashed" : "killed (crash point not reached)");
+
+    /* Restart with the clients waiting. */
+    initPhase(&res->recovery, config.duration_secs, 1);
+    pid = startServer(rundir);
+    res->first_request_us = runWorkload(&res->recovery, 2);
+    res->restored_us = res->recovery.restored;
+    res->throughput90_us = -1;
+    for (j = 0; j < res->recovery.nintervals; j++) {
+        if (res->recovery.intervals[j].ops*1000.0/config.interval_ms >= res->baseline_ops*0.9) {
+            res->throughput90_us = (long long)(j+1)*config.interval_ms*1000;
+            break;
+        }
+    }
+
+    if ((c = connectServer(1000)) != NULL) {
+        redisAppendCommand(c, "SHUTDOWN NOSAVE");
+        if (redisGetReply(c, (void**)&r) == REDIS_OK) freeReplyObject(r);
+        redisFree(c);
+    }
+    if (!waitServer(pid, config.timeout_secs)) killServer(pid);
+}
+
+static void printTime(const char *label, long long us) {
+    if (us == -1)
+        printf("  %-24s not reached\n", label);
+    else
+        printf("  %-24s %.1f ms\n", label, (double)us/1000);
+}
+
+static void writeTimeline(FILE *fp, modeResult *res) {
+    phase *ph = &res->recovery;
+    int j;
+
+    for (j = 0; j < ph->nintervals; j++) {
+        intervalStats *is = ph->intervals+j;
+        long long t = (long long)(j+1)*config.interval_ms;
+
+        fprintf(fp, "%s,%lld,%.0f,%lld,%lld,%lld,%lld,%d\n", res->mode->name, t,
+            is->ops*1000.0/config.interval_ms, is->errors,
+            is->ops ? is->latency_sum/is->ops : 0,
+            intervalPercentile(is, 50), intervalPercentile(is, 99),
+            ph->restored != -1 && t*1000 >= ph->restored);
+    }
+}
+
+static recoveryMode *lookupMode(const char *name, size_t len) {
+    int j;
+
+    for (j = 0; recovery_modes[j].name; j++)
+        if (strlen(recovery_modes[j].name) == len && !strncmp(recovery_modes[j].name, name, len))
+            return recovery_modes+j;
+    return NULL;
+}
+
+static void usage(int exit_status) {
+    int j;
+
+    printf(
+"Usage: redis-recovery-benchmark [options]\n\n"
+"Crashes and restarts a redis-server in each recovery mode, and reports the\n"
+"time to the first request served, to 90%% of the baseline throughput and to\n"
+"the full restore, plus the throughput and latency timeline after the restart.\n\n"
+" --server <path>            redis-server executable (default ./redis-server)\n"
+" --dir <path>               Directory of the runs, overwritten (default /tmp/redis-recovery-benchmark)\n"
+" --port <port>              Port of the server (default 6390)\n"
+" --modes <m1,m2,...>        Recovery modes (default ir-btree,ir-hash,aof,rdb)\n"
+" --keys <n>                 Keys preloaded (default 100000)\n"
+" --updates <n>              Updates after the preload, following the distribution (default: keys)\n"
+" --value-size <bytes>       Size of the values, up to %d (default 32)\n"
+" --distribution <d>         Key distribution: uniform or zipf (default zipf)\n"
+" --zipf-theta <theta>       Skew of the zipf distribution, between 0 and 1 (default 0.99)\n"
+" --crash-at <point>         after-workload, indexer-batch or checkpoint (default after-workload)\n"
+" --tail-writes <n>          Writes that trigger the indexer-batch crash point (default 1000)\n"
+" --checkpoint-interval <s>  Checkpoint interval for the checkpoint crash point (default 5)\n"
+" --clients <n>              Parallel clients of the workload (default 4)\n"
+" --get-ratio <percent>      GET requests of the workload, the others are SET (default 90)\n"
+" --baseline <secs>          Workload before the crash, gives the baseline throughput (default 5)\n"
+" --duration <secs>          Workload after the restart (default 30)\n"
+" --interval <ms>            Interval of the timeline (default 100)\n"
+" --timeout <secs>           Startup, crash point and shutdown timeout (default 60)\n"
+" --seed <n>                 Seed of the keys requested (default 1)\n"
+" --csv <file>               Timeline CSV file (default <dir>/timeline.csv)\n"
+" --ir-settings <text>       Settings appended to the redis_ir.conf of every run\n\n"
+"Recovery modes:\n", MAX_VALUE_SIZE);
+    for (j = 0; recovery_modes[j].name; j++)
+        printf(" %-12s %s\n", recovery_modes[j].name, recovery_modes[j].description);
+    printf(
+"\nThe indexer-batch and checkpoint crash points use DEBUG CRASHAT and only\n"
+"apply to the instant recovery modes.\n\n"
+"Example:\n"
+"  $ redis-recovery-benchmark --keys 1000000 --crash-at indexer-batch --modes ir-btree,ir-hash,aof\n");
+    exit(exit_status);
+}
+
+static void parseOptions(int argc, char **argv) {
+    const char *server = "./redis-server";
+    int j;
+
+    for (j = 1; j < argc; j++) {
+        int lastarg = (j == argc-1);
+
+        if (!strcmp(argv[j], "--help")) {
+            usage(0);
+        } else if (lastarg) {
+            usage(1);
+        } else if (!strcmp(argv[j], "--server")) {
+            server = argv[++j];
+        } else if (!strcmp(argv[j], "--dir")) {
+            config.dir = argv[++j];
+        } else if (!strcmp(argv[j], "--port")) {
+            config.port = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--modes")) {
+            config.modes = argv[++j];
+        } else if (!strcmp(argv[j], "--keys")) {
+            config.keys = atoll(argv[++j]);
+        } else if (!strcmp(argv[j], "--updates")) {
+            config.updates = atoll(argv[++j]);
+        } else if (!strcmp(argv[j], "--value-size")) {
+            config.value_size = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--distribution")) {
+            j++;
+            if (!strcmp(argv[j], "uniform")) config.distribution = DIST_UNIFORM;
+            else if (!strcmp(argv[j], "zipf")) config.distribution = DIST_ZIPF;
+            else usage(1);
+        } else if (!strcmp(argv[j], "--zipf-theta")) {
+            config.zipf_theta = atof(argv[++j]);
+        } else if (!strcmp(argv[j], "--crash-at")) {
+            j++;
+            for (config.crash_point = CRASH_CHECKPOINT; config.crash_point >= 0; config.crash_point--)
+                if (!strcmp(argv[j], crash_point_names[config.crash_point])) break;
+            if (config.crash_point < 0) usage(1);
+        } else if (!strcmp(argv[j], "--tail-writes")) {
+            config.tail_writes = atoll(argv[++j]);
+        } else if (!strcmp(argv[j], "--checkpoint-interval")) {
+            config.checkpoint_interval = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--clients")) {
+            config.clients = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--get-ratio")) {
+            config.get_ratio = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--baseline")) {
+            config.baseline_secs = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--duration")) {
+            config.duration_secs = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--interval")) {
+            config.interval_ms = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--timeout")) {
+            config.timeout_secs = atoi(argv[++j]);
+        } else if (!strcmp(argv[j], "--seed")) {
+            config.seed = strtoull(argv[++j], NULL, 10);
+        } else if (!strcmp(argv[j], "--csv")) {
+            config.csv = argv[++j];
+        } else if (!strcmp(argv[j], "--ir-settings")) {
+            config.ir_settings = argv[++j];
+        } else {
+            usage(1);
+        }
+    }
+
+    if (config.keys < 2 || config.updates < -1 || config.tail_writes < 1 ||
+        config.value_size < 1 || config.value_size > MAX_VALUE_SIZE ||
+        config.zipf_theta <= 0 || config.zipf_theta >= 1 ||
+        config.checkpoint_interval < 1 || config.clients < 1 ||
+        config.get_ratio < 0 || config.get_ratio > 100 || config.baseline_secs < 1 ||
+        config.duration_secs < 1 || config.interval_ms < 1 || config.timeout_secs < 1)
+    {
+        fatal("invalid option value, see --help");
+    }
+    if (config.updates == -1) config.updates = config.keys;
+    if (realpath(server, config.server_path) == NULL)
+        fatal("can't find the server %s: %s", server, strerror(errno));
+    memset(config.value, 'x', config.value_size);
+    config.value[config.value_size] = '\0';
+}
+
+int main(int argc, char **argv) {
+    modeResult *results;
+    recoveryMode *mode;
+    char path[PATH_MAX];
+    const char *p;
+    int nmodes = 0, j;
+    FILE *fp;
+
+    config.dir = "/tmp/redis-recovery-benchmark";
+    config.modes = "ir-btree,ir-hash,aof,rdb";
+    config.csv = NULL;
+    config.ir_settings = NULL;
+    config.port = 6390;
+    config.keys = 100000;
+    config.updates = -1;
+    config.tail_writes = 1000;
+    config.value_size = 32;
+    config.distribution = DIST_ZIPF;
+    config.zipf_theta = 0.99;
+    config.crash_point = CRASH_AFTER_WORKLOAD;
+    config.checkpoint_interval = 5;
+    config.clients = 4;
+    config.get_ratio = 90;
+    config.baseline_secs = 5;
+    config.duration_secs = 30;
+    config.interval_ms = 100;
+    config.timeout_secs = 60;
+    config.seed = 1;
+    parseOptions(argc, argv);
+    signal(SIGPIPE, SIG_IGN);
+    if (config.distribution == DIST_ZIPF) initZipf();
+
+    for (p = config.modes; *p; p++)
+        if (*p == ',') nmodes++;
+    results = zcalloc(sizeof(modeResult)*(nmodes+1));
+    nmodes = 0;
+    for (p = config.modes; *p; ) {
+        size_t len = strcspn(p, ",");
+
+        if ((mode = lookupMode(p, len)) == NULL)
+            fatal("unknown recovery mode '%.*s', see --help", (int)len, p);
+        if (config.crash_point != CRASH_AFTER_WORKLOAD && !mode->instant_recovery)
+            fatal("the crash point %s requires an instant recovery mode, not '%s'",
+                crash_point_names[config.crash_point], mode->name);
+        results[nmodes++].mode = mode;
+        p += len;
+        if (*p == ',') p++;
+    }
+
+    for (j = 0; j < nmodes; j++) {
+        runMode(results[j].mode, results+j);
+        printTime("time to first request:", results[j].first_request_us);
+        printTime("time to 90% throughput:", results[j].throughput90_us);
+        printTime("time to full restore:", results[j].restored_us);
+    }
+
+    if (config.csv == NULL) {
+        snprintf(path, sizeof(path), "%s/timeline.csv", config.dir);
+        config.csv = path;
+    }
+    if ((fp = fopen(config.csv, "w")) == NULL)
+        fatal("can't write %s: %s", config.csv, strerror(errno));
+    fprintf(fp, "mode,time_ms,requests_per_sec,errors,avg_latency_us,p50_latency_us,p99_latency_us,restored\n");
+    for (j = 0; j < nmodes; j++) writeTimeline(fp, results+j);
+    fclose(fp);
+
+    printf("\n====== Summary (%s, %lld keys, %s keys, crash at %s) ======\n",
+        config.modes, config.keys, config.distribution == DIST_ZIPF ? "zipf" : "uniform",
+        crash_point_names[config.crash_point]);
+    printf("%-12s %8s %12s %14s %14s %14s\n", "mode", "crashed", "baseline/s",
+        "first req ms", "90% thr ms", "restore ms");
+    for (j = 0; j < nmodes; j++) {
+        modeResult *res = results+j;
+
+        printf("%-12s %8s %12.0f %14.1f %14.1f %14.1f\n", res->mode->name,
+            res->crashed ? "yes" : "no", res->baseline_ops,
+            res->first_request_us == -1 ? -1 : (double)res->first_request_us/1000,
+            res->throughput90_us == -1 ? -1 : (double)res->throughput90_us/1000,
+            res->restored_us == -1 ? -1 : (double)res->restored_us/1000);
+        zfree(res->recovery.intervals);
+    }
+    printf("\nTimeline written to %s\n", config.csv);
+    zfree(results);
+    return 0;
+}
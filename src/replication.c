@@ -563,12 +563,17 @@ need_full_resync:
  * Returns C_OK on success or C_ERR otherwise. */
 int startBgsaveForReplication(int mincapa) {
     int retval;
-    int socket_target = server.repl_diskless_sync && (mincapa & SLAVE_CAPA_EOF);
+    /* With instant recovery, the RDB can be written from the indexed log
+     * by a thread instead of a forked child. It always targets the disk. */
+    int indexedlog_target = isIndexedLogSnapshotEnabled();
+    int socket_target = !indexedlog_target &&
+        server.repl_diskless_sync && (mincapa & SLAVE_CAPA_EOF);
     listIter li;
     listNode *ln;
 
     serverLog(LL_NOTICE,"Starting BGSAVE for SYNC with target: %s",
-        socket_target ? "replicas sockets" : "disk");
+        socket_target ? "replicas sockets" :
+        (indexedlog_target ? "disk (indexed log snapshot)" : "disk"));
 
     rdbSaveInfo rsi, *rsiptr;
     rsiptr = rdbPopulateSaveInfo(&rsi);
@@ -577,6 +582,8 @@ int startBgsaveForReplication(int mincapa) {
     if (rsiptr) {
         if (socket_target)
             retval = rdbSaveToSlavesSockets(rsiptr);
+        else if (indexedlog_target)
+            retval = startIndexedLogSnapshot(rsiptr);
         else
             retval = rdbSaveBackground(server.rdb_filename,rsiptr);
     } else {
@@ -700,9 +707,11 @@ void syncCommand(client *c) {
         createReplicationBacklog();
     }
 
-    /* CASE 1: BGSAVE is in progress, with disk target. */
-    if (server.rdb_child_pid != -1 &&
-        server.rdb_child_type == RDB_CHILD_TYPE_DISK)
+    /* CASE 1: BGSAVE is in progress, with disk target (or a snapshot of
+     * the indexed log is being written, see startIndexedLogSnapshot()). */
+    if ((server.rdb_child_pid != -1 &&
+         server.rdb_child_type == RDB_CHILD_TYPE_DISK) ||
+        isIndexedLogSnapshotInProgress())
     {
         /* Ok a background save is in progress. Let's check if it is a good
          * one for replication, i.e. if there is another slave that is
@@ -944,6 +953,13 @@ void sendBulkToSlave(aeEventLoop *el, int fd, void *privdata, int mask) {
  * The 'type' argument is the type of the child that terminated
  * (if it had a disk or socket target). */
 void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
+    updateSlavesWaitingBgsaveFromFile(bgsaveerr,type,server.rdb_filename);
+}
+
+/* Like updateSlavesWaitingBgsave() but with disk target the slaves are
+ * served from 'filename', that is the snapshot of the indexed log when the
+ * full resynchronization did not use a BGSAVE. */
+void updateSlavesWaitingBgsaveFromFile(int bgsaveerr, int type, char *filename) {
     listNode *ln;
     int startbgsave = 0;
     int mincapa = -1;
@@ -1003,7 +1019,7 @@ void updateSlavesWaitingBgsave(int bgsaveerr, int type) {
                     serverLog(LL_WARNING,"SYNC failed. BGSAVE child returned an error");
                     continue;
                 }
-                if ((slave->repldbfd = open(server.rdb_filename,O_RDONLY)) == -1 ||
+                if ((slave->repldbfd = open(filename,O_RDONLY)) == -1 ||
                     redis_fstat(slave->repldbfd,&buf) == -1) {
                     freeClient(slave);
                     serverLog(LL_WARNING,"SYNC failed. Can't open/stat DB after BGSAVE: %s", strerror(errno));
@@ -2741,7 +2757,9 @@ void replicationCron(void) {
      * In case of diskless replication, we make sure to wait the specified
      * number of seconds (according to configuration) so that other slaves
      * have the time to arrive before we start streaming. */
-    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1) {
+    if (server.rdb_child_pid == -1 && server.aof_child_pid == -1 &&
+        !isIndexedLogSnapshotInProgress())
+    {
         time_t idle, max_idle = 0;
         int slaves_waiting = 0;
         int mincapa = -1;
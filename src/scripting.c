@@ -441,6 +441,7 @@ int luaRedisGenericCommand(lua_State *lua, int raise_error) {
 
     /* Setup our fake client for command execution */
     c->argv = argv;
+    c->argv_len = argc;
     c->argc = argc;
 
     /* Process module hooks */
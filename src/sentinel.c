@@ -477,6 +477,7 @@ void initSentinel(void) {
         retval = dictAdd(server.commands, sdsnew(cmd->name), cmd);
         serverAssert(retval == DICT_OK);
     }
+    buildCommandLookupTable();
 
     /* Initialize various data structures. */
     sentinel.current_epoch = 0;
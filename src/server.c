@@ -124,6 +124,11 @@ volatile unsigned long lru_clock; /* Server global current LRU time. */
  *    its execution as long as the kernel scheduler is giving us time.
  *    Note that commands that may trigger a DEL as a side effect (like SET)
  *    are not fast commands.
+ * O: Instant recovery restores the key of the command on demand from the
+ *    indexed log before executing it, and logs the accesses to the key.
+ * i: Instant recovery restore command: it is never propagated nor logged.
+ * I: Instant recovery indexes the command when it reads it from the
+ *    sequential log (see isIndexedLogCommand()).
  */
 struct redisCommand redisCommandTable[] = {
 
@@ -133,10 +138,11 @@ struct redisCommand redisCommandTable[] = {
 // Commands executed functions for command line in redis-cli 
 // ==================================================================================
     {"printIndex",printIndex,0,"a",0,NULL,0,0,0,0,0},
-    {"setIR",setIRCommand,-3,"wm",0,NULL,1,1,1,0,0},
-    {"setCheckpoint",setCheckpointCommand,3,"wm",0,NULL,1,1,1,0,0},
-    {"checkpointEnd",checkpointEndCommand,3,"wm",0,NULL,1,1,1,0,0},
+    {"setIR",setIRCommand,-3,"wmi",0,NULL,1,1,1,0,0},
+    {"setCheckpoint",setCheckpointCommand,3,"wmI",0,NULL,1,1,1,0,0},
+    {"checkpointEnd",checkpointEndCommand,3,"wmI",0,NULL,1,1,1,0,0},
     {"benchmarkEnd",benchmarkEndCommand,3,"wm",0,NULL,1,1,1,0,0},
+    {"recovery",recoveryCommand,-2,"aslt",0,NULL,0,0,0,0,0},
 
 // ==================================================================================
 //     End
@@ -144,14 +150,14 @@ struct redisCommand redisCommandTable[] = {
 
 
     {"module",moduleCommand,-2,"as",0,NULL,0,0,0,0,0},
-    {"get",getCommand,2,"rF",0,NULL,1,1,1,0,0},
-    {"set",setCommand,-3,"wm",0,NULL,1,1,1,0,0},
+    {"get",getCommand,2,"rFO",0,NULL,1,1,1,0,0},
+    {"set",setCommand,-3,"wmOI",0,NULL,1,1,1,0,0},
     {"setnx",setnxCommand,3,"wmF",0,NULL,1,1,1,0,0},
-    {"setex",setexCommand,4,"wm",0,NULL,1,1,1,0,0},
-    {"psetex",psetexCommand,4,"wm",0,NULL,1,1,1,0,0},
+    {"setex",setexCommand,4,"wmI",0,NULL,1,1,1,0,0},
+    {"psetex",psetexCommand,4,"wmI",0,NULL,1,1,1,0,0},
     {"append",appendCommand,3,"wm",0,NULL,1,1,1,0,0},
     {"strlen",strlenCommand,2,"rF",0,NULL,1,1,1,0,0},
-    {"del",delCommand,-2,"w",0,NULL,1,-1,1,0,0},
+    {"del",delCommand,-2,"wI",0,NULL,1,-1,1,0,0},
     {"unlink",unlinkCommand,-2,"wF",0,NULL,1,-1,1,0,0},
     {"exists",existsCommand,-2,"rF",0,NULL,1,-1,1,0,0},
     {"setbit",setbitCommand,4,"wm",0,NULL,1,1,1,0,0},
@@ -160,7 +166,7 @@ struct redisCommand redisCommandTable[] = {
     {"setrange",setrangeCommand,4,"wm",0,NULL,1,1,1,0,0},
     {"getrange",getrangeCommand,4,"r",0,NULL,1,1,1,0,0},
     {"substr",getrangeCommand,4,"r",0,NULL,1,1,1,0,0},
-    {"incr",incrCommand,2,"wmF",0,NULL,1,1,1,0,0},
+    {"incr",incrCommand,2,"wmFOI",0,NULL,1,1,1,0,0},
     {"decr",decrCommand,2,"wmF",0,NULL,1,1,1,0,0},
     {"mget",mgetCommand,-2,"rF",0,NULL,1,-1,1,0,0},
     {"rpush",rpushCommand,-3,"wmF",0,NULL,1,1,1,0,0},
@@ -242,15 +248,15 @@ struct redisCommand redisCommandTable[] = {
     {"mset",msetCommand,-3,"wm",0,NULL,1,-1,2,0,0},
     {"msetnx",msetnxCommand,-3,"wm",0,NULL,1,-1,2,0,0},
     {"randomkey",randomkeyCommand,1,"rR",0,NULL,0,0,0,0,0},
-    {"select",selectCommand,2,"lF",0,NULL,0,0,0,0,0},
+    {"select",selectCommand,2,"lFI",0,NULL,0,0,0,0,0},
     {"swapdb",swapdbCommand,3,"wF",0,NULL,0,0,0,0,0},
     {"move",moveCommand,3,"wF",0,NULL,1,1,1,0,0},
     {"rename",renameCommand,3,"w",0,NULL,1,2,1,0,0},
     {"renamenx",renamenxCommand,3,"wF",0,NULL,1,2,1,0,0},
-    {"expire",expireCommand,3,"wF",0,NULL,1,1,1,0,0},
-    {"expireat",expireatCommand,3,"wF",0,NULL,1,1,1,0,0},
-    {"pexpire",pexpireCommand,3,"wF",0,NULL,1,1,1,0,0},
-    {"pexpireat",pexpireatCommand,3,"wF",0,NULL,1,1,1,0,0},
+    {"expire",expireCommand,3,"wFI",0,NULL,1,1,1,0,0},
+    {"expireat",expireatCommand,3,"wFI",0,NULL,1,1,1,0,0},
+    {"pexpire",pexpireCommand,3,"wFI",0,NULL,1,1,1,0,0},
+    {"pexpireat",pexpireatCommand,3,"wFI",0,NULL,1,1,1,0,0},
     {"keys",keysCommand,2,"rS",0,NULL,0,0,0,0,0},
     {"scan",scanCommand,-2,"rR",0,NULL,0,0,0,0,0},
     {"dbsize",dbsizeCommand,1,"rF",0,NULL,0,0,0,0,0},
@@ -263,8 +269,8 @@ struct redisCommand redisCommandTable[] = {
     {"shutdown",shutdownCommand,-1,"aslt",0,NULL,0,0,0,0,0},
     {"lastsave",lastsaveCommand,1,"RF",0,NULL,0,0,0,0,0},
     {"type",typeCommand,2,"rF",0,NULL,1,1,1,0,0},
-    {"multi",multiCommand,1,"sF",0,NULL,0,0,0,0,0},
-    {"exec",execCommand,1,"sM",0,NULL,0,0,0,0,0},
+    {"multi",multiCommand,1,"sFI",0,NULL,0,0,0,0,0},
+    {"exec",execCommand,1,"sMI",0,NULL,0,0,0,0,0},
     {"discard",discardCommand,1,"sF",0,NULL,0,0,0,0,0},
     {"sync",syncCommand,1,"ars",0,NULL,0,0,0,0,0},
     {"psync",syncCommand,3,"ars",0,NULL,0,0,0,0,0},
@@ -277,7 +283,7 @@ struct redisCommand redisCommandTable[] = {
     {"ttl",ttlCommand,2,"rFR",0,NULL,1,1,1,0,0},
     {"touch",touchCommand,-2,"rF",0,NULL,1,1,1,0,0},
     {"pttl",pttlCommand,2,"rFR",0,NULL,1,1,1,0,0},
-    {"persist",persistCommand,2,"wF",0,NULL,1,1,1,0,0},
+    {"persist",persistCommand,2,"wFI",0,NULL,1,1,1,0,0},
     {"slaveof",replicaofCommand,3,"ast",0,NULL,0,0,0,0,0},
     {"replicaof",replicaofCommand,3,"ast",0,NULL,0,0,0,0,0},
     {"role",roleCommand,1,"lst",0,NULL,0,0,0,0,0},
@@ -1253,6 +1259,12 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
         rewriteAppendOnlyFileBackground();
     }
 
+    /* Check if a snapshot of the indexed log for replication terminated. */
+    checkIndexedLogSnapshotDone();
+
+    /* Check if an AOF rewrite from the indexed log terminated. */
+    checkIndexedLogAofRewriteDone();
+
     /* Check if a background saving or AOF rewrite in progress terminated. */
     if (server.rdb_child_pid != -1 || server.aof_child_pid != -1 ||
         ldbPendingChildren())
@@ -1347,6 +1359,9 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
     /* Close clients that need to be closed asynchronous */
     freeClientsInAsyncFreeQueue();
 
+    /* Stop the I/O threads if we don't have enough pending work. */
+    stopThreadedIOIfNeeded();
+
     /* Clear the paused clients flag if needed. */
     clientsArePaused(); /* Don't check return value, just use the side effect.*/
 
@@ -1395,6 +1410,10 @@ int serverCron(struct aeEventLoop *eventLoop, long long id, void *clientData) {
 void beforeSleep(struct aeEventLoop *eventLoop) {
     UNUSED(eventLoop);
 
+    /* Handle the clients whose reads were postponed to the I/O threads:
+     * their commands are executed here, by the main thread. */
+    handleClientsWithPendingReadsUsingThreads();
+
     /* Call the Redis Cluster before sleep function. Note that this function
      * may change the state of Redis Cluster (from ok to fail or vice versa),
      * so it's a good idea to call it before serving the unblocked clients
@@ -1437,8 +1456,16 @@ void beforeSleep(struct aeEventLoop *eventLoop) {
     /* Write the AOF buffer on disk */
     flushAppendOnlyFile(0);
 
+    /* With the AOF writer thread, hold the replies of the clients whose
+     * writes are not durable yet, and release the ones now durable. */
+    handleClientsWaitingAof();
+
     /* Handle writes with pending output buffers. */
-    handleClientsWithPendingWrites();
+    handleClientsWithPendingWritesUsingThreads();
+
+    /* The I/O threads can only schedule clients for closing, close them
+     * before sleeping instead of waiting for serverCron(). */
+    if (server.io_threads_num > 1) freeClientsInAsyncFreeQueue();
 
     /* Before we are going to sleep, let the threads access the dataset by
      * releasing the GIL. Redis main thread will not touch anything at this
@@ -1557,6 +1584,8 @@ void initServerConfig(void) {
     pthread_mutex_init(&server.next_client_id_mutex,NULL);
     pthread_mutex_init(&server.lruclock_mutex,NULL);
     pthread_mutex_init(&server.unixtime_mutex,NULL);
+    pthread_mutex_init(&server.lock_indexing,NULL);
+    pthread_mutex_init(&server.lock_seek_log,NULL);
 
     updateCachedTime(1);
     getRandomHexChars(server.runid,CONFIG_RUN_ID_SIZE);
@@ -1569,15 +1598,28 @@ void initServerConfig(void) {
 //                         INSTANT RECOVERY TECHINIQUE
 // Fields set to instant recovery techinique
 // ==================================================================================
-    server.IR_env = NULL;
+#ifdef USE_BERKELEYDB
+    server.indexedlog_engine = &indexedLogTypeBerkeleyDB;
+#else
+    server.indexedlog_engine = &indexedLogTypeHashLog;
+#endif
     strcpy(server.indexedlog_structure, "BTREE");
     server.indexedlog_filename = "logs/IndexedLog.db";
+    server.indexedlog_partitions = 1;
     server.indexedlog_replicated = IR_ON;
     strcpy(server.starts_log_indexing, "A");
     server.instant_recovery_state = IR_ON;
     server.indexer_time_interval = 500000;
     server.instant_recovery_performing = IR_OFF; //disabled
     server.instant_recovery_performing_stop = IR_OFF; //disabled
+    server.instant_recovery_paused = IR_OFF;
+    server.tiering_evicted_keys = NULL;
+    server.stat_tiering_evictions = 0;
+    server.stat_tiering_restores = 0;
+    server.restore_throttle = 0;
+    server.restore_rate = 0;
+    server.count_tuples_to_restore = -1;
+    server.estimate_recovery_eta = IR_ON;
     server.instant_recovery_synchronous = IR_OFF; //disabled
     server.recovery_start_time = -1;
     server.recovery_end_time = -1;
@@ -1590,6 +1632,9 @@ void initServerConfig(void) {
     server.initial_indexed_records = 0;
     server.count_initial_records_proc = 0;
     server.seek_log_file = 0;
+    server.seek_log_db = 0;
+    server.count_log_records_written = 0;
+    server.count_log_records_indexed = 0;
     server.display_indexer_information = IR_OFF; //disabled
     server.indexer_information_time_interaval = 60;
     server.redisHostname = "127.0.0.1";
@@ -1613,6 +1658,7 @@ void initServerConfig(void) {
     server.count_tuples_loaded_ondemand = 0;
     server.count_tuples_already_loaded = 0;
     server.count_tuples_not_in_log = 0;
+    server.count_tuples_expired = 0;
     server.count_remaining_records_proc = 0;
     server.recovery_report_filename = "recovery_report.txt";
     server.generate_report_file_after_benchmarking = IR_ON;
@@ -1648,6 +1694,7 @@ void initServerConfig(void) {
     server.stop_system_monitoring_end_benckmark = IR_OFF;                        
     server.system_monitoring_csv_filename = "system_monitoring/system_monitoring.csv";
     server.system_monitoring_time_interval = 10;    
+    server.system_monitoring_time_interval_ms = 10000;
     server.overwrite_system_monitoring  = IR_ON;     
 
     first_cmd_executed_List = NULL;
@@ -1662,6 +1709,8 @@ void initServerConfig(void) {
     server.executable = NULL;
     server.hz = server.config_hz = CONFIG_DEFAULT_HZ;
     server.dynamic_hz = CONFIG_DEFAULT_DYNAMIC_HZ;
+    server.io_threads_num = CONFIG_DEFAULT_IO_THREADS_NUM;
+    server.io_threads_do_reads = CONFIG_DEFAULT_IO_THREADS_DO_READS;
     server.arch_bits = (sizeof(long) == 8) ? 64 : 32;
     server.port = CONFIG_DEFAULT_SERVER_PORT;
     server.tcp_backlog = CONFIG_DEFAULT_TCP_BACKLOG;
@@ -1713,12 +1762,14 @@ void initServerConfig(void) {
     server.rdb_save_incremental_fsync = CONFIG_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC;
     server.aof_load_truncated = CONFIG_DEFAULT_AOF_LOAD_TRUNCATED;
     server.aof_use_rdb_preamble = CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE;
+    server.aof_writer_thread = CONFIG_DEFAULT_AOF_WRITER_THREAD;
     server.pidfile = NULL;
     server.rdb_filename = zstrdup(CONFIG_DEFAULT_RDB_FILENAME);
     server.aof_filename = zstrdup(CONFIG_DEFAULT_AOF_FILENAME);
     server.requirepass = NULL;
     server.rdb_compression = CONFIG_DEFAULT_RDB_COMPRESSION;
     server.rdb_checksum = CONFIG_DEFAULT_RDB_CHECKSUM;
+    server.rdb_load_threads = CONFIG_DEFAULT_RDB_LOAD_THREADS;
     server.stop_writes_on_bgsave_err = CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR;
     server.activerehashing = CONFIG_DEFAULT_ACTIVE_REHASHING;
     server.active_defrag_running = 0;
@@ -2150,7 +2201,10 @@ void resetServerStats(void) {
     }
     server.stat_net_input_bytes = 0;
     server.stat_net_output_bytes = 0;
+    server.stat_io_reads_processed = 0;
+    server.stat_io_writes_processed = 0;
     server.aof_delayed_fsync = 0;
+    server.stat_aof_group_commits = 0;
 }
 
 void initServer(void) {
@@ -2175,6 +2229,10 @@ void initServer(void) {
     server.slaves = listCreate();
     server.monitors = listCreate();
     server.clients_pending_write = listCreate();
+    server.clients_pending_read = listCreate();
+    server.clients_waiting_aof = listCreate();
+    server.aof_appended_lsn = 0;
+    server.aof_durable_lsn = 0;
     server.slaveseldb = -1; /* Force to emit the first SELECT command. */
     server.unblocked_clients = listCreate();
     server.ready_keys = listCreate();
@@ -2330,6 +2388,8 @@ void initServer(void) {
  * see: https://sourceware.org/bugzilla/show_bug.cgi?id=19329 */
 void InitServerLast() {
     bioInit();
+    initThreadedIO();
+    initAofWriter();
     server.initial_memory_usage = zmalloc_used_memory();
 }
 
@@ -2359,6 +2419,9 @@ void populateCommandTable(void) {
             case 'M': c->flags |= CMD_SKIP_MONITOR; break;
             case 'k': c->flags |= CMD_ASKING; break;
             case 'F': c->flags |= CMD_FAST; break;
+            case 'O': c->flags |= CMD_IR_ON_DEMAND; break;
+            case 'i': c->flags |= CMD_IR_RESTORE; break;
+            case 'I': c->flags |= CMD_IR_INDEXED; break;
             default: serverPanic("Unsupported command flag"); break;
             }
             f++;
@@ -2370,6 +2433,7 @@ void populateCommandTable(void) {
         retval2 = dictAdd(server.orig_commands, sdsnew(c->name), c);
         serverAssert(retval1 == DICT_OK && retval2 == DICT_OK);
     }
+    buildCommandLookupTable();
 }
 
 void resetCommandTableStats(void) {
@@ -2426,17 +2490,170 @@ void redisOpArrayFree(redisOpArray *oa) {
 
 /* ====================== Commands lookup and execution ===================== */
 
+/* Commands are looked up in a perfect hash table built over server.commands
+ * (so it follows rename-command and module commands), instead of hashing
+ * the name through the dictionary at every call. The table is built with
+ * the "hash and displace" method: names are first hashed into buckets, and
+ * every bucket gets a seed that maps all its names to free slots of the
+ * table. A lookup is then just two hashes of the name and a single compare.
+ *
+ * The table must be rebuilt with buildCommandLookupTable() every time
+ * server.commands is modified. */
+#define COMMAND_LOOKUP_MAX_SEED (1<<20)
+
+typedef struct commandLookupTable {
+    unsigned long size_mask;        /* Slots - 1, the slots are a power of 2 */
+    unsigned long buckets_mask;     /* Buckets - 1, a power of 2 as well */
+    uint32_t *seeds;                /* Seed of every bucket, 0 if empty. */
+    sds *names;                     /* Names (dict keys) of the slots. */
+    struct redisCommand **commands; /* Commands of the slots. */
+} commandLookupTable;
+
+static commandLookupTable *commandLookup = NULL;
+
+/* Case insensitive FNV-1a hash of the command name, seeded and finalized
+ * with the mixer of MurmurHash3 so that every seed gives a different
+ * placement. Setting the 0x20 bit is enough to ignore the case: it only
+ * affects letters among the characters having a case. */
+static uint32_t commandNameHash(const char *name, size_t len, uint32_t seed) {
+    uint32_t h = 2166136261U ^ seed;
+
+    while(len--) {
+        h ^= (unsigned char)(*name++ | 0x20);
+        h *= 16777619U;
+    }
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+}
+
+static void freeCommandLookupTable(commandLookupTable *t) {
+    if (t == NULL) return;
+    zfree(t->seeds);
+    zfree(t->names);
+    zfree(t->commands);
+    zfree(t);
+}
+
+/* Build a new perfect hash table over server.commands. If no seed is found
+ * for some bucket (very unlikely with tables half empty), the lookups keep
+ * using the dictionary. */
+void buildCommandLookupTable(void) {
+    unsigned long numcommands = dictSize(server.commands);
+    unsigned long size = 16, buckets, j, k;
+    dictIterator *di;
+    dictEntry *de;
+
+    while (size < numcommands*2) size <<= 1;
+    buckets = size/4;
+
+    commandLookupTable *t = zmalloc(sizeof(*t));
+    t->size_mask = size-1;
+    t->buckets_mask = buckets-1;
+    t->seeds = zcalloc(sizeof(uint32_t)*buckets);
+    t->names = zcalloc(sizeof(sds)*size);
+    t->commands = zcalloc(sizeof(struct redisCommand*)*size);
+
+    /* Group the names by bucket, with the buckets sorted by size: the
+     * biggest buckets are placed first, while most slots are still free. */
+    sds *names = zmalloc(sizeof(sds)*(numcommands+1));
+    unsigned long *name_bucket = zmalloc(sizeof(unsigned long)*(numcommands+1));
+    unsigned long *bucket_len = zcalloc(sizeof(unsigned long)*buckets);
+    unsigned long *slots = zmalloc(sizeof(unsigned long)*(numcommands+1));
+    unsigned long count = 0;
+
+    di = dictGetIterator(server.commands);
+    while((de = dictNext(di)) != NULL) {
+        sds name = dictGetKey(de);
+        names[count] = name;
+        name_bucket[count] = commandNameHash(name,sdslen(name),0) &
+                             t->buckets_mask;
+        bucket_len[name_bucket[count]]++;
+        count++;
+    }
+    dictReleaseIterator(di);
+
+    int failed = 0;
+    for (unsigned long len = count; len > 0 && !failed; len--) {
+        for (unsigned long b = 0; b < buckets && !failed; b++) {
+            if (bucket_len[b] != len) continue;
+
+            uint32_t seed;
+            for (seed = 1; seed < COMMAND_LOOKUP_MAX_SEED; seed++) {
+                unsigned long placed = 0;
+                for (j = 0; j < count; j++) {
+                    if (name_bucket[j] != b) continue;
+                    unsigned long slot =
+                        commandNameHash(names[j],sdslen(names[j]),seed) &
+                        t->size_mask;
+                    if (t->names[slot] != NULL) break;
+                    for (k = 0; k < placed; k++)
+                        if (slots[k] == slot) break;
+                    if (k != placed) break;
+                    slots[placed++] = slot;
+                }
+                if (placed == len) break;
+            }
+            if (seed == COMMAND_LOOKUP_MAX_SEED) {
+                failed = 1;
+                break;
+            }
+
+            /* Fill the slots found for the names of the bucket. */
+            t->seeds[b] = seed;
+            for (j = 0, k = 0; j < count; j++) {
+                if (name_bucket[j] != b) continue;
+                t->names[slots[k]] = names[j];
+                t->commands[slots[k]] = dictFetchValue(server.commands,names[j]);
+                k++;
+            }
+        }
+    }
+    zfree(names);
+    zfree(name_bucket);
+    zfree(bucket_len);
+    zfree(slots);
+
+    if (failed) {
+        serverLog(LL_WARNING,"Unable to build the perfect hash table of the "
+                             "commands, using the commands dictionary.");
+        freeCommandLookupTable(t);
+        t = NULL;
+    }
+    freeCommandLookupTable(commandLookup);
+    commandLookup = t;
+}
+
+static struct redisCommand *lookupCommandByName(const char *name, size_t len) {
+    commandLookupTable *t = commandLookup;
+
+    if (t == NULL) {
+        sds s = sdsnewlen(name,len);
+        struct redisCommand *cmd = dictFetchValue(server.commands, s);
+        sdsfree(s);
+        return cmd;
+    }
+
+    uint32_t seed = t->seeds[commandNameHash(name,len,0) & t->buckets_mask];
+    if (seed == 0) return NULL;
+
+    unsigned long slot = commandNameHash(name,len,seed) & t->size_mask;
+    sds candidate = t->names[slot];
+    if (candidate == NULL || sdslen(candidate) != len ||
+        strncasecmp(candidate,name,len) != 0) return NULL;
+    return t->commands[slot];
+}
+
 struct redisCommand *lookupCommand(sds name) {
-    return dictFetchValue(server.commands, name);
+    if (commandLookup == NULL) return dictFetchValue(server.commands, name);
+    return lookupCommandByName(name,sdslen(name));
 }
 
 struct redisCommand *lookupCommandByCString(char *s) {
-    struct redisCommand *cmd;
-    sds name = sdsnew(s);
-
-    cmd = dictFetchValue(server.commands, name);
-    sdsfree(name);
-    return cmd;
+    return lookupCommandByName(s,strlen(s));
 }
 
 /* Lookup the command in the current table, if not found also check in
@@ -2471,7 +2688,7 @@ void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc,
 //                         INSTANT RECOVERY TECHINIQUE
 // If it is a setIR command, none record must be logged since this command is only to restore the DB. 
 // ==================================================================================
-    if(strcmp(cmd->name, "setIR") == 0)
+    if(cmd->flags & CMD_IR_RESTORE)
         return;
 // ==================================================================================
 //     End
@@ -2611,21 +2828,32 @@ void call(client *c, int flags) {
 // Restores a key/value on demand if the database is recovering when a command is executed
 // ==================================================================================
     int restored = 0;//
+    //Restores at once all the keys of a transaction or script, whose commands are executed
+    //by nested calls while the server is locked
+    if(c->cmd->proc == execCommand || c->cmd->proc == evalCommand ||
+       c->cmd->proc == evalShaCommand || c->cmd->proc == watchCommand ||
+       c->cmd->proc == migrateCommand)
+        restoreKeysBeforeExecution(c);
+    //Restores the keys evicted to the indexed log (maxmemory-policy allkeys-indexedlog)
+    restoreEvictedKeys(c);
+    //Loads on demand the keys of the command while the RDB is loading (indexed_rdb)
+    if(server.loading && server.rdb_key_directory != NULL)
+        rdbLoadKeysFromDirectory(c);
     if(server.instant_recovery_state == IR_ON && server.instant_recovery_performing == IR_ON){
-        if(strcmp(c->cmd->name, "setIR") != 0){ //Does not apply the IR on-demand if it is a SetIR command.
-            if( (strcasecmp(c->cmd->name, "set") == 0) || 
-                (strcasecmp(c->cmd->name, "get") == 0)  || 
-                (strcasecmp(c->cmd->name, "incr") == 0)) { //Applies the IR on-demand only for SET, GET, and INCR commands.
-                    char* key_requested = (char*)c->argv[1]->ptr;
-                    if( !isRestoredTuple(key_requested) ){
-                        loadRecordFromIndexedLog(key_requested);
-                        restored = 1;
-                    }
-                    else{ //Counts the requests to keys that was already restored into memory during recovery.
-                        server.count_tuples_already_loaded++;
-                        restored = 0;
-                    }
+        //Applies the IR on-demand only for the commands flagged with "O" (SET, GET, and INCR),
+        //that never include the SetIR command.
+        if(c->cmd->flags & CMD_IR_ON_DEMAND){
+            //The keys of the indexed log are qualified by the database
+            sds key_requested = getIndexedLogKey(c->db->id, (char*)c->argv[1]->ptr);
+            if( !isRestoredTuple(key_requested) ){
+                loadRecordFromIndexedLog(key_requested);
+                restored = 1;
+            }
+            else{ //Counts the requests to keys that was already restored into memory during recovery.
+                atomicIncr(server.count_tuples_already_loaded, 1);
+                restored = 0;
             }
+            sdsfree(key_requested);
         }
     }
     latency = ustime() - start;
@@ -2640,27 +2868,32 @@ void call(client *c, int flags) {
     dirty = server.dirty-dirty;
     if (dirty < 0) dirty = 0;
 
+    /* With the AOF writer thread the writes of the other clients may not be
+     * in the AOF yet: the reply of any command, reads included, waits for
+     * them, so that no client observes a write that could be lost. The
+     * writes of this command are accounted by feedAppendOnlyFile(). */
+    if (server.aof_writer_thread && c->aof_lsn < server.aof_appended_lsn)
+        c->aof_lsn = server.aof_appended_lsn;
 
 // ==================================================================================
 //                         INSTANT RECOVERY TECHINIQUE
 // Access Logger component, and executed commands to gerenrate CSV file.
 // ==================================================================================
-    //Do not apply the commands if it is a SetIR command
-    if(strcasecmp(c->cmd->name, "setIR") != 0){
-        if( (strcasecmp(c->cmd->name, "set") == 0) || (strcasecmp(c->cmd->name, "get") == 0) 
-            || (strcasecmp(c->cmd->name, "incr") == 0)){
-
-            // Adds the features of a command executed to the linked list to provide a CSV file.
-            if(server.generate_executed_commands_csv == IR_ON){
-                if(restored)//Command executed after its is data is retored on demand.
-                    addCommandExecuted(&last_cmd_executed_List, (char*)c->argv[1]->ptr, (char*)c->argv[0]->ptr, start, end, 'A', latency);
-                else//Command in normal execution, i.e., the data was restored earlier.
-                     addCommandExecuted(&last_cmd_executed_List, (char*)c->argv[1]->ptr, (char*)c->argv[0]->ptr, start, end, 'N', latency);                 
-            }
+    //Only the SET, GET, and INCR commands (flagged with "O") are logged, never the SetIR command
+    if(c->cmd->flags & CMD_IR_ON_DEMAND){
+        // Adds the features of a command executed to the linked list to provide a CSV file.
+        if(server.generate_executed_commands_csv == IR_ON){
+            if(restored)//Command executed after its is data is retored on demand.
+                addCommandExecuted(&last_cmd_executed_List, (char*)c->argv[1]->ptr, (char*)c->argv[0]->ptr, start, end, 'A', latency);
+            else//Command in normal execution, i.e., the data was restored earlier.
+                 addCommandExecuted(&last_cmd_executed_List, (char*)c->argv[1]->ptr, (char*)c->argv[0]->ptr, start, end, 'N', latency);                 
+        }
 
-            //logs a request a tuple if data 
-            if(dirty && server.accessed_tuples_logger_state == IR_ON)
-                incrementAccessedTuple((char*)c->argv[1]->ptr);
+        //logs a request a tuple if data 
+        if(dirty && server.accessed_tuples_logger_state == IR_ON){
+            sds key_accessed = getIndexedLogKey(c->db->id, (char*)c->argv[1]->ptr);
+            incrementAccessedTuple(key_accessed);
+            sdsfree(key_accessed);
         }
     }
 // ==================================================================================
@@ -2928,7 +3161,9 @@ int processCommand(client *c) {
 
     /* Loading DB? Return an error if the command has not the
      * CMD_LOADING flag. */
-    if (server.loading && !(c->cmd->flags & CMD_LOADING)) {
+    if (server.loading && !(c->cmd->flags & CMD_LOADING) &&
+        !rdbKeyDirectoryAllowsCommand(c->cmd))
+    {
         addReply(c, shared.loadingerr);
         return C_OK;
     }
@@ -3581,7 +3816,7 @@ sds genRedisInfoString(char *section) {
                 -1 : time(NULL)-server.rdb_save_time_start),
             server.stat_rdb_cow_bytes,
             server.aof_state != AOF_OFF,
-            server.aof_child_pid != -1,
+            server.aof_child_pid != -1 || isIndexedLogAofRewriteInProgress(),
             server.aof_rewrite_scheduled,
             (intmax_t)server.aof_rewrite_time_last,
             (intmax_t)((server.aof_child_pid == -1) ?
@@ -3598,14 +3833,18 @@ sds genRedisInfoString(char *section) {
                 "aof_buffer_length:%zu\r\n"
                 "aof_rewrite_buffer_length:%lu\r\n"
                 "aof_pending_bio_fsync:%llu\r\n"
-                "aof_delayed_fsync:%lu\r\n",
+                "aof_delayed_fsync:%lu\r\n"
+                "aof_group_commits:%lld\r\n"
+                "aof_clients_waiting:%lu\r\n",
                 (long long) server.aof_current_size,
                 (long long) server.aof_rewrite_base_size,
                 server.aof_rewrite_scheduled,
                 sdslen(server.aof_buf),
                 aofRewriteBufferSize(),
                 bioPendingJobsOfType(BIO_AOF_FSYNC),
-                server.aof_delayed_fsync);
+                server.aof_delayed_fsync,
+                server.stat_aof_group_commits,
+                listLength(server.clients_waiting_aof));
         }
 
         if (server.loading) {
@@ -3670,7 +3909,9 @@ sds genRedisInfoString(char *section) {
             "active_defrag_hits:%lld\r\n"
             "active_defrag_misses:%lld\r\n"
             "active_defrag_key_hits:%lld\r\n"
-            "active_defrag_key_misses:%lld\r\n",
+            "active_defrag_key_misses:%lld\r\n"
+            "io_threaded_reads_processed:%lld\r\n"
+            "io_threaded_writes_processed:%lld\r\n",
             server.stat_numconnections,
             server.stat_numcommands,
             getInstantaneousMetric(STATS_METRIC_COMMAND),
@@ -3696,7 +3937,9 @@ sds genRedisInfoString(char *section) {
             server.stat_active_defrag_hits,
             server.stat_active_defrag_misses,
             server.stat_active_defrag_key_hits,
-            server.stat_active_defrag_key_misses);
+            server.stat_active_defrag_key_misses,
+            server.stat_io_reads_processed,
+            server.stat_io_writes_processed);
     }
 
     /* Replication */
@@ -3842,6 +4085,19 @@ sds genRedisInfoString(char *section) {
         (long)c_ru.ru_utime.tv_sec, (long)c_ru.ru_utime.tv_usec);
     }
 
+    /* Instant recovery */
+    if (allsections || defsections || !strcasecmp(section,"recovery")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = genRecoveryInfoString(info);
+    }
+
+    /* Latency histograms */
+    if (allsections || defsections || !strcasecmp(section,"latencystats")) {
+        if (sections++) info = sdscat(info,"\r\n");
+        info = sdscat(info,"# Latencystats\r\n");
+        info = genLatencyHistogramInfoString(info);
+    }
+
     /* Command statistics */
     if (allsections || !strcasecmp(section,"commandstats")) {
         if (sections++) info = sdscat(info,"\r\n");
@@ -4106,7 +4362,10 @@ void loadDataFromDisk() {
             serverLog(LL_NOTICE,"DB loaded from sequential log!");
     } else {
         rdbSaveInfo rsi = RDB_SAVE_INFO_INIT;
-        if (rdbLoad(server.rdb_filename,&rsi) == C_OK) {
+        int retval = server.indexed_rdb == IR_ON ?
+            rdbLoadWithKeyDirectory(server.rdb_filename,&rsi) :
+            rdbLoad(server.rdb_filename,&rsi);
+        if (retval == C_OK) {
             serverLog(LL_NOTICE,"DB loaded from disk: %.3f seconds",
                 (float)(ustime()-start)/1000000);
 
@@ -4334,6 +4593,8 @@ int main(int argc, char **argv) {
         redis_check_rdb_main(argc,argv,NULL);
     else if (strstr(argv[0],"redis-check-aof") != NULL)
         redis_check_aof_main(argc,argv);
+    else if (strstr(argv[0],"redis-ir-tool") != NULL)
+        redis_ir_tool_main(argc,argv);
 
     if (argc >= 2) {
         j = 1; /* First option to parse in argv[] */
@@ -4408,10 +4669,32 @@ int main(int argc, char **argv) {
 // ==================================================================================
 
     server.saveparamslen = 0;
-    server.aof_state = AOF_ON;
-    server.aof_fsync =  AOF_FSYNC_ALWAYS;
+    if (server.sequential_log_state == IR_ON) {
+        server.aof_state = AOF_ON;
+        server.aof_fsync =  AOF_FSYNC_ALWAYS;
+    } else {
+        server.aof_state = AOF_OFF;
+        /* Without the sequential log the DB is recovered from the RDB file,
+         * so the instant recovery can't run (see rdbLoadWithKeyDirectory()
+         * for the on demand loading of the RDB). */
+        if (server.instant_recovery_state == IR_ON) {
+            server.instant_recovery_state = IR_OFF;
+            serverLog(LL_WARNING,
+                "Instant recovery disabled: sequential_log_state is OFF.");
+        }
+    }
     server.aof_rewrite_perc = 0;
     server.aof_use_rdb_preamble = 0;
+    /* The synchronous indexing writes the indexed log in aofWrite(), which
+     * is not synchronized with the on-demand restores reading it, so the
+     * AOF must be written by the main thread. */
+    if (server.aof_writer_thread && server.instant_recovery_state == IR_ON &&
+        server.instant_recovery_synchronous == IR_ON)
+    {
+        server.aof_writer_thread = 0;
+        serverLog(LL_WARNING,
+            "aof-writer-thread disabled: the instant recovery indexes the log synchronously.");
+    }
 // ==================================================================================
 //    End
 // ==================================================================================
@@ -4475,6 +4758,9 @@ int main(int argc, char **argv) {
                 loadDataFromDisk();
         }else{ //  If the IR is ON, it indexes log records that were not indexed until the crash.
             
+            //Fixes the indexer offset if the server crashed while the AOF was replaced.
+            recoverIndexedLogAofRewrite();
+
             //Indexes the remaining log records.
             initialIndexesSequentialLogToIndexedLog();
         }
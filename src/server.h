@@ -49,7 +49,6 @@
 #include <lua.h>
 #include <signal.h>
 #include <pthread.h>
-#include <db.h>
 #include <ctype.h>
 
 typedef long long mstime_t; /* millisecond time type. */
@@ -70,6 +69,7 @@ typedef long long ustime_t; /* microsecond time type. */
 #include "quicklist.h"  /* Lists are encoded as linked lists of
                            N-elements flat arrays */
 #include "rax.h"     /* Radix tree */
+#include "indexedlog.h" /* Storage engines of the indexed log */
 
 /* Following includes allow test functions to be called from Redis main() */
 #include "zipmap.h"
@@ -88,6 +88,7 @@ typedef long long ustime_t; /* microsecond time type. */
 /* Instant recovery (ON | OFF) (TRUE | FALSE) */
 #define IR_OFF 0             /* Instant recovery is off */
 #define IR_ON 1              /* Instant recovery is on */
+#define IR_INDEXER_WRITERS_MAX 16 /* Threads writing the partitions of the indexed log */
 
 #define DATABASE_PRELOAD_FILE "temp_ir_files/preloadSystemfile.dat"
 #define RESTART_COUNTER "temp_ir_files/restartCounter.dat"//restarts after benchmarking
@@ -95,6 +96,8 @@ typedef long long ustime_t; /* microsecond time type. */
 #define RESTART_COUNTER3 "temp_ir_files/restartCounter2.dat"//log corruption
 #define FINAL_LOG_SEEK "logs/finalLogSeek.dat"
 #define FINAL_LOG_SEEK_REPLICA "logs/finalLogSeekReplica.dat"
+#define FINAL_LOG_SEEK_REWRITE "logs/finalLogSeekRewrite.dat"
+#define INDEXEDLOG_SNAPSHOT "logs/indexedLogSnapshot.rdb"
 #define CHECKPOINT_LOG_SEEK "logs/checkpointLogSeek.dat"
 
 /* 
@@ -144,12 +147,25 @@ typedef struct indexingReport_ts {
 
 indexingReport *first_indexing_report, *last_indexing_report;
 
+/*
+    Image of a key rebuilt from its log records (see applySnapshotLogRecord()).
+*/
+typedef struct snapshotTuple {
+  int exists;
+  sds value;
+  long long expire;         //absolute expire time of the key in milliseconds, -1 if none
+} snapshotTuple;
+
 /* Functions */
 char *getRedisIRSettings();
 void addCommandExecuted (commandExecuted **last_cmd_executed, char key[50], char command[20], long long startTime, long long finishTime, char type, long long latency);
 int isRestoredTuple(char *key);
 void initializeIRParameters();
 int loadRecordFromIndexedLog(char *key_searched);
+sds getIndexedLogKey(int dbid, char *key);
+int parseIndexedLogKey(char *indexed_key, char **key);
+void applySnapshotLogRecord(snapshotTuple *t, char *command, char *value);
+int writeFinalLogSeek(char *filename, unsigned long long seek, int dbid);
 void *loadDBFromIndexedLog();
 void synchronousIndexing(const char *buf);
 unsigned long long initialIndexesSequentialLogToIndexedLog();
@@ -158,6 +174,8 @@ void *executeMemtierBenchmark();
 int stopMemtierBenchmark();
 void *stopMemtierBenchmarkAfterTimeAlways();
 int preloadDatabaseAndRestart();
+sds genRecoveryInfoString(sds info);
+int armCrashPoint(char *name, long long count);
 int restartSystem();
 void *corruptIndexedLog();
 void stopThredas();
@@ -195,6 +213,9 @@ void waitCommandsExecutedFinish();
 #define CONFIG_DEFAULT_TCP_BACKLOG       511    /* TCP listen backlog. */
 #define CONFIG_DEFAULT_CLIENT_TIMEOUT       0   /* Default client timeout: infinite */
 #define CONFIG_DEFAULT_DBNUM     16
+#define CONFIG_DEFAULT_IO_THREADS_NUM 1         /* Single threaded by default */
+#define CONFIG_DEFAULT_IO_THREADS_DO_READS 0    /* Read + parse from threads? */
+#define IO_THREADS_MAX_NUM 128
 #define CONFIG_MAX_LINE    1024
 #define CRON_DBS_PER_CALL 16
 #define NET_MAX_WRITES_PER_EVENT (1024*64)
@@ -234,6 +255,8 @@ void waitCommandsExecutedFinish();
 #define CONFIG_DEFAULT_STOP_WRITES_ON_BGSAVE_ERROR 1
 #define CONFIG_DEFAULT_RDB_COMPRESSION 1
 #define CONFIG_DEFAULT_RDB_CHECKSUM 1
+#define CONFIG_DEFAULT_RDB_LOAD_THREADS 0       /* Decode the RDB serially */
+#define RDB_LOAD_THREADS_MAX 64
 #define CONFIG_DEFAULT_RDB_FILENAME "dump.rdb"
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC 0
 #define CONFIG_DEFAULT_REPL_DISKLESS_SYNC_DELAY 5
@@ -251,6 +274,7 @@ void waitCommandsExecutedFinish();
 #define CONFIG_DEFAULT_AOF_NO_FSYNC_ON_REWRITE 0
 #define CONFIG_DEFAULT_AOF_LOAD_TRUNCATED 1
 #define CONFIG_DEFAULT_AOF_USE_RDB_PREAMBLE 1
+#define CONFIG_DEFAULT_AOF_WRITER_THREAD 0
 #define CONFIG_DEFAULT_ACTIVE_REHASHING 1
 #define CONFIG_DEFAULT_AOF_REWRITE_INCREMENTAL_FSYNC 1
 #define CONFIG_DEFAULT_RDB_SAVE_INCREMENTAL_FSYNC 1
@@ -294,6 +318,10 @@ void waitCommandsExecutedFinish();
 #define PROTO_REPLY_CHUNK_BYTES (16*1024) /* 16k output buffer */
 #define PROTO_INLINE_MAX_SIZE   (1024*64) /* Max size of inline reads */
 #define PROTO_MBULK_BIG_ARG     (1024*32)
+#define PROTO_REPLY_SHARED_MIN_BYTES (1024*64) /* Reference, don't copy, bigger
+                                                  string replies. */
+#define PROTO_ARGV_MAX_KEEP     1024 /* Max argv array kept between commands. */
+#define PROTO_ARGV_POOL_SIZE    8    /* Argument objects kept for reuse. */
 #define LONG_STR_SIZE      21          /* Bytes needed for long -> str + '\0' */
 #define REDIS_AUTOSYNC_BYTES (1024*1024*32) /* fdatasync every 32MB */
 
@@ -326,6 +354,9 @@ void waitCommandsExecutedFinish();
 #define CMD_FAST (1<<13)            /* "F" flag */
 #define CMD_MODULE_GETKEYS (1<<14)  /* Use the modules getkeys interface. */
 #define CMD_MODULE_NO_CLUSTER (1<<15) /* Deny on Redis Cluster. */
+#define CMD_IR_ON_DEMAND (1<<16)    /* "O" flag */
+#define CMD_IR_RESTORE (1<<17)      /* "i" flag */
+#define CMD_IR_INDEXED (1<<18)      /* "I" flag */
 
 /* AOF states */
 #define AOF_OFF 0             /* AOF is off */
@@ -365,6 +396,13 @@ void waitCommandsExecutedFinish();
 #define CLIENT_LUA_DEBUG_SYNC (1<<26)  /* EVAL debugging without fork() */
 #define CLIENT_MODULE (1<<27) /* Non connected client used by some module. */
 #define CLIENT_PROTECTED (1<<28) /* Client should not be freed for now. */
+#define CLIENT_PENDING_READ (1<<29) /* The client has pending reads and was put
+                                       in the list of clients we can read
+                                       from. */
+#define CLIENT_PENDING_COMMAND (1<<30) /* Used in threaded I/O to signal after
+                                          we return single threaded that the
+                                          client has already pending commands
+                                          to be executed. */
 
 /* Client block type (btype field in client structure)
  * if CLIENT_BLOCKED flag is set. */
@@ -501,6 +539,10 @@ void waitCommandsExecutedFinish();
 #define MAXMEMORY_ALLKEYS_LFU ((5<<8)|MAXMEMORY_FLAG_LFU|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_ALLKEYS_RANDOM ((6<<8)|MAXMEMORY_FLAG_ALLKEYS)
 #define MAXMEMORY_NO_EVICTION (7<<8)
+/* Instant recovery: LRU among the keys already stored in the indexed log, that
+ * are restored on demand when they are accessed again. */
+#define MAXMEMORY_ALLKEYS_INDEXEDLOG ((8<<8)|MAXMEMORY_FLAG_LRU|MAXMEMORY_FLAG_ALLKEYS)
+#define IR_TIERING_MAX_FAILED_CHECKS 16 /* Keys checked in the indexed log per eviction */
 
 #define CONFIG_DEFAULT_MAXMEMORY_POLICY MAXMEMORY_NO_EVICTION
 
@@ -743,9 +785,15 @@ typedef struct redisObject {
 struct evictionPoolEntry; /* Defined in evict.c */
 
 /* This structure is used in order to represent the output buffer of a client,
- * which is actually a linked list of blocks like that, that is: client->reply. */
+ * which is actually a linked list of blocks like that, that is: client->reply.
+ *
+ * When 'obj' is not NULL the block has no buffer of its own: it holds a
+ * reference to a large string object whose content is sent as it is (see
+ * _addReplyObjectToList()), and 'size' and 'used' are both the length of
+ * the string, so that nothing can be appended to the block. */
 typedef struct clientReplyBlock {
     size_t size, used;
+    robj *obj;
     char buf[];
 } clientReplyBlock;
 
@@ -842,6 +890,10 @@ typedef struct client {
     size_t querybuf_peak;   /* Recent (100ms or more) peak of querybuf size. */
     int argc;               /* Num of arguments of current command. */
     robj **argv;            /* Arguments of current command. */
+    int argv_len;           /* Size of argv array (may be more than argc) */
+    robj *argv_pool[PROTO_ARGV_POOL_SIZE]; /* Unused EMBSTR argument objects
+                                              recycled by the next command. */
+    int argv_pool_len;      /* Number of objects in argv_pool. */
     struct redisCommand *cmd, *lastcmd;  /* Last command executed. */
     int reqtype;            /* Request protocol type: PROTO_REQ_* */
     int multibulklen;       /* Number of multi bulk arguments left to read. */
@@ -876,6 +928,9 @@ typedef struct client {
     int btype;              /* Type of blocking op if CLIENT_BLOCKED. */
     blockingState bpop;     /* blocking state */
     long long woff;         /* Last write global replication offset. */
+    long long aof_lsn;      /* AOF LSN its last command observed. */
+    listNode *aof_wait_node; /* Node in server.clients_waiting_aof, if the
+                                reply waits for aof_lsn to be durable. */
     list *watched_keys;     /* Keys WATCHED for MULTI/EXEC CAS */
     dict *pubsub_channels;  /* channels a client is interested in (SUBSCRIBE) */
     list *pubsub_patterns;  /* patterns a client is interested in (SUBSCRIBE) */
@@ -1067,20 +1122,38 @@ struct redisServer {
 // 
 // ==================================================================================
 /* Fields added to instant recovery techinique */
-    DB* IR_db;
-    DB_ENV *IR_env;
+    struct indexedLogType *indexedlog_engine;       /* Storage engine of the indexed log (see indexedlog.h) */
 	char indexedlog_structure[20];					/* Data structure used in the indexed */
 	char *indexedlog_filename;                  	/* Path of indexed log file */
+    int indexedlog_partitions;                      /* Number of partitions (files) of the indexed log, keys are mapped by hash slot */
     char starts_log_indexing[5];                    /* Starts the log indexing before or after the database recovery */
 	int instant_recovery_state;			   			/* IR_(ON|OFF). On, off the instant recovery. */
+    int sequential_log_state;                       /* IR_(ON|OFF). Writes the AOF. If off, the DB is recovered from the RDB */
 	int instant_recovery_performing;				/* IR_(ON|OFF). Informes if the instant recovery is performing. */
     int instant_recovery_performing_stop;           /* IR_(ON|OFF). Sends a signal to stop the recovery performing. */
+    int instant_recovery_paused;                    /* IR_(ON|OFF). Pauses the incremental restore (RECOVERY PAUSE). */
+    long long restore_throttle;                     /* Max tuples restored incrementally per second. 0 is unlimited. */
+    long long restore_rate;                         /* Tuples restored per second in the last second */
+    long long count_tuples_to_restore;              /* Tuples in the indexed log to restore. -1 if not counted yet. */
+    int estimate_recovery_eta;                      /* IR_(ON|OFF). Counts the tuples to restore to estimate the recovery ETA */
 	int instant_recovery_synchronous;	 			/* IR_(ON|OFF). On, off the instant recovery synchronous. */
     long long log_corruption;                       /* Time to simulate a log corruption by deleting the indexed log*/
     pthread_t log_corruption_thread;
     int indexedlog_replicated;                      /* IR_(ON|OFF). On or Off the indexed log file replication */
     char *indexedlog_replicated_filename;           /* Path of indexed log file replicated */
     int rebuild_indexedlog;                         /* IR_(ON|OFF). On or Off the rebuilding of the indexe log if currupted */
+    int replica_sync_from_indexedlog;               /* IR_(ON|OFF). Full resynchronization of replicas from the indexed log */
+    unsigned long long indexedlog_snapshot_limit;   /* Sequential log offset the indexer stops at during a snapshot, 0 if none */
+    long long stat_indexedlog_snapshots;            /* Number of RDB snapshots written from the indexed log */
+    int aof_rewrite_from_indexedlog;                /* IR_(ON|OFF). Rewrites the AOF from the indexed log, without fork */
+    int indexer_paused_at_limit;                    /* Set by the indexer while it waits at indexedlog_snapshot_limit */
+    unsigned long long indexedlog_rewrite_seek;     /* Offset the indexer goes on at in the rewritten AOF, 0 if none */
+    long long stat_indexedlog_aof_rewrites;         /* Number of AOF rewrites from the indexed log */
+    int indexedlog_incomplete;                      /* The dataset has keys the indexed log cannot rebuild */
+    int indexed_rdb;                                /* IR_(ON|OFF). Appends a key directory to the RDB to load keys on demand */
+    dict *rdb_key_directory;                        /* Keys of the RDB not loaded yet -> offset, NULL if not loading on demand */
+    FILE *rdb_key_directory_fp;                     /* RDB file to load the keys on demand */
+    long long stat_rdb_ondemand_loads;              /* Number of keys loaded on demand from the RDB */
 	long long database_startup_time;				/* Database startup time */
 	long long database_shutdown_time;				/* Database shutdown time */
 	long long recovery_start_time;					/* Start time of recovery */
@@ -1094,6 +1167,9 @@ struct redisServer {
     long long int initial_indexed_records;          /* Number of log records indexed before recovery */
     long long int count_initial_records_proc;       /* Number of log records processed before recovery */
 	unsigned long long seek_log_file;				/* Pointer to the last log record indexed */
+    int seek_log_db;                                /* Database selected in the sequential log at seek_log_file */
+    unsigned long long count_log_records_written;   /* Log records appended to the sequential log since startup */
+    unsigned long long count_log_records_indexed;   /* Log records indexed since startup */
 	int display_indexer_information;				/* Displays more information about the log indexing */
 	long long indexer_information_time_interaval;	/* Time interval (in seconds) to display indexing information */
 	pthread_t indexer_thread;						/* Pointer to control indexer thread */
@@ -1126,6 +1202,11 @@ struct redisServer {
     unsigned long long count_inconsistent_load_ondemand;    /* Number of inconsistent load attempts during on demand recovery */
 	unsigned long long count_tuples_already_loaded;	/* Number of keys requested but already loaded, during recovery */
 	unsigned long long count_tuples_not_in_log;		/* Number of keys requested but not in the log, during recovery */
+    unsigned long long count_tuples_expired;        /* Number of keys not restored since they expired before the recovery */
+    //Tiered storage (maxmemory-policy allkeys-indexedlog)
+    dict *tiering_evicted_keys;                     /* Keys evicted from memory that are restored from the indexed log when accessed */
+    long long stat_tiering_evictions;               /* Number of keys evicted to the indexed log */
+    long long stat_tiering_restores;                /* Number of evicted keys restored on demand */
 	unsigned long long count_remaining_records_proc;/* Counts the records processed on the init indexing */
 	char *recovery_report_filename;					/* Path of stats file */
     int generate_report_file_after_benchmarking;
@@ -1163,7 +1244,8 @@ struct redisServer {
 	pthread_t memtier_benchmark_thread;				/* Pointer to control mentier bechmark thread */
     pthread_t stop_memtier_benchmark;
 	//Thread control 
-	//pthread_mutex_t lock_indexing;					/* Locks the thread thats indexing the sequantial log */
+	pthread_mutex_t lock_indexing;					/* Held by the indexer while it writes a batch to the indexed log */
+	pthread_mutex_t lock_seek_log;					/* Publishes seek_log_file and seek_log_db together */
 	//pthread_cond_t cond_indexing;					/* Condition variable to pause/continue the log indexing  */
 	//pthread_mutex_t lock_indexed_log_loading;		/* Locks the thread thats loads the indexed log */
 	//pthread_cond_t cond_indexed_log_loading;		/* Condition variable to pause/continue the log loading */
@@ -1173,6 +1255,7 @@ struct redisServer {
     int stop_system_monitoring_end_benckmark;                           
     char *system_monitoring_csv_filename;
     int system_monitoring_time_interval;    
+    int system_monitoring_time_interval_ms;         /* Time interval to sample the system monitoring in milliseconds */
     int overwrite_system_monitoring; 
     pthread_t system_monitoring_thread;    
 
@@ -1192,6 +1275,8 @@ struct redisServer {
                                    the actual 'hz' field value if dynamic-hz
                                    is enabled. */
     int hz;                     /* serverCron() calls frequency in hertz */
+    int io_threads_num;         /* Number of I/O threads to use. */
+    int io_threads_do_reads;    /* Read and parse from I/O threads? */
     redisDb *db;
     dict *commands;             /* Command table */
     dict *orig_commands;        /* Command table before command renaming. */
@@ -1231,6 +1316,7 @@ struct redisServer {
     list *clients;              /* List of active clients */
     list *clients_to_close;     /* Clients to close asynchronously */
     list *clients_pending_write; /* There is to write or install handler. */
+    list *clients_pending_read;  /* Client has pending read socket buffers. */
     list *slaves, *monitors;    /* List of slaves and MONITORs */
     client *current_client;     /* Current client executing the command. */
     long fixed_time_expire;     /* If > 0, expire keys against server.mstime. */
@@ -1282,6 +1368,8 @@ struct redisServer {
     struct malloc_stats cron_malloc_stats; /* sampled in serverCron(). */
     long long stat_net_input_bytes; /* Bytes read from network. */
     long long stat_net_output_bytes; /* Bytes written to network. */
+    long long stat_io_reads_processed; /* Reads handed to the I/O threads. */
+    long long stat_io_writes_processed; /* Writes handed to the I/O threads. */
     size_t stat_rdb_cow_bytes;      /* Copy on write bytes during RDB saving. */
     size_t stat_aof_cow_bytes;      /* Copy on write bytes during AOF rewrite. */
     /* The following two are used to track instantaneous metrics, like
@@ -1338,6 +1426,12 @@ struct redisServer {
     int aof_last_write_errno;       /* Valid if aof_last_write_status is ERR */
     int aof_load_truncated;         /* Don't stop on unexpected AOF EOF. */
     int aof_use_rdb_preamble;       /* Use RDB preamble on AOF rewrites. */
+    int aof_writer_thread;          /* Write and fsync the AOF in a thread. */
+    long long aof_appended_lsn;     /* LSN: bytes ever appended to aof_buf. */
+    long long aof_durable_lsn;      /* Replies up to this LSN can be sent. */
+    list *clients_waiting_aof;      /* Replies waiting for aof_durable_lsn. */
+    int aof_writer_pipe[2];         /* Wakes the event loop after a batch. */
+    long long stat_aof_group_commits; /* Batches written by the AOF thread. */
     /* AOF pipes used to communicate between parent and child during rewrite. */
     int aof_pipe_write_data_to_child;
     int aof_pipe_read_data_from_parent;
@@ -1357,6 +1451,7 @@ struct redisServer {
     char *rdb_filename;             /* Name of RDB file */
     int rdb_compression;            /* Use compression in RDB? */
     int rdb_checksum;               /* Use RDB checksum? */
+    int rdb_load_threads;           /* Threads decoding the RDB on load. */
     time_t lastsave;                /* Unix time of last successful save */
     time_t lastbgsave_try;          /* Unix time of last attempted bgsave */
     time_t rdb_save_time_last;      /* Time used by last RDB save run. */
@@ -1736,7 +1831,12 @@ void pauseClients(mstime_t duration);
 int clientsArePaused(void);
 int processEventsWhileBlocked(void);
 int handleClientsWithPendingWrites(void);
+int handleClientsWithPendingWritesUsingThreads(void);
+int handleClientsWithPendingReadsUsingThreads(void);
+int stopThreadedIOIfNeeded(void);
+void initThreadedIO(void);
 int clientHasPendingReplies(client *c);
+void clientInstallWriteHandler(client *c);
 void unlinkClient(client *c);
 int writeToClient(int fd, client *c, int handler_installed);
 void linkClient(client *c);
@@ -1795,6 +1895,7 @@ robj *createObject(int type, void *ptr);
 robj *createStringObject(const char *ptr, size_t len);
 robj *createRawStringObject(const char *ptr, size_t len);
 robj *createEmbeddedStringObject(const char *ptr, size_t len);
+robj *createStringObjectFromPool(robj **pool, int *count, const char *ptr, size_t len);
 robj *dupStringObject(const robj *o);
 int isSdsRepresentableAsLongLong(sds s, long long *llval);
 int isObjectRepresentableAsLongLong(robj *o, long long *llongval);
@@ -1839,6 +1940,7 @@ void replicationFeedSlaves(list *slaves, int dictid, robj **argv, int argc);
 void replicationFeedSlavesFromMasterStream(list *slaves, char *buf, size_t buflen);
 void replicationFeedMonitors(client *c, list *monitors, int dictid, robj **argv, int argc);
 void updateSlavesWaitingBgsave(int bgsaveerr, int type);
+void updateSlavesWaitingBgsaveFromFile(int bgsaveerr, int type, char *filename);
 void replicationCron(void);
 void replicationHandleMasterDisconnection(void);
 void replicationCacheMaster(client *c);
@@ -1888,9 +1990,16 @@ void *loadAppendOnlyFile2(void *tmp);
 void stopAppendOnly(void);
 int startAppendOnly(void);
 void backgroundRewriteDoneHandler(int exitcode, int bysignal);
+int aofSwitchToRewrittenFile(int newfd);
 void aofRewriteBufferReset(void);
 unsigned long aofRewriteBufferSize(void);
 ssize_t aofReadDiffFromParent(void);
+void initAofWriter(void);
+size_t aofWriterBufferSize(void);
+size_t aofWriterPendingLength(void);
+void aofWriterSetStall(long long ms);
+int aofHoldClientReply(client *c);
+void handleClientsWaitingAof(void);
 
 /* Child info */
 void openChildInfoPipe(void);
@@ -1973,6 +2082,7 @@ void setupSignalHandlers(void);
 struct redisCommand *lookupCommand(sds name);
 struct redisCommand *lookupCommandByCString(char *s);
 struct redisCommand *lookupCommandOrOriginal(sds name);
+void buildCommandLookupTable(void);
 void call(client *c, int flags);
 void propagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int flags);
 void alsoPropagate(struct redisCommand *cmd, int dbid, robj **argv, int argc, int target);
@@ -2152,6 +2262,9 @@ int redis_check_rdb(char *rdbfilename, FILE *fp);
 int redis_check_rdb_main(int argc, char **argv, FILE *fp);
 int redis_check_aof_main(int argc, char **argv);
 
+/* redis-ir-tool */
+int redis_ir_tool_main(int argc, char **argv);
+
 /* Scripting */
 void scriptingInit(int setup);
 int ldbRemoveChild(pid_t pid);
@@ -2185,6 +2298,38 @@ unsigned long LFUGetTimeInMinutes(void);
 uint8_t LFULogIncr(uint8_t value);
 unsigned long LFUDecrAndReturn(robj *o);
 
+/* instant_recovery.c -- Tiered storage on the indexed log (allkeys-indexedlog). */
+void trackIndexedLogWrite(struct redisCommand *cmd, int dictid, robj **argv, int argc);
+void forgetIndexedLogWrites(void);
+int isIndexedLogEvictable(int dbid, sds key, robj *o);
+int evictKeyToIndexedLog(redisDb *db, sds key);
+void restoreEvictedKeys(client *c);
+int restoreAllEvictedKeys(void);
+
+/* instant_recovery.c -- Restore before the execution of transactions and scripts. */
+void restoreKeysBeforeExecution(client *c);
+
+/* instant_recovery.c -- Slot-level restore in cluster mode. */
+int getIndexedLogSlotPartition(int slot);
+int isSlotRestored(int slot);
+int countSlotsRestored(void);
+void restoreSlotFromIndexedLog(int slot);
+
+/* instant_recovery.c -- Full resynchronization of replicas from the indexed log. */
+int isIndexedLogSnapshotEnabled(void);
+int isIndexedLogSnapshotInProgress(void);
+int startIndexedLogSnapshot(rdbSaveInfo *rsi);
+void checkIndexedLogSnapshotDone(void);
+
+/* instant_recovery.c -- AOF rewrite from the indexed log. */
+int isIndexedLogCommand(struct redisCommand *cmd, int argc);
+void setIndexedLogIncomplete(void);
+void recoverIndexedLogAofRewrite(void);
+int isIndexedLogAofRewriteEnabled(void);
+int isIndexedLogAofRewriteInProgress(void);
+int startIndexedLogAofRewrite(void);
+void checkIndexedLogAofRewriteDone(void);
+
 /* Keys hashing / comparison functions for dict.c hash tables. */
 uint64_t dictSdsHash(const void *key);
 int dictSdsKeyCompare(void *privdata, const void *key1, const void *key2);
@@ -2401,6 +2546,7 @@ void checkpointEndCommand(client *c);
 void setCheckpointCommand(client *c);
 void setIRCommand(client *c);
 void printIndex(client *c);
+void recoveryCommand(client *c);
 
 // ==================================================================================
 //     End
@@ -241,6 +241,20 @@ void setCheckpointCommand(client *c) {
         }
 
         setGenericCommandNoUpdate(c,flags,c->argv[1],expire,unit,NULL,NULL);
+
+        //The checkpoint replaces all the log records of the key in the indexed log, so the
+        //expire of the key is logged again after it.
+        long long when = getExpire(c->db,c->argv[1]);
+        if(when != -1){
+            robj *argv[3];
+            argv[0] = createStringObject("PEXPIREAT",9);
+            argv[1] = c->argv[1];
+            argv[2] = createStringObjectFromLongLong(when);
+            alsoPropagate(lookupCommandByCString("pexpireat"),c->db->id,argv,3,
+                PROPAGATE_AOF|PROPAGATE_REPL);
+            decrRefCount(argv[0]);
+            decrRefCount(argv[2]);
+        }
     }
 }
 
@@ -251,6 +251,62 @@ tags {"aof"} {
         }
     }
 
+    ## The AOF writer thread acknowledges the writes of a batch together
+    ## (group commit): every acknowledged write must be in the AOF.
+    create_aof {}
+
+    start_server_aof [list dir $server_path appendfsync always aof-writer-thread yes] {
+        set host [dict get $srv host]
+        set port [dict get $srv port]
+        set client [redis $host $port]
+
+        test "AOF writer thread: writes of concurrent clients are acknowledged" {
+            set clients {}
+            for {set j 0} {$j < 10} {incr j} {
+                lappend clients [redis $host $port 1]
+            }
+            for {set i 0} {$i < 100} {incr i} {
+                foreach rd $clients {
+                    $rd incr counter
+                    $rd rpush list $i
+                }
+            }
+            foreach rd $clients {
+                for {set i 0} {$i < 200} {incr i} {
+                    $rd read
+                }
+                $rd close
+            }
+            assert_equal 1000 [$client get counter]
+            assert_equal 1000 [$client llen list]
+        }
+
+        test "AOF writer thread: a read waits for the writes it observes" {
+            set rd [redis $host $port 1]
+            $client debug aof-writer-stall 2000
+            $rd set foo bar
+            # Let the SET reach the stalled writer thread: the GET observes
+            # it, so its reply must be held until the batch is written.
+            after 200
+            set start [clock milliseconds]
+            set value [$client get foo]
+            set elapsed [expr {[clock milliseconds]-$start}]
+            assert_equal OK [$rd read]
+            $client debug aof-writer-stall 0
+            $rd close
+            assert_equal bar $value
+            assert {$elapsed >= 1000}
+        }
+
+        test "AOF writer thread: the acknowledged writes are in the AOF" {
+            assert {[status $client aof_group_commits] > 0}
+            set digest [$client debug digest]
+            $client debug loadaof
+            assert_equal $digest [$client debug digest]
+            assert_equal 1000 [$client get counter]
+        }
+    }
+
     start_server {overrides {appendonly {yes} appendfilename {appendonly.aof}}} {
         test {Redis should not try to convert DEL into EXPIREAT for EXPIRE -1} {
             r set x 10
@@ -115,3 +115,88 @@ start_server_and_kill_it [list "dir" $server_path] {
         }
     }
 }
+
+# Populate every encoding the parallel loader slices out to its threads, small
+# and big, plus streams and expires that the main thread decodes itself.
+proc populate_mixed_dataset {} {
+    for {set j 0} {$j < 1000} {incr j} {
+        r set int:$j $j
+        r set str:$j "value:$j"
+        r set lzf:$j [string repeat "compressible:$j " 10]
+        r rpush list $j
+        r sadd intset [expr {$j % 100}]
+        r sadd set "member:$j"
+        r zadd zset $j "member:$j"
+        r hset hash "field:$j" $j
+        r xadd stream * item $j
+    }
+    for {set j 0} {$j < 100} {incr j} {
+        r rpush list:$j a b c $j
+        r sadd set:$j 1 2 3 $j
+        r zadd zset:$j 1 a 2 b 3 $j
+        r hset hash:$j a 1 b 2 c $j
+        r pexpire str:[expr {$j * 10}] 1000000
+        r pexpire list:$j 1000000
+    }
+    r xgroup create stream mygroup 0
+    r xreadgroup GROUP mygroup Alice COUNT 10 STREAMS stream >
+}
+
+set server_path [tmpdir "server.rdb-parallel-encoding-test"]
+set server_path_threads [tmpdir "server.rdb-parallel-encoding-threads-test"]
+exec cp tests/assets/encodings.rdb $server_path
+exec cp tests/assets/encodings.rdb $server_path_threads
+
+start_server [list overrides [list "dir" $server_path "dbfilename" "encodings.rdb"]] {
+    set digest [r debug digest]
+}
+
+start_server [list overrides [list "dir" $server_path_threads "dbfilename" "encodings.rdb" "rdb-load-threads" 4]] {
+    test {Parallel RDB load of the old encodings matches the serial load} {
+        assert_equal $digest [r debug digest]
+    }
+}
+
+set server_path [tmpdir "server.rdb-parallel-load-test"]
+
+start_server [list overrides [list "dir" $server_path "rdb-load-threads" 4]] {
+    test {Parallel RDB load of a mixed dataset} {
+        populate_mixed_dataset
+        set digest [r debug digest]
+        set dbsize [r dbsize]
+        r debug reload
+        assert_equal $digest [r debug digest]
+        assert_equal $dbsize [r dbsize]
+        assert {[r pttl str:0] > 0 && [r pttl list:0] > 0}
+        assert_equal -1 [r pttl str:1]
+        assert_equal 1 [llength [r xinfo groups stream]]
+    }
+}
+
+set server_path [tmpdir "server.rdb-parallel-claim-test"]
+
+start_server [list overrides [list "dir" $server_path "indexed-rdb" yes]] {
+    populate_mixed_dataset
+    r save
+    r config set save ""
+    # Written by the clients while the next server loads: the loader must
+    # not overwrite them with the values of the RDB.
+    r set str:1 changed
+    r hset hash:1 a changed
+    r del list set:1
+    set digest [r debug digest]
+}
+
+start_server [list overrides [list "dir" $server_path "indexed-rdb" yes "rdb-load-threads" 4]] {
+    test {Parallel RDB load skips the keys claimed from the key directory} {
+        r set str:1 changed
+        r hset hash:1 a changed
+        r del list set:1
+        wait_for_condition 50 100 {
+            [s loading] eq 0
+        } else {
+            fail "Loading DB is taking too much time."
+        }
+        assert_equal $digest [r debug digest]
+    }
+}
@@ -78,3 +78,26 @@ start_server {tags {"introspection"}} {
         assert_match {*calls=1,*} [cmdstat geoadd]
     }
 }
+
+start_server {tags {"introspection"} overrides {rename-command {get fetch}}} {
+    test {Renamed command is found under its new name only} {
+        r set mykey myval
+        assert_equal myval [r fetch mykey]
+        assert_equal myval [r FeTcH mykey]
+        assert_error {*unknown command*} {r get mykey}
+        assert_equal {{}} [r command info get]
+    }
+
+    test {Every command resolves after rename-command} {
+        # COMMAND lists the renamed command under its original name.
+        assert_equal get [lindex [lindex [r command info fetch] 0] 0]
+        foreach entry [r command] {
+            set name [lindex $entry 0]
+            if {$name eq {get}} continue
+            assert_equal $name [lindex [lindex [r command info $name] 0] 0]
+            assert_equal $name [lindex [lindex [r command info [string toupper $name]] 0] 0]
+        }
+        assert_equal {{}} [r command info fetchx]
+        assert_equal {{}} [r command info fetc]
+    }
+}
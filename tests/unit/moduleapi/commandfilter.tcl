@@ -81,4 +81,14 @@ start_server {tags {"modules"}} {
         assert_equal {} [r lrange log-key 0 -1]
     }
 
+    test {Module commands are no longer found once the module is unloaded} {
+        r module unload commandfilter
+        assert_error {*unknown command*} {r commandfilter.ping}
+        assert_equal {{}} [r command info commandfilter.ping]
+        assert_equal PONG [r ping]
+        r module load $testmodule log-key 0
+        assert_equal {PONG} [r commandfilter.ping]
+        assert_equal commandfilter.ping [lindex [lindex [r command info commandfilter.ping] 0] 0]
+    }
+
 } 
@@ -115,3 +115,69 @@ start_server {tags {"regression"}} {
         $rd read
     }
 }
+
+start_server {tags {"protocol"}} {
+    set big [string repeat x 200000]
+    r set big $big
+    r set small foo
+
+    test "Large replies sent by reference" {
+        assert_equal $big [r get big]
+        assert_equal [list $big foo $big] [r mget big small big]
+    }
+
+    test "Large reply not changed by a later write to its object" {
+        r multi
+        r get big
+        r append big yy
+        r get big
+        set res [r exec]
+        r set big $big
+        assert_equal $big [lindex $res 0]
+        assert_equal ${big}yy [lindex $res 2]
+    }
+
+    test "Pipelined large replies" {
+        set rd [redis_deferring_client]
+        for {set j 0} {$j < 20} {incr j} {
+            $rd get big
+            $rd get small
+        }
+        for {set j 0} {$j < 20} {incr j} {
+            assert_equal $big [$rd read]
+            assert_equal foo [$rd read]
+        }
+        $rd close
+    }
+
+    test "Deferred length replies" {
+        for {set j 0} {$j < 100} {incr j} {
+            r zadd myzset $j m$j
+        }
+        assert_equal {big myzset small} [lsort [r keys *]]
+        assert_equal {m10 m11 m12} [r zrangebyscore myzset 10 +inf limit 0 3]
+        assert_equal {myzset} [r keys my*]
+    }
+
+    test "Deferred length replies mixed with large replies" {
+        set rd [redis_deferring_client]
+        $rd get big
+        $rd keys *
+        $rd get big
+        $rd zrangebyscore myzset 10 +inf limit 0 3
+        assert_equal $big [$rd read]
+        assert_equal {big myzset small} [lsort [$rd read]]
+        assert_equal $big [$rd read]
+        assert_equal {m10 m11 m12} [$rd read]
+        $rd close
+
+        r multi
+        r keys *
+        r get big
+        r keys my*
+        set res [r exec]
+        assert_equal {big myzset small} [lsort [lindex $res 0]]
+        assert_equal $big [lindex $res 1]
+        assert_equal {myzset} [lindex $res 2]
+    }
+}